@@ -0,0 +1,103 @@
+// ---------------------------------------------------------------------------------------------------
+// MODERNDBS
+// ---------------------------------------------------------------------------------------------------
+// Measures the hit path of fix_page() and unfix_page() with 1 to 32 threads. All pages are loaded,
+// so the threads only contend on the latches of the page table. Compare the throughput of a single
+// partition, i.e. a global latch, with the default number of partitions, and with optimistic reads:
+//     bm_buffer_manager --benchmark_counters_tabular=true
+// FixUnfix_Miss draws the pages from twice as many pages as frames, so half of the fixes evict a page
+// and read from the page cache. The pages are stored in the segment file 0 in the working directory.
+// ---------------------------------------------------------------------------------------------------
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include "moderndbs/buffer_manager.h"
+#include "benchmark/benchmark.h"
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+using moderndbs::BufferManager;
+// ---------------------------------------------------------------------------------------------------
+constexpr size_t PAGE_SIZE = 1024;
+/// The number of pages, all of them fit into the buffer.
+constexpr size_t NUM_PAGES = 1024;
+// ---------------------------------------------------------------------------------------------------
+/// Returns a buffer manager with `num_partitions` partitions that has all NUM_PAGES pages loaded.
+/// It is shared by all threads and runs of a benchmark.
+BufferManager& loaded_buffer_manager(size_t num_partitions) {
+    static std::mutex mutex;
+    static std::map<size_t, std::unique_ptr<BufferManager>> buffer_managers;
+    std::unique_lock lock{mutex};
+    auto& buffer_manager = buffer_managers[num_partitions];
+    if (!buffer_manager) {
+        buffer_manager = std::make_unique<BufferManager>(PAGE_SIZE, NUM_PAGES, num_partitions);
+        for (uint64_t page_id = 0; page_id < NUM_PAGES; ++page_id) {
+            auto& page = buffer_manager->fix_page(page_id, false);
+            buffer_manager->unfix_page(page, false);
+        }
+    }
+    return *buffer_manager;
+}
+// ---------------------------------------------------------------------------------------------------
+/// Fixes and unfixes uniformly random pages shared.
+void FixUnfix_Hit(benchmark::State& state) {
+    auto& buffer_manager = loaded_buffer_manager(state.range(0));
+    std::mt19937_64 engine{std::hash<std::thread::id>{}(std::this_thread::get_id())};
+    std::uniform_int_distribution<uint64_t> page_distr{0, NUM_PAGES - 1};
+
+    for (auto _ : state) {
+        auto& page = buffer_manager.fix_page(page_distr(engine), false);
+        benchmark::DoNotOptimize(page.get_data()[0]);
+        buffer_manager.unfix_page(page, false);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+// ---------------------------------------------------------------------------------------------------
+/// Fixes and unfixes uniformly random pages of twice as many pages as frames shared.
+void FixUnfix_Miss(benchmark::State& state) {
+    auto& buffer_manager = loaded_buffer_manager(state.range(0));
+    std::mt19937_64 engine{std::hash<std::thread::id>{}(std::this_thread::get_id())};
+    std::uniform_int_distribution<uint64_t> page_distr{0, 2 * NUM_PAGES - 1};
+
+    for (auto _ : state) {
+        auto& page = buffer_manager.fix_page(page_distr(engine), false);
+        benchmark::DoNotOptimize(page.get_data()[0]);
+        buffer_manager.unfix_page(page, false);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+// ---------------------------------------------------------------------------------------------------
+/// Reads uniformly random pages optimistically, which writes no shared memory.
+void FixOptimistic_Hit(benchmark::State& state) {
+    auto& buffer_manager = loaded_buffer_manager(state.range(0));
+    std::mt19937_64 engine{std::hash<std::thread::id>{}(std::this_thread::get_id())};
+    std::uniform_int_distribution<uint64_t> page_distr{0, NUM_PAGES - 1};
+
+    for (auto _ : state) {
+        while (true) {
+            auto fix = buffer_manager.fix_page_optimistic(page_distr(engine));
+            char value = fix.data[0];
+            if (buffer_manager.validate(fix)) {
+                benchmark::DoNotOptimize(value);
+                break;
+            }
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK(FixUnfix_Hit)->ArgName("partitions")->Arg(1)->Arg(64)->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK(FixOptimistic_Hit)->ArgName("partitions")->Arg(64)->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK(FixUnfix_Miss)->ArgName("partitions")->Arg(1)->Arg(64)->ThreadRange(1, 32)->UseRealTime();
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK_MAIN();
+// ---------------------------------------------------------------------------------------------------
@@ -0,0 +1,87 @@
+// ---------------------------------------------------------------------------------------------------
+// MODERNDBS
+// ---------------------------------------------------------------------------------------------------
+// Scans a segment of four times as many pages as frames sequentially, so every fix misses. With
+// prefetchers, the scan prefetches the next `distance` pages every `distance` pages, and the fixes
+// mostly wait for reads that are in flight already instead of reading the page themselves.
+// The pages are stored in the segment file 1 in the working directory. Drop the page cache before
+// running it to measure the device instead of memcpy:
+//     sync; echo 3 > /proc/sys/vm/drop_caches; bm_prefetch
+// ---------------------------------------------------------------------------------------------------
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <tuple>
+#include "moderndbs/buffer_manager.h"
+#include "benchmark/benchmark.h"
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+using moderndbs::BufferManager;
+// ---------------------------------------------------------------------------------------------------
+constexpr size_t PAGE_SIZE = 4096;
+constexpr size_t NUM_FRAMES = 1 << 10;
+constexpr size_t NUM_PAGES = 4 * NUM_FRAMES;
+constexpr uint16_t SEGMENT_ID = 1;
+// ---------------------------------------------------------------------------------------------------
+/// Returns the page id of a page of the scanned segment.
+uint64_t make_page_id(uint64_t segment_page_id) {
+    return (static_cast<uint64_t>(SEGMENT_ID) << 48) | segment_page_id;
+}
+// ---------------------------------------------------------------------------------------------------
+/// Returns a buffer manager with `num_prefetchers` prefetchers. It is shared by all runs of a benchmark.
+/// The first one writes all pages of the segment.
+BufferManager& scan_buffer_manager(size_t num_prefetchers) {
+    static bool written = false;
+    if (!written) {
+        BufferManager buffer_manager{PAGE_SIZE, NUM_FRAMES};
+        for (uint64_t segment_page_id = 0; segment_page_id < NUM_PAGES; ++segment_page_id) {
+            auto& page = buffer_manager.fix_page(make_page_id(segment_page_id), true);
+            *reinterpret_cast<uint64_t*>(page.get_data()) = segment_page_id;
+            buffer_manager.unfix_page(page, true);
+        }
+        written = true;
+    }
+    static std::map<size_t, std::unique_ptr<BufferManager>> buffer_managers;
+    auto& buffer_manager = buffer_managers[num_prefetchers];
+    if (!buffer_manager) {
+        buffer_manager = std::make_unique<BufferManager>(PAGE_SIZE, NUM_FRAMES, 64, moderndbs::ReplacementPolicy::TWO_Q, 0, num_prefetchers);
+    }
+    return *buffer_manager;
+}
+// ---------------------------------------------------------------------------------------------------
+/// Fixes the pages of the segment in order, shared.
+void Scan(benchmark::State& state) {
+    const auto num_prefetchers = static_cast<size_t>(state.range(0));
+    const auto distance = static_cast<size_t>(state.range(1));
+    auto& buffer_manager = scan_buffer_manager(num_prefetchers);
+
+    uint64_t segment_page_id = 0;
+    for (auto _ : state) {
+        if (num_prefetchers > 0 && segment_page_id % distance == 0) {
+            buffer_manager.prefetch_range(SEGMENT_ID, segment_page_id + distance, distance);
+        }
+        auto& page = buffer_manager.fix_page(make_page_id(segment_page_id), false);
+        benchmark::DoNotOptimize(page.get_data()[0]);
+        buffer_manager.unfix_page(page, false);
+        segment_page_id = (segment_page_id + 1) % NUM_PAGES;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * PAGE_SIZE);
+}
+// ---------------------------------------------------------------------------------------------------
+void Arguments(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"prefetchers", "distance"});
+    b->Args({0, 1});
+    for (int64_t num_prefetchers : {1, 4, 16}) {
+        b->Args({num_prefetchers, 32});
+    }
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK(Scan)->Apply(Arguments)->UseRealTime();
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK_MAIN();
+// ---------------------------------------------------------------------------------------------------
@@ -0,0 +1,174 @@
+// ---------------------------------------------------------------------------------------------------
+// MODERNDBS
+// ---------------------------------------------------------------------------------------------------
+// Compares the replacement policies of the buffer manager on workloads with twice as many pages as
+// frames, so that a part of the accesses misses and evicts a page:
+//  * ZIPF: pages drawn from a zipfian distribution.
+//  * SCAN: 80% of the accesses scan over all pages, the others hit a hot set of a quarter of the frames.
+// The pages are 64 bytes, so 1M frames fit into memory, and the misses read from the page cache.
+// The pages are stored in the segment file 0 in the working directory.
+// Cleaner runs the ZIPF workload with every other access writing its page, with and without a
+// background cleaner, and counts the dirty pages a miss had to write itself.
+// ---------------------------------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <vector>
+#include "moderndbs/buffer_manager.h"
+#include "benchmark/benchmark.h"
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+using moderndbs::BufferManager;
+using moderndbs::ReplacementPolicy;
+// ---------------------------------------------------------------------------------------------------
+constexpr size_t PAGE_SIZE = 64;
+/// The number of accesses of a workload, which is repeated.
+constexpr size_t NUM_ACCESSES = 1 << 22;
+// ---------------------------------------------------------------------------------------------------
+/// Workloads.
+enum Workload : int64_t {
+    ZIPF,
+    SCAN
+};
+// ---------------------------------------------------------------------------------------------------
+/// Draws ranks 1..n with probability proportional to 1 / rank.
+class ZipfDistribution {
+    /// The cumulative probabilities of the ranks.
+    std::vector<double> cdf;
+
+public:
+    explicit ZipfDistribution(size_t n) : cdf(n) {
+        double sum = 0;
+        for (size_t rank = 1; rank <= n; ++rank) {
+            sum += 1.0 / static_cast<double>(rank);
+            cdf[rank - 1] = sum;
+        }
+        for (auto& p : cdf) {
+            p /= sum;
+        }
+    }
+
+    template <typename Engine>
+    uint64_t operator()(Engine& engine) {
+        const double p = std::uniform_real_distribution<double>{}(engine);
+        return std::lower_bound(cdf.begin(), std::prev(cdf.end()), p) - cdf.begin() + 1;
+    }
+};
+// ---------------------------------------------------------------------------------------------------
+/// Returns the page ids of a workload over `num_pages` pages, generated once.
+const std::vector<uint64_t>& make_accesses(int64_t workload, size_t num_pages) {
+    static std::map<std::pair<int64_t, size_t>, std::vector<uint64_t>> accesses;
+    auto& result = accesses[{workload, num_pages}];
+    if (!result.empty()) {
+        return result;
+    }
+    std::mt19937_64 engine{0};
+    result.resize(NUM_ACCESSES);
+    if (workload == ZIPF) {
+        /// Scatter the ranks over the pages, so the hot pages are not the first ones
+        std::vector<uint64_t> pages(num_pages);
+        for (size_t i = 0; i < num_pages; ++i) {
+            pages[i] = i;
+        }
+        std::shuffle(pages.begin(), pages.end(), engine);
+        ZipfDistribution zipf{num_pages};
+        for (auto& page_id : result) {
+            page_id = pages[zipf(engine) - 1];
+        }
+    } else {
+        std::bernoulli_distribution scan_distr{0.8};
+        std::uniform_int_distribution<uint64_t> hot_distr{0, num_pages / 8 - 1};
+        uint64_t scan_position = 0;
+        for (auto& page_id : result) {
+            page_id = scan_distr(engine) ? scan_position++ % num_pages : hot_distr(engine);
+        }
+    }
+    return result;
+}
+// ---------------------------------------------------------------------------------------------------
+/// Returns a buffer manager with `num_frames` frames that has its first `num_frames` pages loaded.
+/// It is shared by all runs of a benchmark.
+BufferManager& loaded_buffer_manager(int64_t replacement_policy, size_t num_frames, size_t num_cleaners = 0) {
+    static std::map<std::tuple<int64_t, size_t, size_t>, std::unique_ptr<BufferManager>> buffer_managers;
+    auto& buffer_manager = buffer_managers[{replacement_policy, num_frames, num_cleaners}];
+    if (!buffer_manager) {
+        buffer_manager = std::make_unique<BufferManager>(PAGE_SIZE, num_frames, 64, static_cast<ReplacementPolicy>(replacement_policy), num_cleaners);
+        for (uint64_t page_id = 0; page_id < num_frames; ++page_id) {
+            auto& page = buffer_manager->fix_page(page_id, false);
+            buffer_manager->unfix_page(page, false);
+        }
+    }
+    return *buffer_manager;
+}
+// ---------------------------------------------------------------------------------------------------
+/// Fixes and unfixes the pages of a workload shared.
+void Replacement(benchmark::State& state) {
+    const auto replacement_policy = state.range(0);
+    const auto num_frames = static_cast<size_t>(state.range(1));
+    const auto& accesses = make_accesses(state.range(2), 2 * num_frames);
+    auto& buffer_manager = loaded_buffer_manager(replacement_policy, num_frames);
+
+    size_t i = 0;
+    for (auto _ : state) {
+        auto& page = buffer_manager.fix_page(accesses[i], false);
+        benchmark::DoNotOptimize(page.get_data()[0]);
+        buffer_manager.unfix_page(page, false);
+        i = (i + 1) % NUM_ACCESSES;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+// ---------------------------------------------------------------------------------------------------
+/// Fixes the pages of the ZIPF workload, every other one exclusively to write it.
+void Cleaner(benchmark::State& state) {
+    const auto replacement_policy = state.range(0);
+    const auto num_frames = static_cast<size_t>(state.range(1));
+    const auto& accesses = make_accesses(ZIPF, 2 * num_frames);
+    auto& buffer_manager = loaded_buffer_manager(replacement_policy, num_frames, state.range(2));
+    const size_t num_eviction_writes = buffer_manager.get_num_eviction_writes();
+
+    size_t i = 0;
+    for (auto _ : state) {
+        const bool exclusive = i % 2 == 0;
+        auto& page = buffer_manager.fix_page(accesses[i], exclusive);
+        ++page.get_data()[0];
+        buffer_manager.unfix_page(page, exclusive);
+        i = (i + 1) % NUM_ACCESSES;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["eviction_writes"] = benchmark::Counter(buffer_manager.get_num_eviction_writes() - num_eviction_writes, benchmark::Counter::kAvgIterations);
+}
+// ---------------------------------------------------------------------------------------------------
+void Arguments(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"policy", "frames", "workload"});
+    for (auto workload : {ZIPF, SCAN}) {
+        for (int64_t num_frames : {1 << 14, 1 << 20}) {
+            for (auto replacement_policy : {ReplacementPolicy::TWO_Q, ReplacementPolicy::CLOCK}) {
+                b->Args({static_cast<int64_t>(replacement_policy), num_frames, workload});
+            }
+        }
+    }
+}
+// ---------------------------------------------------------------------------------------------------
+void CleanerArguments(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"policy", "frames", "cleaners"});
+    for (auto replacement_policy : {ReplacementPolicy::TWO_Q, ReplacementPolicy::CLOCK}) {
+        for (int64_t num_cleaners : {0, 1}) {
+            b->Args({static_cast<int64_t>(replacement_policy), 1 << 16, num_cleaners});
+        }
+    }
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK(Replacement)->Apply(Arguments)->UseRealTime();
+BENCHMARK(Cleaner)->Apply(CleanerArguments)->UseRealTime();
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK_MAIN();
+// ---------------------------------------------------------------------------------------------------
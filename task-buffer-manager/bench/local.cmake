@@ -0,0 +1,12 @@
+# ---------------------------------------------------------------------------
+# MODERNDBS
+# ---------------------------------------------------------------------------
+
+add_executable(bm_buffer_manager bench/bm_buffer_manager.cc)
+target_link_libraries(bm_buffer_manager moderndbs benchmark Threads::Threads)
+
+add_executable(bm_replacement bench/bm_replacement.cc)
+target_link_libraries(bm_replacement moderndbs benchmark Threads::Threads)
+
+add_executable(bm_prefetch bench/bm_prefetch.cc)
+target_link_libraries(bm_prefetch moderndbs benchmark Threads::Threads)
@@ -1,15 +1,23 @@
 #ifndef INCLUDE_MODERNDBS_BUFFER_MANAGER_H
 #define INCLUDE_MODERNDBS_BUFFER_MANAGER_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <deque>
 #include <exception>
 #include <vector>
 #include <memory>
 #include <list>
 #include <shared_mutex>
+#include <string>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 #include "file.h"
 
@@ -69,12 +77,22 @@ private:
     /// Is this page dirty
     bool is_dirty = false;
 
+    /// Is this page being written by a cleaner, then it must not be evicted
+    bool writing_back = false;
+
+    /// Was this page loaded by a prefetcher and not fixed since, only with ReplacementPolicy::TWO_Q
+    bool prefetched = false;
+
     /// Position of this BufferFrame in the FIFO List
     list_position  fifo_position;
 
     /// Position of this BufferFrame in the LRU List
     list_position lru_position;
 
+    /// Time this BufferFrame was appended to the FIFO or LRU List, orders the
+    /// lists of all partitions. Increases along every list
+    uint64_t stamp = 0;
+
     /**
      * Lock the shared_mutex
      * @param exclusive: if it should be exclusively locked
@@ -131,6 +149,20 @@ class buffer_full_error : public std::exception {
     const char* what() const noexcept override { return "buffer is full"; }
 };
 
+/// Strategy that picks the page to evict when the buffer is full.
+enum class ReplacementPolicy {
+    /// Pages fixed once are in a FIFO list, pages fixed again in an LRU list.
+    /// Evicts the oldest unfixed page of the FIFO list, or of the LRU list if
+    /// there is none. Every hit moves the page to the end of the LRU list.
+    TWO_Q,
+    /// CLOCK / second chance over the frames of the buffer. A hit only sets
+    /// the reference bit of its frame. The clock hand clears the reference
+    /// bits of the frames it passes until it finds an unfixed frame without
+    /// one, which is O(1) per miss amortized. The FIFO and LRU lists stay
+    /// empty.
+    CLOCK
+};
+
 class BufferManager {
 private:
 
@@ -142,64 +174,324 @@ private:
         explicit SegmentFile(std::unique_ptr<File> file) : file(std::move(file)) {}
     };
 
+    /// Version latch of a frame of loaded_pages for optimistic reads
+    /// Aligned to a cache line so that writes to one frame don't disturb the readers of others
+    struct alignas(64) FrameVersion {
+        /// Odd while the frame is locked exclusively, being loaded or evicted. Changes with every write
+        std::atomic<uint64_t> version = 0;
+
+        /// Page id of the page in this frame, INVALID_PAGE_ID while there is none
+        std::atomic<uint64_t> page_id = INVALID_PAGE_ID;
+    };
+
+    /// Front stamp of an empty list
+    static constexpr uint64_t NO_STAMP = ~0ull;
+
+    /// A hash partition of the page table with its own FIFO and LRU List
+    /// Aligned to a cache line so that the latches of partitions don't share one
+    struct alignas(64) Partition {
+        /// Latch of the Hash Table and of both lists of this partition
+        /// Directory_Latch in the Tipp Slide, but only for the pages of this partition
+        std::mutex latch;
+
+        /// FIFO List
+        std::list<BufferFrame*> fifo_list;
+
+        /// LRU List
+        std::list<BufferFrame*> lru_list;
+
+        /// Hashtable of the pages/frames of this partition, which loaded in RAM
+        std::unordered_map<uint64_t, BufferFrame> bufferframes;
+
+        /// Stamp of the first page of the FIFO List and of the LRU List, NO_STAMP while a list is empty
+        /// Written under the latch, read without it by misses to find the partitions that can hold the oldest page
+        std::atomic<uint64_t> fifo_front_stamp = NO_STAMP;
+        std::atomic<uint64_t> lru_front_stamp = NO_STAMP;
+    };
+
     const size_t page_size;
 
     const size_t page_count;
 
-    /// FIFO List
-    std::list<BufferFrame*> fifo_list;
+    const size_t num_partitions;
 
-    /// LRU List
-    std::list<BufferFrame*> lru_list;
+    const ReplacementPolicy replacement_policy;
 
-    /// global lock that makes sure we don't modify the Hash Table when doing look ups
-    /// Directory_Latch in the Tipp Slide
-    std::mutex global_mutex;
+    /// The partitions, a page belongs to partitions[get_partition(pid)]
+    std::unique_ptr<Partition[]> partitions;
+
+    /// Number of frames of loaded_pages that have been handed out, the others are still free
+    std::atomic<size_t> num_used_frames = 0;
 
     /// Memory Storage for all loaded pages
     std::unique_ptr<char[]> loaded_pages;
 
+    /// Version latch of every frame of loaded_pages
+    std::unique_ptr<FrameVersion[]> frame_versions;
+
+    /// Number of frame_hints
+    const size_t num_frame_hints;
+
+    /// Hash of a page id -> frame that probably holds this page
+    /// Lets optimistic reads find a page without looking into the page table, checked with frame_versions
+    std::unique_ptr<std::atomic<size_t>[]> frame_hints;
+
+    /// Reference bit of every frame of loaded_pages for ReplacementPolicy::CLOCK
+    std::unique_ptr<std::atomic<bool>[]> reference_bits;
+
+    /// Dirty bit of every frame of loaded_pages, a copy of BufferFrame::is_dirty that the cleaners read without the
+    /// partition latch, so that they only latch the frames they have to write
+    std::unique_ptr<std::atomic<bool>[]> dirty_bits;
+
+    /// Next frame the clock hand looks at, modulo page_count
+    std::atomic<size_t> clock_hand = 0;
+
+    const size_t num_cleaners;
+
+    /// Background threads that write dirty pages near the eviction end of the replacement order
+    std::vector<std::thread> cleaners;
+
+    /// Latch of stop_cleaners
+    std::mutex cleaner_latch;
+
+    /// Wakes the cleaners, e.g. when an eviction had to write a dirty page itself
+    std::condition_variable cleaner_cv;
+
+    /// Tells the cleaners to finish
+    bool stop_cleaners = false;
+
+    /// Number of dirty pages written by the cleaners
+    std::atomic<size_t> num_cleaner_writes = 0;
+
+    /// Number of dirty pages written by evictions
+    std::atomic<size_t> num_eviction_writes = 0;
+
+    const size_t num_prefetchers;
+
+    /// Background threads that load the pages of prefetch_queue
+    std::vector<std::thread> prefetchers;
+
+    /// Latch of prefetch_queue and stop_prefetchers
+    std::mutex prefetch_latch;
+
+    /// Wakes the prefetchers when pages are queued
+    std::condition_variable prefetch_cv;
+
+    /// Pages to load in the background, at most page_count
+    std::deque<uint64_t> prefetch_queue;
+
+    /// Tells the prefetchers to finish
+    bool stop_prefetchers = false;
+
+    /// Number of pages loaded by the prefetchers
+    std::atomic<size_t> num_prefetch_loads = 0;
+
+    /// Latch of segment_files
+    std::mutex segment_files_latch;
+
     /// Maps segment ids to their files
     std::unordered_map<uint16_t, SegmentFile> segment_files;
 
-    /// Hashtable of all pages/frames, which loaded in RAM
-    std::unordered_map<uint64_t, BufferFrame> bufferframes;
+    /**
+     * Returns the partition of a page
+     * @param page_id the page id
+     * @return the partition that holds this page
+     */
+    Partition& get_partition(uint64_t page_id);
+
+    /**
+     * Returns the frame of loaded_pages that holds a page
+     * @param data the data of the page
+     * @return the index of the frame
+     */
+    size_t get_frame(const char* data) const;
+
+    /**
+     * Returns the frame hint of a page
+     * @param page_id the page id
+     * @return the hint in frame_hints
+     */
+    std::atomic<size_t>& get_frame_hint(uint64_t page_id);
+
+    /**
+     * Make the version of a frame odd before writing to it, invalidates the optimistic reads of it
+     * @param frame the index of the frame
+     */
+    void begin_write(size_t frame);
+
+    /**
+     * Make the version of a frame even again after writing to it
+     * @param frame the index of the frame
+     */
+    void end_write(size_t frame);
+
+    /**
+     * Returns the file of a segment, opens it if necessary
+     * @param segment_id the segment id
+     * @return the file of this segment
+     */
+    SegmentFile& get_segment_file(uint16_t segment_id);
 
     /**
      * Load the Page from Disk
      * @param page load this page
-     * @param latch the locked global latch / directory latch => should be unlocked while doing I/O
+     * @param latch the locked partition latch of this page => should be unlocked while doing I/O
      */
     void load_page(BufferFrame& page, unique_lock<mutex>& latch);
 
     /**
      * Write out the Page to Disk
      * @param page write out this page
-     * @param latch the locked global latch / directory latch => should be unlocked while doing I/O
+     * @param latch the locked partition latch of this page => should be unlocked while doing I/O
      */
     void write_out_page(BufferFrame& page, unique_lock<mutex>& latch);
 
     /**
-     * Caller must hold the global latch / directory latch
+     * Mark a page as used for the replacement policy
+     * Caller must hold the partition latch of the page
+     * @param page the page that is fixed
+     */
+    void touch_page(BufferFrame& page);
+
+    /**
+     * Publishes the stamps of the first pages of the FIFO and LRU List of a partition after they changed
+     * Caller must hold the latch of the partition
+     * @param partition the partition
+     */
+    void update_front_stamps(Partition& partition);
+
+    /**
+     * Loads a page that is not in the page table into a free or evicted frame.
+     * The page is fixed once and unlocked when this returns
+     * @param partition the partition of the page
+     * @param latch the locked latch of the partition, is locked again when this returns
+     * @param page_id the page to load
+     * @param prefetch if the page is loaded by a prefetcher, then it is not fixed in the replacement order yet
+     * @return the loaded page
+     * @throws buffer_full_error, if no page can be evicted
+     */
+    BufferFrame& load_new_page(Partition& partition, unique_lock<mutex>& latch, uint64_t page_id, bool prefetch);
+
+    /**
+     * Loads a page of the page table that is in state NEW into a free or evicted frame.
+     * The caller fixed the page once and locked it exclusively, it is unlocked when this returns
+     * @param partition the partition of the page
+     * @param latch the locked latch of the partition, is locked again when this returns
+     * @param page the page to load
+     * @param prefetch if the page is loaded by a prefetcher, then it is not fixed in the replacement order yet
+     * @throws buffer_full_error, if no page can be evicted. Then the page is unfixed, and removed if nobody waits for it
+     */
+    void load_into_frame(Partition& partition, unique_lock<mutex>& latch, BufferFrame& page, bool prefetch);
+
+    /**
+     * Finds the page to evict with the replacement policy, preferably a clean one if there are cleaners.
+     * Caller must not hold any partition latch.
+     * @param latch set to the locked latch of the partition of the returned page
+     * @return the next page that can be evicted. When no page can be evicted, return nullptr
+     */
+    BufferFrame* find_page_to_evict(unique_lock<mutex>& latch);
+
+    /**
+     * Finds the page to evict over all partitions: the oldest evictable page of all FIFO Lists,
+     * or of all LRU Lists if there is none. Only latches the partitions whose first page is older than
+     * the best page found so far. Caller must not hold any partition latch.
+     * @param latch set to the locked latch of the partition of the returned page
+     * @param prefer_clean if a partition may pass a few dirty pages within the window of the cleaners for a clean one,
+     *                     and a clean page of a partition beats an older dirty one of another
+     * @return the next page that can be evicted. When no page can be evicted, return nullptr
+     */
+    BufferFrame* find_page_to_evict_2q(unique_lock<mutex>& latch, bool prefer_clean);
+
+    /**
+     * Finds the page to evict with the clock hand: the next unfixed frame without reference bit.
+     * Caller must not hold any partition latch.
+     * @param latch set to the locked latch of the partition of the returned page
+     * @param prefer_clean if the clock hand may pass a few dirty frames within the window of the cleaners for a clean one
      * @return the next page that can be evicted. When no page can be evicted, return nullptr
      */
-    BufferFrame* find_page_to_evict();
+    BufferFrame* find_page_to_evict_clock(unique_lock<mutex>& latch, bool prefer_clean);
 
     /**
-     * Evicts a page from the buffer
-     * @param latch must be the locked directory latch
+     * Evicts a page from the buffer. Caller must not hold any partition latch.
      * @return the data pointer to the evicted page. When no page can be evicted, return nullptr
      */
-    char* evict_page(std::unique_lock<mutex>& latch);
+    char* evict_page();
+
+    /**
+     * Main loop of a cleaner thread
+     * @param cleaner the index of the cleaner
+     */
+    void run_cleaner(size_t cleaner);
+
+    /**
+     * Writes the dirty unfixed pages of the cleaner near the eviction end of the replacement order
+     * @param cleaner the index of the cleaner
+     * @return the number of pages written
+     */
+    size_t clean_pages(size_t cleaner);
+
+    /**
+     * Writes a page if it is dirty and unfixed. Caller must not hold any partition latch.
+     * @param page_id the page to write
+     * @return true if the page was written
+     */
+    bool clean_page(uint64_t page_id);
+
+    /**
+     * Main loop of a prefetcher thread
+     */
+    void run_prefetcher();
+
+    /**
+     * Loads a page if it is not in the page table, without fixing it. Caller must not hold any partition latch.
+     * @param page_id the page to load
+     * @return true if the page was loaded
+     */
+    bool prefetch_page(uint64_t page_id);
 
 public:
+    /// Page id of no page.
+    static constexpr uint64_t INVALID_PAGE_ID = ~0ull;
+
+    /// A page that is read optimistically, see `fix_page_optimistic()`.
+    struct OptimisticFix {
+        /// Data of the page, only valid until `validate()` fails
+        const char* data = nullptr;
+        /// Frame of the page in the buffer
+        size_t frame = 0;
+        /// Version of the frame when the read started
+        uint64_t version = 0;
+    };
+
     /// Constructor.
     /// @param[in] page_size  Size in bytes that all pages will have.
     /// @param[in] page_count Maximum number of pages that should reside in
     ///                       memory at the same time.
-    BufferManager(size_t page_size, size_t page_count);
-
-    /// Destructor. Writes all dirty pages to disk.
+    /// @param[in] num_partitions Number of hash partitions of the page table.
+    ///                       Every partition has its own latch and FIFO and
+    ///                       LRU list, so fixes of pages in different
+    ///                       partitions don't contend. The lists are ordered
+    ///                       by the time of the fix, and a miss only latches
+    ///                       the partitions that can hold the oldest page. So
+    ///                       the order of the lists and the evicted page are
+    ///                       the same as with a single partition.
+    /// @param[in] replacement_policy Strategy that picks the page to evict.
+    /// @param[in] num_cleaners Number of background threads that write dirty
+    ///                       unfixed pages near the eviction end of the
+    ///                       replacement order, i.e. among the first quarter
+    ///                       of the pages `find_page_to_evict()` would pick.
+    ///                       A miss passes up to 8 dirty pages for a clean
+    ///                       one, so it only waits for a write if the
+    ///                       cleaners fell behind.
+    /// @param[in] num_prefetchers Number of background threads that load the
+    ///                       pages of `prefetch()`, i.e. the number of reads
+    ///                       that are in flight at the same time.
+    BufferManager(size_t page_size, size_t page_count, size_t num_partitions = 64,
+                  ReplacementPolicy replacement_policy = ReplacementPolicy::TWO_Q, size_t num_cleaners = 0,
+                  size_t num_prefetchers = 0);
+
+    /// Destructor. Stops the prefetchers and cleaners and writes all dirty
+    /// pages to disk.
     ~BufferManager();
 
     /// Returns a reference to a `BufferFrame` object for a given page id. When
@@ -220,16 +512,71 @@ public:
     /// written back to disk eventually.
     void unfix_page(BufferFrame& page, bool is_dirty);
 
+    /// Returns a page for an optimistic read, e.g. of an inner node of a
+    /// B-tree. The page is neither locked nor fixed, and it does not move in
+    /// the FIFO and LRU lists. So a read of a page that is loaded and not
+    /// locked exclusively writes no shared memory at all. Everything read
+    /// from `data` is only valid if `validate()` returns true afterwards.
+    /// Otherwise the page was written or evicted meanwhile, and the read must
+    /// be restarted.
+    /// With `ReplacementPolicy::CLOCK`, the reference bit of the frame is set
+    /// if it is not set yet.
+    /// A page that is not loaded or locked exclusively is fixed shared and
+    /// unfixed again, so this blocks on writers and throws
+    /// `buffer_full_error` like `fix_page()`.
+    /// Is thread-safe.
+    /// @param[in] page_id   Page id of the page that should be read.
+    OptimisticFix fix_page_optimistic(uint64_t page_id);
+
+    /// Returns true if the page of `fix` was not written or evicted since
+    /// `fix_page_optimistic()` returned it, i.e. if everything read from it
+    /// is consistent.
+    /// Is thread-safe.
+    bool validate(const OptimisticFix& fix) const;
+
+    /// Tells the buffer manager that the given pages will be fixed soon, e.g.
+    /// by a sequential scan or a B-tree range scan. Returns immediately, the
+    /// prefetchers load the pages that are not loaded yet in the background,
+    /// in order. A `fix_page()` of a page that is still being loaded waits
+    /// for its read.
+    /// Prefetching a page does not count as a fix: with
+    /// `ReplacementPolicy::TWO_Q` the page enters the FIFO list, and stays
+    /// there when it is fixed for the first time.
+    /// This is only a hint. Pages are dropped if there are no prefetchers,
+    /// if `page_count` pages are queued already, or if the buffer is full.
+    /// Is thread-safe.
+    /// @param[in] page_ids  Page ids of the pages that should be loaded.
+    void prefetch(const std::vector<uint64_t>& page_ids);
+
+    /// Prefetches the pages `first` to `first + count - 1` of a segment, see
+    /// `prefetch()`. `count` is cut to `page_count`, as more pages would evict
+    /// the first ones again before they are fixed, and to the last page of the
+    /// segment, whose page id within the segment is 2^48 - 1.
+    /// @param[in] segment_id Segment id of the pages.
+    /// @param[in] first      Page id within the segment of the first page.
+    /// @param[in] count      Number of pages.
+    void prefetch_range(uint16_t segment_id, uint64_t first, size_t count);
+
     /// Returns the page ids of all pages (fixed and unfixed) that are in the
-    /// FIFO list in FIFO order.
+    /// FIFO list in FIFO order. Empty with `ReplacementPolicy::CLOCK`.
     /// Is not thread-safe.
     std::vector<uint64_t> get_fifo_list() const;
 
     /// Returns the page ids of all pages (fixed and unfixed) that are in the
-    /// LRU list in LRU order.
+    /// LRU list in LRU order. Empty with `ReplacementPolicy::CLOCK`.
     /// Is not thread-safe.
     std::vector<uint64_t> get_lru_list() const;
 
+    /// Returns the number of dirty pages the cleaners wrote.
+    size_t get_num_cleaner_writes() const;
+
+    /// Returns the number of dirty pages `fix_page()` had to write itself to
+    /// evict them.
+    size_t get_num_eviction_writes() const;
+
+    /// Returns the number of pages the prefetchers loaded.
+    size_t get_num_prefetch_loads() const;
+
     /// Returns the segment id for a given page id which is contained in the 16
     /// most significant bits of the page id.
     static constexpr uint16_t get_segment_id(uint64_t page_id) { return page_id >> 48; }
@@ -7,6 +7,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
+#include <chrono>
 #include <thread>
 #include <sstream>
 
@@ -15,6 +16,55 @@
 //#define DEBUG 1
 namespace moderndbs {
 
+namespace {
+
+/**
+ * Fibonacci hashing, so that consecutive pages and the same page of different segments spread evenly
+ * @param page_id the page id
+ * @return the hash of the page id
+ */
+size_t hash_page_id(uint64_t page_id) {
+    return (page_id * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+/// The cleaners keep the first 1/CLEAN_FRACTION of the replacement order clean
+constexpr size_t CLEAN_FRACTION = 4;
+
+/// A miss passes at most this many dirty pages for a clean one, then it writes a dirty page itself
+constexpr size_t MAX_DIRTY_SKIPS = 8;
+
+/// A miss tries this many times to evict a page before it throws a buffer_full_error
+constexpr size_t MAX_EVICT_ATTEMPTS = 4;
+
+/**
+ * Returns the number of pages the cleaners keep clean at the eviction end of a part of the replacement order
+ * @param num_pages the number of pages
+ * @param num_parts the number of parts the replacement order is split into
+ * @return the size of the window of every part
+ */
+size_t clean_window(size_t num_pages, size_t num_parts) {
+    return (num_pages + CLEAN_FRACTION * num_parts - 1) / (CLEAN_FRACTION * num_parts);
+}
+
+/**
+ * Returns the stamp of a page that is appended to a list: the time in ns, which orders the lists of all partitions
+ * without a counter that every hit writes. It is larger than the last stamp of the list and of this thread, so the
+ * lists and the fixes of a thread stay ordered if the clock did not move in between
+ * @param last_stamp the stamp of the page in front of the appended one, 0 if there is none
+ * @return the stamp
+ */
+uint64_t next_stamp(uint64_t last_stamp) {
+    thread_local uint64_t last_thread_stamp = 0;
+    const uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    last_thread_stamp = std::max({now, last_stamp + 1, last_thread_stamp + 1});
+    return last_thread_stamp;
+}
+
+/// How long an idle cleaner sleeps before it looks for dirty pages again
+constexpr auto CLEANER_INTERVAL = std::chrono::milliseconds(10);
+
+}  // namespace
+
 /**
  * Returns a pointer to this page's data.
  * @return data in char*
@@ -81,15 +131,48 @@ void BufferFrame::dec_num_users() { num_users--; }
 /// @param[in] page_size  Size in bytes that all pages will have.
 /// @param[in] page_count Maximum number of pages that should reside in
 ///                       memory at the same time.
-BufferManager::BufferManager(size_t page_size, size_t page_count) : page_size(page_size), page_count(page_count), loaded_pages(std::make_unique<char[]>(page_count * page_size)) {}
+/// @param[in] num_partitions Number of hash partitions of the page table.
+/// @param[in] replacement_policy Strategy that picks the page to evict.
+/// @param[in] num_cleaners Number of background threads that write dirty pages.
+/// @param[in] num_prefetchers Number of background threads that load prefetched pages.
+BufferManager::BufferManager(size_t page_size, size_t page_count, size_t num_partitions, ReplacementPolicy replacement_policy, size_t num_cleaners, size_t num_prefetchers) : page_size(page_size), page_count(page_count), num_partitions(num_partitions), replacement_policy(replacement_policy), partitions(std::make_unique<Partition[]>(num_partitions)), loaded_pages(std::make_unique<char[]>(page_count * page_size)), frame_versions(std::make_unique<FrameVersion[]>(page_count)), num_frame_hints(2 * page_count + 1), frame_hints(std::make_unique<std::atomic<size_t>[]>(num_frame_hints)), reference_bits(std::make_unique<std::atomic<bool>[]>(page_count)), dirty_bits(std::make_unique<std::atomic<bool>[]>(page_count)), num_cleaners(num_cleaners), num_prefetchers(num_prefetchers) {
+    assert(num_partitions > 0);
+    for (size_t cleaner = 0; cleaner < num_cleaners; ++cleaner) {
+        cleaners.emplace_back([this, cleaner] { run_cleaner(cleaner); });
+    }
+    for (size_t prefetcher = 0; prefetcher < num_prefetchers; ++prefetcher) {
+        prefetchers.emplace_back([this] { run_prefetcher(); });
+    }
+}
 
-/// Destructor. Writes all dirty pages to disk.
+/// Destructor. Stops the prefetchers and cleaners and writes all dirty pages to disk.
 BufferManager::~BufferManager() {
-    std::unique_lock u_lock(global_mutex); // can not be acquired by other thread! no shared mutex
+    {
+        std::unique_lock lock{prefetch_latch};
+        stop_prefetchers = true;
+    }
+    prefetch_cv.notify_all();
+    for (auto& prefetcher : prefetchers) {
+        prefetcher.join();
+    }
 
-    // write dirty pages back to file
-    for (auto& bufferframe: bufferframes) {
-        write_out_page(bufferframe.second, u_lock);
+    {
+        std::unique_lock lock{cleaner_latch};
+        stop_cleaners = true;
+    }
+    cleaner_cv.notify_all();
+    for (auto& cleaner : cleaners) {
+        cleaner.join();
+    }
+
+    for (size_t i = 0; i < num_partitions; ++i) {
+        auto& partition = partitions[i];
+        std::unique_lock u_lock(partition.latch);
+
+        // write dirty pages back to file
+        for (auto& bufferframe: partition.bufferframes) {
+            write_out_page(bufferframe.second, u_lock);
+        }
     }
 }
 
@@ -105,90 +188,55 @@ BufferManager::~BufferManager() {
 ///                      exclusively. Otherwise it is locked
 ///                      non-exclusively (shared).
 BufferFrame& BufferManager::fix_page(uint64_t page_id, bool exclusive) {
-    /// First: acquire the global latch
-    /// so other threads can not modify the Hash Table when we are looking for an entry
-    std::unique_lock u_lock(global_mutex); /// can not be acquired by other thread! no shared mutex
+    /// First: acquire the latch of the partition of this page
+    /// so other threads can not modify its Hash Table when we are looking for an entry
+    /// Pages of other partitions are fixed concurrently
+    auto& partition = get_partition(page_id);
+    std::unique_lock u_lock(partition.latch);
 
-    while (true) {
-        if (auto it = bufferframes.find(page_id); it != bufferframes.end()) {
-            /// Page is buffered / loaded in RAM
-            auto& page = it->second;
-            page.inc_num_users();
-            if (page.state == BufferFrame::EVICTING) {
-                /// Page is being evicted by other thread
-                /// BUT this thread want to (re)use this Page
-                /// (Re)set the state to RELOADED
-                page.state = BufferFrame::RELOADED;
-            } else if (page.state == BufferFrame::NEW) {
-                /// Another thread is trying to evict another page for this
-                /// Wait for the other thread to finish by locking the page exclusively.
+    if (auto it = partition.bufferframes.find(page_id); it != partition.bufferframes.end()) {
+        /// Page is buffered / loaded in RAM
+        auto& page = it->second;
+        page.inc_num_users();
+        if (page.state == BufferFrame::EVICTING) {
+            /// Page is being evicted by other thread
+            /// BUT this thread want to (re)use this Page
+            /// (Re)set the state to RELOADED
+            page.state = BufferFrame::RELOADED;
+        } else if (page.state == BufferFrame::NEW) {
+            /// Another thread is trying to evict another page for this
+            /// Wait for the other thread to finish by locking the page exclusively.
+            u_lock.unlock();
+            page.lock(true);
+            u_lock.lock();
+            if (page.state == BufferFrame::NEW) {
+                /// Other thread failed to evict another page => take over its load
+                /// Waiters must not retry on the failed page, as they keep it in the page table while they wait
+                load_into_frame(partition, u_lock, page, false);
                 u_lock.unlock();
-                page.lock(true);
-                page.unlock();
-                u_lock.lock();
-                if (page.state == BufferFrame::NEW) {
-                    /// Other thread failed to evict another page
-                    page.dec_num_users();
-                    if (page.get_num_users() == 0) {
-                        /// Remove the failed page
-                        assert(page.fifo_position == fifo_list.end() && page.lru_position == lru_list.end());
-                        bufferframes.erase(it);
-                    }
-                    continue;
+                page.lock(exclusive);
+                if (exclusive) {
+                    begin_write(get_frame(page.data));
                 }
+                return page;
             }
-            if (page.lru_position != lru_list.end()) {
-                /// Page is in LRU List => Update it to the end of LRU List
-                lru_list.erase(page.lru_position);
-                page.lru_position = lru_list.insert(lru_list.end(), &page);
-            } else {
-                assert(page.fifo_position != fifo_list.end());
-                /// Page is in the FIFO List and being fixed again => Hot Page => move it the the LRU List
-                fifo_list.erase(page.fifo_position);
-                page.fifo_position = fifo_list.end();
-                page.lru_position = lru_list.insert(lru_list.end(), &page);
-            }
-            u_lock.unlock();
-            page.lock(exclusive);
-            return page;
-        } else {
-            break;
-        }
-    }
-
-    /// Create a new page and don't insert it in the queues, yet.
-    assert(bufferframes.find(page_id) == bufferframes.end());
-    auto& page = bufferframes.emplace(
-            std::piecewise_construct,
-            std::forward_as_tuple(page_id),
-            std::forward_as_tuple(page_id, nullptr, fifo_list.end(), lru_list.end())
-            ).first->second;
-    page.inc_num_users();
-    page.lock(true);
-    char* data;
-    if (bufferframes.size() - 1 < page_count) {
-        /// We still have space in the RAM => so load this new page
-        data = &loaded_pages[(bufferframes.size() - 1) * page_size];
-    } else {
-        data = evict_page(u_lock);
-        if (data == nullptr) {
-            /// No page could be evicted => throw a buffer_full_error
-            page.dec_num_users();
             page.unlock();
-            if (page.get_num_users() == 0) {
-                assert(page.fifo_position == fifo_list.end() && page.lru_position == lru_list.end());
-                bufferframes.erase(page_id);
-            }
-            throw buffer_full_error();
         }
+        touch_page(page);
+        u_lock.unlock();
+        page.lock(exclusive);
+        if (exclusive) {
+            begin_write(get_frame(page.data));
+        }
+        return page;
     }
-    page.state = BufferFrame::LOADING;
-    page.data = data;
-    page.fifo_position = fifo_list.insert(fifo_list.end(), &page);
-    load_page(page, u_lock);
-    page.unlock();
+
+    auto& page = load_new_page(partition, u_lock, page_id, false);
     u_lock.unlock();
     page.lock(exclusive);
+    if (exclusive) {
+        begin_write(get_frame(page.data));
+    }
     return page;
 }
 
@@ -201,23 +249,114 @@ void BufferManager::unfix_page(BufferFrame& page, bool is_dirty) {
         stream << "BufferManager.unfix_page: " << (std::string) page.pid << "  threadID:" << std::this_thread::get_id() << std::endl;
         std::cout << stream.str();
 #endif
+    if (page.exclusively_locked) {
+        end_write(get_frame(page.data));
+    }
     page.unlock();
-    /// First lock global and frame
-    std::unique_lock u_lock(global_mutex); /// can not be acquired by other thread! no shared mutex
+    /// First lock the partition and frame
+    std::unique_lock u_lock(get_partition(page.pid).latch);
 
     if (is_dirty) {
         page.set_dirty();
+        auto& dirty_bit = dirty_bits[get_frame(page.data)];
+        if (!dirty_bit.load(std::memory_order_relaxed)) {
+            dirty_bit.store(true, std::memory_order_relaxed);
+        }
     }
     page.dec_num_users();
 }
 
+/// Returns a page for an optimistic read. The page is neither locked nor
+/// fixed, and it does not move in the FIFO and LRU lists. Everything read
+/// from `data` is only valid if `validate()` returns true afterwards.
+/// A page that is not loaded or locked exclusively is fixed shared and
+/// unfixed again.
+/// @param[in] page_id   Page id of the page that should be read.
+BufferManager::OptimisticFix BufferManager::fix_page_optimistic(uint64_t page_id) {
+    /// Fast path: the hinted frame holds the page and is not locked exclusively => only reads
+    /// The page id is read after the version, so validate() covers it as well
+    auto& frame_hint = get_frame_hint(page_id);
+    size_t frame = frame_hint.load(std::memory_order_relaxed);
+    auto& frame_version = frame_versions[frame];
+    uint64_t version = frame_version.version.load(std::memory_order_acquire);
+    if ((version & 1) == 0 && frame_version.page_id.load(std::memory_order_relaxed) == page_id) {
+        if (replacement_policy == ReplacementPolicy::CLOCK && !reference_bits[frame].load(std::memory_order_relaxed)) {
+            /// Only write the reference bit if it is not set yet, so hot pages stay read-only
+            reference_bits[frame].store(true, std::memory_order_relaxed);
+        }
+        return OptimisticFix{&loaded_pages[frame * page_size], frame, version};
+    }
+    /// Slow path: fix the page to load it or to wait for the writer
+    /// While the page is fixed shared, nobody writes to its frame
+    auto& page = fix_page(page_id, false);
+    frame = get_frame(page.data);
+    OptimisticFix fix{page.data, frame, frame_versions[frame].version.load(std::memory_order_acquire)};
+    frame_hint.store(frame, std::memory_order_relaxed);
+    unfix_page(page, false);
+    return fix;
+}
+
+/// Returns true if the page of `fix` was not written or evicted since
+/// `fix_page_optimistic()` returned it.
+bool BufferManager::validate(const OptimisticFix& fix) const {
+    /// The reads of the page must not move behind the read of the version
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame_versions[fix.frame].version.load(std::memory_order_relaxed) == fix.version;
+}
+
+/// Tells the buffer manager that the given pages will be fixed soon. The
+/// prefetchers load them in the background.
+/// @param[in] page_ids  Page ids of the pages that should be loaded.
+void BufferManager::prefetch(const std::vector<uint64_t>& page_ids) {
+    if (num_prefetchers == 0) {
+        return;
+    }
+    {
+        std::unique_lock lock{prefetch_latch};
+        for (auto page_id : page_ids) {
+            if (prefetch_queue.size() >= page_count) {
+                /// More pages would evict the first ones of the queue again before they are fixed
+                break;
+            }
+            prefetch_queue.push_back(page_id);
+        }
+    }
+    prefetch_cv.notify_all();
+}
+
+/// Prefetches the pages `first` to `first + count - 1` of a segment, at most
+/// `page_count` of them and none past the end of the segment.
+/// @param[in] segment_id Segment id of the pages.
+/// @param[in] first      Page id within the segment of the first page.
+/// @param[in] count      Number of pages.
+void BufferManager::prefetch_range(uint16_t segment_id, uint64_t first, size_t count) {
+    /// The page id within the segment has 48 bits, more would run into the segment id
+    constexpr uint64_t NUM_SEGMENT_PAGES = 1ull << 48;
+    if (first >= NUM_SEGMENT_PAGES) {
+        return;
+    }
+    const size_t num_pages = std::min<uint64_t>({count, page_count, NUM_SEGMENT_PAGES - first});
+    std::vector<uint64_t> page_ids;
+    page_ids.reserve(num_pages);
+    for (size_t i = 0; i < num_pages; ++i) {
+        page_ids.push_back((static_cast<uint64_t>(segment_id) << 48) | (first + i));
+    }
+    prefetch(page_ids);
+}
+
 /// Returns the page ids of all pages (fixed and unfixed) that are in the
 /// FIFO list in FIFO order.
 /// Is not thread-safe.
 std::vector<uint64_t> BufferManager::get_fifo_list() const {
+    /// Every partition has its own FIFO List => merge them by their stamps
+    std::vector<const BufferFrame*> pages;
+    for (size_t i = 0; i < num_partitions; ++i) {
+        pages.insert(pages.end(), partitions[i].fifo_list.begin(), partitions[i].fifo_list.end());
+    }
+    std::sort(pages.begin(), pages.end(), [](const BufferFrame* a, const BufferFrame* b) { return a->stamp < b->stamp; });
     std::vector<uint64_t> v;
-    v.reserve(fifo_list.size());
-    for (const auto& fifo : fifo_list) {
+    v.reserve(pages.size());
+    for (const auto& fifo : pages) {
         v.push_back(fifo->pid);
     }
     return v;
@@ -227,36 +366,114 @@ std::vector<uint64_t> BufferManager::get_fifo_list() const {
 /// LRU list in LRU order.
 /// Is not thread-safe.
 std::vector<uint64_t> BufferManager::get_lru_list() const {
+    /// Every partition has its own LRU List => merge them by their stamps
+    std::vector<const BufferFrame*> pages;
+    for (size_t i = 0; i < num_partitions; ++i) {
+        pages.insert(pages.end(), partitions[i].lru_list.begin(), partitions[i].lru_list.end());
+    }
+    std::sort(pages.begin(), pages.end(), [](const BufferFrame* a, const BufferFrame* b) { return a->stamp < b->stamp; });
     std::vector<uint64_t> v;
-    v.reserve(lru_list.size());
-    for (const auto& lru: lru_list) {
+    v.reserve(pages.size());
+    for (const auto& lru: pages) {
         v.push_back(lru->pid);
     }
     return v;
 }
 
+/// Returns the number of dirty pages the cleaners wrote.
+size_t BufferManager::get_num_cleaner_writes() const {
+    return num_cleaner_writes.load();
+}
+
+/// Returns the number of dirty pages `fix_page()` had to write itself to
+/// evict them.
+size_t BufferManager::get_num_eviction_writes() const {
+    return num_eviction_writes.load();
+}
+
+/// Returns the number of pages the prefetchers loaded.
+size_t BufferManager::get_num_prefetch_loads() const {
+    return num_prefetch_loads.load();
+}
+
+/**
+ * Returns the partition of a page
+ * @param page_id the page id
+ * @return the partition that holds this page
+ */
+BufferManager::Partition& BufferManager::get_partition(uint64_t page_id) {
+    return partitions[hash_page_id(page_id) % num_partitions];
+}
+
+/**
+ * Returns the frame of loaded_pages that holds a page
+ * @param data the data of the page
+ * @return the index of the frame
+ */
+size_t BufferManager::get_frame(const char* data) const {
+    return (data - loaded_pages.get()) / page_size;
+}
+
+/**
+ * Returns the frame hint of a page
+ * @param page_id the page id
+ * @return the hint in frame_hints
+ */
+std::atomic<size_t>& BufferManager::get_frame_hint(uint64_t page_id) {
+    return frame_hints[hash_page_id(page_id) % num_frame_hints];
+}
+
+/**
+ * Make the version of a frame odd before writing to it, invalidates the optimistic reads of it
+ * @param frame the index of the frame
+ */
+void BufferManager::begin_write(size_t frame) {
+    auto& version = frame_versions[frame].version;
+    assert((version.load(std::memory_order_relaxed) & 1) == 0);
+    version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    /// The writes to the frame must not move in front of the odd version
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+/**
+ * Make the version of a frame even again after writing to it
+ * @param frame the index of the frame
+ */
+void BufferManager::end_write(size_t frame) {
+    auto& version = frame_versions[frame].version;
+    assert((version.load(std::memory_order_relaxed) & 1) == 1);
+    version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/**
+ * Returns the file of a segment, opens it if necessary
+ * @param segment_id the segment id
+ * @return the file of this segment
+ */
+BufferManager::SegmentFile& BufferManager::get_segment_file(uint16_t segment_id) {
+    std::unique_lock lock{segment_files_latch};
+    if (auto it = segment_files.find(segment_id); it != segment_files.end()) {
+        /// File is opened already
+        return it->second;
+    }
+    auto filename = to_string(segment_id);
+    /// Open file in WRITE Mode
+    /// Because we have to write dirty pages to it
+    return segment_files.emplace(segment_id, File::open_file(filename.c_str(), File::WRITE)).first->second;
+}
+
 /**
  * Load the Page from Disk
  * @param page load this page
- * @param latch the locked global latch / directory latch => should be unlocked while doing I/O
+ * @param latch the locked partition latch of this page => should be unlocked while doing I/O
  */
 void BufferManager::load_page(BufferFrame& page, unique_lock<mutex>& latch) {
     assert(page.state == BufferFrame::LOADING);
-    auto segment_id = get_segment_id(page.pid);
     auto segment_page_id = get_segment_page_id(page.pid);
-    SegmentFile* segment_file;
-    if (auto it = segment_files.find(segment_id); it != segment_files.end()) {
-        /// File is opened already
-        segment_file = &it->second;
-    } else {
-        auto filename = to_string(segment_id);
-        /// Open file in WRITE Mode
-        /// Because we have to write dirty pages to it
-        segment_file = &segment_files.emplace(segment_id, File::open_file(filename.c_str(), File::WRITE)).first->second;
-    }
+    auto& segment_file = get_segment_file(get_segment_id(page.pid));
     {
-        std::unique_lock file_latch{segment_file->file_latch};
-        auto& file = *segment_file->file;
+        std::unique_lock file_latch{segment_file.file_latch};
+        auto& file = *segment_file.file;
         if (file.size() < (segment_page_id + 1) * page_size) {
             /// When the file is too small, resize it and zero out the data for it.
             /// As the bytes in the file are zeroed anyway. we don't have to read the zeroes from Disk
@@ -272,54 +489,335 @@ void BufferManager::load_page(BufferFrame& page, unique_lock<mutex>& latch) {
     }
     page.state = BufferFrame::LOADED;
     page.is_dirty = false;
+    dirty_bits[get_frame(page.data)].store(false, std::memory_order_relaxed);
 
 }
 
 /**
  * Write out the Page to Disk
  * @param page write out this page
- * @param latch the locked global latch / directory latch => should be unlocked while doing I/O
+ * @param latch the locked partition latch of this page => should be unlocked while doing I/O
  */
 void BufferManager::write_out_page(BufferFrame& page, unique_lock<mutex>& latch) {
-    auto segment_id = get_segment_id(page.pid);
     auto segment_page_id = get_segment_page_id(page.pid);
-    auto& file = *segment_files.find(segment_id)->second.file;
+    auto& file = *get_segment_file(get_segment_id(page.pid)).file;
     latch.unlock();
     file.write_block(page.data, segment_page_id * page_size, page_size);
     latch.lock();
     page.is_dirty = false;
+    dirty_bits[get_frame(page.data)].store(false, std::memory_order_relaxed);
+}
+
+/**
+ * Mark a page as used for the replacement policy
+ * Caller must hold the partition latch of the page
+ * @param page the page that is fixed
+ */
+void BufferManager::touch_page(BufferFrame& page) {
+    if (replacement_policy == ReplacementPolicy::CLOCK) {
+        /// Only write the reference bit if it is not set yet, so hits on hot pages don't write its cache line
+        auto& reference_bit = reference_bits[get_frame(page.data)];
+        if (!reference_bit.load(std::memory_order_relaxed)) {
+            reference_bit.store(true, std::memory_order_relaxed);
+        }
+        return;
+    }
+    auto& partition = get_partition(page.pid);
+    if (page.lru_position != partition.lru_list.end()) {
+        /// Page is in LRU List => Update it to the end of LRU List
+        /// Splice the node instead of erasing and inserting it, so a hit does not allocate
+        partition.lru_list.splice(partition.lru_list.end(), partition.lru_list, page.lru_position);
+    } else if (page.fifo_position != partition.fifo_list.end() && page.prefetched) {
+        /// Page was prefetched and is fixed for the first time => move it to the end of the FIFO List
+        partition.fifo_list.splice(partition.fifo_list.end(), partition.fifo_list, page.fifo_position);
+        page.prefetched = false;
+    } else if (page.fifo_position != partition.fifo_list.end()) {
+        /// Page is in the FIFO List and being fixed again => Hot Page => move it the the LRU List
+        partition.lru_list.splice(partition.lru_list.end(), partition.fifo_list, page.fifo_position);
+        page.lru_position = page.fifo_position;
+        page.fifo_position = partition.fifo_list.end();
+    } else {
+        /// Page is new => append it to the FIFO List
+        page.fifo_position = partition.fifo_list.insert(partition.fifo_list.end(), &page);
+    }
+    /// The page is the last one of its list now
+    const bool in_lru_list = page.lru_position != partition.lru_list.end();
+    auto& list = in_lru_list ? partition.lru_list : partition.fifo_list;
+    auto position = in_lru_list ? page.lru_position : page.fifo_position;
+    page.stamp = next_stamp(position == list.begin() ? 0 : (*std::prev(position))->stamp);
+    update_front_stamps(partition);
+}
+
+/**
+ * Publishes the stamps of the first pages of the FIFO and LRU List of a partition after they changed
+ * Caller must hold the latch of the partition
+ * @param partition the partition
+ */
+void BufferManager::update_front_stamps(Partition& partition) {
+    for (auto [list, front_stamp] : {std::pair{&partition.fifo_list, &partition.fifo_front_stamp}, std::pair{&partition.lru_list, &partition.lru_front_stamp}}) {
+        const uint64_t stamp = list->empty() ? NO_STAMP : list->front()->stamp;
+        /// Only write the stamp if it changed, so that hits behind the first page don't disturb the misses that read it
+        if (front_stamp->load(std::memory_order_relaxed) != stamp) {
+            front_stamp->store(stamp, std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Loads a page that is not in the page table into a free or evicted frame.
+ * The page is fixed once and unlocked when this returns
+ * @param partition the partition of the page
+ * @param latch the locked latch of the partition, is locked again when this returns
+ * @param page_id the page to load
+ * @param prefetch if the page is loaded by a prefetcher, then it is not fixed in the replacement order yet
+ * @return the loaded page
+ * @throws buffer_full_error, if no page can be evicted
+ */
+BufferFrame& BufferManager::load_new_page(Partition& partition, unique_lock<mutex>& latch, uint64_t page_id, bool prefetch) {
+    /// Create a new page and don't insert it in the queues, yet.
+    assert(partition.bufferframes.find(page_id) == partition.bufferframes.end());
+    auto& page = partition.bufferframes.emplace(
+            std::piecewise_construct,
+            std::forward_as_tuple(page_id),
+            std::forward_as_tuple(page_id, nullptr, partition.fifo_list.end(), partition.lru_list.end())
+            ).first->second;
+    page.inc_num_users();
+    page.lock(true);
+    load_into_frame(partition, latch, page, prefetch);
+    return page;
+}
+
+/**
+ * Loads a page of the page table that is in state NEW into a free or evicted frame.
+ * The caller fixed the page once and locked it exclusively, it is unlocked when this returns
+ * @param partition the partition of the page
+ * @param latch the locked latch of the partition, is locked again when this returns
+ * @param page the page to load
+ * @param prefetch if the page is loaded by a prefetcher, then it is not fixed in the replacement order yet
+ * @throws buffer_full_error, if no page can be evicted. Then the page is unfixed, and removed if nobody waits for it
+ */
+void BufferManager::load_into_frame(Partition& partition, unique_lock<mutex>& latch, BufferFrame& page, bool prefetch) {
+    assert(page.state == BufferFrame::NEW);
+    const uint64_t page_id = page.pid;
+    char* data;
+    size_t frame = num_used_frames.load();
+    while (frame < page_count && !num_used_frames.compare_exchange_weak(frame, frame + 1)) {}
+    if (frame < page_count) {
+        /// We still have space in the RAM => so load this new page
+        data = &loaded_pages[frame * page_size];
+        begin_write(frame);
+    } else {
+        /// evict_page() already began the write to the frame of the evicted page
+        /// The page to evict can be in any partition => release our latch first
+        /// Other threads that fix this page wait for its exclusive lock
+        /// All pages can be fixed only for a moment, e.g. while their users are descheduled => retry a few times
+        latch.unlock();
+        data = evict_page();
+        for (size_t attempt = 1; data == nullptr && attempt < MAX_EVICT_ATTEMPTS; ++attempt) {
+            std::this_thread::yield();
+            data = evict_page();
+        }
+        latch.lock();
+        if (data == nullptr) {
+            /// No page could be evicted => throw a buffer_full_error
+            page.dec_num_users();
+            page.unlock();
+            if (page.get_num_users() == 0) {
+                assert(page.fifo_position == partition.fifo_list.end() && page.lru_position == partition.lru_list.end());
+                partition.bufferframes.erase(page_id);
+            }
+            throw buffer_full_error();
+        }
+    }
+    page.state = BufferFrame::LOADING;
+    page.data = data;
+    page.prefetched = prefetch && replacement_policy == ReplacementPolicy::TWO_Q;
+    touch_page(page);
+    frame = get_frame(data);
+    frame_versions[frame].page_id.store(page_id, std::memory_order_relaxed);
+    get_frame_hint(page_id).store(frame, std::memory_order_relaxed);
+    load_page(page, latch);
+    end_write(frame);
+    page.unlock();
+}
+
+/**
+ * Finds the page to evict with the replacement policy, preferably a clean one if there are cleaners.
+ * Caller must not hold any partition latch.
+ * @param latch set to the locked latch of the partition of the returned page
+ * @return the next page that can be evicted. When no page can be evicted, return nullptr
+ */
+BufferFrame* BufferManager::find_page_to_evict(unique_lock<mutex>& latch) {
+    /// Leave the dirty pages to the cleaners, if there is a clean page close behind them
+    if (replacement_policy == ReplacementPolicy::CLOCK) {
+        return find_page_to_evict_clock(latch, num_cleaners > 0);
+    }
+    return find_page_to_evict_2q(latch, num_cleaners > 0);
 }
 
 /**
- * Caller must hold the global latch / directory latch
+ * Finds the page to evict over all partitions: the oldest evictable page of all FIFO Lists,
+ * or of all LRU Lists if there is none. Only latches the partitions whose first page is older than
+ * the best page found so far. Caller must not hold any partition latch.
+ * @param latch set to the locked latch of the partition of the returned page
+ * @param prefer_clean if a partition may pass a few dirty pages within the window of the cleaners for a clean one,
+ *                     and a clean page of a partition beats an older dirty one of another
  * @return the next page that can be evicted. When no page can be evicted, return nullptr
  */
-BufferFrame* BufferManager::find_page_to_evict() {
-    /// Try FIFO List first
-    for (auto* page : fifo_list) {
-        if (page->get_num_users() == 0 && page->state == BufferFrame::LOADED) {
-            return page;
+BufferFrame* BufferManager::find_page_to_evict_2q(unique_lock<mutex>& latch, bool prefer_clean) {
+    const size_t max_dirty_skips = prefer_clean ? std::min(MAX_DIRTY_SKIPS, clean_window(page_count, num_partitions)) : 0;
+    /// The first clean evictable page of a list, or the first dirty one if there is no clean one behind a few of them
+    auto find_candidate = [&](const std::list<BufferFrame*>& list) -> BufferFrame* {
+        BufferFrame* candidate = nullptr;
+        size_t num_dirty_skips = 0;
+        for (auto* page : list) {
+            if (page->get_num_users() != 0 || page->writing_back || page->state != BufferFrame::LOADED) {
+                continue;
+            }
+            if (!page->is_dirty) {
+                return page;
+            }
+            if (candidate == nullptr) {
+                candidate = page;
+            }
+            if (++num_dirty_skips > max_dirty_skips) {
+                break;
+            }
+        }
+        return candidate;
+    };
+    /// (stamp of the first page, partition) of every partition with pages in the list
+    std::vector<std::pair<uint64_t, size_t>> front_stamps;
+    front_stamps.reserve(num_partitions);
+    /// Try FIFO Lists first
+    /// If FIFO Lists are empty or all pages in them are fixed(used by at least Thread), try to evict in LRU Lists
+    for (auto [list, front_stamp] : {std::pair{&Partition::fifo_list, &Partition::fifo_front_stamp}, std::pair{&Partition::lru_list, &Partition::lru_front_stamp}}) {
+        while (true) {
+            /// Visit the partitions in the order of their first pages, as no page of a partition is older than its first one
+            front_stamps.clear();
+            for (size_t i = 0; i < num_partitions; ++i) {
+                const uint64_t stamp = (partitions[i].*front_stamp).load(std::memory_order_relaxed);
+                if (stamp != NO_STAMP) {
+                    front_stamps.emplace_back(stamp, i);
+                }
+            }
+            std::sort(front_stamps.begin(), front_stamps.end());
+            /// The oldest page so far, only one latch is held at a time
+            bool found = false;
+            uint64_t oldest_pid = 0;
+            uint64_t oldest_stamp = 0;
+            bool oldest_dirty = false;
+            size_t oldest_partition = 0;
+            /// Number of partitions with only younger pages that were visited for a clean page
+            size_t num_dirty_skips = 0;
+            for (auto [stamp, i] : front_stamps) {
+                if (found && stamp > oldest_stamp) {
+                    /// Only younger pages are left, but they may be clean
+                    if (!oldest_dirty || ++num_dirty_skips > max_dirty_skips) {
+                        break;
+                    }
+                }
+                std::unique_lock partition_latch(partitions[i].latch);
+                auto* candidate = find_candidate(partitions[i].*list);
+                if (candidate == nullptr) {
+                    continue;
+                }
+                const bool better = !found || (prefer_clean && candidate->is_dirty != oldest_dirty ? !candidate->is_dirty : candidate->stamp < oldest_stamp);
+                if (better) {
+                    found = true;
+                    oldest_pid = candidate->pid;
+                    oldest_stamp = candidate->stamp;
+                    oldest_dirty = candidate->is_dirty;
+                    oldest_partition = i;
+                }
+            }
+            if (!found) {
+                break;
+            }
+            /// Latch the partition of the oldest page again, retry if the page was fixed or evicted meanwhile
+            auto& partition = partitions[oldest_partition];
+            unique_lock<mutex> partition_latch(partition.latch);
+            if (auto it = partition.bufferframes.find(oldest_pid); it != partition.bufferframes.end()) {
+                auto& page = it->second;
+                if (page.stamp == oldest_stamp && page.get_num_users() == 0 && !page.writing_back && page.state == BufferFrame::LOADED) {
+                    latch = std::move(partition_latch);
+                    return &page;
+                }
+            }
         }
     }
-    /// If FIFO list is empty or all pages in FIFO List are fixed(used by at least Thread), try to evcit in LRU List
-    for (auto* page : lru_list) {
-        if (page->get_num_users() == 0 && page->state == BufferFrame::LOADED) {
-            return page;
+    return nullptr;
+}
+
+/**
+ * Finds the page to evict with the clock hand: the next unfixed frame without reference bit.
+ * Caller must not hold any partition latch.
+ * @param latch set to the locked latch of the partition of the returned page
+ * @param prefer_clean if the clock hand may pass a few dirty frames within the window of the cleaners for a clean one
+ * @return the next page that can be evicted. When no page can be evicted, return nullptr
+ */
+BufferFrame* BufferManager::find_page_to_evict_clock(unique_lock<mutex>& latch, bool prefer_clean) {
+    const size_t max_dirty_skips = prefer_clean ? std::min(MAX_DIRTY_SKIPS, clean_window(page_count, 1)) : 0;
+    size_t num_dirty_skips = 0;
+    /// Frames that are busy only for a moment, i.e. loaded, evicted or written by a cleaner, and the dirty frames
+    /// left to the cleaners are passed without counting them, up to one more round of them
+    size_t num_skips = 0;
+    auto skip = [&] {
+        num_skips = std::min(num_skips + 1, page_count);
+    };
+    /// The first round clears all reference bits, so the second one finds a victim unless all pages are fixed
+    /// or touched again meanwhile => give up after two rounds
+    for (size_t step = 0; step < 2 * page_count + num_skips; ++step) {
+        size_t frame = clock_hand.fetch_add(1, std::memory_order_relaxed) % page_count;
+        if (reference_bits[frame].load(std::memory_order_relaxed)) {
+            /// Second chance
+            reference_bits[frame].store(false, std::memory_order_relaxed);
+            continue;
+        }
+        uint64_t page_id = frame_versions[frame].page_id.load(std::memory_order_relaxed);
+        if (page_id == INVALID_PAGE_ID) {
+            /// Frame is being loaded or evicted by another thread
+            skip();
+            continue;
         }
+        auto& partition = get_partition(page_id);
+        std::unique_lock partition_latch(partition.latch);
+        auto it = partition.bufferframes.find(page_id);
+        if (it == partition.bufferframes.end() || it->second.data != &loaded_pages[frame * page_size]) {
+            /// The page left the frame before we got the latch
+            skip();
+            continue;
+        }
+        auto& page = it->second;
+        if (page.get_num_users() != 0) {
+            continue;
+        }
+        if (page.writing_back || page.state != BufferFrame::LOADED) {
+            skip();
+            continue;
+        }
+        if (page.is_dirty && num_dirty_skips < max_dirty_skips) {
+            /// Leave the page to the cleaners, its cleared reference bit makes it the victim of the next round
+            ++num_dirty_skips;
+            skip();
+            continue;
+        }
+        latch = std::move(partition_latch);
+        return &page;
     }
     return nullptr;
 }
 
 /**
- * Evicts a page from the buffer
- * @param latch must be the locked directory latch
+ * Evicts a page from the buffer. Caller must not hold any partition latch.
  * @return the data pointer to the evicted page. When no page can be evicted, return nullptr
  */
-char* BufferManager::evict_page(unique_lock<mutex>& latch) {
+char* BufferManager::evict_page() {
     BufferFrame* page_to_evict;
+    unique_lock<mutex> latch;
     while (true) {
         /// Need to evict another page. If no page can be evict, find_page_to_evict() returns nullptr
-        page_to_evict = find_page_to_evict();
+        page_to_evict = find_page_to_evict(latch);
         if (page_to_evict == nullptr) {
             return nullptr;
         }
@@ -328,13 +826,14 @@ char* BufferManager::evict_page(unique_lock<mutex>& latch) {
         if (!page_to_evict->is_dirty) {
             break;
         }
-        /// Create a copy pf the page that is written to the file so that other threads can continue using it while it is being written
-        {
-            auto page_data = std::make_unique<char[]>(page_size);
-            std::memcpy(page_data.get(), page_to_evict->data, page_size);
-            BufferFrame page_copy{page_to_evict->pid, page_data.get(), fifo_list.end(), lru_list.end()};
-            write_out_page(page_copy, latch);
-        }
+        /// The cleaners fell behind => write the page ourselves and wake them
+        /// Lock the page shared while it is written, so that other threads can continue reading it but not write it
+        /// The page has no users, so the lock is free
+        ++num_eviction_writes;
+        cleaner_cv.notify_all();
+        page_to_evict->shared_mutex.lock_shared();
+        write_out_page(*page_to_evict, latch);
+        page_to_evict->shared_mutex.unlock_shared();
         assert(page_to_evict->state == BufferFrame::EVICTING || page_to_evict->state == BufferFrame::RELOADED);
         if (page_to_evict->state == BufferFrame::EVICTING) {
             /// Nobody claimed the page while we were evicting it
@@ -342,15 +841,155 @@ char* BufferManager::evict_page(unique_lock<mutex>& latch) {
             break;
         }
         page_to_evict->state = BufferFrame::LOADED;
+        /// find_page_to_evict() takes the latches it needs again
+        latch.unlock();
     }
-    if (page_to_evict->lru_position != lru_list.end()) {
-        lru_list.erase(page_to_evict->lru_position);
+    auto& partition = get_partition(page_to_evict->pid);
+    if (page_to_evict->lru_position != partition.lru_list.end()) {
+        partition.lru_list.erase(page_to_evict->lru_position);
+    } else if (page_to_evict->fifo_position != partition.fifo_list.end()) {
+        partition.fifo_list.erase(page_to_evict->fifo_position);
     } else {
-        assert(page_to_evict->fifo_position != fifo_list.end());
-        fifo_list.erase(page_to_evict->fifo_position);
+        /// ReplacementPolicy::CLOCK keeps no lists
+        assert(replacement_policy == ReplacementPolicy::CLOCK);
     }
+    update_front_stamps(partition);
     char* data = page_to_evict->data;
-    bufferframes.erase(page_to_evict->pid);
+    /// The frame belongs to no page until the caller loaded its page into it
+    auto frame = get_frame(data);
+    begin_write(frame);
+    frame_versions[frame].page_id.store(INVALID_PAGE_ID, std::memory_order_relaxed);
+    partition.bufferframes.erase(page_to_evict->pid);
     return data;
 }
+
+/**
+ * Main loop of a cleaner thread
+ * @param cleaner the index of the cleaner
+ */
+void BufferManager::run_cleaner(size_t cleaner) {
+    std::unique_lock lock{cleaner_latch};
+    while (!stop_cleaners) {
+        lock.unlock();
+        size_t num_written = clean_pages(cleaner);
+        lock.lock();
+        if (num_written == 0 && !stop_cleaners) {
+            /// Nothing to write => sleep until an eviction had to write a page or the interval passed
+            cleaner_cv.wait_for(lock, CLEANER_INTERVAL);
+        }
+    }
+}
+
+/**
+ * Writes the dirty unfixed pages of the cleaner near the eviction end of the replacement order
+ * @param cleaner the index of the cleaner
+ * @return the number of pages written
+ */
+size_t BufferManager::clean_pages(size_t cleaner) {
+    std::vector<uint64_t> page_ids;
+    if (replacement_policy == ReplacementPolicy::CLOCK) {
+        /// The dirty frames the clock hand reaches next, every cleaner takes every num_cleaners-th
+        /// The dirty bits are read without latches, so only the frames that probably need a write are latched
+        size_t clock_position = clock_hand.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < clean_window(page_count, 1); ++i) {
+            size_t frame = (clock_position + i) % page_count;
+            if (frame % num_cleaners != cleaner || !dirty_bits[frame].load(std::memory_order_relaxed)) {
+                continue;
+            }
+            uint64_t page_id = frame_versions[frame].page_id.load(std::memory_order_relaxed);
+            if (page_id != INVALID_PAGE_ID) {
+                page_ids.push_back(page_id);
+            }
+        }
+    } else {
+        /// The front of the FIFO List, then of the LRU List of every num_cleaners-th partition
+        const size_t window = clean_window(page_count, num_partitions);
+        for (size_t i = cleaner; i < num_partitions; i += num_cleaners) {
+            auto& partition = partitions[i];
+            std::unique_lock partition_latch(partition.latch);
+            size_t num_visited = 0;
+            for (auto* list : {&partition.fifo_list, &partition.lru_list}) {
+                for (auto it = list->begin(); it != list->end() && num_visited < window; ++it, ++num_visited) {
+                    if ((*it)->is_dirty && (*it)->get_num_users() == 0 && !(*it)->writing_back) {
+                        page_ids.push_back((*it)->pid);
+                    }
+                }
+            }
+        }
+    }
+    size_t num_written = 0;
+    for (auto page_id : page_ids) {
+        num_written += clean_page(page_id);
+    }
+    return num_written;
+}
+
+/**
+ * Writes a page if it is dirty and unfixed. Caller must not hold any partition latch.
+ * @param page_id the page to write
+ * @return true if the page was written
+ */
+bool BufferManager::clean_page(uint64_t page_id) {
+    auto& partition = get_partition(page_id);
+    std::unique_lock u_lock(partition.latch);
+    auto it = partition.bufferframes.find(page_id);
+    if (it == partition.bufferframes.end()) {
+        return false;
+    }
+    auto& page = it->second;
+    if (!page.is_dirty || page.get_num_users() != 0 || page.writing_back || page.state != BufferFrame::LOADED) {
+        return false;
+    }
+    /// Mark the page so that it is not evicted, and lock it shared so that nobody writes it while it is written
+    /// It is not fixed, so that the clock hand and the FIFO and LRU Lists don't take it for a page in use
+    /// The page has no users, so the lock is free
+    page.writing_back = true;
+    page.shared_mutex.lock_shared();
+    write_out_page(page, u_lock);
+    page.shared_mutex.unlock_shared();
+    page.writing_back = false;
+    ++num_cleaner_writes;
+    return true;
+}
+
+/**
+ * Main loop of a prefetcher thread
+ */
+void BufferManager::run_prefetcher() {
+    std::unique_lock lock{prefetch_latch};
+    while (true) {
+        prefetch_cv.wait(lock, [this] { return stop_prefetchers || !prefetch_queue.empty(); });
+        if (stop_prefetchers) {
+            return;
+        }
+        uint64_t page_id = prefetch_queue.front();
+        prefetch_queue.pop_front();
+        lock.unlock();
+        prefetch_page(page_id);
+        lock.lock();
+    }
+}
+
+/**
+ * Loads a page if it is not in the page table, without fixing it. Caller must not hold any partition latch.
+ * @param page_id the page to load
+ * @return true if the page was loaded
+ */
+bool BufferManager::prefetch_page(uint64_t page_id) {
+    auto& partition = get_partition(page_id);
+    std::unique_lock u_lock(partition.latch);
+    if (partition.bufferframes.find(page_id) != partition.bufferframes.end()) {
+        /// Page is loaded or being loaded already
+        return false;
+    }
+    try {
+        auto& page = load_new_page(partition, u_lock, page_id, true);
+        page.dec_num_users();
+    } catch (const buffer_full_error&) {
+        /// All pages are fixed => drop the prefetch
+        return false;
+    }
+    ++num_prefetch_loads;
+    return true;
+}
 }  // namespace moderndbs
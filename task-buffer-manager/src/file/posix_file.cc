@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <cerrno>
 #include <memory>
+#include <new>
 #include <system_error>
 
 
@@ -17,6 +18,27 @@ namespace {
     throw std::system_error{errno, std::system_category()};
 }
 
+[[noreturn]] static void throw_unaligned() {
+    throw std::system_error{EINVAL, std::system_category(), "unaligned block for direct I/O"};
+}
+
+/// Bypasses the page cache for all reads and writes of `fd`.
+static void enable_direct_io(int fd) {
+#if defined(O_DIRECT)
+    int flags = ::fcntl(fd, F_GETFL);
+    if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_DIRECT) < 0) {
+        throw_errno();
+    }
+#elif defined(F_NOCACHE)
+    if (::fcntl(fd, F_NOCACHE, 1) < 0) {
+        throw_errno();
+    }
+#else
+    errno = ENOTSUP;
+    throw_errno();
+#endif
+}
+
 }  // namespace
 
 
@@ -24,6 +46,7 @@ class PosixFile
 : public File {
 private:
     Mode mode;
+    Caching caching;
     int fd;
     size_t cached_size;
 
@@ -36,9 +59,10 @@ private:
     }
 
 public:
-    PosixFile(Mode mode, int fd, size_t size) : mode(mode), fd(fd), cached_size(size) {}
+    PosixFile(Mode mode, Caching caching, int fd, size_t size)
+    : mode(mode), caching(caching), fd(fd), cached_size(size) {}
 
-    PosixFile(const char* filename, Mode mode) : mode(mode) {
+    PosixFile(const char* filename, Mode mode, Caching caching) : mode(mode), caching(caching) {
         switch (mode) {
             case READ:
                 fd = ::open(filename, O_RDONLY | O_SYNC);
@@ -49,6 +73,14 @@ public:
         if (fd < 0) {
             throw_errno();
         }
+        if (caching == Caching::DIRECT) {
+            try {
+                enable_direct_io(fd);
+            } catch (...) {
+                ::close(fd);
+                throw;
+            }
+        }
         cached_size = read_size();
     }
 
@@ -63,6 +95,10 @@ public:
         return mode;
     }
 
+    Caching get_caching() const override {
+        return caching;
+    }
+
     size_t size() const override {
         return cached_size;
     }
@@ -78,6 +114,9 @@ public:
     }
 
     void read_block(size_t offset, size_t size, char* block) override {
+        if (caching == Caching::DIRECT && !is_aligned(block, offset, size)) {
+            throw_unaligned();
+        }
         size_t total_bytes_read = 0;
         while (total_bytes_read < size) {
             ssize_t bytes_read = ::pread(
@@ -99,6 +138,9 @@ public:
     }
 
     void write_block(const char* block, size_t offset, size_t size) override {
+        if (caching == Caching::DIRECT && !is_aligned(block, offset, size)) {
+            throw_unaligned();
+        }
         size_t total_bytes_written = 0;
         while (total_bytes_written < size) {
             ssize_t bytes_written = ::pwrite(
@@ -121,12 +163,12 @@ public:
 };
 
 
-std::unique_ptr<File> File::open_file(const char* filename, Mode mode) {
-    return std::make_unique<PosixFile>(filename, mode);
+std::unique_ptr<File> File::open_file(const char* filename, Mode mode, Caching caching) {
+    return std::make_unique<PosixFile>(filename, mode, caching);
 }
 
 
-std::unique_ptr<File> File::make_temporary_file() {
+std::unique_ptr<File> File::make_temporary_file(Caching caching) {
     char file_template[] = ".tmpfile-XXXXXX";
     int fd = ::mkstemp(file_template);
     if (fd < 0) {
@@ -136,7 +178,26 @@ std::unique_ptr<File> File::make_temporary_file() {
         ::close(fd);
         throw_errno();
     }
-    return std::make_unique<PosixFile>(File::WRITE, fd, 0);
+    if (caching == Caching::DIRECT) {
+        try {
+            enable_direct_io(fd);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
+    return std::make_unique<PosixFile>(File::WRITE, caching, fd, 0);
+}
+
+
+File::AlignedBlock File::allocate_aligned(size_t size) {
+    size = (size + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+    void* block = nullptr;
+    // posix_memalign() does not accept a size of 0 everywhere
+    if (::posix_memalign(&block, DIRECT_ALIGNMENT, size > 0 ? size : DIRECT_ALIGNMENT) != 0) {
+        throw std::bad_alloc{};
+    }
+    return AlignedBlock{static_cast<char*>(block)};
 }
 
 }  // namespace moderndbs
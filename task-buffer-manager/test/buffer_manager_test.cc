@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstring>
 #include <memory>
 #include <random>
@@ -133,6 +134,201 @@ TEST(BufferManagerTest, LRURefresh) {
     EXPECT_EQ((std::vector<uint64_t>{2, 1}), buffer_manager.get_lru_list());
 }
 
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, PartitionsKeepGlobalOrder) {
+    // The pages spread over the partitions, but the lists and the evicted
+    // page are the ones of a single partition.
+    moderndbs::BufferManager buffer_manager{1024, 10, 4};
+    for (uint64_t i = 1; i < 11; ++i) {
+        auto& page = buffer_manager.fix_page(i, false);
+        buffer_manager.unfix_page(page, false);
+    }
+    for (uint64_t i : {7, 3, 9}) {
+        auto& page = buffer_manager.fix_page(i, false);
+        buffer_manager.unfix_page(page, false);
+    }
+    EXPECT_EQ((std::vector<uint64_t>{1, 2, 4, 5, 6, 8, 10}), buffer_manager.get_fifo_list());
+    EXPECT_EQ((std::vector<uint64_t>{7, 3, 9}), buffer_manager.get_lru_list());
+    for (uint64_t i = 1; i < 11; ++i) {
+        if (i == 3 || i == 7 || i == 9) {
+            continue;
+        }
+        auto& page = buffer_manager.fix_page(i + 10, false);
+        buffer_manager.unfix_page(page, false);
+    }
+    // All FIFO pages are evicted before the LRU pages, oldest first.
+    EXPECT_EQ((std::vector<uint64_t>{11, 12, 14, 15, 16, 18, 20}), buffer_manager.get_fifo_list());
+    EXPECT_EQ((std::vector<uint64_t>{7, 3, 9}), buffer_manager.get_lru_list());
+    {
+        auto& page = buffer_manager.fix_page(3, false);
+        buffer_manager.unfix_page(page, false);
+    }
+    EXPECT_EQ((std::vector<uint64_t>{7, 9, 3}), buffer_manager.get_lru_list());
+}
+
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, FixOptimistic) {
+    moderndbs::BufferManager buffer_manager{1024, 2};
+    {
+        auto& page = buffer_manager.fix_page(1, true);
+        *reinterpret_cast<uint64_t*>(page.get_data()) = 123;
+        buffer_manager.unfix_page(page, true);
+    }
+    auto fix = buffer_manager.fix_page_optimistic(1);
+    EXPECT_EQ(123, *reinterpret_cast<const uint64_t*>(fix.data));
+    EXPECT_TRUE(buffer_manager.validate(fix));
+    // Optimistic reads don't move the page to the LRU list.
+    EXPECT_EQ(std::vector<uint64_t>{1}, buffer_manager.get_fifo_list());
+    EXPECT_TRUE(buffer_manager.get_lru_list().empty());
+    {
+        // A shared fix does not write the page.
+        auto& page = buffer_manager.fix_page(1, false);
+        buffer_manager.unfix_page(page, false);
+        EXPECT_TRUE(buffer_manager.validate(fix));
+    }
+    {
+        auto& page = buffer_manager.fix_page(1, true);
+        EXPECT_FALSE(buffer_manager.validate(fix));
+        *reinterpret_cast<uint64_t*>(page.get_data()) = 124;
+        buffer_manager.unfix_page(page, true);
+        EXPECT_FALSE(buffer_manager.validate(fix));
+    }
+    fix = buffer_manager.fix_page_optimistic(1);
+    EXPECT_EQ(124, *reinterpret_cast<const uint64_t*>(fix.data));
+    EXPECT_TRUE(buffer_manager.validate(fix));
+    // Evicting the page invalidates the read as well. Page 1 is in the LRU
+    // list, so page 2 stays fixed to make it the only page to evict.
+    {
+        auto& page2 = buffer_manager.fix_page(2, false);
+        auto& page3 = buffer_manager.fix_page(3, false);
+        buffer_manager.unfix_page(page3, false);
+        buffer_manager.unfix_page(page2, false);
+    }
+    EXPECT_FALSE(buffer_manager.validate(fix));
+    // The page is loaded again.
+    fix = buffer_manager.fix_page_optimistic(1);
+    EXPECT_EQ(124, *reinterpret_cast<const uint64_t*>(fix.data));
+    EXPECT_TRUE(buffer_manager.validate(fix));
+}
+
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, ClockEvict) {
+    moderndbs::BufferManager buffer_manager{1024, 3, 4, moderndbs::ReplacementPolicy::CLOCK};
+    for (uint64_t i = 1; i < 4; ++i) {
+        auto& page = buffer_manager.fix_page(i, false);
+        buffer_manager.unfix_page(page, false);
+    }
+    // An optimistic read fails once its page is evicted.
+    auto fix1 = buffer_manager.fix_page_optimistic(1);
+    auto fix2 = buffer_manager.fix_page_optimistic(2);
+    auto fix3 = buffer_manager.fix_page_optimistic(3);
+    {
+        // All pages are referenced => the clock hand clears all reference
+        // bits and evicts the first page.
+        auto& page = buffer_manager.fix_page(4, false);
+        buffer_manager.unfix_page(page, false);
+    }
+    EXPECT_FALSE(buffer_manager.validate(fix1));
+    EXPECT_TRUE(buffer_manager.validate(fix2));
+    EXPECT_TRUE(buffer_manager.validate(fix3));
+    {
+        // Page 2 gets a second chance, page 3 is evicted.
+        auto& page2 = buffer_manager.fix_page(2, false);
+        buffer_manager.unfix_page(page2, false);
+        auto& page5 = buffer_manager.fix_page(5, false);
+        buffer_manager.unfix_page(page5, false);
+    }
+    EXPECT_TRUE(buffer_manager.validate(fix2));
+    EXPECT_FALSE(buffer_manager.validate(fix3));
+    EXPECT_TRUE(buffer_manager.get_fifo_list().empty());
+    EXPECT_TRUE(buffer_manager.get_lru_list().empty());
+}
+
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, ClockBufferFull) {
+    moderndbs::BufferManager buffer_manager{1024, 10, 4, moderndbs::ReplacementPolicy::CLOCK};
+    std::vector<moderndbs::BufferFrame*> pages;
+    pages.reserve(10);
+    for (uint64_t i = 1; i < 11; ++i) {
+        pages.push_back(&buffer_manager.fix_page(i, false));
+    }
+    EXPECT_THROW(buffer_manager.fix_page(11, false), moderndbs::buffer_full_error);
+    buffer_manager.unfix_page(*pages[3], false);
+    pages.erase(pages.begin() + 3);
+    auto& page = buffer_manager.fix_page(11, false);
+    buffer_manager.unfix_page(page, false);
+    for (auto* page : pages) {
+        buffer_manager.unfix_page(*page, false);
+    }
+}
+
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, CleanerWritesVictims) {
+    {
+        moderndbs::BufferManager buffer_manager{1024, 10, 1, moderndbs::ReplacementPolicy::TWO_Q, 1};
+        for (uint64_t i = 1; i < 11; ++i) {
+            auto& page = buffer_manager.fix_page(i, true);
+            *reinterpret_cast<uint64_t*>(page.get_data()) = i;
+            buffer_manager.unfix_page(page, true);
+        }
+        // The cleaner writes the first quarter of the FIFO list, i.e. the
+        // pages 1, 2 and 3.
+        for (size_t i = 0; i < 5000 && buffer_manager.get_num_cleaner_writes() < 3; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_EQ(3, buffer_manager.get_num_cleaner_writes());
+        // The victim is clean already.
+        auto& page = buffer_manager.fix_page(11, false);
+        buffer_manager.unfix_page(page, false);
+        EXPECT_EQ(0, buffer_manager.get_num_eviction_writes());
+    }
+    moderndbs::BufferManager buffer_manager{1024, 10};
+    for (uint64_t i = 1; i < 11; ++i) {
+        auto& page = buffer_manager.fix_page(i, false);
+        EXPECT_EQ(i, *reinterpret_cast<uint64_t*>(page.get_data()));
+        buffer_manager.unfix_page(page, false);
+    }
+}
+
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, Prefetch) {
+    {
+        moderndbs::BufferManager buffer_manager{1024, 10};
+        for (uint64_t i = 0; i < 10; ++i) {
+            auto& page = buffer_manager.fix_page(i, true);
+            *reinterpret_cast<uint64_t*>(page.get_data()) = i;
+            buffer_manager.unfix_page(page, true);
+        }
+    }
+    moderndbs::BufferManager buffer_manager{1024, 10, 1, moderndbs::ReplacementPolicy::TWO_Q, 0, 1};
+    buffer_manager.prefetch_range(0, 0, 5);
+    for (size_t i = 0; i < 5000 && buffer_manager.get_num_prefetch_loads() < 5; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(5, buffer_manager.get_num_prefetch_loads());
+    std::vector<uint64_t> expected_fifo{0, 1, 2, 3, 4};
+    EXPECT_EQ(expected_fifo, buffer_manager.get_fifo_list());
+    // The first fix of a prefetched page keeps it in the FIFO list.
+    for (uint64_t i = 0; i < 5; ++i) {
+        auto& page = buffer_manager.fix_page(i, false);
+        EXPECT_EQ(i, *reinterpret_cast<uint64_t*>(page.get_data()));
+        buffer_manager.unfix_page(page, false);
+    }
+    EXPECT_EQ(expected_fifo, buffer_manager.get_fifo_list());
+    EXPECT_TRUE(buffer_manager.get_lru_list().empty());
+    // Loaded pages are not loaded again.
+    buffer_manager.prefetch({3, 4, 5});
+    for (size_t i = 0; i < 5000 && buffer_manager.get_num_prefetch_loads() < 6; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(6, buffer_manager.get_num_prefetch_loads());
+    auto& page = buffer_manager.fix_page(5, false);
+    EXPECT_EQ(5, *reinterpret_cast<uint64_t*>(page.get_data()));
+    buffer_manager.unfix_page(page, false);
+    expected_fifo.push_back(5);
+    EXPECT_EQ(expected_fifo, buffer_manager.get_fifo_list());
+}
+
 // NOLINTNEXTLINE
 TEST(BufferManagerTest, MultithreadParallelFix) {
     moderndbs::BufferManager buffer_manager{1024, 10};
@@ -190,6 +386,54 @@ TEST(BufferManagerTest, MultithreadExclusiveAccess) {
     EXPECT_EQ(4000, value);
 }
 
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, MultithreadOptimisticRead) {
+    moderndbs::BufferManager buffer_manager{1024, 10};
+    for (uint64_t i = 0; i < 16; ++i) {
+        auto& page = buffer_manager.fix_page(i, true);
+        std::memset(page.get_data(), 0, 1024);
+        buffer_manager.unfix_page(page, true);
+    }
+    std::atomic<bool> done = false;
+    std::vector<std::thread> threads;
+    // Readers check that both values of a page are equal whenever the read
+    // is valid. There are more pages than frames, so pages are evicted while
+    // they are read.
+    for (size_t i = 0; i < 3; ++i) {
+        threads.emplace_back([i, &buffer_manager, &done] {
+            std::mt19937_64 engine{i};
+            std::uniform_int_distribution<uint64_t> page_distr{0, 15};
+            size_t num_valid = 0;
+            while (!done.load() || num_valid == 0) {
+                auto fix = buffer_manager.fix_page_optimistic(page_distr(engine));
+                auto* values = reinterpret_cast<const volatile uint64_t*>(fix.data);
+                uint64_t first = values[0];
+                uint64_t last = values[127];
+                if (buffer_manager.validate(fix)) {
+                    ASSERT_EQ(first, last);
+                    ++num_valid;
+                }
+            }
+        });
+    }
+    // The writer increments both values of a page under an exclusive fix.
+    {
+        std::mt19937_64 engine{42};
+        std::uniform_int_distribution<uint64_t> page_distr{0, 15};
+        for (size_t j = 0; j < 10000; ++j) {
+            auto& page = buffer_manager.fix_page(page_distr(engine), true);
+            auto* values = reinterpret_cast<volatile uint64_t*>(page.get_data());
+            values[0] = values[0] + 1;
+            values[127] = values[127] + 1;
+            buffer_manager.unfix_page(page, true);
+        }
+    }
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
 // NOLINTNEXTLINE
 TEST(BufferManagerTest, MultithreadBufferFull) {
     moderndbs::BufferManager buffer_manager{1024, 10};
@@ -257,6 +501,117 @@ TEST(BufferManagerTest, MultithreadManyPages) {
 }
 #endif
 
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, MultithreadClockExclusiveAccess) {
+    // Like MultithreadExclusiveAccess, but with more pages than frames, so
+    // the pages are written out and read again while being incremented.
+    {
+        moderndbs::BufferManager buffer_manager{1024, 10, 4, moderndbs::ReplacementPolicy::CLOCK};
+        for (uint64_t i = 0; i < 20; ++i) {
+            auto& page = buffer_manager.fix_page(i, true);
+            std::memset(page.get_data(), 0, 1024);
+            buffer_manager.unfix_page(page, true);
+        }
+    }
+    moderndbs::BufferManager buffer_manager{1024, 10, 4, moderndbs::ReplacementPolicy::CLOCK};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 4; ++i) {
+        threads.emplace_back([i, &buffer_manager] {
+            std::mt19937_64 engine{i};
+            std::geometric_distribution<uint64_t> distr{0.2};
+            for (size_t j = 0; j < 1000; ++j) {
+                auto& page = buffer_manager.fix_page(distr(engine) % 20, true);
+                ++*reinterpret_cast<uint64_t*>(page.get_data());
+                buffer_manager.unfix_page(page, true);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < 20; ++i) {
+        auto& page = buffer_manager.fix_page(i, false);
+        sum += *reinterpret_cast<uint64_t*>(page.get_data());
+        buffer_manager.unfix_page(page, false);
+    }
+    EXPECT_EQ(4000, sum);
+}
+
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, MultithreadCleanerExclusiveAccess) {
+    // Like MultithreadClockExclusiveAccess, but the cleaners write the pages
+    // while they are incremented.
+    for (auto replacement_policy : {moderndbs::ReplacementPolicy::TWO_Q, moderndbs::ReplacementPolicy::CLOCK}) {
+        {
+            moderndbs::BufferManager buffer_manager{1024, 10};
+            for (uint64_t i = 0; i < 20; ++i) {
+                auto& page = buffer_manager.fix_page(i, true);
+                std::memset(page.get_data(), 0, 1024);
+                buffer_manager.unfix_page(page, true);
+            }
+        }
+        moderndbs::BufferManager buffer_manager{1024, 10, 4, replacement_policy, 2};
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < 4; ++i) {
+            threads.emplace_back([i, &buffer_manager] {
+                std::mt19937_64 engine{i};
+                std::geometric_distribution<uint64_t> distr{0.2};
+                for (size_t j = 0; j < 1000; ++j) {
+                    auto& page = buffer_manager.fix_page(distr(engine) % 20, true);
+                    ++*reinterpret_cast<uint64_t*>(page.get_data());
+                    buffer_manager.unfix_page(page, true);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < 20; ++i) {
+            auto& page = buffer_manager.fix_page(i, false);
+            sum += *reinterpret_cast<uint64_t*>(page.get_data());
+            buffer_manager.unfix_page(page, false);
+        }
+        EXPECT_EQ(4000, sum);
+    }
+}
+
+// NOLINTNEXTLINE
+TEST(BufferManagerTest, MultithreadPrefetchScan) {
+    // Every thread scans all pages and prefetches the next ones, so fixes
+    // wait for pages that are still being loaded or evicted.
+    for (auto replacement_policy : {moderndbs::ReplacementPolicy::TWO_Q, moderndbs::ReplacementPolicy::CLOCK}) {
+        {
+            moderndbs::BufferManager buffer_manager{1024, 10};
+            for (uint64_t i = 0; i < 40; ++i) {
+                auto& page = buffer_manager.fix_page(i, true);
+                *reinterpret_cast<uint64_t*>(page.get_data()) = i;
+                buffer_manager.unfix_page(page, true);
+            }
+        }
+        moderndbs::BufferManager buffer_manager{1024, 10, 4, replacement_policy, 0, 2};
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < 4; ++i) {
+            threads.emplace_back([&buffer_manager] {
+                for (size_t j = 0; j < 10; ++j) {
+                    for (uint64_t page_id = 0; page_id < 40; ++page_id) {
+                        if (page_id % 2 == 0) {
+                            buffer_manager.prefetch_range(0, page_id + 1, 2);
+                        }
+                        auto& page = buffer_manager.fix_page(page_id, false);
+                        EXPECT_EQ(page_id, *reinterpret_cast<uint64_t*>(page.get_data()));
+                        buffer_manager.unfix_page(page, false);
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
 // NOLINTNEXTLINE
 TEST(BufferManagerTest, MultithreadReaderWriter) {
     {
@@ -0,0 +1,192 @@
+// ---------------------------------------------------------------------------------------------------
+// MODERNDBS
+// ---------------------------------------------------------------------------------------------------
+// Sweeps external_sort() over input sizes, memory sizes and value distributions on real files.
+// Write the results as JSON to diff them between releases:
+//     bm_external_sort --benchmark_out=bm_external_sort.json --benchmark_out_format=json
+// ---------------------------------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "moderndbs/external_sort.h"
+#include "moderndbs/file.h"
+#include "benchmark/benchmark.h"
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+using moderndbs::File;
+// ---------------------------------------------------------------------------------------------------
+/// Distributions of the input values.
+enum Distribution : int64_t {
+    RANDOM,
+    ASCENDING,
+    DESCENDING,
+    FEW_DISTINCT,
+    ZIPF
+};
+// ---------------------------------------------------------------------------------------------------
+/// Draws ranks 1..n with probability proportional to 1 / rank.
+class ZipfDistribution {
+    /// The cumulative probabilities of the ranks.
+    std::vector<double> cdf;
+
+public:
+    explicit ZipfDistribution(size_t n) : cdf(n) {
+        double sum = 0;
+        for (size_t rank = 1; rank <= n; ++rank) {
+            sum += 1.0 / static_cast<double>(rank);
+            cdf[rank - 1] = sum;
+        }
+        for (auto& p : cdf) {
+            p /= sum;
+        }
+    }
+
+    template <typename Engine>
+    uint64_t operator()(Engine& engine) {
+        const double p = std::uniform_real_distribution<double>{}(engine);
+        return std::lower_bound(cdf.begin(), std::prev(cdf.end()), p) - cdf.begin() + 1;
+    }
+};
+// ---------------------------------------------------------------------------------------------------
+/// Generates `num_values` values of the given distribution.
+std::vector<uint64_t> make_values(size_t num_values, int64_t distribution) {
+    std::mt19937_64 engine{0};
+    std::uniform_int_distribution<uint64_t> distr;
+    ZipfDistribution zipf{distribution == ZIPF ? size_t{1} << 16 : 1};
+    std::vector<uint64_t> values(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        switch (distribution) {
+            case ASCENDING: values[i] = i; break;
+            case DESCENDING: values[i] = num_values - i; break;
+            case FEW_DISTINCT: values[i] = distr(engine) % 16; break;
+            case ZIPF: values[i] = zipf(engine); break;
+            default: values[i] = distr(engine); break;
+        }
+    }
+    return values;
+}
+// ---------------------------------------------------------------------------------------------------
+/// An input file on disk that is removed again at the end of the benchmark.
+class InputFile {
+    /// The path of the file.
+    std::string path;
+
+public:
+    explicit InputFile(const std::vector<uint64_t>& values)
+        : path("bm_external_sort_input_" + std::to_string(::getpid())) {
+        std::remove(path.c_str());
+        auto file = File::open_file(path.c_str(), File::WRITE);
+        file->resize(values.size() * sizeof(uint64_t));
+        file->write_block(reinterpret_cast<const char*>(values.data()), 0, values.size() * sizeof(uint64_t));
+    }
+
+    ~InputFile() {
+        std::remove(path.c_str());
+    }
+
+    /// Opens the file for reading.
+    std::unique_ptr<File> open() const {
+        return File::open_file(path.c_str(), File::READ);
+    }
+};
+// ---------------------------------------------------------------------------------------------------
+/// Sorts the input with `mem_size` bytes, reports throughput, I/O and the time of run generation and merge.
+void ExternalSort(benchmark::State& state) {
+    const size_t num_values = state.range(0);
+    const size_t mem_size = state.range(1);
+    const InputFile input_file{make_values(num_values, state.range(2))};
+    auto input = input_file.open();
+
+    moderndbs::ExternalSortStats stats;
+    moderndbs::ExternalSortOptions options;
+    options.stats = &stats;
+    moderndbs::ExternalSortStats total;
+
+    for (auto _ : state) {
+        auto output = File::make_temporary_file();
+        /// external_sort() logs every sort, keep that out of the benchmark report
+        auto* cout_buffer = std::cout.rdbuf(nullptr);
+        moderndbs::external_sort(*input, num_values, *output, mem_size, options);
+        std::cout.rdbuf(cout_buffer);
+        std::cout.clear();
+
+        total.num_reads += stats.num_reads;
+        total.num_writes += stats.num_writes;
+        total.bytes_read += stats.bytes_read;
+        total.bytes_written += stats.bytes_written;
+        total.run_generation_seconds += stats.run_generation_seconds;
+        total.merge_seconds += stats.merge_seconds;
+    }
+
+    const auto average = benchmark::Counter::kAvgIterations;
+    state.SetBytesProcessed(state.iterations() * num_values * sizeof(uint64_t));
+    state.SetItemsProcessed(state.iterations() * num_values);
+    state.counters["reads"] = benchmark::Counter(total.num_reads, average);
+    state.counters["writes"] = benchmark::Counter(total.num_writes, average);
+    state.counters["bytes_read"] = benchmark::Counter(total.bytes_read, average);
+    state.counters["bytes_written"] = benchmark::Counter(total.bytes_written, average);
+    state.counters["runs"] = stats.num_runs;
+    state.counters["merge_passes"] = stats.num_merge_passes;
+    state.counters["peak_memory"] = stats.peak_memory;
+    state.counters["run_generation_s"] = benchmark::Counter(total.run_generation_seconds, average);
+    state.counters["merge_s"] = benchmark::Counter(total.merge_seconds, average);
+}
+// ---------------------------------------------------------------------------------------------------
+/// Pulls the sorted input batch by batch from a `SortedStream`, i.e. external_sort() without writing the output.
+void SortedStream(benchmark::State& state) {
+    const size_t num_values = state.range(0);
+    const size_t mem_size = state.range(1);
+    const InputFile input_file{make_values(num_values, state.range(2))};
+    auto input = input_file.open();
+
+    moderndbs::ExternalSortStats stats;
+    moderndbs::ExternalSortOptions options;
+    options.stats = &stats;
+    double merge_seconds = 0;
+    uint64_t checksum = 0;
+
+    for (auto _ : state) {
+        auto* cout_buffer = std::cout.rdbuf(nullptr);
+        moderndbs::SortedStream stream{*input, num_values, mem_size, options};
+        std::cout.rdbuf(cout_buffer);
+        std::cout.clear();
+        for (auto batch = stream.next(); !batch.empty(); batch = stream.next()) {
+            checksum += batch.values[batch.size - 1];
+        }
+        merge_seconds += stats.merge_seconds;
+    }
+    benchmark::DoNotOptimize(checksum);
+
+    state.SetBytesProcessed(state.iterations() * num_values * sizeof(uint64_t));
+    state.SetItemsProcessed(state.iterations() * num_values);
+    state.counters["runs"] = stats.num_runs;
+    state.counters["merge_s"] = benchmark::Counter(merge_seconds, benchmark::Counter::kAvgIterations);
+}
+// ---------------------------------------------------------------------------------------------------
+/// Inputs from 8 MiB to 128 MiB, memory from 1 MiB to 16 MiB, each with all distributions.
+void Arguments(benchmark::internal::Benchmark* b) {
+    for (int64_t num_values = 1 << 20; num_values <= 1 << 24; num_values <<= 2) {
+        for (int64_t mem_size = 1 << 20; mem_size <= 1 << 24; mem_size <<= 2) {
+            for (int64_t distribution : {RANDOM, ASCENDING, DESCENDING, FEW_DISTINCT, ZIPF}) {
+                b->Args({num_values, mem_size, distribution});
+            }
+        }
+    }
+    b->ArgNames({"values", "mem_size", "distribution"});
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK(ExternalSort)->Apply(Arguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(SortedStream)->Apply(Arguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK_MAIN();
+// ---------------------------------------------------------------------------------------------------
@@ -0,0 +1,96 @@
+// ---------------------------------------------------------------------------------------------------
+// MODERNDBS
+// ---------------------------------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+#include "moderndbs/loser_tree.h"
+#include "benchmark/benchmark.h"
+// ---------------------------------------------------------------------------------------------------
+using LoserTree = moderndbs::LoserTree<uint64_t>;
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+/// The number of values of all runs together.
+constexpr size_t NUM_VALUES = 1 << 22;
+// ---------------------------------------------------------------------------------------------------
+/// Splits NUM_VALUES random values into `num_runs` sorted runs.
+std::vector<std::vector<uint64_t>> make_runs(size_t num_runs) {
+    std::mt19937_64 engine{0};
+    std::uniform_int_distribution<uint64_t> distr;
+    std::vector<std::vector<uint64_t>> runs(num_runs);
+    for (auto& run : runs) {
+        run.resize(NUM_VALUES / num_runs);
+        for (auto& value : run) {
+            value = distr(engine);
+        }
+        std::sort(run.begin(), run.end());
+    }
+    return runs;
+}
+// ---------------------------------------------------------------------------------------------------
+/// The merge of the external sort before the loser tree: a std::priority_queue of (value, run) pairs.
+void KWayMerge_PriorityQueue(benchmark::State& state) {
+    const auto runs = make_runs(state.range(0));
+    std::vector<uint64_t> output(NUM_VALUES);
+    using PQ_Element = std::pair<uint64_t, size_t>;
+
+    for (auto _ : state) {
+        std::vector<size_t> positions(runs.size(), 1);
+        std::priority_queue<PQ_Element, std::vector<PQ_Element>, std::greater<PQ_Element>> pq;  // NOLINT
+        for (size_t i = 0; i < runs.size(); ++i) {
+            pq.emplace(runs[i][0], i);
+        }
+        size_t out = 0;
+        while (!pq.empty()) {
+            const auto [value, run] = pq.top();
+            pq.pop();
+            output[out++] = value;
+            if (positions[run] < runs[run].size()) {
+                pq.emplace(runs[run][positions[run]++], run);
+            }
+        }
+        benchmark::DoNotOptimize(output.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * runs.size() * runs[0].size());
+}
+// ---------------------------------------------------------------------------------------------------
+void KWayMerge_LoserTree(benchmark::State& state) {
+    const auto runs = make_runs(state.range(0));
+    std::vector<uint64_t> output(NUM_VALUES);
+
+    for (auto _ : state) {
+        std::vector<size_t> positions(runs.size(), 1);
+        LoserTree tree(runs.size());
+        for (size_t i = 0; i < runs.size(); ++i) {
+            tree.set(i, runs[i][0]);
+        }
+        tree.build();
+        size_t out = 0;
+        while (!tree.empty()) {
+            output[out++] = tree.top();
+            const size_t run = tree.top_source();
+            if (positions[run] < runs[run].size()) {
+                tree.replace_top(runs[run][positions[run]++]);
+            } else {
+                tree.pop_top();
+            }
+        }
+        benchmark::DoNotOptimize(output.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * runs.size() * runs[0].size());
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK(KWayMerge_PriorityQueue)->RangeMultiplier(4)->Range(16, 1024);
+BENCHMARK(KWayMerge_LoserTree)->RangeMultiplier(4)->Range(16, 1024);
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK_MAIN();
+// ---------------------------------------------------------------------------------------------------
@@ -0,0 +1,88 @@
+// ---------------------------------------------------------------------------------------------------
+// MODERNDBS
+// ---------------------------------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "moderndbs/radix_sort.h"
+#include "benchmark/benchmark.h"
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+/// Distributions of the values of a run.
+enum Distribution : int64_t {
+    RANDOM,
+    ASCENDING,
+    DESCENDING,
+    FEW_DISTINCT
+};
+// ---------------------------------------------------------------------------------------------------
+/// Generates `num_values` values of the given distribution.
+std::vector<uint64_t> make_values(size_t num_values, int64_t distribution) {
+    std::mt19937_64 engine{0};
+    std::uniform_int_distribution<uint64_t> distr;
+    std::vector<uint64_t> values(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        switch (distribution) {
+            case ASCENDING: values[i] = i; break;
+            case DESCENDING: values[i] = num_values - i; break;
+            case FEW_DISTINCT: values[i] = distr(engine) % 16; break;
+            default: values[i] = distr(engine); break;
+        }
+    }
+    return values;
+}
+// ---------------------------------------------------------------------------------------------------
+/// Run sort kernel of the external sort before the radix sort.
+void RunSort_StdSort(benchmark::State& state) {
+    const auto input = make_values(state.range(0), state.range(1));
+    std::vector<uint64_t> values(input.size());
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        values = input;
+        state.ResumeTiming();
+        std::sort(values.begin(), values.end());
+        benchmark::DoNotOptimize(values.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * input.size());
+}
+// ---------------------------------------------------------------------------------------------------
+template <unsigned DIGIT_BITS>
+void RunSort_Radix(benchmark::State& state) {
+    const auto input = make_values(state.range(0), state.range(1));
+    std::vector<uint64_t> values(input.size());
+    std::vector<uint64_t> scratch(input.size());
+    std::vector<size_t> histograms(moderndbs::radix_histograms_size(DIGIT_BITS) / sizeof(size_t));
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        values = input;
+        state.ResumeTiming();
+        auto* sorted = moderndbs::radix_sort(values.data(), scratch.data(), histograms.data(), values.size(), DIGIT_BITS);
+        benchmark::DoNotOptimize(sorted);
+    }
+
+    state.SetItemsProcessed(state.iterations() * input.size());
+}
+// ---------------------------------------------------------------------------------------------------
+/// Run sizes from 32 KiB to 32 MiB of values, each with all distributions.
+void Arguments(benchmark::internal::Benchmark* b) {
+    for (int64_t num_values = 1 << 12; num_values <= 1 << 22; num_values <<= 5) {
+        for (int64_t distribution : {RANDOM, ASCENDING, DESCENDING, FEW_DISTINCT}) {
+            b->Args({num_values, distribution});
+        }
+    }
+    b->ArgNames({"values", "distribution"});
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK(RunSort_StdSort)->Apply(Arguments);
+BENCHMARK_TEMPLATE(RunSort_Radix, 8)->Apply(Arguments);
+BENCHMARK_TEMPLATE(RunSort_Radix, 11)->Apply(Arguments);
+// ---------------------------------------------------------------------------------------------------
+BENCHMARK_MAIN();
+// ---------------------------------------------------------------------------------------------------
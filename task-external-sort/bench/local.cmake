@@ -0,0 +1,12 @@
+# ---------------------------------------------------------------------------
+# MODERNDBS
+# ---------------------------------------------------------------------------
+
+add_executable(bm_loser_tree bench/bm_loser_tree.cc)
+target_link_libraries(bm_loser_tree moderndbs benchmark Threads::Threads)
+
+add_executable(bm_radix_sort bench/bm_radix_sort.cc)
+target_link_libraries(bm_radix_sort moderndbs benchmark Threads::Threads)
+
+add_executable(bm_external_sort bench/bm_external_sort.cc)
+target_link_libraries(bm_external_sort moderndbs benchmark Threads::Threads)
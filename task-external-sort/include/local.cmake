@@ -8,6 +8,14 @@
 
 set(
     INCLUDE_H
+    include/moderndbs/async_file.h
     include/moderndbs/external_sort.h
     include/moderndbs/file.h
+    include/moderndbs/loser_tree.h
+    include/moderndbs/memory_arena.h
+    include/moderndbs/merge_plan.h
+    include/moderndbs/radix_sort.h
+    include/moderndbs/record_sort.h
+    include/moderndbs/run_codec.h
+    include/moderndbs/striped_file.h
 )
@@ -0,0 +1,96 @@
+#ifndef INCLUDE_MODERNDBS_ASYNC_FILE_H
+#define INCLUDE_MODERNDBS_ASYNC_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+namespace moderndbs {
+
+class File;
+
+/// Implementation of an `AsyncFile`.
+enum class AsyncBackend {
+    /// io_uring if the kernel supports it and the file has a file descriptor,
+    /// otherwise a thread pool.
+    AUTO,
+    /// Linux io_uring, all requests of a batch are submitted with one system
+    /// call. Throws `std::system_error` if io_uring is not available.
+    IO_URING,
+    /// Worker threads that call `File::read_block()` and
+    /// `File::write_block()`. Works with every `File`.
+    THREAD_POOL
+};
+
+///
+/// Asynchronous block I/O on a `File`. Requests are submitted without waiting
+/// for them, every request gets a handle to poll or wait for its completion.
+/// Up to `queue_depth` requests are in flight at once, further submissions
+/// wait for a free slot.
+///
+/// The blocks must stay valid until their request completed, and the rules
+/// of `File::read_block()` and `File::write_block()` apply, e.g. the
+/// alignment of `File::Caching::DIRECT` files. The file must outlive the
+/// `AsyncFile`, which waits for all requests on destruction.
+/// Is not thread-safe, i.e. one thread submits and reaps.
+///
+class AsyncFile {
+public:
+    /// Completion handle of a request, handles of a batch are consecutive.
+    using Handle = uint64_t;
+
+    /// A request of a batch.
+    struct Request {
+        enum Kind { READ, WRITE };
+        Kind kind;
+        /// The offset in the file.
+        size_t offset;
+        /// The size of the block.
+        size_t size;
+        /// The block that is read into or written out.
+        char* block;
+    };
+
+    virtual ~AsyncFile() = default;
+
+    /// Returns the backend that executes the requests.
+    virtual AsyncBackend get_backend() const = 0;
+
+    /// Submits the requests in order, so that they are executed concurrently.
+    /// @return the handles of the requests.
+    virtual std::vector<Handle> submit(const std::vector<Request>& requests) = 0;
+
+    /// Submits a read of `size` bytes at `offset` into `block`.
+    Handle submit_read(size_t offset, size_t size, char* block) {
+        return submit({{Request::READ, offset, size, block}})[0];
+    }
+
+    /// Submits a write of `size` bytes of `block` at `offset`.
+    Handle submit_write(const char* block, size_t offset, size_t size) {
+        return submit({{Request::WRITE, offset, size, const_cast<char*>(block)}})[0];
+    }
+
+    /// Returns whether the request completed without blocking. A handle
+    /// must not be used any more once it completed. Rethrows the error of a
+    /// failed request as `std::system_error`.
+    virtual bool poll(Handle handle) = 0;
+
+    /// Blocks until the request completed, see `poll()`.
+    virtual void wait(Handle handle) = 0;
+
+    /// Blocks until all submitted requests completed. Their handles must not
+    /// be used any more. Throws the first error of a failed request.
+    virtual void wait_all() = 0;
+
+    /// Opens an asynchronous view on `file`.
+    /// @param[in] file        The file that is read and written.
+    /// @param[in] backend     The implementation of the requests.
+    /// @param[in] queue_depth The maximum number of requests in flight.
+    static std::unique_ptr<AsyncFile> open(File& file, AsyncBackend backend = AsyncBackend::AUTO, size_t queue_depth = 64);
+};
+
+}  // namespace moderndbs
+
+#endif
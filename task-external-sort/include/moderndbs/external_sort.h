@@ -6,12 +6,166 @@
 #include <cstddef>
 #include <cstdint>
 #include <cassert>
+#include <memory>
+#include <string>
+#include <vector>
 
 
 namespace moderndbs {
 
 class File;
 
+/// Strategy that cuts the input into sorted runs.
+enum class RunGeneration {
+    /// Read `mem_size` bytes, sort them and write them out as one run.
+    SORT,
+    /// Replacement selection with a min-heap. Produces runs of about twice
+    /// `mem_size` on random input and a single run on presorted input. Always
+    /// single-threaded.
+    REPLACEMENT_SELECTION
+};
+
+/// Kernel that sorts the values of a run in memory.
+enum class RunSort {
+    /// `std::sort()` in place.
+    STD_SORT,
+    /// LSD radix sort with 8 bit digits.
+    RADIX_SORT_8,
+    /// LSD radix sort with 11 bit digits.
+    RADIX_SORT_11
+};
+
+/// Aggregation of equal values in the output of `external_sort()`, e.g. for a
+/// sort-based DISTINCT or GROUP BY.
+enum class Aggregate {
+    /// Write every value.
+    NONE,
+    /// Write every distinct value once.
+    DISTINCT,
+    /// Write a (value, count) pair of 8-byte little-endian integers for every
+    /// distinct value.
+    COUNT
+};
+
+/// I/O of one phase of `external_sort()`.
+struct ExternalSortPhaseIo {
+    /// Number of block reads.
+    size_t num_reads = 0;
+    /// Number of block writes, every resize of a file counts as one.
+    size_t num_writes = 0;
+    /// Number of bytes read.
+    size_t bytes_read = 0;
+    /// Number of bytes written.
+    size_t bytes_written = 0;
+    /// Wall time the threads of the sort were blocked in block reads and
+    /// writes, summed up over the threads. The rest of the phase is CPU, or
+    /// I/O that overlaps with it on a background I/O thread.
+    double wait_seconds = 0;
+};
+
+/// Metrics of one `external_sort()` call.
+struct ExternalSortStats {
+    /// Number of block reads.
+    size_t num_reads = 0;
+    /// Number of block writes, every resize of a file counts as one.
+    size_t num_writes = 0;
+    /// Number of bytes read from the input and the tmp files.
+    size_t bytes_read = 0;
+    /// Number of bytes written to the tmp files and the output.
+    size_t bytes_written = 0;
+    /// Number of sorted runs, 1 if the input fits into `mem_size`.
+    size_t num_runs = 0;
+    /// Number of merge passes over the data, 0 if the input fits into
+    /// `mem_size`.
+    size_t num_merge_passes = 0;
+    /// Wall time of run generation in seconds, i.e. of the whole sort if the
+    /// input fits into `mem_size`.
+    double run_generation_seconds = 0;
+    /// Wall time of the merge in seconds.
+    double merge_seconds = 0;
+    /// I/O of run generation, i.e. of the whole sort if the input fits into
+    /// `mem_size`.
+    ExternalSortPhaseIo run_generation_io;
+    /// I/O of the merge.
+    ExternalSortPhaseIo merge_io;
+    /// Fan-in of the merges, 0 without a merge.
+    size_t merge_fan_in = 0;
+    /// `read_size_histogram[i]` := number of block reads of at least `2^i`
+    /// and less than `2^(i + 1)` bytes, up to the largest size read. Same for
+    /// the block writes, resizes are not counted.
+    std::vector<size_t> read_size_histogram;
+    std::vector<size_t> write_size_histogram;
+    /// Number of bytes read from and written to the tmp files in each of
+    /// `ExternalSortOptions::spill_directories`, in the same order.
+    std::vector<size_t> spill_bytes_read;
+    std::vector<size_t> spill_bytes_written;
+    /// Largest number of bytes of `mem_size` the buffers of the sort took at
+    /// once, see `MemoryArena`.
+    size_t peak_memory = 0;
+};
+
+/// Optional knobs of `external_sort()`. The defaults give the plain
+/// single-threaded external sort.
+struct ExternalSortOptions {
+    /// Number of threads that generate runs concurrently. `mem_size` is split
+    /// evenly among them, so every thread reads, sorts and writes runs of
+    /// `mem_size / num_threads` bytes on its own buffer.
+    size_t num_threads = 1;
+    /// How the input is cut into sorted runs before merging.
+    RunGeneration run_generation = RunGeneration::SORT;
+    /// How `RunGeneration::SORT` sorts a run. The radix sorts scatter into a
+    /// second buffer of the same size, so they sort runs of half the size
+    /// within the same `mem_size`.
+    RunSort run_sort = RunSort::STD_SORT;
+    /// Double-buffer the merge. Every run buffer and the output buffer are
+    /// split into two halves, and a background I/O thread reads the next part
+    /// of a run into one half and writes out the full output half while the
+    /// merge works on the other halves.
+    bool prefetch = false;
+    /// Number of threads of every merge. The runs of a merge are cut into
+    /// `num_merge_threads` key ranges at splitters sampled from all runs, and
+    /// every thread merges one range directly into its part of the output.
+    /// Every thread gets `mem_size / num_merge_threads` bytes, which lowers the
+    /// fan-in accordingly.
+    size_t num_merge_threads = 1;
+    /// Write the runs in the tmp files with `run_codec`, i.e. as blocks of
+    /// bit-packed differences to a frame of reference, which are decoded
+    /// value by value during the merge. Ignored with `num_merge_threads` > 1,
+    /// as the key ranges of a parallel merge need random access into the runs.
+    bool encode_runs = false;
+    /// Read the input once for its natural runs, i.e. maximal ascending and
+    /// descending sequences, before generating runs. Sorted and reverse sorted
+    /// input is written straight to the output, and a few natural runs that
+    /// fit into a single merge are merged without generating runs. Detection
+    /// gives up as soon as it found more natural runs than one per `mem_size`
+    /// bytes of input, or than a single merge can take. Random input gives up
+    /// within the first `mem_size` bytes, but input whose natural runs are
+    /// just shorter than `mem_size` is read almost completely before, i.e. the
+    /// worst case is one wasted read of the input.
+    bool detect_presorted = false;
+    /// Collapse equal values while merging, the output is cut to the size of
+    /// the aggregated values. Every sorted run is collapsed as well before it
+    /// is written to the tmp file. Aggregation generates runs with
+    /// `RunGeneration::SORT`, and ignores `num_merge_threads`, `encode_runs`
+    /// and `detect_presorted`.
+    Aggregate aggregate = Aggregate::NONE;
+    /// Directories of the tmp files, each on a device of its own. Every tmp
+    /// file is striped round-robin across them in stripes of
+    /// `spill_stripe_size` bytes, see `StripedFile`, so the runs are spread
+    /// over all devices, and every block that spans several stripes is read
+    /// and written on their devices in parallel. Empty := a single tmp file
+    /// in the working directory.
+    std::vector<std::string> spill_directories;
+    /// Bytes of a stripe of the tmp files across `spill_directories`. A merge
+    /// reads in blocks of about `mem_size / (fan-in + 1)` bytes, so stripes
+    /// smaller than that let every read use several devices.
+    size_t spill_stripe_size = 256 * 1024;
+    /// If set, filled with the metrics of the call. The I/O counters are
+    /// shared by all sorts of the process, so concurrent sorts count the I/O
+    /// of each other.
+    ExternalSortStats* stats = nullptr;
+};
+
 /// Sorts 64 bit unsigned integers using external sort.
 /// @param[in] input      File that contains 64 bit unsigned integers which are
 ///                       stored as 8-byte little-endian values. This file may
@@ -21,8 +175,65 @@ class File;
 /// @param[in] output     File that should contain the sorted values in the
 ///                       end. This file must be in `WRITE` mode.
 /// @param[in] mem_size   The maximum amount of main-memory in bytes that
-///                       should be used for internal sorting.
-void external_sort(File& input, size_t num_values, File& output, size_t mem_size);
+///                       should be used for internal sorting. All buffers are
+///                       taken from one allocation of `mem_size` bytes, see
+///                       `MemoryArena`, and a buffer that does not fit throws
+///                       `MemoryArena::BudgetExceeded`.
+/// @param[in] options    Optional knobs, see `ExternalSortOptions`.
+void external_sort(File& input, size_t num_values, File& output, size_t mem_size,
+                   const ExternalSortOptions& options = ExternalSortOptions{});
+
+/// Sorts like `external_sort()`, but hands out the sorted values batch by
+/// batch instead of writing them into an output file. That saves the write
+/// and the re-read of the output for consumers that read it once, e.g. a
+/// merge join or an aggregation. The constructor generates the runs and
+/// executes all merges but the last one, `next()` pulls the last merge.
+/// The last merge is sequential, `num_merge_threads` only applies to the
+/// merges before it.
+class SortedStream {
+public:
+    /// Sorted 64 bit words, (value, count) pairs with `Aggregate::COUNT`.
+    struct Batch {
+        const uint64_t* values = nullptr;
+        size_t size = 0;
+
+        const uint64_t* begin() const { return values; }
+        const uint64_t* end() const { return values + size; }
+        bool empty() const { return size == 0; }
+    };
+
+    /// Generates the sorted runs. The parameters are the ones of
+    /// `external_sort()`, `mem_size` also holds the batches. The input must
+    /// outlive the stream, as runs of presorted input are merged from it.
+    SortedStream(File& input, size_t num_values, size_t mem_size,
+                 const ExternalSortOptions& options = ExternalSortOptions{});
+    ~SortedStream();
+
+    SortedStream(const SortedStream&) = delete;
+    SortedStream& operator=(const SortedStream&) = delete;
+
+    /// Returns the next batch of sorted values, which stays valid until the
+    /// next call. An empty batch marks the end.
+    Batch next();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/// Writes the `k` smallest 64 bit unsigned integers in ascending order, i.e.
+/// the first `k` values `external_sort()` would write. If `k` values fit into
+/// half of `mem_size`, the input is read once into a bounded heap. Otherwise
+/// only the `k` smallest values of every run are written out, and the merges
+/// stop after `k` values.
+/// @param[in] input      File that contains 64 bit unsigned integers, see
+///                       `external_sort()`.
+/// @param[in] num_values The number of integers in the input.
+/// @param[in] k          The number of smallest integers to write.
+/// @param[in] output     File that contains the `min(k, num_values)` smallest
+///                       values in the end. This file must be in `WRITE` mode.
+/// @param[in] mem_size   The maximum amount of main-memory in bytes.
+void external_top_k(File& input, size_t num_values, size_t k, File& output, size_t mem_size);
 }  // namespace moderndbs
 
 #endif
@@ -2,6 +2,7 @@
 #define INCLUDE_MODERNDBS_FILE_H_
 
 #include <cstdint>
+#include <cstdlib>
 #include <memory>
 
 
@@ -15,11 +16,46 @@ public:
     /// File mode (read or write)
     enum Mode { READ, WRITE };
 
+    /// How blocks get from and to the disk.
+    enum class Caching {
+        /// Through the page cache of the OS.
+        BUFFERED,
+        /// Past the page cache (`O_DIRECT`). The memory, the offset and the
+        /// size of every block must be multiples of `DIRECT_ALIGNMENT`, see
+        /// `allocate_aligned()`.
+        DIRECT
+    };
+
+    /// Alignment of the blocks of `Caching::DIRECT` files. A multiple of the
+    /// logical block size of all common devices.
+    static constexpr size_t DIRECT_ALIGNMENT = 4096;
+
+    /// Frees the memory of `allocate_aligned()`.
+    struct AlignedDelete {
+        void operator()(char* block) const {
+            std::free(block);  // NOLINT
+        }
+    };
+
+    /// Memory of `allocate_aligned()`.
+    using AlignedBlock = std::unique_ptr<char[], AlignedDelete>;
+
     virtual ~File() = default;
 
     /// Returns the `Mode` this file was opened with.
     virtual Mode get_mode() const = 0;
 
+    /// Returns the `Caching` this file was opened with.
+    virtual Caching get_caching() const {
+        return Caching::BUFFERED;
+    }
+
+    /// Returns the file descriptor of the file for system calls that are not
+    /// covered by this API (e.g. asynchronous I/O), or -1 if it has none.
+    virtual int native_handle() const {
+        return -1;
+    }
+
     /// Returns the current size of the file in bytes.
     /// Is not thread-safe w.r.t concurrent calls to `resize()`.
     virtual size_t size() const = 0;
@@ -31,7 +67,8 @@ public:
     virtual void resize(size_t new_size) = 0;
 
     /// Reads a block of the file. `offset + size` must not be larger than
-    /// `size()`.
+    /// `size()`. Throws `std::system_error` with `EINVAL` if the file uses
+    /// `Caching::DIRECT` and the block is not aligned, see `is_aligned()`.
     /// Is thread-safe w.r.t concurrent calls to `read_block()` and
     /// `write_block()`.
     /// @param[in]  offset The offset in the file from which the block should
@@ -41,7 +78,8 @@ public:
     ///                    Must be able to hold at least `size` bytes.
     virtual void read_block(size_t offset, size_t size, char* block) = 0;
 
-    /// Reads a block of the file and returns it.
+    /// Reads a block of the file and returns it. Use `allocate_aligned()`
+    /// and the other overload for `Caching::DIRECT` files.
     std::unique_ptr<char[]> read_block(size_t offset, size_t size) {
         auto block = std::make_unique<char[]>(size);
         read_block(offset, size, block.get());
@@ -50,7 +88,8 @@ public:
 
     /// Writes a block to the file. `offset + size` must not be larger than
     /// `size()`. If you want to write past the end of the file, use
-    /// `resize()` first.
+    /// `resize()` first. Throws `std::system_error` with `EINVAL` if the file
+    /// uses `Caching::DIRECT` and the block is not aligned.
     /// This function must not be used when the file was opened in `READ` mode.
     /// Is thread-safe w.r.t concurrent calls to `read_block()` and
     /// `write_block()`.
@@ -61,14 +100,62 @@ public:
     /// @param[in] size   The size of the block.
     virtual void write_block(const char* block, size_t offset, size_t size) = 0;
 
+    /// Access pattern hints for `map_range()`.
+    enum class Advice {
+        /// No hint.
+        NORMAL,
+        /// The range is read once from front to back, so pages can be read
+        /// ahead aggressively and dropped soon after.
+        SEQUENTIAL,
+        /// The range is read soon, so it should be read in right away.
+        WILLNEED
+    };
+
+    /// Returns a pointer to the bytes `[offset, offset + size)` of the file
+    /// without copying them, or `nullptr` if this file cannot be mapped.
+    /// `offset + size` must not be larger than `size()`. The pointer stays
+    /// valid as long as the file. Only files opened by `open_mapped_file()`
+    /// can be mapped.
+    /// Is thread-safe.
+    /// @param[in] offset The offset in the file at which the range starts.
+    /// @param[in] size   The size of the range.
+    /// @param[in] advice How the range will be accessed.
+    virtual const char* map_range(size_t /*offset*/, size_t /*size*/, Advice /*advice*/ = Advice::NORMAL) {
+        return nullptr;
+    }
+
     /// Opens a file with the given mode. Existing files are never overwritten.
     /// @param[in] filename Path to the file.
     /// @param[in] mode     `Mode` that should be used to open the file.
-    static std::unique_ptr<File> open_file(const char* filename, Mode mode);
+    /// @param[in] caching  `Caching` that should be used for the file.
+    static std::unique_ptr<File> open_file(const char* filename, Mode mode, Caching caching = Caching::BUFFERED);
 
     /// Opens a temporary file in `WRITE` mode. The file will be deleted
     /// automatically after use.
-    static std::unique_ptr<File> make_temporary_file();
+    /// @param[in] caching `Caching` that should be used for the file.
+    static std::unique_ptr<File> make_temporary_file(Caching caching = Caching::BUFFERED);
+
+    /// Opens a temporary file in `WRITE` mode in `directory` instead of the
+    /// working directory, e.g. to put it on another device.
+    /// @param[in] directory Path to an existing directory.
+    /// @param[in] caching   `Caching` that should be used for the file.
+    static std::unique_ptr<File> make_temporary_file(const char* directory, Caching caching = Caching::BUFFERED);
+
+    /// Allocates `size` bytes aligned to `DIRECT_ALIGNMENT`, with `size`
+    /// rounded up to a multiple of it. Throws `std::bad_alloc` on failure.
+    static AlignedBlock allocate_aligned(size_t size);
+
+    /// Returns whether a block can be read or written with `Caching::DIRECT`.
+    static bool is_aligned(const void* block, size_t offset, size_t size) {
+        return reinterpret_cast<uintptr_t>(block) % DIRECT_ALIGNMENT == 0 &&
+            offset % DIRECT_ALIGNMENT == 0 && size % DIRECT_ALIGNMENT == 0;
+    }
+
+    /// Opens a file in `READ` mode that is memory mapped as a whole, so
+    /// `map_range()` returns pointers into it, and `read_block()` copies from
+    /// the mapping without a system call.
+    /// @param[in] filename Path to the file.
+    static std::unique_ptr<File> open_mapped_file(const char* filename);
 };
 
 }  // namespace moderndbs
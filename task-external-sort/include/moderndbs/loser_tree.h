@@ -0,0 +1,151 @@
+#ifndef INCLUDE_MODERNDBS_LOSER_TREE_H
+#define INCLUDE_MODERNDBS_LOSER_TREE_H
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+
+namespace moderndbs {
+
+///
+/// Tournament tree of losers for k-way merging.
+///
+/// Every inner node stores the key and source of the loser of the match
+/// played there, node 0 stores the overall winner. Replacing the winner only
+/// replays the matches on the path from its leaf to the root, i.e. exactly
+/// log k comparisons per output value, whereas a binary heap needs about
+/// 2 log k. The nodes are one contiguous array of (key, source) pairs, so a
+/// replay does not chase pointers into the input buffers.
+///
+template <typename Key, typename Compare = std::less<Key>>
+class LoserTree {
+private:
+    struct Node {
+        /// Current key of the source.
+        Key key;
+        /// Index of the source.
+        size_t source;
+        /// Is the source exhausted. Exhausted sources lose every match.
+        bool exhausted;
+    };
+
+    /// Number of leaves, i.e. the number of sources rounded up to a power of two.
+    size_t num_leaves;
+
+    /// Number of sources that are not exhausted.
+    size_t num_active;
+
+    /// nodes[0] is the winner, nodes[1, num_leaves) are the losers of the inner matches.
+    std::vector<Node> nodes;
+
+    /// The keys of the leaves, only used until `build()`.
+    std::vector<Node> leaves;
+
+    Compare compare;
+
+    /// Does `a` win the match against `b`.
+    bool wins(const Node& a, const Node& b) const {
+        if (a.exhausted) {
+            return false;
+        }
+        if (b.exhausted) {
+            return true;
+        }
+        return compare(a.key, b.key);
+    }
+
+    /// Replays the matches from the leaf of `winner` up to the root.
+    void replay(Node winner) {
+        for (size_t node = (num_leaves + winner.source) / 2; node > 0; node /= 2) {
+            if (wins(nodes[node], winner)) {
+                std::swap(nodes[node], winner);
+            }
+        }
+        nodes[0] = std::move(winner);
+    }
+
+public:
+    /// Constructor. All sources start exhausted, use `set()` to give them a
+    /// first key and `build()` before merging.
+    /// @param[in] num_sources Number of sources that are merged.
+    explicit LoserTree(size_t num_sources, Compare compare = Compare())
+        : num_leaves(1), num_active(0), compare(std::move(compare)) {
+        while (num_leaves < num_sources) {
+            num_leaves *= 2;
+        }
+        leaves.resize(num_leaves);
+        for (size_t i = 0; i < num_leaves; ++i) {
+            leaves[i] = Node{Key(), i, true};
+        }
+    }
+
+    /// Sets the first key of a source. Must be called before `build()`.
+    void set(size_t source, Key key) {
+        assert(source < leaves.size() && nodes.empty());
+        if (leaves[source].exhausted) {
+            ++num_active;
+        }
+        leaves[source] = Node{std::move(key), source, false};
+    }
+
+    /// Plays the initial tournament.
+    void build() {
+        /// winners[n] := the winner of the subtree of node n
+        std::vector<Node> winners(2 * num_leaves);
+        for (size_t i = 0; i < num_leaves; ++i) {
+            winners[num_leaves + i] = std::move(leaves[i]);
+        }
+        leaves.clear();
+        leaves.shrink_to_fit();
+        nodes.resize(num_leaves);
+        for (size_t node = num_leaves - 1; node > 0; --node) {
+            auto& left = winners[2 * node];
+            auto& right = winners[2 * node + 1];
+            if (wins(right, left)) {
+                nodes[node] = std::move(left);
+                winners[node] = std::move(right);
+            } else {
+                nodes[node] = std::move(right);
+                winners[node] = std::move(left);
+            }
+        }
+        nodes[0] = std::move(winners[1]);
+    }
+
+    /// Are all sources exhausted.
+    bool empty() const {
+        return num_active == 0;
+    }
+
+    /// Returns the smallest key of all sources. Must not be `empty()`.
+    const Key& top() const {
+        assert(!empty());
+        return nodes[0].key;
+    }
+
+    /// Returns the source of `top()`.
+    size_t top_source() const {
+        assert(!empty());
+        return nodes[0].source;
+    }
+
+    /// Replaces `top()` by the next key of its source.
+    void replace_top(Key key) {
+        assert(!empty());
+        replay(Node{std::move(key), nodes[0].source, false});
+    }
+
+    /// Removes `top()` because its source is exhausted.
+    void pop_top() {
+        assert(!empty());
+        --num_active;
+        replay(Node{Key(), nodes[0].source, true});
+    }
+};
+
+}  // namespace moderndbs
+
+#endif
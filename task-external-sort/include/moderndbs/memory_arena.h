@@ -0,0 +1,92 @@
+#ifndef INCLUDE_MODERNDBS_MEMORY_ARENA_H
+#define INCLUDE_MODERNDBS_MEMORY_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+
+namespace moderndbs {
+
+///
+/// A memory budget of `capacity` bytes, allocated once up front, that hands
+/// out the buffers of a sort. Every buffer is a block of the one allocation,
+/// so the buffers never take more than the budget, and an allocation that
+/// does not fit into the free rest throws `BudgetExceeded` instead of taking
+/// memory from the OS. The memory is not touched before it is used, so pages
+/// of the budget that are never used are not resident either.
+///
+/// Blocks can be given back in any order, a block is placed into the first
+/// gap that is large enough. Is thread-safe, e.g. for the buffers of
+/// concurrent merges.
+///
+class MemoryArena {
+public:
+    /// Thrown by `allocate()` if the block does not fit into the budget.
+    class BudgetExceeded : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    /// Gives a block of `allocate()` back to its arena.
+    struct Release {
+        MemoryArena* arena = nullptr;
+
+        void operator()(char* block) const {
+            arena->release(block);
+        }
+    };
+
+    /// A block of `allocate()`, the arena must outlive it.
+    using Buffer = std::unique_ptr<char[], Release>;
+
+    /// Alignment of every block, and the unit its size is rounded up to.
+    static constexpr size_t ALIGNMENT = alignof(uint64_t);
+
+    /// Constructor.
+    /// @param[in] capacity The budget in bytes.
+    explicit MemoryArena(size_t capacity);
+    /// Destructor. All blocks must have been given back.
+    ~MemoryArena();
+
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    /// Hands out a block of `size` bytes. Throws `BudgetExceeded` if there is
+    /// no gap of `size` bytes left.
+    Buffer allocate(size_t size);
+
+    /// Returns the size of the largest block `allocate()` can hand out now.
+    size_t available() const;
+
+    /// Returns the budget in bytes.
+    size_t capacity() const {
+        return CAPACITY;
+    }
+
+    /// Returns the bytes of all blocks that are handed out.
+    size_t used() const;
+
+    /// Returns the largest `used()` so far.
+    size_t peak() const;
+
+private:
+    void release(char* block);
+
+    const size_t CAPACITY;
+    /// The budget, not initialized.
+    std::unique_ptr<char[]> memory;
+
+    mutable std::mutex mutex;
+    /// Offset -> size of the blocks that are handed out.
+    std::map<size_t, size_t> blocks;
+    size_t used_size = 0;
+    size_t peak_size = 0;
+};
+
+}  // namespace moderndbs
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef INCLUDE_MODERNDBS_MERGE_PLAN_H
+#define INCLUDE_MODERNDBS_MERGE_PLAN_H
+
+#include <cstddef>
+#include <vector>
+
+
+namespace moderndbs {
+
+/// One k-way merge of a `MergePlan`.
+struct MergeStep {
+    /// The merged runs. Ids below the number of generated runs refer to them,
+    /// the id `num_runs + i` refers to the output of step i.
+    std::vector<size_t> inputs;
+    /// Size of the merged run, in the unit of the run sizes.
+    size_t size;
+};
+
+/// Order of the k-way merges that merge the generated runs into the output.
+struct MergePlan {
+    /// Fan-in of every merge, except for the first one which may merge fewer
+    /// runs.
+    size_t fan_in;
+    /// The merges in execution order. The last merge writes into the output,
+    /// the others into tmp files.
+    std::vector<MergeStep> steps;
+    /// Maximum number of merges a value passes through.
+    size_t num_passes;
+    /// Size written by all merges, each of it is read once as well.
+    size_t size_to_move;
+};
+
+/// Plans the merge of sorted runs with the largest fan-in the memory allows.
+/// As long as the runs do not fit into one merge, the smallest runs are merged
+/// first (Huffman-style), so large runs are read and written as few times as
+/// possible. The first merge only takes as many runs as needed to make all
+/// later merges full.
+/// @param[in] run_sizes  The size of every run, e.g. in bytes or values.
+/// @param[in] max_fan_in The largest number of runs a merge can take, at
+///                       least 2.
+MergePlan plan_merge(const std::vector<size_t>& run_sizes, size_t max_fan_in);
+
+}  // namespace moderndbs
+
+#endif
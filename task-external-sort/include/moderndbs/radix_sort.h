@@ -0,0 +1,32 @@
+#ifndef INCLUDE_MODERNDBS_RADIX_SORT_H
+#define INCLUDE_MODERNDBS_RADIX_SORT_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace moderndbs {
+
+/// Sorts 64 bit unsigned integers with a least-significant-digit radix sort.
+/// Every pass scatters the values by one digit of `digit_bits` bits from one
+/// array into the other, so the sorted values end up in either `values` or
+/// `scratch`. The histograms of all digits are built in a single read of the
+/// input, and passes over digits that are equal for all values are skipped.
+/// @param[in] values     The values to sort.
+/// @param[in] scratch    Memory for at least `num_values` values.
+/// @param[in] histograms Memory of `radix_histograms_size(digit_bits)` bytes
+///                       for the histograms, owned by the caller.
+/// @param[in] num_values The number of values.
+/// @param[in] digit_bits Bits per digit, 8 (8 passes) or 11 (6 passes).
+/// @return `values` or `scratch`, whichever holds the sorted values.
+uint64_t* radix_sort(uint64_t* values, uint64_t* scratch, size_t* histograms, size_t num_values, unsigned digit_bits);
+
+/// Returns the bytes of the histograms `radix_sort()` needs with `digit_bits`
+/// bits per digit: 16 KiB with 8 bits, 96 KiB with 11 bits.
+constexpr size_t radix_histograms_size(unsigned digit_bits) {
+    return (64 + digit_bits - 1) / digit_bits * (size_t{1} << digit_bits) * sizeof(size_t);
+}
+
+}  // namespace moderndbs
+
+#endif
@@ -0,0 +1,579 @@
+#ifndef INCLUDE_MODERNDBS_RECORD_SORT_H
+#define INCLUDE_MODERNDBS_RECORD_SORT_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "moderndbs/file.h"
+#include "moderndbs/loser_tree.h"
+#include "moderndbs/memory_arena.h"
+#include "moderndbs/merge_plan.h"
+
+
+namespace moderndbs {
+
+namespace detail {
+
+/// Number of block reads and writes of one sort.
+struct IoCounters {
+    size_t reads = 0;
+    size_t writes = 0;
+};
+
+inline void read_block(File& file, size_t offset, size_t size, char* block, IoCounters& io) {
+    file.read_block(offset, size, block);
+    io.reads++;
+}
+
+inline void write_block(File& file, const char* block, size_t offset, size_t size, IoCounters& io) {
+    file.write_block(block, offset, size);
+    io.writes++;
+}
+
+inline void print_io(const IoCounters& io) {
+    std::cout << "NUM_IO_READS: " << io.reads << ", NUM_IO_WRITES: " << io.writes
+              << ", NUM_IO: " << io.reads + io.writes << std::endl;
+}
+
+/// A sorted run of records in a tmp file.
+struct RecordRun {
+    /// The tmp file that contains this run.
+    File* file;
+    /// Byte-offset of the first record of this run in the tmp file.
+    size_t offset;
+    /// Size of this run in bytes.
+    size_t size;
+};
+
+/// Size of the length that prefixes every variable-length record in a run.
+constexpr size_t RECORD_HEADER_SIZE = sizeof(uint32_t);
+
+/// Executes a `MergePlan` over runs with sizes in bytes. `merge(inputs, run_file)` merges the inputs into the tmp file
+/// `run_file`, or into the output of the sort if `run_file` is nullptr, which is the case for the last merge.
+template <typename Merge>
+void execute_record_merge_plan(const MergePlan& plan, const std::vector<RecordRun>& runs, IoCounters& io, Merge&& merge) {
+    /// runs of all ids, the generated ones followed by the merged ones
+    std::vector<RecordRun> all_runs(runs);
+    std::vector<std::unique_ptr<File>> merged_files;
+    for (const auto& step : plan.steps) {
+        std::vector<RecordRun> inputs;
+        inputs.reserve(step.inputs.size());
+        for (auto id : step.inputs) {
+            inputs.push_back(all_runs[id]);
+        }
+        if (&step == &plan.steps.back()) {
+            merge(inputs, nullptr);
+            break;
+        }
+        auto merged_file = File::make_temporary_file();
+        merged_file->resize(step.size);
+        io.writes++;
+        merge(inputs, merged_file.get());
+        all_runs.push_back({merged_file.get(), 0, step.size});
+        merged_files.push_back(std::move(merged_file));
+        /// drop the tmp files of merged runs that were merged again
+        for (auto id : step.inputs) {
+            if (id >= runs.size()) {
+                merged_files[id - runs.size()].reset();
+            }
+        }
+    }
+}
+
+/// K-way merge of runs of fixed-size records with a loser tree over their keys. mem_size is divided into (FAN_IN + 1)
+/// buffers of whole records, one for every run and one for the output, taken from `arena`.
+template <typename Record, typename KeyExtractor, typename Compare>
+void merge_record_runs(const std::vector<RecordRun>& runs, File& output, size_t mem_size, MemoryArena& arena,
+                       KeyExtractor& key_extractor, const Compare& compare, IoCounters& io) {
+    using Key = std::decay_t<std::invoke_result_t<KeyExtractor&, const Record&>>;
+    constexpr size_t RECORD_SIZE = sizeof(Record);
+    /// 1. Init merge phase
+    const size_t FAN_IN = runs.size();
+    const size_t RECORDS_PER_BUFFER = mem_size / RECORD_SIZE / (FAN_IN + 1);
+    const size_t BUFFER_SIZE = RECORDS_PER_BUFFER * RECORD_SIZE;
+    assert(RECORDS_PER_BUFFER > 0);
+    assert(BUFFER_SIZE * (FAN_IN + 1) <= mem_size);
+    auto memory = arena.allocate(BUFFER_SIZE * (FAN_IN + 1));
+    auto* output_buffer = reinterpret_cast<Record*>(memory.get() + FAN_IN * BUFFER_SIZE);
+    /// next record and end of the loaded part of every run
+    std::vector<const Record*> positions(FAN_IN, nullptr);
+    std::vector<const Record*> ends(FAN_IN, nullptr);
+    std::vector<size_t> next_read_offset(FAN_IN, 0);
+
+    /// Loads the next part of a run into its buffer, returns false if the run is exhausted.
+    auto load_next_part = [&](size_t run) {
+        const size_t load_size = std::min(BUFFER_SIZE, runs[run].size - next_read_offset[run]);
+        if (load_size == 0) {
+            return false;
+        }
+        char* buffer = memory.get() + run * BUFFER_SIZE;
+        read_block(*runs[run].file, runs[run].offset + next_read_offset[run], load_size, buffer, io);
+        next_read_offset[run] += load_size;
+        positions[run] = reinterpret_cast<const Record*>(buffer);
+        ends[run] = positions[run] + load_size / RECORD_SIZE;
+        return true;
+    };
+
+    /// 2. Init the loser tree with the key of the first record of every run
+    LoserTree<Key, Compare> tree(FAN_IN, compare);
+    for (size_t i = 0; i < FAN_IN; i++) {
+        if (load_next_part(i)) {
+            tree.set(i, key_extractor(*positions[i]));
+        }
+    }
+    tree.build();
+
+    /// 3. Move the record of the winning key into the output buffer, replace the key by the next one of its run
+    size_t num_output_records = 0;
+    size_t output_offset = 0;
+    while (!tree.empty()) {
+        const size_t run = tree.top_source();
+        output_buffer[num_output_records++] = *positions[run]++;
+        if (num_output_records == RECORDS_PER_BUFFER) {
+            write_block(output, reinterpret_cast<const char*>(output_buffer), output_offset, BUFFER_SIZE, io);
+            output_offset += BUFFER_SIZE;
+            num_output_records = 0;
+        }
+        if (positions[run] == ends[run] && !load_next_part(run)) {
+            tree.pop_top();
+            continue;
+        }
+        tree.replace_top(key_extractor(*positions[run]));
+    }
+    if (num_output_records > 0) {
+        write_block(output, reinterpret_cast<const char*>(output_buffer), output_offset, num_output_records * RECORD_SIZE, io);
+    }
+}
+
+/// Buffered sequential writer of variable-length records. Runs store every record prefixed by its length, the output
+/// of the sort stores the plain records in a data file and their offsets in an offset file.
+class VariableRecordWriter {
+private:
+    File& data;
+    /// The offset file, nullptr for runs.
+    File* offsets;
+    IoCounters& io;
+    /// Buffer of the data file.
+    char* data_buffer;
+    size_t data_buffer_size;
+    size_t data_buffer_used = 0;
+    /// Byte-offset in the data file where the buffer goes.
+    size_t data_file_offset;
+    /// Buffer of the offset file.
+    uint64_t* offset_buffer = nullptr;
+    size_t offset_buffer_size = 0;
+    size_t offset_buffer_used = 0;
+    /// Byte-offset in the offset file where the buffer goes.
+    size_t offset_file_offset = 0;
+    /// Number of data bytes written so far, i.e. the offset of the next record in the output.
+    size_t num_data_bytes = 0;
+
+    void put_data(const char* bytes, size_t size) {
+        while (size > 0) {
+            const size_t part = std::min(size, data_buffer_size - data_buffer_used);
+            std::memcpy(data_buffer + data_buffer_used, bytes, part);
+            data_buffer_used += part;
+            bytes += part;
+            size -= part;
+            if (data_buffer_used == data_buffer_size) {
+                flush_data();
+            }
+        }
+    }
+
+    void put_offset(uint64_t offset) {
+        offset_buffer[offset_buffer_used++] = offset;
+        if (offset_buffer_used == offset_buffer_size) {
+            write_block(*offsets, reinterpret_cast<const char*>(offset_buffer), offset_file_offset, offset_buffer_used * sizeof(uint64_t), io);
+            offset_file_offset += offset_buffer_used * sizeof(uint64_t);
+            offset_buffer_used = 0;
+        }
+    }
+
+    void flush_data() {
+        if (data_buffer_used > 0) {
+            write_block(data, data_buffer, data_file_offset, data_buffer_used, io);
+            data_file_offset += data_buffer_used;
+            data_buffer_used = 0;
+        }
+    }
+
+public:
+    /// Writes length-prefixed records into a run starting at `run_offset` of `run_file`.
+    VariableRecordWriter(File& run_file, size_t run_offset, char* buffer, size_t buffer_size, IoCounters& io)
+    : data(run_file), offsets(nullptr), io(io), data_buffer(buffer), data_buffer_size(buffer_size), data_file_offset(run_offset) {
+        assert(buffer_size > 0);
+    }
+
+    /// Writes records into the output `data` and their offsets into `offsets`, the buffer is shared by both.
+    VariableRecordWriter(File& data, File& offsets, char* buffer, size_t buffer_size, IoCounters& io)
+    : data(data), offsets(&offsets), io(io), data_file_offset(0) {
+        offset_buffer_size = std::max<size_t>(1, buffer_size / 2 / sizeof(uint64_t));
+        offset_buffer = reinterpret_cast<uint64_t*>(buffer);
+        data_buffer = buffer + offset_buffer_size * sizeof(uint64_t);
+        data_buffer_size = buffer_size - offset_buffer_size * sizeof(uint64_t);
+        assert(buffer_size % sizeof(uint64_t) == 0);
+        assert(data_buffer_size > 0);
+    }
+
+    void append(std::string_view record) {
+        if (offsets) {
+            put_offset(num_data_bytes);
+        } else {
+            const auto length = static_cast<uint32_t>(record.size());
+            put_data(reinterpret_cast<const char*>(&length), RECORD_HEADER_SIZE);
+        }
+        put_data(record.data(), record.size());
+        num_data_bytes += record.size();
+    }
+
+    /// Writes out the buffers. The output gets the end offset of the last record as well.
+    void finish() {
+        flush_data();
+        if (offsets) {
+            put_offset(num_data_bytes);
+            if (offset_buffer_used > 0) {
+                write_block(*offsets, reinterpret_cast<const char*>(offset_buffer), offset_file_offset, offset_buffer_used * sizeof(uint64_t), io);
+            }
+        }
+    }
+};
+
+/// K-way merge of runs of length-prefixed records with a loser tree over their keys. mem_size is divided into
+/// (FAN_IN + 1) buffers of `buffer_size` bytes, which must hold the largest record with its length.
+template <typename KeyExtractor, typename Compare>
+void merge_variable_record_runs(const std::vector<RecordRun>& runs, VariableRecordWriter& writer, char* memory,
+                                size_t buffer_size, KeyExtractor& key_extractor, const Compare& compare, IoCounters& io) {
+    using Key = std::decay_t<std::invoke_result_t<KeyExtractor&, std::string_view>>;
+    const size_t FAN_IN = runs.size();
+    /// [begin, end) is the loaded, unmerged part of every buffer, next_read_offset is the next part of every run
+    std::vector<size_t> begins(FAN_IN, 0);
+    std::vector<size_t> ends(FAN_IN, 0);
+    std::vector<size_t> next_read_offset(FAN_IN, 0);
+    std::vector<std::string_view> records(FAN_IN);
+
+    /// Moves the unmerged bytes of a buffer to its front and fills up the rest with the next part of the run.
+    auto refill = [&](size_t run) {
+        char* buffer = memory + run * buffer_size;
+        std::memmove(buffer, buffer + begins[run], ends[run] - begins[run]);
+        ends[run] -= begins[run];
+        begins[run] = 0;
+        const size_t load_size = std::min(buffer_size - ends[run], runs[run].size - next_read_offset[run]);
+        if (load_size > 0) {
+            read_block(*runs[run].file, runs[run].offset + next_read_offset[run], load_size, buffer + ends[run], io);
+            next_read_offset[run] += load_size;
+            ends[run] += load_size;
+        }
+    };
+    /// Makes the next record of a run contiguous in its buffer, returns false if the run is exhausted.
+    auto next_record = [&](size_t run) {
+        if (ends[run] - begins[run] < RECORD_HEADER_SIZE) {
+            refill(run);
+            if (ends[run] == begins[run]) {
+                return false;
+            }
+        }
+        uint32_t length;
+        std::memcpy(&length, memory + run * buffer_size + begins[run], RECORD_HEADER_SIZE);
+        if (ends[run] - begins[run] < RECORD_HEADER_SIZE + length) {
+            refill(run);
+        }
+        assert(ends[run] - begins[run] >= RECORD_HEADER_SIZE + length);
+        records[run] = std::string_view(memory + run * buffer_size + begins[run] + RECORD_HEADER_SIZE, length);
+        begins[run] += RECORD_HEADER_SIZE + length;
+        return true;
+    };
+
+    LoserTree<Key, Compare> tree(FAN_IN, compare);
+    for (size_t i = 0; i < FAN_IN; i++) {
+        if (next_record(i)) {
+            tree.set(i, key_extractor(records[i]));
+        }
+    }
+    tree.build();
+    /// the record of the winner stays valid until the next record of its run is loaded
+    while (!tree.empty()) {
+        const size_t run = tree.top_source();
+        writer.append(records[run]);
+        if (!next_record(run)) {
+            tree.pop_top();
+            continue;
+        }
+        tree.replace_top(key_extractor(records[run]));
+    }
+    writer.finish();
+}
+
+/// Reads an offset file in chunks of `chunk_size` offsets.
+class OffsetReader {
+private:
+    File& offsets;
+    IoCounters& io;
+    uint64_t* chunk;
+    size_t chunk_size;
+    /// Index of the first offset in the chunk, and number of offsets in it.
+    size_t chunk_begin = 0;
+    size_t chunk_count = 0;
+
+public:
+    OffsetReader(File& offsets, uint64_t* chunk, size_t chunk_size, IoCounters& io)
+    : offsets(offsets), io(io), chunk(chunk), chunk_size(chunk_size) {}
+
+    /// Returns offset `i` of the `num_offsets` offsets, loading the chunk starting at `i` if needed.
+    uint64_t get(size_t i, size_t num_offsets) {
+        if (i < chunk_begin || i >= chunk_begin + chunk_count) {
+            chunk_begin = i;
+            chunk_count = std::min(chunk_size, num_offsets - i);
+            read_block(offsets, i * sizeof(uint64_t), chunk_count * sizeof(uint64_t), reinterpret_cast<char*>(chunk), io);
+        }
+        return chunk[i - chunk_begin];
+    }
+};
+
+}  // namespace detail
+
+/// Sorts fixed-size records using external sort. Runs of mem_size bytes are
+/// sorted with `std::sort()` and merged with a loser tree over the keys of
+/// the records, with the largest fan-in mem_size allows (see `plan_merge()`).
+/// @tparam Record        Trivially copyable record, stored as its raw bytes.
+/// @tparam KeyExtractor  Returns the sort key of a `const Record&`.
+/// @tparam Compare       Strict weak order of the keys.
+/// @param[in] input       File that contains the records. This file may be in
+///                        `READ` mode and should not be written to.
+/// @param[in] num_records The number of records that should be sorted from
+///                        the input.
+/// @param[in] output      File that should contain the sorted records in the
+///                        end. This file must be in `WRITE` mode.
+/// @param[in] mem_size    The maximum amount of main-memory in bytes that
+///                        should be used, at least 3 records.
+template <typename Record, typename KeyExtractor, typename Compare = std::less<>>
+void external_sort(File& input, size_t num_records, File& output, size_t mem_size,
+                   KeyExtractor key_extractor = KeyExtractor(), Compare compare = Compare()) {
+    static_assert(std::is_trivially_copyable_v<Record>, "records are read and written as raw bytes");
+    static_assert(alignof(Record) <= MemoryArena::ALIGNMENT, "the buffers of the arena are not aligned for the records");
+    constexpr size_t RECORD_SIZE = sizeof(Record);
+    /// 0. Init
+    assert(input.get_mode() == File::Mode::READ);
+    assert(output.get_mode() == File::Mode::WRITE);
+    const size_t INPUT_SORT_SIZE = num_records * RECORD_SIZE;
+    assert(input.size() >= INPUT_SORT_SIZE);
+    output.resize(INPUT_SORT_SIZE);
+    detail::IoCounters io;
+    /// every buffer is taken from mem_size, rounded up to whole blocks of the arena
+    MemoryArena arena{(mem_size + MemoryArena::ALIGNMENT - 1) / MemoryArena::ALIGNMENT * MemoryArena::ALIGNMENT};
+    auto less = [&](const Record& a, const Record& b) {
+        return compare(key_extractor(a), key_extractor(b));
+    };
+
+    /// 1. Edge cases: no records, or all of them fit into memory
+    if (num_records == 0) {
+        return;
+    }
+    if (INPUT_SORT_SIZE <= mem_size) {
+        auto buffer = arena.allocate(INPUT_SORT_SIZE);
+        detail::read_block(input, 0, INPUT_SORT_SIZE, buffer.get(), io);
+        auto* records = reinterpret_cast<Record*>(buffer.get());
+        std::sort(records, records + num_records, less);
+        detail::write_block(output, buffer.get(), 0, INPUT_SORT_SIZE, io);
+        detail::print_io(io);
+        return;
+    }
+    /// Min is 3 records := 2 for input, 1 for output
+    assert(mem_size / RECORD_SIZE >= 3);
+
+    /// 2. Sort runs of mem_size into a tmp file
+    const size_t RUN_SIZE = mem_size / RECORD_SIZE * RECORD_SIZE;
+    auto tmp_file = File::make_temporary_file();
+    tmp_file->resize(INPUT_SORT_SIZE);
+    io.writes++;
+    std::vector<detail::RecordRun> runs;
+    std::vector<size_t> run_sizes;
+    {
+        auto buffer = arena.allocate(RUN_SIZE);
+        auto* records = reinterpret_cast<Record*>(buffer.get());
+        for (size_t offset = 0; offset < INPUT_SORT_SIZE; offset += RUN_SIZE) {
+            const size_t this_run_size = std::min(RUN_SIZE, INPUT_SORT_SIZE - offset);
+            detail::read_block(input, offset, this_run_size, buffer.get(), io);
+            std::sort(records, records + this_run_size / RECORD_SIZE, less);
+            detail::write_block(*tmp_file, buffer.get(), offset, this_run_size, io);
+            runs.push_back({tmp_file.get(), offset, this_run_size});
+            run_sizes.push_back(this_run_size);
+        }
+    }
+
+    /// 3. Merge with the largest fan-in mem_size allows
+    const MergePlan plan = plan_merge(run_sizes, mem_size / RECORD_SIZE - 1);
+    detail::execute_record_merge_plan(plan, runs, io, [&](const std::vector<detail::RecordRun>& inputs, File* run_file) {
+        detail::merge_record_runs<Record>(inputs, run_file ? *run_file : output, mem_size, arena, key_extractor, compare, io);
+    });
+    detail::print_io(io);
+}
+
+/// Sorts variable-length records using external sort. The records are stored
+/// back to back in a data file, an offset file holds the byte-offset of every
+/// record in the data file followed by the end offset of the last record, as
+/// 8-byte little-endian values. The output has the same format, with the
+/// first record at offset 0. Runs store every record prefixed by its length.
+/// mem_size must hold at least 3 times the largest record.
+/// @tparam KeyExtractor  Returns the sort key of a record as `std::string_view`.
+///                       The key may point into the record.
+/// @tparam Compare       Strict weak order of the keys.
+/// @param[in] input          The data file of the records.
+/// @param[in] input_offsets  The offset file of the records, with
+///                           `num_records + 1` offsets.
+/// @param[in] num_records    The number of records that should be sorted.
+/// @param[in] output         Data file of the sorted records, in `WRITE` mode.
+/// @param[in] output_offsets Offset file of the sorted records, in `WRITE` mode.
+/// @param[in] mem_size       The maximum amount of main-memory in bytes that
+///                           should be used.
+/// @throws std::length_error if a record is too large for mem_size.
+template <typename KeyExtractor, typename Compare = std::less<>>
+void external_sort_variable(File& input, File& input_offsets, size_t num_records, File& output, File& output_offsets,
+                            size_t mem_size, KeyExtractor key_extractor = KeyExtractor(), Compare compare = Compare()) {
+    using detail::RECORD_HEADER_SIZE;
+    /// Position of a record in the sort buffer.
+    struct Slot {
+        size_t offset;
+        size_t size;
+    };
+    /// 0. Init
+    assert(input.get_mode() == File::Mode::READ);
+    assert(input_offsets.get_mode() == File::Mode::READ);
+    assert(output.get_mode() == File::Mode::WRITE);
+    assert(output_offsets.get_mode() == File::Mode::WRITE);
+    assert(input_offsets.size() >= (num_records + 1) * sizeof(uint64_t));
+    assert(mem_size % sizeof(uint64_t) == 0);
+    output_offsets.resize((num_records + 1) * sizeof(uint64_t));
+    detail::IoCounters io;
+
+    /// 1. Divide mem_size for the run generation
+    /**
+      *  0        INDEX_CHUNK_SIZE      + STAGING_SIZE                                    mem_size
+      *  ^                 ^                   ^                                               ^
+      *  -------------------------------------------------------------------------------------
+      *  |  offset chunk   |  output staging   |  records of a run ...           ... slots  |
+      *  -------------------------------------------------------------------------------------
+      */
+    const size_t INDEX_CHUNK_SIZE = std::max<size_t>(2, mem_size / 16 / sizeof(uint64_t)) * sizeof(uint64_t);
+    const size_t STAGING_SIZE = std::max<size_t>(2, mem_size / 4 / sizeof(uint64_t)) * sizeof(uint64_t);
+    assert(mem_size > INDEX_CHUNK_SIZE + STAGING_SIZE);
+    const size_t SORT_SIZE = mem_size - INDEX_CHUNK_SIZE - STAGING_SIZE;
+    MemoryArena arena{mem_size};
+    auto memory = arena.allocate(mem_size);
+    char* staging = memory.get() + INDEX_CHUNK_SIZE;
+    char* sort_buffer = staging + STAGING_SIZE;
+    detail::OffsetReader offsets(input_offsets, reinterpret_cast<uint64_t*>(memory.get()), INDEX_CHUNK_SIZE / sizeof(uint64_t), io);
+    const size_t DATA_SIZE = offsets.get(num_records, num_records + 1) - offsets.get(0, num_records + 1);
+    output.resize(DATA_SIZE);
+    /// the slots go behind the records, aligned
+    auto slots_begin = [](size_t data_size) {
+        return (data_size + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+    };
+
+    /// 2. Generate sorted runs, or sort everything in one go if it fits (always the case without records)
+    std::unique_ptr<File> tmp_file;
+    std::vector<detail::RecordRun> runs;
+    std::vector<size_t> run_sizes;
+    size_t tmp_file_size = 0;
+    size_t max_record_size = 0;
+    size_t next_record = 0;
+    do {
+        /// 2.1. Take as many records as fit into the sort buffer with their slots
+        const size_t first_offset = offsets.get(next_record, num_records + 1);
+        size_t end_record = next_record;
+        size_t end_offset = first_offset;
+        while (end_record < num_records) {
+            const size_t next_end_offset = offsets.get(end_record + 1, num_records + 1);
+            if (slots_begin(next_end_offset - first_offset) + (end_record - next_record + 1) * sizeof(Slot) > SORT_SIZE) {
+                break;
+            }
+            max_record_size = std::max<size_t>(max_record_size, next_end_offset - end_offset);
+            end_offset = next_end_offset;
+            end_record++;
+        }
+        if (end_record == next_record && next_record < num_records) {
+            throw std::length_error("record does not fit into mem_size");
+        }
+        /// 2.2. Read them and sort their slots by key
+        const size_t data_size = end_offset - first_offset;
+        if (data_size > 0) {
+            detail::read_block(input, first_offset, data_size, sort_buffer, io);
+        }
+        auto* slots = reinterpret_cast<Slot*>(sort_buffer + slots_begin(data_size));
+        const size_t num_slots = end_record - next_record;
+        {
+            size_t offset = 0;
+            for (size_t i = 0; i < num_slots; i++) {
+                const size_t record_end = offsets.get(next_record + i + 1, num_records + 1) - first_offset;
+                slots[i] = {offset, record_end - offset};
+                offset = record_end;
+            }
+        }
+        std::sort(slots, slots + num_slots, [&](const Slot& a, const Slot& b) {
+            return compare(key_extractor(std::string_view(sort_buffer + a.offset, a.size)),
+                           key_extractor(std::string_view(sort_buffer + b.offset, b.size)));
+        });
+        /// 2.3. Write them out, into the output if these are all records
+        const bool is_output = next_record == 0 && end_record == num_records;
+        if (is_output) {
+            detail::VariableRecordWriter writer(output, output_offsets, staging, STAGING_SIZE, io);
+            for (size_t i = 0; i < num_slots; i++) {
+                writer.append(std::string_view(sort_buffer + slots[i].offset, slots[i].size));
+            }
+            writer.finish();
+            detail::print_io(io);
+            return;
+        }
+        if (!tmp_file) {
+            tmp_file = File::make_temporary_file();
+            tmp_file->resize(DATA_SIZE + num_records * RECORD_HEADER_SIZE);
+            io.writes++;
+        }
+        detail::VariableRecordWriter writer(*tmp_file, tmp_file_size, staging, STAGING_SIZE, io);
+        for (size_t i = 0; i < num_slots; i++) {
+            writer.append(std::string_view(sort_buffer + slots[i].offset, slots[i].size));
+        }
+        writer.finish();
+        const size_t run_size = data_size + num_slots * RECORD_HEADER_SIZE;
+        runs.push_back({tmp_file.get(), tmp_file_size, run_size});
+        run_sizes.push_back(run_size);
+        tmp_file_size += run_size;
+        next_record = end_record;
+    } while (next_record < num_records);
+
+    /// 3. Merge with the largest fan-in mem_size allows, every buffer must hold the largest record with its length
+    const size_t BUFFER_SIZE = std::max<size_t>(2 * sizeof(uint64_t), (max_record_size + RECORD_HEADER_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t));
+    if (mem_size / BUFFER_SIZE < 3) {
+        throw std::length_error("record does not fit into mem_size / 3");
+    }
+    const MergePlan plan = plan_merge(run_sizes, mem_size / BUFFER_SIZE - 1);
+    detail::execute_record_merge_plan(plan, runs, io, [&](const std::vector<detail::RecordRun>& inputs, File* run_file) {
+        /// (FAN_IN + 1) equal buffers, the output buffer gets the rest
+        const size_t MERGE_BUFFER_SIZE = mem_size / (inputs.size() + 1) / sizeof(uint64_t) * sizeof(uint64_t);
+        assert(MERGE_BUFFER_SIZE >= BUFFER_SIZE);
+        char* output_buffer = memory.get() + inputs.size() * MERGE_BUFFER_SIZE;
+        const size_t OUTPUT_BUFFER_SIZE = mem_size - inputs.size() * MERGE_BUFFER_SIZE;
+        if (run_file) {
+            detail::VariableRecordWriter writer(*run_file, 0, output_buffer, OUTPUT_BUFFER_SIZE, io);
+            detail::merge_variable_record_runs(inputs, writer, memory.get(), MERGE_BUFFER_SIZE, key_extractor, compare, io);
+        } else {
+            detail::VariableRecordWriter writer(output, output_offsets, output_buffer, OUTPUT_BUFFER_SIZE, io);
+            detail::merge_variable_record_runs(inputs, writer, memory.get(), MERGE_BUFFER_SIZE, key_extractor, compare, io);
+        }
+    });
+    detail::print_io(io);
+}
+
+}  // namespace moderndbs
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef INCLUDE_MODERNDBS_RUN_CODEC_H
+#define INCLUDE_MODERNDBS_RUN_CODEC_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace moderndbs {
+
+///
+/// Codec for sorted runs of 64 bit unsigned integers.
+///
+/// An encoded run is a sequence of blocks of 64 bit words. A block starts
+/// with a header of two words, the first value of the block (the frame of
+/// reference) and `num_values << 8 | bit_width`. The differences between
+/// consecutive values follow, bit-packed with `bit_width` bits each, which
+/// is the width of the largest difference. A block of n values takes at most
+/// n + 1 words.
+///
+/// ```
+///  | first value | num_values, bit_width | d1 d2 d3 | d3 d4 d5 | d5 ... |
+/// ```
+///
+namespace run_codec {
+
+/// Number of words of the header of a block.
+constexpr size_t HEADER_WORDS = 2;
+
+/// Encodes the sorted values `words[HEADER_WORDS, HEADER_WORDS + num_values)`
+/// in place into one block starting at `words[0]`, so the caller stages the
+/// values behind `HEADER_WORDS` words of headroom.
+/// @param[in] max_words Leave the values untouched if the block would take
+///                      more words.
+/// @return the number of words of the block, 0 if it was not encoded.
+size_t encode_block(uint64_t* words, size_t num_values, size_t max_words = SIZE_MAX);
+
+/// Decodes the values of encoded blocks one by one. The words are pulled
+/// with `next_word()` when they are needed, so a block may span any number of
+/// buffer refills of the caller.
+class Decoder {
+private:
+    /// The last decoded value.
+    uint64_t value = 0;
+    /// Number of values of the current block that are not decoded yet.
+    uint64_t remaining = 0;
+    /// Bits per difference in the current block.
+    unsigned bit_width = 0;
+    /// The unconsumed bits of the current word, and their number.
+    uint64_t word = 0;
+    unsigned bits_left = 0;
+
+    static uint64_t low_bits(uint64_t bits, unsigned count) {
+        return count == 64 ? bits : bits & ((uint64_t{1} << count) - 1);
+    }
+
+public:
+    /// Decodes the next value, the first value of the next block once the
+    /// current one is exhausted.
+    template <typename NextWord>
+    uint64_t next(NextWord&& next_word) {
+        if (remaining == 0) {
+            value = next_word();
+            const uint64_t meta = next_word();
+            remaining = (meta >> 8) - 1;
+            bit_width = meta & 0xFF;
+            bits_left = 0;
+            assert((meta >> 8) > 0 && bit_width <= 64);
+            return value;
+        }
+        remaining--;
+        if (bit_width == 0) {
+            return value;
+        }
+        uint64_t delta;
+        if (bits_left >= bit_width) {
+            delta = low_bits(word, bit_width);
+            word = bit_width == 64 ? 0 : word >> bit_width;
+            bits_left -= bit_width;
+        } else {
+            /// the difference continues in the next word
+            const unsigned missing = bit_width - bits_left;
+            delta = word;
+            word = next_word();
+            delta |= low_bits(word, missing) << bits_left;
+            word = missing == 64 ? 0 : word >> missing;
+            bits_left = 64 - missing;
+        }
+        value += delta;
+        return value;
+    }
+};
+
+}  // namespace run_codec
+
+}  // namespace moderndbs
+
+#endif
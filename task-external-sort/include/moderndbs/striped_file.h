@@ -0,0 +1,66 @@
+#ifndef INCLUDE_MODERNDBS_STRIPED_FILE_H
+#define INCLUDE_MODERNDBS_STRIPED_FILE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "moderndbs/file.h"
+
+
+namespace moderndbs {
+
+///
+/// A file striped round-robin across the files of several devices, like
+/// RAID 0. Stripe `i` := the bytes `[i * stripe_size, (i + 1) * stripe_size)`
+/// is stored on device `i % num_devices`. A block that spans several devices
+/// is read and written on all of them in parallel, every device but the one
+/// of the first stripe by its own I/O thread.
+///
+class StripedFile : public File {
+public:
+    /// Bytes read from and written to one device.
+    struct DeviceCounters {
+        std::atomic<size_t> bytes_read{0};
+        std::atomic<size_t> bytes_written{0};
+    };
+
+    /// Stripes over the files, which are in `WRITE` mode and empty.
+    /// @param[in] files       One file per device.
+    /// @param[in] stripe_size Bytes of a stripe, > 0.
+    /// @param[in] counters    One counter per file, may be nullptr. The
+    ///                        counters must outlive the file.
+    StripedFile(std::vector<std::unique_ptr<File>> files, size_t stripe_size, DeviceCounters* counters = nullptr);
+    ~StripedFile() override;
+
+    StripedFile(const StripedFile&) = delete;
+    StripedFile& operator=(const StripedFile&) = delete;
+
+    Mode get_mode() const override {
+        return WRITE;
+    }
+
+    size_t size() const override;
+    void resize(size_t new_size) override;
+    void read_block(size_t offset, size_t size, char* block) override;
+    void write_block(const char* block, size_t offset, size_t size) override;
+
+    /// Returns the number of devices.
+    size_t num_devices() const;
+
+    /// Opens a temporary file in every directory, and stripes over them.
+    /// Every directory should be on a device of its own.
+    /// @param[in] directories The directories of the devices, not empty.
+    /// @param[in] stripe_size Bytes of a stripe, > 0.
+    /// @param[in] counters    One counter per directory, may be nullptr.
+    static std::unique_ptr<StripedFile> make_temporary_file(const std::vector<std::string>& directories, size_t stripe_size, DeviceCounters* counters = nullptr);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+}  // namespace moderndbs
+
+#endif
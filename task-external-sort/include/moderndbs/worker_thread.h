@@ -0,0 +1,51 @@
+#ifndef INCLUDE_MODERNDBS_WORKER_THREAD_H
+#define INCLUDE_MODERNDBS_WORKER_THREAD_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <pthread.h>
+
+
+namespace moderndbs {
+
+///
+/// A thread with a small stack for the workers of `AsyncFile` and
+/// `StripedFile`, which only block in the calls of a file. It is used like a
+/// `std::thread`, which cannot shrink the stack: the default stacks of 8 MiB
+/// count against `RLIMIT_DATA`, and stay mapped in the stack cache of glibc
+/// after the threads are joined.
+///
+class WorkerThread {
+public:
+    /// Stack size of every worker, at least `PTHREAD_STACK_MIN`.
+    static constexpr size_t STACK_SIZE = 256 * 1024;
+
+    /// Constructor, no thread.
+    WorkerThread() = default;
+    /// Constructor. Starts a thread that calls `function`. Throws
+    /// `std::system_error` if the thread cannot be created.
+    explicit WorkerThread(std::function<void()> function);
+    /// Destructor. The thread must have been joined, like with `std::thread`.
+    ~WorkerThread();
+
+    WorkerThread(WorkerThread&& other) noexcept;
+    WorkerThread& operator=(WorkerThread&& other) noexcept;
+
+    /// Returns true if there is a thread that is not joined yet.
+    bool joinable() const {
+        return function != nullptr;
+    }
+
+    /// Waits until the thread finished.
+    void join();
+
+private:
+    /// The function of the thread, on the heap so it does not move with the `WorkerThread`.
+    std::unique_ptr<std::function<void()>> function;
+    ::pthread_t thread{};
+};
+
+}  // namespace moderndbs
+
+#endif
@@ -1,11 +1,29 @@
 #include "moderndbs/external_sort.h"
 #include "moderndbs/file.h"
+#include "moderndbs/loser_tree.h"
+#include "moderndbs/memory_arena.h"
+#include "moderndbs/merge_plan.h"
+#include "moderndbs/radix_sort.h"
+#include "moderndbs/run_codec.h"
+#include "moderndbs/striped_file.h"
 
 #include <iostream>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <string>
 #include <utility>
-#include <queue>
 #include <memory>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 namespace moderndbs {
 
@@ -13,192 +31,1427 @@ namespace {
 // Helpers in anonymous namespace
 static constexpr size_t VALUE_SIZE     = sizeof(uint64_t); /// Assumption: Sort only 64 bit unsigned integers.
 static_assert(VALUE_SIZE == 8);
-static size_t NUM_IO_READS             = 0;                /// Benchmark metric.
-static size_t NUM_IO_WRITES            = 0;                /// Benchmark metric.
+static std::atomic<size_t> NUM_IO_READS{0};                /// Benchmark metric. Atomic, as runs are generated concurrently.
+static std::atomic<size_t> NUM_IO_WRITES{0};               /// Benchmark metric. Atomic, as runs are generated concurrently.
+static std::atomic<size_t> NUM_IO_BYTES_READ{0};           /// Benchmark metric := bytes of all block reads.
+static std::atomic<size_t> NUM_IO_BYTES_WRITTEN{0};        /// Benchmark metric := bytes of all block writes.
+static std::atomic<size_t> NUM_IO_WAIT_NANOS{0};           /// Benchmark metric := time threads were blocked in block I/O.
+static constexpr size_t NUM_IO_SIZE_CLASSES = 64;          /// Block sizes of [2^i, 2^(i+1)) bytes, see io_size_class().
+static std::array<std::atomic<size_t>, NUM_IO_SIZE_CLASSES> NUM_IO_READ_SIZES{};   /// Benchmark metric := reads per size class.
+static std::array<std::atomic<size_t>, NUM_IO_SIZE_CLASSES> NUM_IO_WRITE_SIZES{};  /// Benchmark metric := writes per size class.
+static std::atomic<size_t> NUM_RUN_BYTES_RAW{0};           /// Compression metric := bytes of the encoded runs without compression.
+static std::atomic<size_t> NUM_RUN_BYTES_ENCODED{0};       /// Compression metric := bytes of the encoded runs.
+/// Encode a block of runs only if it holds at least that many values, smaller blocks hardly pay off their header.
+static constexpr size_t MIN_VALUES_ENCODED_BLOCK = 16;
 
-// https://www.cplusplus.com/reference/utility/pair/operators/, https://en.cppreference.com/w/cpp/utility/pair/operator_cmp default std::pair < operator checks the **pair.first** value first
 using Value = uint64_t;
 using Input_Buffer_Index = uint64_t;
-using PQ_Element = std::pair<Value, Input_Buffer_Index>;
 
-/// Check if 64 bit unsigned integers sorted using std::is_sorted.
-/// Attention: this function is using more than mem_size memory, and this function
-///            is only called in assertion.
+/// Size class of a block := floor(log2(size)), 0 for an empty block.
+size_t io_size_class(size_t size) {
+    return size == 0 ? 0 : 63 - __builtin_clzll(size);
+}
+
+/// Counts a block read of `size` bytes.
+void count_read(size_t size) {
+    NUM_IO_READS++;
+    NUM_IO_BYTES_READ += size;
+    NUM_IO_READ_SIZES[io_size_class(size)]++;
+}
+
+/// Counts a block write of `size` bytes.
+void count_write(size_t size) {
+    NUM_IO_WRITES++;
+    NUM_IO_BYTES_WRITTEN += size;
+    NUM_IO_WRITE_SIZES[io_size_class(size)]++;
+}
+
+/// Adds its lifetime to the time the threads were blocked in block I/O.
+class IoWaitTimer {
+private:
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+public:
+    ~IoWaitTimer() {
+        NUM_IO_WAIT_NANOS += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+};
+
+/// Reads a block of the file on the calling thread, and counts it.
+void read_block(File &file, size_t offset, size_t size, char *block) {
+    {
+        IoWaitTimer timer;
+        file.read_block(offset, size, block);
+    }
+    count_read(size);
+}
+
+/// Writes a block into the file on the calling thread, and counts it.
+void write_block(File &file, const char *block, size_t offset, size_t size) {
+    {
+        IoWaitTimer timer;
+        file.write_block(block, offset, size);
+    }
+    count_write(size);
+}
+
+/// A snapshot of the I/O counters.
+struct IoCounters {
+    size_t reads, writes, bytes_read, bytes_written, wait_nanos;
+    std::array<size_t, NUM_IO_SIZE_CLASSES> read_sizes, write_sizes;
+
+    /// Takes a snapshot of the counters now.
+    static IoCounters now() {
+        IoCounters counters{NUM_IO_READS, NUM_IO_WRITES, NUM_IO_BYTES_READ, NUM_IO_BYTES_WRITTEN, NUM_IO_WAIT_NANOS, {}, {}};
+        for (size_t i = 0; i < NUM_IO_SIZE_CLASSES; i++) {
+            counters.read_sizes[i] = NUM_IO_READ_SIZES[i];
+            counters.write_sizes[i] = NUM_IO_WRITE_SIZES[i];
+        }
+        return counters;
+    }
+};
+
+/// A sorted run in a tmp file.
+struct Run {
+    /// The tmp file that contains this run.
+    File *file;
+    /// Byte-offset of the first value of this run in the tmp file.
+    size_t offset;
+    /// Number of values in this run.
+    size_t num_values;
+    /// Number of bytes of this run in the tmp file.
+    size_t size;
+    /// Is this run a sequence of `run_codec` blocks instead of plain values.
+    bool encoded;
+};
+
+/// Creates the tmp files of one external sort, striped across the spill directories if there are any, and counts
+/// their bytes per directory.
+class SpillSpace {
+private:
+    const std::vector<std::string> directories;
+    const size_t STRIPE_SIZE;
+    /// One counter per directory, shared by all tmp files of the sort.
+    std::unique_ptr<StripedFile::DeviceCounters[]> counters;
+
+public:
+    /// Tmp files in the working directory.
+    SpillSpace() : STRIPE_SIZE(0) {}
+
+    explicit SpillSpace(const ExternalSortOptions &options)
+        : directories(options.spill_directories), STRIPE_SIZE(options.spill_stripe_size),
+          counters(std::make_unique<StripedFile::DeviceCounters[]>(directories.size())) {
+        assert(directories.empty() || STRIPE_SIZE > 0);
+    }
+
+    /// Opens a tmp file.
+    std::unique_ptr<File> make_temporary_file() {
+        if (directories.empty()) {
+            return File::make_temporary_file();
+        }
+        return StripedFile::make_temporary_file(directories, STRIPE_SIZE, counters.get());
+    }
+
+    /// Stores the bytes read from and written to every directory.
+    void report(ExternalSortStats &stats) const {
+        stats.spill_bytes_read.resize(directories.size());
+        stats.spill_bytes_written.resize(directories.size());
+        for (size_t i = 0; i < directories.size(); i++) {
+            stats.spill_bytes_read[i] = counters[i].bytes_read;
+            stats.spill_bytes_written[i] = counters[i].bytes_written;
+        }
+    }
+
+    /// Logs the bytes of every directory.
+    void log() const {
+        for (size_t i = 0; i < directories.size(); i++) {
+            std::cout << "LOGGING OUTPUT: SPILL DIRECTORY " << directories[i] << ": " << counters[i].bytes_read << " BYTES READ, "
+                      << counters[i].bytes_written << " BYTES WRITTEN." << std::endl;
+        }
+    }
+};
+
+/// Fills `ExternalSortStats` of one external sort with the wall time and the I/O of its phases, and the I/O counters
+/// since the start.
+class StatsRecorder {
+public:
+    /// A phase of the sort := the stats of its wall time and of its I/O.
+    struct Phase {
+        double ExternalSortStats::*seconds;
+        ExternalSortPhaseIo ExternalSortStats::*io;
+    };
+    static constexpr Phase RUN_GENERATION{&ExternalSortStats::run_generation_seconds, &ExternalSortStats::run_generation_io};
+    static constexpr Phase MERGE{&ExternalSortStats::merge_seconds, &ExternalSortStats::merge_io};
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    /// The stats to fill, may be nullptr.
+    ExternalSortStats *stats;
+    /// The tmp files of the sort, may be nullptr.
+    const SpillSpace *spill;
+    /// The memory budget of the sort, may be nullptr.
+    const MemoryArena *arena;
+    /// The I/O counters at the start of the sort, and at the start of the running phase.
+    IoCounters start_io, phase_start_io;
+    /// The start of the running phase.
+    Clock::time_point phase_start;
+
+    /// Stores the counts of the size classes since the start, up to the largest class with a count.
+    static void store_histogram(const std::array<size_t, NUM_IO_SIZE_CLASSES> &now, const std::array<size_t, NUM_IO_SIZE_CLASSES> &start, std::vector<size_t> &histogram) {
+        histogram.clear();
+        for (size_t i = 0; i < NUM_IO_SIZE_CLASSES; i++) {
+            if (now[i] != start[i]) {
+                histogram.resize(i + 1);
+                histogram[i] = now[i] - start[i];
+            }
+        }
+    }
+
+public:
+    explicit StatsRecorder(ExternalSortStats *stats, const SpillSpace *spill = nullptr, const MemoryArena *arena = nullptr)
+        : stats(stats), spill(spill), arena(arena), start_io(IoCounters::now()), phase_start_io(start_io), phase_start(Clock::now()) {
+        if (stats) {
+            *stats = {};
+        }
+    }
+
+    /// Starts a phase.
+    void start_phase() {
+        phase_start = Clock::now();
+        phase_start_io = IoCounters::now();
+    }
+
+    /// Ends the running phase, stores its wall time and its I/O in the phase, and the I/O since the start of the sort.
+    void end_phase(const Phase &phase) {
+        if (!stats) {
+            return;
+        }
+        stats->*phase.seconds = 0;
+        stats->*phase.io = {};
+        add_phase(phase);
+    }
+
+    /// Ends the running phase, adds its wall time and its I/O to the phase, and stores the I/O since the start of the
+    /// sort.
+    void add_phase(const Phase &phase) {
+        if (!stats) {
+            return;
+        }
+        const IoCounters now = IoCounters::now();
+        stats->*phase.seconds += std::chrono::duration<double>(Clock::now() - phase_start).count();
+        ExternalSortPhaseIo &io = stats->*phase.io;
+        io.num_reads += now.reads - phase_start_io.reads;
+        io.num_writes += now.writes - phase_start_io.writes;
+        io.bytes_read += now.bytes_read - phase_start_io.bytes_read;
+        io.bytes_written += now.bytes_written - phase_start_io.bytes_written;
+        io.wait_seconds += static_cast<double>(now.wait_nanos - phase_start_io.wait_nanos) / 1e9;
+        stats->num_reads = now.reads - start_io.reads;
+        stats->num_writes = now.writes - start_io.writes;
+        stats->bytes_read = now.bytes_read - start_io.bytes_read;
+        stats->bytes_written = now.bytes_written - start_io.bytes_written;
+        store_histogram(now.read_sizes, start_io.read_sizes, stats->read_size_histogram);
+        store_histogram(now.write_sizes, start_io.write_sizes, stats->write_size_histogram);
+        if (spill) {
+            spill->report(*stats);
+        }
+        if (arena) {
+            stats->peak_memory = arena->peak();
+        }
+    }
+
+    /// Stores the shape of the sort.
+    void set_runs(size_t num_runs, size_t num_merge_passes, size_t merge_fan_in = 0) {
+        if (stats) {
+            stats->num_runs = num_runs;
+            stats->num_merge_passes = num_merge_passes;
+            stats->merge_fan_in = merge_fan_in;
+        }
+    }
+};
+
+/// Number of words of a value in aggregated runs and output, i.e. 2 for a (value, count) pair.
+size_t aggregate_words(Aggregate aggregate) {
+    return aggregate == Aggregate::COUNT ? 2 : 1;
+}
+
+/// A plain run of `num_values` values at `offset` of `file`.
+Run plain_run(File *file, size_t offset, size_t num_values) {
+    return {file, offset, num_values, num_values * VALUE_SIZE, false};
+}
+
+/// Reads `num_values` values at `offset` of a file that are only scanned. A mapped file hands out a pointer right into
+/// the mapping, otherwise the values are read into the buffer.
+/// @return pointer to the values.
+const Value *scan_values(File &file, size_t offset, size_t num_values, Value *buffer) {
+    if (const char *mapped = file.map_range(offset, num_values * VALUE_SIZE, File::Advice::SEQUENTIAL)) {
+        count_read(num_values * VALUE_SIZE);
+        return reinterpret_cast<const Value *>(mapped);
+    }
+    read_block(file, offset, num_values * VALUE_SIZE, reinterpret_cast<char *>(buffer));
+    return buffer;
+}
+
+/// Reverses the values into the buffer, which may hold the values already.
+/// @return the buffer.
+Value *reverse_values(const Value *values, size_t num_values, Value *buffer) {
+    if (values == buffer) {
+        std::reverse(buffer, buffer + num_values);
+    } else {
+        std::reverse_copy(values, values + num_values, buffer);
+    }
+    return buffer;
+}
+
+/// Encodes the sorted values `words[run_codec::HEADER_WORDS, run_codec::HEADER_WORDS + num_values)` in place and
+/// counts the compression ratio. Returns the number of bytes of the block, 0 if it would take more than `max_size`.
+size_t encode_block(Value *words, size_t num_values, size_t max_size = SIZE_MAX) {
+    const size_t size = run_codec::encode_block(words, num_values, max_size / VALUE_SIZE) * VALUE_SIZE;
+    NUM_RUN_BYTES_RAW += num_values * VALUE_SIZE;
+    NUM_RUN_BYTES_ENCODED += size > 0 ? size : num_values * VALUE_SIZE;
+    return size;
+}
+
+/// Check if 64 bit unsigned integers sorted, run by run through a buffer of the rest of the memory budget.
+/// Attention: this function is only called in assertion, and does not count its I/O.
 /// @param[in] tmp_file   Tmp_File that contains 64 bit unsigned integers which are
 ///                       stored as 8-byte little-endian values.
 /// @param[in] num_values The number of integers that should be sorted from the
 ///                       input.
-/// @param[in] run_size   The size of run
-bool sort_phase_done(File *tmp_file, size_t num_values, size_t run_size) {
+/// @param[in] runs       The runs in the tmp file in file order, only encoded runs leave a gap behind them.
+/// @param[in] arena      The memory budget, which must have room for at least one value.
+bool sort_phase_done(File *tmp_file, size_t num_values, const std::vector<Run> &runs, MemoryArena &arena) {
     const size_t INPUT_SORT_SIZE = num_values * VALUE_SIZE;  /// Size in memory, in bytes.
-    assert(tmp_file->size() == INPUT_SORT_SIZE);
-    const size_t NUM_RUNS = (INPUT_SORT_SIZE - 1) / run_size + 1;  /// (x - 1) / y + 1 := to do the ceil.
-    const size_t NUM_VALUES_RUN = run_size / VALUE_SIZE;
-
-    /// the size of last run. if last is full, then with mem_size.
-    const size_t LAST_RUN_SIZE = (INPUT_SORT_SIZE == NUM_RUNS * run_size) ? run_size : INPUT_SORT_SIZE - (NUM_RUNS - 1) * run_size;
-    assert(LAST_RUN_SIZE <= run_size);
-    /// number of values in the last run
-    assert(LAST_RUN_SIZE % VALUE_SIZE == 0);
-    const size_t NUM_VALUES_LAST_RUN = LAST_RUN_SIZE / VALUE_SIZE;
-
-    auto tmp_file_data = tmp_file->read_block(0, INPUT_SORT_SIZE);
-    auto *tmp_file_data_ub8 = reinterpret_cast<Value *>(tmp_file_data.get());
+    assert(tmp_file->size() >= INPUT_SORT_SIZE);
+    const size_t NUM_WORDS_BUFFER = arena.available() / VALUE_SIZE;
+    assert(NUM_WORDS_BUFFER > 0);
+    auto buffer = arena.allocate(NUM_WORDS_BUFFER * VALUE_SIZE);
+    const auto *words = reinterpret_cast<const Value *>(buffer.get());
 
     size_t offset = 0;
+    bool previous_encoded = false;
+    size_t num_run_values = 0;
     bool result = true;
-    for (size_t i = 0; i < NUM_RUNS - 1; i++, offset += run_size) {
-        result &= std::is_sorted(tmp_file_data_ub8 + i * NUM_VALUES_RUN, tmp_file_data_ub8 + i * NUM_VALUES_RUN + NUM_VALUES_RUN);
+    for (const auto &run : runs) {
+        result &= run.file == tmp_file && run.offset >= offset && (previous_encoded || run.offset == offset);
+        assert(result);
+        /// the words [buffer_begin, buffer_end) of the run are in the buffer
+        const size_t NUM_RUN_WORDS = run.size / VALUE_SIZE;
+        size_t next_word = 0;
+        size_t buffer_begin = 0;
+        size_t buffer_end = 0;
+        auto next = [&] {
+            assert(next_word < NUM_RUN_WORDS);
+            if (next_word == buffer_end) {
+                buffer_begin = buffer_end;
+                buffer_end = std::min(NUM_RUN_WORDS, buffer_begin + NUM_WORDS_BUFFER);
+                tmp_file->read_block(run.offset + buffer_begin * VALUE_SIZE, (buffer_end - buffer_begin) * VALUE_SIZE, buffer.get());
+            }
+            return words[next_word++ - buffer_begin];
+        };
+        run_codec::Decoder decoder;
+        Value previous = 0;
+        for (size_t i = 0; i < run.num_values; i++) {
+            const Value value = run.encoded ? decoder.next(next) : next();
+            result &= i == 0 || previous <= value;
+            previous = value;
+        }
+        result &= next_word == NUM_RUN_WORDS;
         assert(result);
+        offset = run.offset + run.size;
+        previous_encoded = run.encoded;
+        num_run_values += run.num_values;
     }
-    result &= std::is_sorted(tmp_file_data_ub8 + (NUM_RUNS - 1) * NUM_VALUES_RUN, tmp_file_data_ub8 + (NUM_RUNS - 1) * NUM_VALUES_RUN + NUM_VALUES_LAST_RUN);
+    result &= num_run_values == num_values;
     assert(result);
     return result;
 }
 
-/// Not Full Merge := with intermediate passes and terrible I/O number, since memory size too little.
-/// This function use 2-way merge with code structure similar as k-way merge.
-void not_full_way_merge(File *tmp_file, size_t num_values, size_t mem_size,
-                        size_t &NUM_RUNS, size_t &NUM_VALUES_RUN,
-                        size_t &NUM_VALUES_LAST_RUN, size_t &RUN_SIZE,
-                        size_t &LAST_RUN_SIZE) {
-    /// const fan-in := 2-way merge
-    static constexpr size_t FAN_IN = 2;
-    const size_t NUM_VALUE_INPUT_BUFFER = (mem_size / 3) / VALUE_SIZE;
+/// Executes block reads and writes in submission order. Without `background` every request is executed right away
+/// on the calling thread. With `background` the requests are executed by one I/O thread, so the caller can keep
+/// merging while a buffer is filled or flushed, and only waits for the ticket of the buffer it needs next.
+class IoQueue {
+private:
+    struct Request {
+        /// File to read from or write to.
+        File *file;
+        /// Byte-offset in the file.
+        size_t offset;
+        /// Size of the block.
+        size_t size;
+        /// Memory to read into or write from.
+        char *block;
+        /// Write the block into the file instead of reading it.
+        bool is_write;
+    };
+
+    std::mutex mutex;
+    /// Signals new requests to the I/O thread and completed requests to waiting callers.
+    std::condition_variable cv;
+    /// Submitted requests that are not executed yet.
+    std::deque<Request> requests;
+    /// Number of submitted requests, the ticket of a request is the number of requests submitted up to it.
+    size_t num_submitted = 0;
+    /// Number of executed requests.
+    size_t num_completed = 0;
+    /// The first failure of the I/O thread, which is rethrown by `wait()`.
+    std::exception_ptr error;
+    /// Tells the I/O thread to stop once `requests` is empty.
+    bool stop = false;
+    /// The I/O thread, if any.
+    std::thread io_thread;
+
+    static void execute(const Request &request) {
+        if (request.is_write) {
+            request.file->write_block(request.block, request.offset, request.size);
+            count_write(request.size);
+        } else {
+            request.file->read_block(request.offset, request.size, request.block);
+            count_read(request.size);
+        }
+    }
+
+    void run() {
+        std::unique_lock lock(mutex);
+        while (true) {
+            cv.wait(lock, [&] { return stop || !requests.empty(); });
+            if (requests.empty()) {
+                return;
+            }
+            const Request request = requests.front();
+            requests.pop_front();
+            /// after a failure the remaining requests are skipped
+            const bool skip = error != nullptr;
+            lock.unlock();
+            std::exception_ptr failure;
+            try {
+                if (!skip) {
+                    execute(request);
+                }
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            lock.lock();
+            if (failure && !error) {
+                error = failure;
+            }
+            num_completed++;
+            cv.notify_all();
+        }
+    }
+
+    size_t submit(const Request &request) {
+        if (!io_thread.joinable()) {
+            IoWaitTimer timer;
+            execute(request);
+            return ++num_submitted;
+        }
+        std::unique_lock lock(mutex);
+        requests.push_back(request);
+        cv.notify_all();
+        return ++num_submitted;
+    }
+
+public:
+    explicit IoQueue(bool background) {
+        if (background) {
+            io_thread = std::thread([this] { run(); });
+        }
+    }
+
+    /// Executes the remaining requests, so no request outlives the buffers of the caller.
+    ~IoQueue() {
+        if (io_thread.joinable()) {
+            {
+                std::unique_lock lock(mutex);
+                stop = true;
+                cv.notify_all();
+            }
+            io_thread.join();
+        }
+    }
+
+    IoQueue(const IoQueue &) = delete;
+    IoQueue &operator=(const IoQueue &) = delete;
+
+    /// Reads a block of `file` into `block`, returns the ticket of the request.
+    size_t read(File &file, size_t offset, size_t size, char *block) {
+        return submit({&file, offset, size, block, false});
+    }
+
+    /// Writes `block` into `file`, returns the ticket of the request.
+    size_t write(File &file, const char *block, size_t offset, size_t size) {
+        return submit({&file, offset, size, const_cast<char *>(block), true});  // NOLINT
+    }
+
+    /// Waits until the request with `ticket` and all requests before it are executed.
+    void wait(size_t ticket) {
+        if (!io_thread.joinable()) {
+            return;
+        }
+        IoWaitTimer timer;
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&] { return num_completed >= ticket; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    /// Waits until all submitted requests are executed.
+    void wait_all() {
+        wait(num_submitted);
+    }
+};
+
+/// The input side of a K-way Merge := an input buffer of `num_halves` halves for every run, and a loser tree over the
+/// next value of every run. The merged values are taken one by one, so the caller decides where they go.
+/**
+  *  tmp file := a set of runs
+  *
+  *  offset in file:
+  *  (n stands for the number of runs)
+  *  (--- := loaded into input buffer)
+  *
+  *  runs[0].offset          runs[1].offset          runs[2].offset                                 runs[n-1].offset
+  *  ^                       ^                       ^                                              ^
+  *  -----------------------------------------------------------------------------------------------------------
+  *  |---      Run 0         |---      Run 1         |---      Run 2         |---      ...          |---Run n-1|
+  *  -----------------------------------------------------------------------------------------------------------
+  */
+class RunMerger {
+private:
+    const std::vector<Run> runs;
+    const size_t FAN_IN;
+    const size_t NUM_HALVES;
+    const Aggregate AGGREGATE;
+    const size_t INPUT_BUFFER_SIZE;
+    /// The queue of the reads into the input buffers.
+    IoQueue &io;
+
+    /// next_read_offset_run             := next byte-offset to request of each run relative to the run start.
+    /// Improvement after grading: Never use a variable-sized array! Use a std::vector.
+    std::vector<size_t> next_read_offset_run;
+    /// next_word_index_input_buffer     := next word-index to consume of the current half of each input buffer.
+    /// Improvement after grading: Never use a variable-sized array! Use a std::vector allocated at Heap.
+    /// value range is [0, NUM_VALUE_INPUT_BUFFER]
+    std::vector<size_t> next_word_index_input_buffer;
+    /// remaining_num_values_run         := remaining values to be output-ed in each run.
+    /// Improvement after grading: Never use a variable-sized array! Use a std::vector.
+    std::vector<size_t> remaining_num_values_run;
+    /// current_half_input_buffer        := the half of each input buffer the merge currently drains.
+    std::vector<size_t> current_half_input_buffer;
+    /// num_words_half / ticket_half     := number of words requested into each half of each input buffer, and the ticket of that request.
+    std::vector<size_t> num_words_half;
+    std::vector<size_t> ticket_half;
+    /// decoders                         := decoder of each encoded run.
+    std::vector<run_codec::Decoder> decoders;
+    /// counts                           := count of the current value of each run, always 1 unless the runs are counted.
+    std::vector<size_t> counts;
+    /// input_buffer_base_ptrs           := base pointer of each input buffer half.
+    std::vector<Value*> input_buffer_base_ptrs;
+    LoserTree<Value> tree;
+
+    /// Requests the next part of a run into a half of its input buffer, if there is any.
+    void request_next_part(size_t run, size_t half) {
+        /// the last load from a run may be smaller than the input buffer.
+        const size_t load_size = std::min(INPUT_BUFFER_SIZE, runs[run].size - next_read_offset_run[run]);
+        assert(load_size % 8 == 0);
+        num_words_half[run * NUM_HALVES + half] = load_size / VALUE_SIZE;
+        if (load_size > 0) {
+            ticket_half[run * NUM_HALVES + half] = io.read(*runs[run].file, runs[run].offset + next_read_offset_run[run], load_size, reinterpret_cast<char*>(input_buffer_base_ptrs[run * NUM_HALVES + half]));
+            next_read_offset_run[run] += load_size;
+        }
+    }
+
+    /// Consumes the next word of a run. If the current half is used up, the next part of the run is requested into it
+    /// and the merge continues with the other half (with a single half: the same one) as soon as it is loaded.
+    Value next_word(size_t run) {
+        size_t &half = current_half_input_buffer[run];
+        if (next_word_index_input_buffer[run] == num_words_half[run * NUM_HALVES + half]) {
+            request_next_part(run, half);
+            half = (half + 1) % NUM_HALVES;
+            io.wait(ticket_half[run * NUM_HALVES + half]);
+            assert(runs[run].encoded || AGGREGATE == Aggregate::COUNT || std::is_sorted(input_buffer_base_ptrs[run * NUM_HALVES + half], input_buffer_base_ptrs[run * NUM_HALVES + half] + num_words_half[run * NUM_HALVES + half]));
+            next_word_index_input_buffer[run] = 0;
+        }
+        assert(next_word_index_input_buffer[run] < num_words_half[run * NUM_HALVES + half]);
+        return *(input_buffer_base_ptrs[run * NUM_HALVES + half] + next_word_index_input_buffer[run]++);
+    }
+
+    /// Consumes the next value of a run, and its count if the run is counted.
+    Value next_value(size_t run) {
+        if (runs[run].encoded) {
+            return decoders[run].next([&] { return next_word(run); });
+        }
+        const Value value = next_word(run);
+        if (AGGREGATE == Aggregate::COUNT) {
+            counts[run] = next_word(run);
+        }
+        return value;
+    }
+
+    /// Takes the min value out of the loser tree, and returns its count.
+    size_t pop() {
+        /// Locate which run the min comes from.
+        const Input_Buffer_Index ib_index = tree.top_source();
+        const size_t count = counts[ib_index];
+        /// Decrement remaining values in this run.
+        remaining_num_values_run[ib_index]--;
+        if (remaining_num_values_run[ib_index] == 0) {
+            /// This run is done / empty.
+            tree.pop_top();
+        } else {
+            /// Replace the min by the next one from this run, replaying only the matches of its run.
+            tree.replace_top(next_value(ib_index));
+        }
+        return count;
+    }
+
+public:
+    /// Requests the first part of every run and builds the loser tree over their first values.
+    /// @param[in] runs              The runs to merge, none of them empty.
+    /// @param[in] memory            The input buffers, `runs.size() * num_halves` halves of `input_buffer_size` bytes.
+    /// @param[in] input_buffer_size Bytes of every input buffer half, a multiple of 8.
+    /// @param[in] num_halves        1 for synchronous I/O, 2 for double-buffered I/O on the I/O thread of `io`.
+    /// @param[in] aggregate         Collapse equal values, see `Aggregate`.
+    /// @param[in] io                The queue of the reads, it must not outlive the memory.
+    RunMerger(const std::vector<Run> &runs, char *memory, size_t input_buffer_size, size_t num_halves, Aggregate aggregate, IoQueue &io)
+        : runs(runs), FAN_IN(runs.size()), NUM_HALVES(num_halves), AGGREGATE(aggregate), INPUT_BUFFER_SIZE(input_buffer_size),
+          io(io), next_read_offset_run(FAN_IN, 0), next_word_index_input_buffer(FAN_IN, 0),
+          remaining_num_values_run(FAN_IN, 0), current_half_input_buffer(FAN_IN, 0), num_words_half(FAN_IN * NUM_HALVES, 0),
+          ticket_half(FAN_IN * NUM_HALVES, 0), decoders(FAN_IN), counts(FAN_IN, 1),
+          input_buffer_base_ptrs(FAN_IN * NUM_HALVES, nullptr), tree(FAN_IN) {
+        assert(FAN_IN > 0);
+        assert(NUM_HALVES == 1 || NUM_HALVES == 2);
+        assert(INPUT_BUFFER_SIZE > 0);
+        assert(INPUT_BUFFER_SIZE % 8 == 0);
+        for (size_t i = 0; i < FAN_IN; i++) {
+            assert(runs[i].num_values > 0);
+            assert(AGGREGATE == Aggregate::NONE || !runs[i].encoded);
+            remaining_num_values_run[i] = runs[i].num_values;
+        }
+        for (size_t i = 0; i < FAN_IN * NUM_HALVES; i++) {
+            input_buffer_base_ptrs[i] = reinterpret_cast<Value*>(memory + i * INPUT_BUFFER_SIZE);
+        }
+
+        /// 1. Request up to INPUT_BUFFER_SIZE bytes of each run into each half of the read buffers
+        for (size_t h = 0; h < NUM_HALVES; h++) {
+            for (size_t i = 0; i < FAN_IN; i++) {
+                request_next_part(i, h);
+            }
+        }
+
+        /// 2. Init a loser tree, add the first value of each Input Buffer.
+        for (size_t i = 0; i < FAN_IN; i++) {
+            io.wait(ticket_half[i * NUM_HALVES]);
+            assert(runs[i].encoded || AGGREGATE == Aggregate::COUNT || std::is_sorted(input_buffer_base_ptrs[i * NUM_HALVES], input_buffer_base_ptrs[i * NUM_HALVES] + num_words_half[i * NUM_HALVES]));
+            tree.set(i, next_value(i));
+        }
+        tree.build();
+    }
+
+    /// Takes the next smallest value of all runs. With an `Aggregate` all equal values are taken at once.
+    /// @param[out] value The value.
+    /// @param[out] count The number of values that were collapsed into it, i.e. the sum of their counts if the runs are
+    ///                   counted. Always 1 without an `Aggregate`.
+    /// @return false if all runs are exhausted.
+    bool next(Value &value, size_t &count) {
+        if (tree.empty()) {
+            return false;
+        }
+        value = tree.top();
+        count = pop();
+        /// an aggregated value is complete once a larger value shows up, as the other runs may still add to its count.
+        while (AGGREGATE != Aggregate::NONE && !tree.empty() && tree.top() == value) {
+            count += pop();
+        }
+        return true;
+    }
+};
+
+/// Full K-way Merge := partitioning mem_size into K input buffers and 1 output buffer without any intermediate passes
+/**
+  *  mem_size := a set of K input buffers and 1 output buffer
+  *
+  *  IN HEAP ALLOCATED
+  *  (n stands for the number of runs)
+  *
+  *  0           buffer_size       buffer_size*2     buffer_size*3    buffer_size*(n-1)  buffer_size*n            mem_size
+  *  ^                 ^                 ^                 ^                 ^                 ^                  ^
+  *  --------------------------------------------------------------------------------------------------------------
+  *  |   Run 0 Buffer  |   Run 1 Buffer  |   Run 2 Buffer  |   ............  |   Run n Buffer  |   Output Buffer  |
+  *  --------------------------------------------------------------------------------------------------------------
+  *  ^                                                                                         ^
+  *  | <-----------------------------------Input Buffer--------------------------------------->|
+  *
+  *  With prefetching every buffer consists of two halves. The merge drains one half of a run buffer while the I/O
+  *  thread fills the other half with the next part of the run, and fills one half of the output buffer while the I/O
+  *  thread writes out the other half.
+  *
+  *  An input buffer holds the next words of its run, which are its values, or the `run_codec` blocks of an encoded
+  *  run which are decoded value by value. An encoded output stages its values behind the header words of the block in
+  *  every output buffer half and encodes the half in place before it is written.
+  */
+/// @param[in] runs           The runs to merge. mem_size must hold at least `num_halves` values per run and output.
+/// @param[in] output         File the merged run is written to.
+/// @param[in] output_offset  Byte-offset in the output where the merged run starts.
+/// @param[in] mem_size       The maximum amount of main-memory in bytes used for the buffers.
+/// @param[in] num_halves     1 for synchronous I/O, 2 for double-buffered I/O on a background I/O thread.
+/// @param[in] arena          The memory budget the buffers are taken from.
+/// @param[in] encode_output  Write the merged run as `run_codec` blocks, if the output buffer is large enough.
+/// @param[in] max_values     Stop the merge after that many values.
+/// @param[in] aggregate      Collapse equal values, see `Aggregate`. With `Aggregate::COUNT` the runs and the output
+///                           are (value, count) pairs and `num_values` of a run counts pairs.
+/// @return the merged run.
+Run k_way_merge(const std::vector<Run> &runs, File &output, size_t output_offset, size_t mem_size, size_t num_halves, MemoryArena &arena, bool encode_output = false, size_t max_values = SIZE_MAX, Aggregate aggregate = Aggregate::NONE) {
+    /// 1. Init Merge phase.
+    const size_t FAN_IN = runs.size();
+    const size_t NUM_HALVES = num_halves;
+    const Aggregate AGGREGATE = aggregate;
+    assert(FAN_IN > 0);
+    assert(NUM_HALVES == 1 || NUM_HALVES == 2);
+    assert(AGGREGATE == Aggregate::NONE || (!encode_output && max_values == SIZE_MAX));
+    size_t OUTPUT_NUM_VALUES = 0;
+    for (const auto &run : runs) {
+        OUTPUT_NUM_VALUES += run.num_values;
+    }
+    OUTPUT_NUM_VALUES = std::min(OUTPUT_NUM_VALUES, max_values);
+    /// 1.1. Get the buffer (half) size and number values in buffer (half).
+    /// Make sure Input Buffer Size is multiple time of 8.
+    const size_t NUM_VALUE_INPUT_BUFFER = (mem_size / (FAN_IN + 1)) / VALUE_SIZE / NUM_HALVES;
     const size_t INPUT_BUFFER_SIZE = NUM_VALUE_INPUT_BUFFER * VALUE_SIZE;
     assert(NUM_VALUE_INPUT_BUFFER > 0);
+    assert(INPUT_BUFFER_SIZE > 0);
     assert(INPUT_BUFFER_SIZE % 8 == 0);
-    const size_t NUM_VALUE_OUTPUT_BUFFER_ = (mem_size - FAN_IN * INPUT_BUFFER_SIZE) / VALUE_SIZE;
-    const size_t OUT_BUFFER_SIZE = NUM_VALUE_OUTPUT_BUFFER_ * VALUE_SIZE;
-    assert(NUM_VALUE_OUTPUT_BUFFER_ > 0);
+    /// Make sure Output Buffer Size is multiple time of 8.
+    const size_t NUM_VALUE_OUTPUT_BUFFER = (mem_size - FAN_IN * NUM_HALVES * INPUT_BUFFER_SIZE) / VALUE_SIZE / NUM_HALVES;
+    const size_t OUT_BUFFER_SIZE = NUM_VALUE_OUTPUT_BUFFER * VALUE_SIZE;
+    assert(OUT_BUFFER_SIZE > 0);
     assert(OUT_BUFFER_SIZE % 8 == 0);
-    while (NUM_RUNS > FAN_IN) {
-        const size_t num_iterations_in_pass = NUM_RUNS / FAN_IN;
-        for (size_t it = 0; it < num_iterations_in_pass; it++) {
-            size_t output_buffer_current_num_values = 0;
-            std::array<size_t, FAN_IN> next_read_offset_run{0};
-            std::array<size_t, FAN_IN> next_push_index_input_buffer{0};
-            std::array<size_t, FAN_IN> remaining_num_values_run{0};
-            for (size_t i = 0; i < FAN_IN; i++) {
-                next_read_offset_run[i] = INPUT_BUFFER_SIZE;
-                next_push_index_input_buffer[i] = 1;
-                remaining_num_values_run[i] = NUM_VALUES_RUN;
+    /// 1.2. Make sure heap usage not to exceed the mem_size.
+    const size_t BUFFERS_SIZE = (INPUT_BUFFER_SIZE * FAN_IN + OUT_BUFFER_SIZE) * NUM_HALVES;
+    assert(BUFFERS_SIZE <= mem_size);
+    /// An encoded output keeps room for the block header in front of the values of every output buffer half.
+    const bool ENCODE_OUTPUT = encode_output && NUM_VALUE_OUTPUT_BUFFER >= run_codec::HEADER_WORDS + MIN_VALUES_ENCODED_BLOCK;
+    const size_t OUTPUT_HEADROOM = ENCODE_OUTPUT ? run_codec::HEADER_WORDS : 0;
+    const size_t NUM_VALUE_OUTPUT_BLOCK = NUM_VALUE_OUTPUT_BUFFER - OUTPUT_HEADROOM;
+
+    /// 1.3. Allocate the buffers from the budget, the input buffers of the merger are followed by the output buffer halves
+    auto memory = arena.allocate(BUFFERS_SIZE);
+    char *memory_ptr = reinterpret_cast<char*>(memory.get());
+    std::vector<Value*> output_buffer_base_ptrs(NUM_HALVES, nullptr);
+    std::vector<size_t> ticket_output_half(NUM_HALVES, 0);
+    for (size_t h = 0; h < NUM_HALVES; h++) {
+        output_buffer_base_ptrs[h] = reinterpret_cast<Value*>(memory_ptr + FAN_IN * NUM_HALVES * INPUT_BUFFER_SIZE + h * OUT_BUFFER_SIZE);
+    }
+    size_t current_output_half = 0;
+    /// The I/O queue must not outlive the memory, its destructor finishes all requests into it.
+    IoQueue io(NUM_HALVES > 1);
+
+    /// 1.4. Bookkeeping of the output
+    /// output_buffer_current_num_values := current number of values in the current output buffer half, value range is [0, NUM_VALUE_OUTPUT_BLOCK).
+    size_t output_buffer_current_num_values = 0;
+    /// Writes out the current output buffer half, encoded if requested, and continues with the other half.
+    size_t output_size = 0;
+    auto flush_output = [&] {
+        Value *half = output_buffer_base_ptrs[current_output_half];
+        assert(AGGREGATE == Aggregate::COUNT || std::is_sorted(half + OUTPUT_HEADROOM, half + OUTPUT_HEADROOM + output_buffer_current_num_values));
+        const size_t block_size = ENCODE_OUTPUT ? encode_block(half, output_buffer_current_num_values) : output_buffer_current_num_values * VALUE_SIZE;
+        ticket_output_half[current_output_half] = io.write(output, reinterpret_cast<char*>(half), output_offset + output_size, block_size);
+        output_size += block_size;
+        current_output_half = (current_output_half + 1) % NUM_HALVES;
+        /// the other half may still be written out
+        io.wait(ticket_output_half[current_output_half]);
+        output_buffer_current_num_values = 0;
+    };
+    /// Writes a word into the output buffer half. If full, writes it out to output file and continues with the other half.
+    auto output_word = [&](Value word) {
+        *(output_buffer_base_ptrs[current_output_half] + OUTPUT_HEADROOM + output_buffer_current_num_values++) = word;
+        if (output_buffer_current_num_values == NUM_VALUE_OUTPUT_BLOCK) {
+            flush_output();
+        }
+    };
+    /// Writes a value, a counted value is a (value, count) pair that spans two words which may end up in different blocks.
+    size_t num_output_values = 0;
+    auto output_value = [&](Value value, size_t count) {
+        output_word(value);
+        if (AGGREGATE == Aggregate::COUNT) {
+            output_word(count);
+        }
+        num_output_values++;
+    };
+
+    /// 1.5. Request the first part of every run and build the loser tree over their first values
+    RunMerger merger(runs, memory_ptr, INPUT_BUFFER_SIZE, NUM_HALVES, AGGREGATE, io);
+
+    /// 2. Merge until OUTPUT_NUM_VALUES are written.
+    Value value = 0;
+    size_t count = 0;
+    while (num_output_values < OUTPUT_NUM_VALUES && merger.next(value, count)) {
+        output_value(value, count);
+    }
+    /// 2.1 The runs are exhausted. But the output buffer still has to be written out.
+    if (output_buffer_current_num_values > 0) {
+        flush_output();
+    }
+    io.wait_all();
+    return {&output, output_offset, num_output_values, output_size, ENCODE_OUTPUT};
+}
+
+/// Reads the value at `index` of a run.
+Value read_run_value(const Run &run, size_t index) {
+    assert(!run.encoded);
+    Value value;
+    read_block(*run.file, run.offset + index * VALUE_SIZE, VALUE_SIZE, reinterpret_cast<char *>(&value));
+    return value;
+}
+
+/// A value of a run with its position. Ordering by (value, run, index) makes all values distinct, so runs full of
+/// duplicates can still be cut at any position.
+struct Splitter {
+    Value value;
+    size_t run;
+    size_t index;
+
+    bool operator<(const Splitter &other) const {
+        return std::tie(value, run, index) < std::tie(other.value, other.run, other.index);
+    }
+};
+
+/// Number of values of a run that are ordered before the splitter := binary search in the run on disk.
+size_t run_partition_point(const std::vector<Run> &runs, size_t run, const Splitter &splitter) {
+    if (run == splitter.run) {
+        return splitter.index;
+    }
+    /// values equal to the splitter value belong before it in the runs before the splitter run
+    const bool include_equal = run < splitter.run;
+    size_t begin = 0;
+    size_t end = runs[run].num_values;
+    while (begin < end) {
+        const size_t middle = begin + (end - begin) / 2;
+        const Value value = read_run_value(runs[run], middle);
+        if (value < splitter.value || (include_equal && value == splitter.value)) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return begin;
+}
+
+/// Cuts the runs into `num_partitions` key ranges of about the same number of values (sample sort).
+/**
+  *  1. Sample values at evenly spaced positions of every run, every sample stands for the values up to the next one.
+  *  2. Sort the samples and pick the splitters where the summed up values reach 1/num_partitions, 2/num_partitions ...
+  *  3. Binary search every splitter in every run.
+  *
+  *                 partition 0    |  partition 1  |      partition 2
+  *  Run 0   |-------------------|-----------------|---------------------|
+  *  Run 1   |--------|------------------------|-------------|
+  *  Run 2   |--------------------------|--|---------------------------------|
+  *                                ^               ^
+  *                           splitter 1       splitter 2
+  */
+/// @param[in] runs           The sorted runs.
+/// @param[in] num_partitions Number of key ranges.
+/// @param[in] mem_size       The maximum amount of main-memory in bytes used for the samples.
+/// @param[in] arena          The memory budget the samples are taken from.
+/// @return bounds[p][r] := index of the first value of run r in partition p, bounds[num_partitions][r] := size of run r.
+std::vector<std::vector<size_t>> partition_runs(const std::vector<Run> &runs, size_t num_partitions, size_t mem_size, MemoryArena &arena) {
+    /// Samples per partition and run, more samples give better balanced partitions.
+    static constexpr size_t OVERSAMPLING = 16;
+    /// A sample stands for the values from it up to the next sample of its run.
+    struct Sample {
+        Splitter splitter;
+        size_t num_values;
+    };
+    const size_t FAN_IN = runs.size();
+    const size_t SAMPLES_PER_RUN = std::max<size_t>(1, std::min(OVERSAMPLING * num_partitions, mem_size / sizeof(Sample) / FAN_IN));
+    size_t num_all_samples = 0;
+    for (const auto &run : runs) {
+        num_all_samples += std::min(SAMPLES_PER_RUN, run.num_values);
+    }
+    auto sample_buffer = arena.allocate(num_all_samples * sizeof(Sample));
+    auto *samples = reinterpret_cast<Sample *>(sample_buffer.get());
+
+    /// 1. Sample the runs
+    size_t num_samples_taken = 0;
+    size_t total_values = 0;
+    for (size_t r = 0; r < FAN_IN; r++) {
+        const size_t num_values = runs[r].num_values;
+        const size_t num_samples = std::min(SAMPLES_PER_RUN, num_values);
+        for (size_t k = 0; k < num_samples; k++) {
+            const size_t index = k * num_values / num_samples;
+            const size_t next_index = (k + 1) * num_values / num_samples;
+            samples[num_samples_taken++] = {{read_run_value(runs[r], index), r, index}, next_index - index};
+        }
+        total_values += num_values;
+    }
+    /// 2. Sort the samples
+    std::sort(samples, samples + num_all_samples, [](const auto &a, const auto &b) { return a.splitter < b.splitter; });
+
+    /// 3. Pick the splitters and search them in every run
+    std::vector<std::vector<size_t>> bounds(num_partitions + 1, std::vector<size_t>(FAN_IN, 0));
+    for (size_t r = 0; r < FAN_IN; r++) {
+        bounds[num_partitions][r] = runs[r].num_values;
+    }
+    size_t sample = 0;
+    size_t values_before_sample = 0;
+    for (size_t p = 1; p < num_partitions; p++) {
+        const size_t target = p * total_values / num_partitions;
+        while (sample + 1 < num_all_samples && values_before_sample + samples[sample].num_values <= target) {
+            values_before_sample += samples[sample++].num_values;
+        }
+        for (size_t r = 0; r < FAN_IN; r++) {
+            bounds[p][r] = run_partition_point(runs, r, samples[sample].splitter);
+            assert(bounds[p][r] >= bounds[p - 1][r]);
+        }
+    }
+    return bounds;
+}
+
+/// Merges the runs into the output with `num_threads` threads, each merging one key range of `partition_runs()` with
+/// `mem_size / num_threads` bytes of the arena into its precomputed offset of the output. With a single thread this is
+/// `k_way_merge()` on the calling thread. The key ranges need random access into the runs, so with several threads
+/// all runs must be plain and the output is plain as well. Only a single thread stops after `max_values` values or
+/// aggregates, as the output offsets of the key ranges are known upfront.
+/// @return the merged run.
+Run parallel_k_way_merge(const std::vector<Run> &runs, File &output, size_t output_offset, size_t mem_size, size_t num_halves, size_t num_threads, MemoryArena &arena, bool encode_output, size_t max_values = SIZE_MAX, Aggregate aggregate = Aggregate::NONE) {
+    if (num_threads == 1) {
+        return k_way_merge(runs, output, output_offset, mem_size, num_halves, arena, encode_output, max_values, aggregate);
+    }
+    assert(max_values == SIZE_MAX && aggregate == Aggregate::NONE);
+    /// 1. Cut the runs into key ranges, with the whole mem_size for the samples
+    const auto bounds = partition_runs(runs, num_threads, mem_size, arena);
+
+    /// 2. The part of every run in every key range, and the output offset of every key range
+    std::vector<std::vector<Run>> partitions(num_threads);
+    std::vector<size_t> partition_offsets(num_threads + 1, output_offset);
+    for (size_t p = 0; p < num_threads; p++) {
+        partition_offsets[p + 1] = partition_offsets[p];
+        for (size_t r = 0; r < runs.size(); r++) {
+            const size_t num_values = bounds[p + 1][r] - bounds[p][r];
+            if (num_values > 0) {
+                partitions[p].push_back(plain_run(runs[r].file, runs[r].offset + bounds[p][r] * VALUE_SIZE, num_values));
             }
-            size_t odd_run_num_adjustment = 0;
-            if (it == num_iterations_in_pass - 1) {
-                remaining_num_values_run[FAN_IN - 1] = NUM_VALUES_LAST_RUN;
-                if (NUM_RUNS % FAN_IN != 0) {
-                    /// if NUM_RUNS is not even, so can't be 2-way merged.
-                    /// In this case we process the last 3 runs together := Full Run A, Full Run B, the Last Run merge Full Run B and the last Run into single Run first, then we have even NUM_RUNS
-                    odd_run_num_adjustment = RUN_SIZE;
-                }
+            partition_offsets[p + 1] += num_values * VALUE_SIZE;
+        }
+    }
+
+    /// 3. Merge every key range on its own thread
+    std::vector<std::exception_ptr> errors(num_threads);
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (size_t p = 0; p < num_threads; p++) {
+        if (partitions[p].empty()) {
+            continue;
+        }
+        threads.emplace_back([&, p] {
+            try {
+                k_way_merge(partitions[p], output, partition_offsets[p], mem_size / num_threads, num_halves, arena);
+            } catch (...) {
+                errors[p] = std::current_exception();
             }
-            auto memory = std::make_unique<char[]>(mem_size);
-            char *memory_ptr = reinterpret_cast<char *>(memory.get());
-            std::array<Value*, FAN_IN> input_buffer_base_ptrs{0};
-            auto *output_buffer_base_ptr = reinterpret_cast<Value *>(memory_ptr + INPUT_BUFFER_SIZE * FAN_IN);
-
-            /// intermediate_file only used in this iteration
-            auto intermediate_file = File::make_temporary_file();
-            if (it == num_iterations_in_pass - 1) {
-                intermediate_file->resize((FAN_IN - 1) * RUN_SIZE + LAST_RUN_SIZE);
-            } else {
-                intermediate_file->resize(FAN_IN * RUN_SIZE);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (auto &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    return plain_run(&output, output_offset, (partition_offsets[num_threads] - output_offset) / VALUE_SIZE);
+}
+
+/// The largest fan-in mem_size allows := mem_size can be devided into (FAN_IN + 1) buffers of `num_halves` values.
+size_t max_fan_in(size_t mem_size, size_t num_halves) {
+    return mem_size / VALUE_SIZE / num_halves - 1;
+}
+
+/// Plans the merge of the runs with the largest fan-in mem_size allows, see `plan_merge()`. Run sizes are in bytes.
+MergePlan plan_run_merge(const std::vector<Run> &runs, size_t mem_size, size_t num_halves) {
+    std::vector<size_t> run_sizes;
+    run_sizes.reserve(runs.size());
+    for (const auto &run : runs) {
+        run_sizes.push_back(run.num_values * VALUE_SIZE);
+    }
+    return plan_merge(run_sizes, std::max<size_t>(2, max_fan_in(mem_size, num_halves)));
+}
+
+/// Executes all merges of a `MergePlan` but the last. Every merge writes into its own tmp file, which is dropped as
+/// soon as its run is merged again. Every merge runs on `num_threads` threads. With `encode_runs` the merges write
+/// `run_codec` blocks. Every merge stops after `max_values` values, and collapses equal values with `aggregate`.
+/// @param[in] spill         Creates the tmp files.
+/// @param[in] arena         The memory budget of the merges.
+/// @param[out] merged_files The tmp files of the merged runs, the ones of the runs of the last merge stay open.
+/// @return the runs of the last merge, none for a plan without merges.
+std::vector<Run> execute_intermediate_merges(const MergePlan &plan, const std::vector<Run> &runs, SpillSpace &spill, std::vector<std::unique_ptr<File>> &merged_files, size_t mem_size, MemoryArena &arena, size_t num_halves, size_t num_threads, bool encode_runs, size_t max_values = SIZE_MAX, Aggregate aggregate = Aggregate::NONE) {
+    /// runs of all ids, the generated ones followed by the merged ones
+    std::vector<Run> all_runs(runs);
+    for (const auto &step : plan.steps) {
+        std::vector<Run> inputs;
+        inputs.reserve(step.inputs.size());
+        for (auto id : step.inputs) {
+            inputs.push_back(all_runs[id]);
+        }
+        if (&step == &plan.steps.back()) {
+            return inputs;
+        }
+        auto merged_file = spill.make_temporary_file();
+        /// every block takes at most one word more than its values, and holds at least MIN_VALUES_ENCODED_BLOCK values but the last
+        const size_t NUM_VALUES = std::min(step.size / VALUE_SIZE, max_values);
+        merged_file->resize(NUM_VALUES * aggregate_words(aggregate) * VALUE_SIZE + (encode_runs ? (NUM_VALUES / MIN_VALUES_ENCODED_BLOCK + 1) * VALUE_SIZE : 0));
+        NUM_IO_WRITES++;
+        all_runs.push_back(parallel_k_way_merge(inputs, *merged_file, 0, mem_size, num_halves, num_threads, arena, encode_runs, max_values, aggregate));
+        merged_files.push_back(std::move(merged_file));
+        /// drop the tmp files of merged runs that were merged again
+        for (auto id : step.inputs) {
+            if (id >= runs.size()) {
+                merged_files[id - runs.size()].reset();
             }
-            NUM_IO_WRITES++;
-            for (size_t i = 0, buffer_offset = 0, tmpfile_offset = RUN_SIZE * FAN_IN * it + odd_run_num_adjustment; i < FAN_IN; i++, buffer_offset += INPUT_BUFFER_SIZE, tmpfile_offset += RUN_SIZE) {
-                input_buffer_base_ptrs[i] = reinterpret_cast<Value *>(memory_ptr + buffer_offset);
-                tmp_file->read_block(tmpfile_offset, INPUT_BUFFER_SIZE, memory_ptr + buffer_offset);
-                NUM_IO_READS++;
+        }
+    }
+    return {};
+}
+
+/// Executes a `MergePlan`, see `execute_intermediate_merges()`. The last merge writes plain values into the output.
+/// @return the run of the last merge in the output.
+Run execute_merge_plan(const MergePlan &plan, const std::vector<Run> &runs, SpillSpace &spill, File &output, size_t mem_size, MemoryArena &arena, size_t num_halves, size_t num_threads, bool encode_runs, size_t max_values = SIZE_MAX, Aggregate aggregate = Aggregate::NONE) {
+    std::vector<std::unique_ptr<File>> merged_files;
+    const auto inputs = execute_intermediate_merges(plan, runs, spill, merged_files, mem_size, arena, num_halves, num_threads, encode_runs, max_values, aggregate);
+    if (inputs.empty()) {
+        /// a plan without merges := no runs
+        return plain_run(&output, 0, 0);
+    }
+    return parallel_k_way_merge(inputs, output, 0, mem_size, num_halves, num_threads, arena, false, max_values, aggregate);
+}
+
+/// Returns the bytes of the histograms the kernel needs besides the values, see `radix_histograms_size()`.
+size_t sort_histograms_size(RunSort run_sort) {
+    switch (run_sort) {
+        case RunSort::RADIX_SORT_8:
+            return radix_histograms_size(8);
+        case RunSort::RADIX_SORT_11:
+            return radix_histograms_size(11);
+        case RunSort::STD_SORT:
+            break;
+    }
+    return 0;
+}
+
+/// Sorts `num_values` values at the start of `buffer` with the given kernel.
+/// @param[in] buffer     The values, followed by memory for another `num_values` values if a radix sort is used.
+/// @param[in] histograms Memory of `sort_histograms_size(run_sort)` bytes.
+/// @return pointer to the sorted values, which are either at the start of the buffer or right behind the values.
+Value *sort_values(Value *buffer, size_t num_values, RunSort run_sort, size_t *histograms) {
+    switch (run_sort) {
+        case RunSort::RADIX_SORT_8:
+            return radix_sort(buffer, buffer + num_values, histograms, num_values, 8);
+        case RunSort::RADIX_SORT_11:
+            return radix_sort(buffer, buffer + num_values, histograms, num_values, 11);
+        case RunSort::STD_SORT:
+            break;
+    }
+    std::sort(buffer, buffer + num_values);
+    return buffer;
+}
+
+/// Returns how many times the size of a run the buffer for sorting it must be.
+size_t sort_buffer_factor(RunSort run_sort, Aggregate aggregate = Aggregate::NONE) {
+    return run_sort == RunSort::STD_SORT && aggregate != Aggregate::COUNT ? 1 : 2;
+}
+
+/// Returns the size of the buffer for sorting a run, with room for the block header if the run is encoded, and for the
+/// histograms of a radix sort behind the values.
+size_t sort_buffer_size(size_t run_size, RunSort run_sort, bool encode, Aggregate aggregate = Aggregate::NONE) {
+    return run_size * sort_buffer_factor(run_sort, aggregate) + (encode ? run_codec::HEADER_WORDS * VALUE_SIZE : 0) + sort_histograms_size(run_sort);
+}
+
+/// Collapses the equal values of a sorted run to the start of its buffer, see `Aggregate`.
+/// @param[in] buffer         The sort buffer of the run, of `sort_buffer_factor(run_sort, aggregate)` times the run.
+/// @param[in] sorted_values  The sorted values in the buffer, see `sort_values()`.
+/// @return the number of words at the start of the buffer.
+size_t aggregate_run(Value *buffer, const Value *sorted_values, size_t num_values, Aggregate aggregate) {
+    assert(aggregate != Aggregate::NONE);
+    /// The pair of the i-th distinct value goes to the words 2i and 2i+1, which never overtake the values not read yet
+    /// if these are in the second half of the buffer.
+    if (aggregate == Aggregate::COUNT && sorted_values != buffer + num_values) {
+        std::memcpy(buffer + num_values, sorted_values, num_values * VALUE_SIZE);
+        sorted_values = buffer + num_values;
+    }
+    size_t num_words = 0;
+    for (size_t i = 0; i < num_values;) {
+        const Value value = sorted_values[i];
+        size_t count = 1;
+        while (i + count < num_values && sorted_values[i + count] == value) {
+            count++;
+        }
+        i += count;
+        buffer[num_words++] = value;
+        if (aggregate == Aggregate::COUNT) {
+            buffer[num_words++] = count;
+        }
+    }
+    return num_words;
+}
+
+/// Sorts the runs of the input into the tmp file. Every call works on its own buffer of `run_size` bytes and claims
+/// the next unsorted run through `next_run`, so several calls can run concurrently on different threads.
+/// @param[in] input          File that contains the unsorted 64 bit unsigned integers.
+/// @param[in] tmp_file       File the sorted runs are written to, at the same offset as in the input.
+/// @param[in] input_size     Number of bytes to sort from the input.
+/// @param[in] run_size       The size of a run (the last run may be smaller).
+/// @param[in] next_run       Index of the next run that is not claimed by any thread yet.
+/// @param[in] buffer         Memory of at least `sort_buffer_size(run_size, run_sort, encode, aggregate)` bytes owned by the caller.
+/// @param[in] run_sort       Kernel that sorts a run.
+/// @param[in] encode         Write every run as one `run_codec` block, unless the block would be larger than the run.
+/// @param[in] aggregate      Collapse the equal values of every run, a counted run takes twice its place in the tmp file.
+/// @param[out] runs          The sorted runs, sized to the number of runs by the caller.
+void sort_runs(File &input, File &tmp_file, size_t input_size, size_t run_size, std::atomic<size_t> &next_run, char *buffer, RunSort run_sort, bool encode, Aggregate aggregate, std::vector<Run> &runs) {
+    const size_t NUM_RUNS = (input_size - 1) / run_size + 1;
+    /// an encoded run is staged behind the room for its block header
+    const size_t HEADROOM = encode ? run_codec::HEADER_WORDS : 0;
+    /// the histograms of a radix sort are at the end of the buffer
+    auto *histograms = reinterpret_cast<size_t*>(buffer + sort_buffer_size(run_size, run_sort, encode, aggregate) - sort_histograms_size(run_sort));
+    for (size_t i = next_run++; i < NUM_RUNS; i = next_run++) {
+        const size_t offset = i * run_size;
+        const size_t this_run_size = std::min(run_size, input_size - offset);
+        /// Read a run from input file
+        read_block(input, offset, this_run_size, buffer + HEADROOM * VALUE_SIZE);
+        /// Sort it, a radix sort may leave the values in its scratch memory whose front is free then
+        auto *sorted_values = sort_values(reinterpret_cast<Value*>(buffer) + HEADROOM, this_run_size / VALUE_SIZE, run_sort, histograms);
+        /// Write this sorted run out to tmp file, aggregated, or encoded if it fits into the place of the run
+        const size_t encoded_size = encode ? encode_block(sorted_values - HEADROOM, this_run_size / VALUE_SIZE, this_run_size) : 0;
+        if (aggregate != Aggregate::NONE) {
+            auto *values = reinterpret_cast<Value*>(buffer);
+            const size_t num_words = aggregate_run(values, sorted_values, this_run_size / VALUE_SIZE, aggregate);
+            const size_t tmp_offset = offset * aggregate_words(aggregate);
+            write_block(tmp_file, buffer, tmp_offset, num_words * VALUE_SIZE);
+            runs[i] = {&tmp_file, tmp_offset, num_words / aggregate_words(aggregate), num_words * VALUE_SIZE, false};
+        } else if (encoded_size > 0) {
+            write_block(tmp_file, reinterpret_cast<const char*>(sorted_values - HEADROOM), offset, encoded_size);
+            runs[i] = {&tmp_file, offset, this_run_size / VALUE_SIZE, encoded_size, true};
+        } else {
+            write_block(tmp_file, reinterpret_cast<const char*>(sorted_values), offset, this_run_size);
+            runs[i] = plain_run(&tmp_file, offset, this_run_size / VALUE_SIZE);
+        }
+    }
+}
+
+/// Sorts the runs with `num_threads` threads, each owning `sort_buffer_size(run_size, run_sort, encode, aggregate)` bytes of the
+/// memory budget `arena`. While one thread sorts its run, the others read the following runs and write the preceding ones,
+/// so reading, sorting and writing overlap. With a single thread the runs are sorted on the calling thread.
+/// @return the sorted runs.
+std::vector<Run> parallel_sort_runs(File &input, File &tmp_file, size_t input_size, size_t run_size, size_t num_threads, RunSort run_sort, bool encode, Aggregate aggregate, MemoryArena &arena) {
+    std::atomic<size_t> next_run{0};
+    std::vector<Run> runs((input_size - 1) / run_size + 1);
+    const size_t BUFFER_SIZE = sort_buffer_size(run_size, run_sort, encode, aggregate);
+    if (num_threads == 1) {
+        auto buffer = arena.allocate(BUFFER_SIZE);
+        sort_runs(input, tmp_file, input_size, run_size, next_run, buffer.get(), run_sort, encode, aggregate, runs);
+        return runs;
+    }
+    /// Allocate all buffers upfront, so a failing allocation does not leave threads behind.
+    std::vector<MemoryArena::Buffer> buffers;
+    buffers.reserve(num_threads);
+    for (size_t t = 0; t < num_threads; t++) {
+        buffers.push_back(arena.allocate(BUFFER_SIZE));
+    }
+    std::vector<std::exception_ptr> errors(num_threads);
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t] {
+            try {
+                sort_runs(input, tmp_file, input_size, run_size, next_run, buffers[t].get(), run_sort, encode, aggregate, runs);
+            } catch (...) {
+                errors[t] = std::current_exception();
+                /// Make the other threads stop claiming runs
+                next_run = input_size;
             }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (auto &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    return runs;
+}
 
-            /// inputs_compare for 2-way merge, in this simple case priority queue is not necessary:
-            /// [0]                    | [1]
-            /// first input buffer     | second input buffer
-            std::array<Value*, FAN_IN> inputs_compare{input_buffer_base_ptrs[0], input_buffer_base_ptrs[1]};
-            size_t num_full_writes = 0;
-            while (inputs_compare[0] != nullptr || inputs_compare[1] != nullptr) {
-                /// the less value side index
-                const Input_Buffer_Index ib_index = [&] {
-                  if (inputs_compare[0] == nullptr) {
-                      return 1;
-                  } else if (inputs_compare[1] == nullptr) {
-                      return 0;
-                  } else {
-                      return (*inputs_compare[0] < *inputs_compare[1]) ? 0 : 1;
-                  }
-                } ();
-                *(output_buffer_base_ptr + output_buffer_current_num_values++) = *inputs_compare[ib_index];
-
-                remaining_num_values_run[ib_index]--;
-                if (output_buffer_current_num_values == NUM_VALUE_OUTPUT_BUFFER_) {
-                    assert(std::is_sorted(output_buffer_base_ptr, output_buffer_base_ptr + NUM_VALUE_OUTPUT_BUFFER_));
-                    intermediate_file->write_block(reinterpret_cast<char *>(output_buffer_base_ptr), (num_full_writes++) * OUT_BUFFER_SIZE, OUT_BUFFER_SIZE);
-                    NUM_IO_WRITES++;
-                    output_buffer_current_num_values = 0;
-                }
-                if (remaining_num_values_run[ib_index] == 0) {
-                    inputs_compare[ib_index] = nullptr;
-                    continue;
-                }
-                const bool if_last_run = it == num_iterations_in_pass - 1 && ib_index == (FAN_IN - 1);
-                if (next_push_index_input_buffer[ib_index] == NUM_VALUE_INPUT_BUFFER) {
-                    if (if_last_run ? next_read_offset_run[ib_index] + INPUT_BUFFER_SIZE >= LAST_RUN_SIZE : next_read_offset_run[ib_index] + INPUT_BUFFER_SIZE >= RUN_SIZE) {
-                        /// last load from this run
-                        const size_t last_load_size = (if_last_run ? LAST_RUN_SIZE - next_read_offset_run[ib_index] : RUN_SIZE - next_read_offset_run[ib_index]);
-                        assert(last_load_size % 8 == 0);
-                        tmp_file->read_block(next_read_offset_run[ib_index] + RUN_SIZE * ib_index + RUN_SIZE * FAN_IN * it + odd_run_num_adjustment, last_load_size, reinterpret_cast<char *>(input_buffer_base_ptrs[ib_index]));
-                        assert(std::is_sorted(input_buffer_base_ptrs[ib_index], input_buffer_base_ptrs[ib_index] + (last_load_size / VALUE_SIZE)));
-                        next_read_offset_run[ib_index] += last_load_size;
-                    } else {
-                        /// Load from run (not the last load)
-                        tmp_file->read_block(next_read_offset_run[ib_index] + RUN_SIZE * ib_index + RUN_SIZE * FAN_IN * it + odd_run_num_adjustment, INPUT_BUFFER_SIZE, reinterpret_cast<char *>(input_buffer_base_ptrs[ib_index]));
-                        assert(std::is_sorted(input_buffer_base_ptrs[ib_index], input_buffer_base_ptrs[ib_index] + NUM_VALUE_INPUT_BUFFER));
-                        next_read_offset_run[ib_index] += INPUT_BUFFER_SIZE;
-                    }
-                    NUM_IO_READS++;
-                    next_push_index_input_buffer[ib_index] = 0;
-                }
-                inputs_compare[ib_index] = input_buffer_base_ptrs[ib_index] + next_push_index_input_buffer[ib_index]++;
+/// Replaces the minimum of the heap [heap, heap + heap_size) by `value` and restores the heap property, with a
+/// single sift-down instead of a `std::pop_heap()` followed by a `std::push_heap()`.
+void replace_heap_top(Value *heap, size_t heap_size, Value value) {
+    size_t hole = 0;
+    while (true) {
+        size_t child = 2 * hole + 1;
+        if (child >= heap_size) {
+            break;
+        }
+        if (child + 1 < heap_size && heap[child + 1] < heap[child]) {
+            child++;
+        }
+        if (value <= heap[child]) {
+            break;
+        }
+        heap[hole] = heap[child];
+        hole = child;
+    }
+    heap[hole] = value;
+}
+
+/// Generates runs with replacement selection. A min-heap over most of mem_size outputs its minimum into the current
+/// run and replaces it with the next input value. A value that is smaller than the last output value cannot join the
+/// current run anymore, it is parked behind the heap for the next run and the heap shrinks by one. On random input
+/// the runs are about twice the size of the heap, presorted input results in a single run.
+/**
+  *  mem_size := heap, parked values of the next run, 1 input buffer and 1 output buffer
+  *
+  *  0                          heap_size                 heap_capacity                                   mem_size
+  *  ^                              ^                           ^                                            ^
+  *  ---------------------------------------------------------------------------------------------------------
+  *  |  Heap of the current run     |  Values of the next run   |   Input Buffer   |   Output Buffer        |
+  *  ---------------------------------------------------------------------------------------------------------
+  */
+/// @param[in] input      File that contains the unsorted 64 bit unsigned integers.
+/// @param[in] tmp_file   File the sorted runs are written to, one after another.
+/// @param[in] input_size Number of bytes to sort from the input.
+/// @param[in] mem_size   The maximum amount of main-memory in bytes that should be used.
+/// @param[in] arena      The memory budget the buffers are taken from.
+/// @param[in] encode     Write the runs as `run_codec` blocks, one per output buffer, if the output buffer is large enough.
+/// @return the generated runs in the tmp file
+std::vector<Run> replacement_selection(File &input, File &tmp_file, size_t input_size, size_t mem_size, MemoryArena &arena, bool encode) {
+    /// 1. Partition mem_size, input and output buffer get 1/32 of mem_size each, but at least one value
+    const size_t NUM_VALUES_MEMORY = mem_size / VALUE_SIZE;
+    assert(NUM_VALUES_MEMORY >= 3);
+    const size_t NUM_VALUE_IO_BUFFER = std::max<size_t>(1, NUM_VALUES_MEMORY / 32);
+    const size_t IO_BUFFER_SIZE = NUM_VALUE_IO_BUFFER * VALUE_SIZE;
+    /// an encoded output buffer keeps room for the block header in front of its values
+    const bool ENCODE = encode && NUM_VALUE_IO_BUFFER >= MIN_VALUES_ENCODED_BLOCK;
+    const size_t OUTPUT_HEADROOM = ENCODE ? run_codec::HEADER_WORDS : 0;
+    const size_t HEAP_CAPACITY = NUM_VALUES_MEMORY - 2 * NUM_VALUE_IO_BUFFER - OUTPUT_HEADROOM;
+    assert(HEAP_CAPACITY > 0);
+    auto memory = arena.allocate(mem_size);
+    auto *heap = reinterpret_cast<Value*>(memory.get());
+    auto *input_buffer = heap + HEAP_CAPACITY;
+    auto *output_block = input_buffer + NUM_VALUE_IO_BUFFER;
+    auto *output_buffer = output_block + OUTPUT_HEADROOM;
+
+    /// 2. Input buffer bookkeeping := the values [input_index, input_buffer_num_values) are not consumed yet, they are
+    ///    in the input buffer or right in the mapped input
+    size_t next_read_offset = 0;
+    size_t input_index = 0;
+    size_t input_buffer_num_values = 0;
+    const Value *input_values = input_buffer;
+    auto next_input = [&](Value &value) {
+        if (input_index == input_buffer_num_values) {
+            if (next_read_offset == input_size) {
+                return false;
             }
+            const size_t load_size = std::min(IO_BUFFER_SIZE, input_size - next_read_offset);
+            input_values = scan_values(input, next_read_offset, load_size / VALUE_SIZE, input_buffer);
+            next_read_offset += load_size;
+            input_index = 0;
+            input_buffer_num_values = load_size / VALUE_SIZE;
+        }
+        value = input_values[input_index++];
+        return true;
+    };
+
+    /// 3. Output buffer bookkeeping := output_buffer_num_values values are not written yet
+    size_t next_write_offset = 0;
+    size_t output_buffer_num_values = 0;
+    auto flush_output = [&] {
+        if (output_buffer_num_values == 0) {
+            return;
+        }
+        const size_t block_size = ENCODE ? encode_block(output_block, output_buffer_num_values) : output_buffer_num_values * VALUE_SIZE;
+        write_block(tmp_file, reinterpret_cast<char*>(output_block), next_write_offset, block_size);
+        next_write_offset += block_size;
+        output_buffer_num_values = 0;
+    };
 
-            const size_t intermediate_file_size = intermediate_file->size();
-            const size_t num_full_write = intermediate_file_size / OUT_BUFFER_SIZE;
-            if (intermediate_file_size > OUT_BUFFER_SIZE * num_full_write) {
-                assert(std::is_sorted(output_buffer_base_ptr, output_buffer_base_ptr + ((intermediate_file_size - OUT_BUFFER_SIZE * num_full_write) / VALUE_SIZE)));
-                intermediate_file->write_block(reinterpret_cast<char *>(output_buffer_base_ptr), num_full_writes * OUT_BUFFER_SIZE, intermediate_file_size - OUT_BUFFER_SIZE * num_full_write);
-                NUM_IO_WRITES++;
+    /// 4. Fill the heap with the first values of the input
+    size_t heap_size = 0;
+    for (Value value; heap_size < HEAP_CAPACITY && next_input(value);) {
+        heap[heap_size++] = value;
+    }
+    /// the parked values of the next run are [next_run_begin, HEAP_CAPACITY), the first run starts with them all
+    std::move_backward(heap, heap + heap_size, heap + HEAP_CAPACITY);
+    size_t next_run_begin = HEAP_CAPACITY - heap_size;
+
+    /// 5. Output runs until both the heap and the parked values are empty
+    std::vector<Run> runs;
+    while (next_run_begin < HEAP_CAPACITY) {
+        /// 5.1. The parked values become the heap of the next run
+        heap_size = HEAP_CAPACITY - next_run_begin;
+        std::move(heap + next_run_begin, heap + HEAP_CAPACITY, heap);
+        next_run_begin = HEAP_CAPACITY;
+        std::make_heap(heap, heap + heap_size, std::greater<>());
+        Run run{&tmp_file, next_write_offset + output_buffer_num_values * VALUE_SIZE, 0, 0, ENCODE};
+
+        /// 5.2. Output the minimum and replace it with the next input value
+        while (heap_size > 0) {
+            const Value min = heap[0];
+            output_buffer[output_buffer_num_values++] = min;
+            run.num_values++;
+            if (output_buffer_num_values == NUM_VALUE_IO_BUFFER) {
+                flush_output();
             }
+            Value value;
+            if (!next_input(value)) {
+                /// input is exhausted := the heap only shrinks
+                std::pop_heap(heap, heap + heap_size--, std::greater<>());
+            } else if (value >= min) {
+                /// value still belongs to the current run
+                replace_heap_top(heap, heap_size, value);
+            } else {
+                /// value belongs to the next run := park it in the slot freed at the end of the heap
+                std::pop_heap(heap, heap + heap_size--, std::greater<>());
+                heap[--next_run_begin] = value;
+                assert(next_run_begin == heap_size);
+            }
+        }
+        /// an encoded block must not span two runs
+        if (ENCODE) {
+            flush_output();
+        }
+        run.size = ENCODE ? next_write_offset - run.offset : run.num_values * VALUE_SIZE;
+        runs.push_back(run);
+    }
+    flush_output();
+    assert(ENCODE || next_write_offset == input_size);
+    return runs;
+}
 
-            /// free this buffer
-            memory.reset();
-            /// buffer this intermediate, copy it's content into tem file
-            /// Attention: This copy uses maybe more than mem_size memory XD
-            auto intermediate_data = intermediate_file->read_block(0, intermediate_file_size);
-            NUM_IO_READS++;
-            assert(std::is_sorted(reinterpret_cast<Value *>(intermediate_data.get()), reinterpret_cast<Value *>(intermediate_data.get()) + (intermediate_file_size / VALUE_SIZE)));
-            tmp_file->write_block(reinterpret_cast<char *>(intermediate_data.get()), RUN_SIZE * FAN_IN * it + odd_run_num_adjustment, intermediate_file_size);
-            NUM_IO_WRITES++;
-            /// Ff odd, merge two runs into one. Then we have even run number
-            if (it == num_iterations_in_pass - 1 && NUM_RUNS % FAN_IN != 0) {
-                assert(odd_run_num_adjustment == RUN_SIZE);
-                NUM_RUNS--;
-                it--;
-                LAST_RUN_SIZE += RUN_SIZE;
-                NUM_VALUES_LAST_RUN += NUM_VALUES_RUN;
-                continue;
+/// Copies `num_values` values from `offset` of `from` to `to_offset` of `to` through the buffer, in reverse order
+/// with `reverse`.
+void copy_values(File &from, size_t offset, size_t num_values, File &to, size_t to_offset, bool reverse, Value *buffer, size_t buffer_num_values) {
+    for (size_t i = 0; i < num_values; i += buffer_num_values) {
+        const size_t block_num_values = std::min(buffer_num_values, num_values - i);
+        const Value *values = scan_values(from, offset + i * VALUE_SIZE, block_num_values, buffer);
+        /// the values [i, i + block_num_values) of a reversed run end up at [num_values - i - block_num_values, num_values - i)
+        size_t write_index = i;
+        if (reverse) {
+            values = reverse_values(values, block_num_values, buffer);
+            write_index = num_values - i - block_num_values;
+        }
+        write_block(to, reinterpret_cast<const char *>(values), to_offset + write_index * VALUE_SIZE, block_num_values * VALUE_SIZE);
+    }
+}
+
+/// A maximal ascending or descending sequence of values in the input.
+struct NaturalRun {
+    /// Byte-offset of the first value in the input.
+    size_t offset;
+    /// Number of values.
+    size_t num_values;
+    /// Are the values descending, i.e. does the run have to be reversed.
+    bool descending;
+};
+
+/// Cuts the input into its natural runs, i.e. maximal ascending and descending sequences, in one sequential read with
+/// buffers of mem_size. Gives up as soon as there are more than `max_runs` runs, which random input reaches within
+/// the first buffer. While the input is a single run so far, every buffer is written right away to its place in the
+/// sorted output, so sorted and reverse sorted input are done with one read and one write.
+/// @param[in] input       File that contains the unsorted 64 bit unsigned integers.
+/// @param[in] num_values  Number of values to sort from the input.
+/// @param[in] output      File that gets the sorted values if the input is a single run.
+/// @param[in] mem_size    The maximum amount of main-memory in bytes that should be used.
+/// @param[in] arena       The memory budget the buffer is taken from.
+/// @param[in] max_runs    The maximum number of runs worth to keep.
+/// @return the natural runs in input order, empty if there are more than `max_runs`.
+std::vector<NaturalRun> detect_natural_runs(File &input, size_t num_values, File &output, size_t mem_size, MemoryArena &arena, size_t max_runs) {
+    const size_t NUM_VALUES_BUFFER = mem_size / VALUE_SIZE;
+    auto memory = arena.allocate(NUM_VALUES_BUFFER * VALUE_SIZE);
+    auto *buffer = reinterpret_cast<Value *>(memory.get());
+
+    /// 1. The open run := the values [run_begin, i), ascending until it has two different values
+    enum class Direction { UNKNOWN, ASCENDING, DESCENDING };
+    std::vector<NaturalRun> runs;
+    size_t run_begin = 0;
+    Direction direction = Direction::UNKNOWN;
+    Value previous = 0;
+    /// The direction in which the buffers of the first run were written to the output so far
+    Direction output_direction = Direction::ASCENDING;
+    bool output_complete = true;
+
+    for (size_t block_begin = 0; block_begin < num_values; block_begin += NUM_VALUES_BUFFER) {
+        const size_t block_num_values = std::min(NUM_VALUES_BUFFER, num_values - block_begin);
+        const Value *values = scan_values(input, block_begin * VALUE_SIZE, block_num_values, buffer);
+
+        /// 2. Extend the open run value by value, close it where the direction turns
+        for (size_t j = 0; j < block_num_values; j++) {
+            const size_t i = block_begin + j;
+            const Value value = values[j];
+            if (i > run_begin) {
+                if (direction == Direction::UNKNOWN && value != previous) {
+                    direction = value > previous ? Direction::ASCENDING : Direction::DESCENDING;
+                } else if ((direction == Direction::ASCENDING && value < previous) || (direction == Direction::DESCENDING && value > previous)) {
+                    runs.push_back({run_begin * VALUE_SIZE, i - run_begin, direction == Direction::DESCENDING});
+                    if (runs.size() >= max_runs) {
+                        return {};
+                    }
+                    run_begin = i;
+                    direction = Direction::UNKNOWN;
+                }
             }
+            previous = value;
+        }
+
+        /// 3. Still a single run := write the buffer to its place in the output, a descending one reversed
+        if (!runs.empty() || !output_complete) {
+            output_complete = false;
+            continue;
+        }
+        if (direction == Direction::DESCENDING && (output_direction == Direction::DESCENDING || block_begin == 0)) {
+            output_direction = Direction::DESCENDING;
+            const Value *reversed = reverse_values(values, block_num_values, buffer);
+            write_block(output, reinterpret_cast<const char *>(reversed), (num_values - block_begin - block_num_values) * VALUE_SIZE, block_num_values * VALUE_SIZE);
+        } else if (direction != Direction::DESCENDING && output_direction == Direction::ASCENDING) {
+            write_block(output, reinterpret_cast<const char *>(values), block_begin * VALUE_SIZE, block_num_values * VALUE_SIZE);
+        } else {
+            /// a long run of equal values was written ascending, but turned out to be descending
+            output_complete = false;
+            continue;
         }
-        NUM_RUNS /= FAN_IN;
-        LAST_RUN_SIZE += (RUN_SIZE * (FAN_IN - 1));
-        NUM_VALUES_LAST_RUN += (NUM_VALUES_RUN * (FAN_IN - 1));
-        RUN_SIZE *= FAN_IN;
-        NUM_VALUES_RUN *= FAN_IN;
-        assert(sort_phase_done(tmp_file, num_values, RUN_SIZE));
     }
+    runs.push_back({run_begin * VALUE_SIZE, num_values - run_begin, direction == Direction::DESCENDING});
+
+    /// 4. A single run the output did not get while reading := copy it over
+    if (runs.size() == 1 && !output_complete) {
+        copy_values(input, 0, num_values, output, 0, runs[0].descending, buffer, NUM_VALUES_BUFFER);
+    }
+    return runs;
 }
 
-/// Sorts 64 bit unsigned integers using in-memory std::sort.
+/// Reads all values into a buffer, and sorts them with std::sort, or the radix sort if its scratch memory and histograms fit as well.
+/// @param[in] arena      The memory budget the buffer is taken from.
+/// @param[out] buffer    The memory of the values.
+/// @return the sorted and aggregated words in the buffer, and their number.
+std::pair<const Value *, size_t> inmemory_sort_values(File &input, size_t num_values, size_t mem_size, RunSort run_sort, Aggregate aggregate, MemoryArena &arena, MemoryArena::Buffer &buffer) {
+    const size_t INPUT_SORT_SIZE = num_values * VALUE_SIZE;
+    if (sort_buffer_size(INPUT_SORT_SIZE, run_sort, false, aggregate) > mem_size) {
+        run_sort = RunSort::STD_SORT;
+    }
+    buffer = arena.allocate(sort_buffer_size(INPUT_SORT_SIZE, run_sort, false, aggregate));
+    read_block(input, 0, INPUT_SORT_SIZE, buffer.get());
+    auto *values = reinterpret_cast<Value *>(buffer.get());
+    auto *histograms = reinterpret_cast<size_t *>(buffer.get() + INPUT_SORT_SIZE * sort_buffer_factor(run_sort, aggregate));
+    const auto *sorted_values = sort_values(values, num_values, run_sort, histograms);
+    if (aggregate == Aggregate::NONE) {
+        return {sorted_values, num_values};
+    }
+    return {values, aggregate_run(values, sorted_values, num_values, aggregate)};
+}
+
+/// Sorts 64 bit unsigned integers using in-memory std::sort, or the radix sort if its scratch memory and histograms fit as well.
 /// @param[in] input      File that contains 64 bit unsigned integers which are
 ///                       stored as 8-byte little-endian values. This file may
 ///                       be in `READ` mode and should not be written to.
@@ -206,23 +1459,231 @@ void not_full_way_merge(File *tmp_file, size_t num_values, size_t mem_size,
 ///                       input.
 /// @param[in] output     File that should contain the sorted values in the
 ///                       end. This file must be in `WRITE` mode.
-void inmemory_sort(File &input, size_t num_values, File &output) {
-    const size_t INPUT_SORT_SIZE = num_values * VALUE_SIZE;
-    const auto input_file_buffer = input.read_block(0, INPUT_SORT_SIZE);
-    NUM_IO_READS++;
-    auto *const input_values = reinterpret_cast<Value *>(input_file_buffer.get());
-    std::sort(input_values, input_values + num_values);
-    output.write_block(input_file_buffer.get(), 0, INPUT_SORT_SIZE);
-    NUM_IO_WRITES++;
+/// @param[in] mem_size   The maximum amount of main-memory in bytes.
+/// @param[in] run_sort   Kernel that sorts the values.
+/// @param[in] aggregate  Collapse the equal values, the output is cut to the aggregated values.
+/// @param[in] arena      The memory budget the buffer is taken from.
+void inmemory_sort(File &input, size_t num_values, File &output, size_t mem_size, RunSort run_sort, Aggregate aggregate, MemoryArena &arena) {
+    MemoryArena::Buffer buffer;
+    const auto [sorted_values, num_words] = inmemory_sort_values(input, num_values, mem_size, run_sort, aggregate, arena, buffer);
+    const size_t output_size = num_words * VALUE_SIZE;
+    if (aggregate != Aggregate::NONE) {
+        output.resize(output_size);
+    }
+    write_block(output, reinterpret_cast<const char *>(sorted_values), 0, output_size);
     std::cout << "LOGGING OUTPUT: IN-MEMORY SORTING." << std::endl;
     std::cout << "NUM_IO_READS: " << NUM_IO_READS
               << ", NUM_IO_WRITES: " << NUM_IO_WRITES
               << ", NUM_IO: " << NUM_IO_READS + NUM_IO_WRITES << std::endl;
 }
 
+/// Writes the k smallest values in ascending order with a bounded max-heap of the k smallest values so far, in one
+/// sequential read of the input with the rest of mem_size as input buffer.
+/**
+  *  mem_size := heap, input buffer
+  *
+  *  0                                 k * VALUE_SIZE                                                   mem_size
+  *  ^                                        ^                                                            ^
+  *  -------------------------------------------------------------------------------------------------------
+  *  |     Max-Heap of the k smallest         |                     Input Buffer                           |
+  *  -------------------------------------------------------------------------------------------------------
+  */
+void heap_top_k(File &input, size_t num_values, size_t k, File &output, size_t mem_size, MemoryArena &arena) {
+    const size_t NUM_VALUES_MEMORY = mem_size / VALUE_SIZE;
+    assert(k > 0 && k < NUM_VALUES_MEMORY);
+    const size_t NUM_VALUE_INPUT_BUFFER = NUM_VALUES_MEMORY - k;
+    auto memory = arena.allocate(NUM_VALUES_MEMORY * VALUE_SIZE);
+    auto *heap = reinterpret_cast<Value *>(memory.get());
+    auto *input_buffer = heap + k;
+    size_t heap_size = 0;
+
+    for (size_t i = 0; i < num_values; i += NUM_VALUE_INPUT_BUFFER) {
+        const size_t load_num_values = std::min(NUM_VALUE_INPUT_BUFFER, num_values - i);
+        const Value *values = scan_values(input, i * VALUE_SIZE, load_num_values, input_buffer);
+        for (size_t j = 0; j < load_num_values; j++) {
+            const Value value = values[j];
+            if (heap_size < k) {
+                heap[heap_size++] = value;
+                std::push_heap(heap, heap + heap_size);
+            } else if (value < heap[0]) {
+                /// the largest of the k smallest so far is replaced
+                std::pop_heap(heap, heap + k);
+                heap[k - 1] = value;
+                std::push_heap(heap, heap + k);
+            }
+        }
+    }
+    std::sort_heap(heap, heap + k);
+    write_block(output, reinterpret_cast<const char *>(heap), 0, k * VALUE_SIZE);
+}
+
+/// Generates runs of mem_size that keep only what can still be among the k smallest values: at most the k smallest
+/// values of every run, and no values above a cutoff, which is the smallest k-th value of a run so far.
+/// @return the generated runs in the tmp file, one after another.
+std::vector<Run> top_k_runs(File &input, File &tmp_file, size_t num_values, size_t k, size_t mem_size, MemoryArena &arena) {
+    const size_t NUM_VALUE_RUN = mem_size / VALUE_SIZE;
+    auto memory = arena.allocate(NUM_VALUE_RUN * VALUE_SIZE);
+    auto *buffer = reinterpret_cast<Value *>(memory.get());
+    Value cutoff = std::numeric_limits<Value>::max();
+    size_t next_write_offset = 0;
+    std::vector<Run> runs;
+    for (size_t i = 0; i < num_values; i += NUM_VALUE_RUN) {
+        const size_t run_num_values = std::min(NUM_VALUE_RUN, num_values - i);
+        read_block(input, i * VALUE_SIZE, run_num_values * VALUE_SIZE, reinterpret_cast<char *>(buffer));
+        /// 1. Drop the values above the cutoff, and all but the k smallest of the rest
+        auto *end = std::partition(buffer, buffer + run_num_values, [&](Value value) { return value <= cutoff; });
+        const size_t keep = std::min<size_t>(end - buffer, k);
+        if (keep == 0) {
+            continue;
+        }
+        std::nth_element(buffer, buffer + keep - 1, end);
+        std::sort(buffer, buffer + keep);
+        if (keep == k) {
+            cutoff = std::min(cutoff, buffer[k - 1]);
+        }
+        /// 2. Write the rest out as the next run
+        write_block(tmp_file, reinterpret_cast<const char *>(buffer), next_write_offset, keep * VALUE_SIZE);
+        runs.push_back(plain_run(&tmp_file, next_write_offset, keep));
+        next_write_offset += keep * VALUE_SIZE;
+    }
+    return runs;
+}
+
+/// Settings of the merges of an external sort, which run generation depends on as well.
+struct MergeSettings {
+    /// 1 for synchronous I/O, 2 for double-buffered I/O on a background I/O thread.
+    size_t num_halves;
+    /// Number of threads of every merge.
+    size_t num_merge_threads;
+    /// Write the generated and the merged runs as `run_codec` blocks.
+    bool encode_runs;
+};
+
+/// Picks the merge settings of the options that mem_size allows.
+MergeSettings merge_settings(size_t mem_size, const ExternalSortOptions &options) {
+    const Aggregate AGGREGATE = options.aggregate;
+    /// Min is 3 := 2 for input, 1 for output | Less than 3 not possible for merging phase
+    assert((mem_size / VALUE_SIZE) >= 3);
+    /// Prefetching needs two halves of at least one value for 2 input buffers and the output buffer
+    const size_t NUM_HALVES = (options.prefetch && (mem_size / VALUE_SIZE) >= 6) ? 2 : 1;
+    /// Every merge thread needs room for a 2-way merge, an aggregating merge is sequential as its output size is unknown
+    const size_t NUM_MERGE_THREADS = AGGREGATE != Aggregate::NONE ? 1 : std::max<size_t>(1, std::min(options.num_merge_threads, mem_size / VALUE_SIZE / NUM_HALVES / 3));
+    /// The key ranges of a parallel merge need random access into the runs, so only a sequential merge reads encoded runs
+    const bool ENCODE_RUNS = options.encode_runs && options.num_merge_threads <= 1 && AGGREGATE == Aggregate::NONE;
+    return {NUM_HALVES, NUM_MERGE_THREADS, ENCODE_RUNS};
+}
+
+/// The sorted runs of an external sort.
+struct SortedRuns {
+    /// The runs in the tmp file, the ascending natural runs in the input, or the single natural run in the output.
+    std::vector<Run> runs;
+    /// The tmp file of the runs.
+    std::unique_ptr<File> tmp_file;
+};
+
+/// Generates sorted runs into a tmp file
+/**
+  *  tmp file := a set of runs
+  *
+  *  offset in file:
+  *  (n stands for the number of runs)
+  *
+  *  runs[0].offset          runs[1].offset          runs[2].offset          runs[3].offset          runs[n-1].offset
+  *  ^                       ^                       ^                       ^                       ^
+  *  ---------------------------------------------------------------------------------------------------------
+  *  |         Run 0         |         Run 1         |         Run 2         |          ...          |Run n-1|
+  *  ---------------------------------------------------------------------------------------------------------
+  *                                                                                                  ^
+  *                                                  with RunGeneration::SORT the last run may be not full
+  */
+/// @param[in] output With `options.detect_presorted`, the file of at least `num_values` values that holds the input
+///                    if it turns out to be a single natural run.
+/// @param[in] spill  Creates the tmp file.
+/// @param[in] arena  The memory budget of `mem_size` bytes the buffers are taken from.
+SortedRuns generate_runs(File &input, size_t num_values, File *output, size_t mem_size, const ExternalSortOptions &options, const MergeSettings &settings, SpillSpace &spill, MemoryArena &arena) {
+    const size_t INPUT_SORT_SIZE = num_values * VALUE_SIZE;
+    const Aggregate AGGREGATE = options.aggregate;
+    const size_t AGGREGATE_WORDS = aggregate_words(AGGREGATE);
+    const size_t NUM_HALVES = settings.num_halves;
+    const size_t NUM_MERGE_THREADS = settings.num_merge_threads;
+    const bool ENCODE_RUNS = settings.encode_runs;
+
+    /// 2.1. Natural runs := presorted input, as long as its runs are not shorter than generated ones, and a single merge
+    ///      of them is enough
+    std::vector<NaturalRun> natural_runs;
+    if (options.detect_presorted && AGGREGATE == Aggregate::NONE) {
+        const size_t MAX_NATURAL_RUNS = std::min(INPUT_SORT_SIZE / mem_size + 1, max_fan_in(mem_size / NUM_MERGE_THREADS, NUM_HALVES));
+        natural_runs = detect_natural_runs(input, num_values, *output, mem_size, arena, MAX_NATURAL_RUNS);
+        std::cout << "LOGGING OUTPUT: " << (natural_runs.empty() ? "NO" : std::to_string(natural_runs.size())) << " NATURAL RUNS." << std::endl;
+    }
+    /// 2.2. A single natural run is already in the output
+    if (natural_runs.size() == 1) {
+        return {{plain_run(output, 0, num_values)}, nullptr};
+    }
+
+    /// 2.3. New a tmp file having same size as INPUT_SORT_SIZE, or as the descending natural runs
+    ///      Encoded blocks of replacement selection take at most one word more than their at least MIN_VALUES_ENCODED_BLOCK values.
+    auto tmp_file = spill.make_temporary_file();
+    size_t tmp_file_size = INPUT_SORT_SIZE * AGGREGATE_WORDS + (ENCODE_RUNS ? (num_values / MIN_VALUES_ENCODED_BLOCK + 1) * VALUE_SIZE : 0);
+    if (!natural_runs.empty()) {
+        tmp_file_size = 0;
+        for (const auto &natural_run : natural_runs) {
+            tmp_file_size += natural_run.descending ? natural_run.num_values * VALUE_SIZE : 0;
+        }
+    }
+    tmp_file->resize(tmp_file_size);
+    NUM_IO_WRITES++;
+    std::vector<Run> runs;
+    if (!natural_runs.empty()) {
+        /// 2.4. Ascending natural runs are merged right from the input, descending ones are reversed into the tmp file
+        auto buffer = arena.allocate(mem_size);
+        size_t tmp_offset = 0;
+        for (const auto &natural_run : natural_runs) {
+            if (!natural_run.descending) {
+                runs.push_back(plain_run(&input, natural_run.offset, natural_run.num_values));
+                continue;
+            }
+            copy_values(input, natural_run.offset, natural_run.num_values, *tmp_file, tmp_offset, true, reinterpret_cast<Value *>(buffer.get()), mem_size / VALUE_SIZE);
+            runs.push_back(plain_run(tmp_file.get(), tmp_offset, natural_run.num_values));
+            tmp_offset += natural_run.num_values * VALUE_SIZE;
+        }
+    } else if (options.run_generation == RunGeneration::REPLACEMENT_SELECTION && AGGREGATE == Aggregate::NONE) {
+        /// 2.5. Replacement selection := runs of variable size, about 2 * mem_size on random input
+        runs = replacement_selection(input, *tmp_file, INPUT_SORT_SIZE, mem_size, arena, ENCODE_RUNS);
+        std::cout << "LOGGING OUTPUT: REPLACEMENT SELECTION GENERATED " << runs.size() << " RUNS." << std::endl;
+    } else {
+        /// 2.6. Init sorting phase
+        /// a radix sort needs its histograms and a scratch buffer of the run size, so it needs room for them and at least
+        /// two values
+        const RunSort RUN_SORT = mem_size >= sort_buffer_size(VALUE_SIZE, options.run_sort, false, AGGREGATE) ? options.run_sort : RunSort::STD_SORT;
+        const size_t BUFFER_FACTOR = sort_buffer_factor(RUN_SORT, AGGREGATE);
+        const size_t HISTOGRAMS_SIZE = sort_histograms_size(RUN_SORT);
+        /// every thread gets the same share of mem_size, but at least one value
+        const size_t NUM_THREADS = std::max<size_t>(1, std::min(options.num_threads, mem_size / sort_buffer_size(VALUE_SIZE, RUN_SORT, false, AGGREGATE)));
+        /// an encoded run needs room for its block header, and enough values to pay off the header
+        const bool ENCODE_SORTED_RUNS = ENCODE_RUNS && (mem_size / NUM_THREADS - HISTOGRAMS_SIZE) / BUFFER_FACTOR / VALUE_SIZE >= run_codec::HEADER_WORDS + MIN_VALUES_ENCODED_BLOCK;
+        const size_t HEADROOM_SIZE = ENCODE_SORTED_RUNS ? run_codec::HEADER_WORDS * VALUE_SIZE : 0;
+        /// the size of run.
+        const size_t RUN_SIZE = ((mem_size / NUM_THREADS - HEADROOM_SIZE - HISTOGRAMS_SIZE) / BUFFER_FACTOR) / VALUE_SIZE * VALUE_SIZE;
+        assert(RUN_SIZE > 0);
+        assert(sort_buffer_size(RUN_SIZE, RUN_SORT, ENCODE_SORTED_RUNS, AGGREGATE) * NUM_THREADS <= mem_size);
+        /// number of runs, the last one maybe not full => so ceil
+        const size_t NUM_RUNS = (INPUT_SORT_SIZE - 1) / RUN_SIZE + 1;
+
+        /// 2.7. Sort each run, NUM_THREADS runs at the same time, each thread with its share of mem_size
+        ///      An encoded run takes less than RUN_SIZE in the tmp file, but still starts at its offset in the input.
+        runs = parallel_sort_runs(input, *tmp_file, INPUT_SORT_SIZE, RUN_SIZE, NUM_THREADS, RUN_SORT, ENCODE_SORTED_RUNS, AGGREGATE, arena);
+        assert(runs.size() == NUM_RUNS);
+    }
+
+    /// 2.8. Check if sorted in tmp file, through the budget that run generation left free
+    assert(!natural_runs.empty() || AGGREGATE != Aggregate::NONE || sort_phase_done(tmp_file.get(), num_values, runs, arena));
+    return {std::move(runs), std::move(tmp_file)};
+}
+
 } // namespace
 
-void external_sort(File& input, size_t num_values, File& output, size_t mem_size) {
+void external_sort(File& input, size_t num_values, File& output, size_t mem_size, const ExternalSortOptions& options) {
     /// 0. Init
     /// 0.1. Assumption: the mem_size is multiple time of 8
     assert(mem_size % VALUE_SIZE == 0);
@@ -232,7 +1693,15 @@ void external_sort(File& input, size_t num_values, File& output, size_t mem_size
     /// 0.3. Input file should have more or equal the size of sorting values
     const size_t INPUT_SORT_SIZE = num_values * VALUE_SIZE;
     assert(input.size() >= INPUT_SORT_SIZE);
-    output.resize(INPUT_SORT_SIZE);
+    /// 0.4. A counted output takes up to twice the input, an aggregated output is cut in the end
+    const Aggregate AGGREGATE = options.aggregate;
+    const size_t AGGREGATE_WORDS = aggregate_words(AGGREGATE);
+    output.resize(INPUT_SORT_SIZE * AGGREGATE_WORDS);
+    /// 0.5. Tmp files in the spill directories, all buffers from one allocation of mem_size, and measure the phases if
+    ///      asked to
+    SpillSpace spill(options);
+    MemoryArena arena(mem_size);
+    StatsRecorder stats(options.stats, &spill, &arena);
 
     /// 1. Edge cases
     /// 1.1. Edge Case: no values to sort, return directly
@@ -240,9 +1709,12 @@ void external_sort(File& input, size_t num_values, File& output, size_t mem_size
         std::cout << "LOGGING OUTPUT: NO VALUE FOR SORTING." << std::endl;
         return;
     }
-    /// 1.2. Edges Case: fits actually into main memory
-    if (INPUT_SORT_SIZE <= mem_size) {
-        return inmemory_sort(input, num_values, output);
+    /// 1.2. Edges Case: fits actually into main memory, with the room for the counts
+    if (INPUT_SORT_SIZE * AGGREGATE_WORDS <= mem_size) {
+        inmemory_sort(input, num_values, output, mem_size, options.run_sort, AGGREGATE, arena);
+        stats.end_phase(StatsRecorder::RUN_GENERATION);
+        stats.set_runs(1, 0);
+        return;
     }
 
     /// -------------------------------------------------------------------------------------------------------------------------------------------
@@ -253,238 +1725,230 @@ void external_sort(File& input, size_t num_values, File& output, size_t mem_size
     /// ------------------------------------SORTING------------------------------------
     /// -------------------------------------------------------------------------------
 
-    /// 2. Sort each run having the size of mem_size
-    /**
-      *  tmp file / input file := a set of runs
-      *
-      *  offset in file:
-      *  (n stands for NUM_RUNS)
-      *
-      *  0                    mem_size                mem_size*2              mem_size*3              mem_size*(n-1)
-      *  ^                       ^                       ^                       ^                       ^
-      *  ---------------------------------------------------------------------------------------------------------
-      *  |         Run 0         |         Run 1         |         Run 2         |          ...          |Run n-1|
-      *  ---------------------------------------------------------------------------------------------------------
-      *                                                                                                  ^
-      *                                                                                                  the last run may be not full
-      */
-
-    /// 2.1. Init sorting phase
-    /// number of runs, the last one maybe not full => so ceil
-    size_t NUM_RUNS = (INPUT_SORT_SIZE - 1) / mem_size + 1;
-    /// the size of run.
-    size_t RUN_SIZE = mem_size;
-    /// number of values in normal run (not the last run)
-    size_t NUM_VALUES_RUN = mem_size / VALUE_SIZE;
-    /// the size of last run. if last is full, then with mem_size.
-    size_t LAST_RUN_SIZE = (INPUT_SORT_SIZE == NUM_RUNS * RUN_SIZE) ? RUN_SIZE : INPUT_SORT_SIZE - (NUM_RUNS - 1) * RUN_SIZE;
-    assert(LAST_RUN_SIZE <= mem_size);
-    /// number of values in the last run
-    assert(LAST_RUN_SIZE % VALUE_SIZE == 0);
-    size_t NUM_VALUES_LAST_RUN = LAST_RUN_SIZE / VALUE_SIZE;
-
-    /// 2.2. New a tmp file having same size as INPUT_SORT_SIZE
-    auto tmp_file = File::make_temporary_file();
-    tmp_file->resize(INPUT_SORT_SIZE);
-    NUM_IO_WRITES++;
-
-    /// 2.3. Sort each runs having full utilized mem_size
-    size_t offset = 0;
-    for (size_t i = 0; i < NUM_RUNS - 1; i++, offset += RUN_SIZE) {
-        /// 2.3.1. Read a run (but not the last one) from input file
-        const auto input_file_buffer = input.read_block(offset, RUN_SIZE);
-        NUM_IO_READS++;
-        /// 2.3.2. Sort it
-        auto *input_values = reinterpret_cast<Value*>(input_file_buffer.get());
-        std::sort(input_values, input_values + NUM_VALUES_RUN);
-        /// 2.3.3. Write this sorted run out to tmp file
-        tmp_file->write_block(reinterpret_cast<char*>(input_values), offset, RUN_SIZE);
-        NUM_IO_WRITES++;
+    /// 2. Generate sorted runs into a tmp file, see generate_runs()
+    const MergeSettings settings = merge_settings(mem_size, options);
+    const size_t NUM_HALVES = settings.num_halves;
+    const size_t NUM_MERGE_THREADS = settings.num_merge_threads;
+    const bool ENCODE_RUNS = settings.encode_runs;
+    const SortedRuns sorted_runs = generate_runs(input, num_values, &output, mem_size, options, settings, spill, arena);
+    const std::vector<Run> &runs = sorted_runs.runs;
+    stats.end_phase(StatsRecorder::RUN_GENERATION);
+    /// 2.1. A single natural run is already in the output
+    if (runs.size() == 1 && runs[0].file == &output) {
+        stats.set_runs(1, 0);
+        return;
     }
 
-    /// 2.3.4. Read the last run from input file
-    const auto input_file_buffer = input.read_block(offset, LAST_RUN_SIZE);
-    NUM_IO_READS++;
-    /// 2.3.5. Sort it
-    auto *input_values = reinterpret_cast<Value*>(input_file_buffer.get());
-    std::sort(input_values, input_values + NUM_VALUES_LAST_RUN);
-    /// 2.3.6. Write this sorted last run out to tmp file
-    tmp_file->write_block(input_file_buffer.get(), offset, LAST_RUN_SIZE);
-    NUM_IO_WRITES++;
-
-    /// 2.3.7. Check if sorted in tmp file => this function use more than mem_size memory for checking
-    assert(sort_phase_done(tmp_file.get(), num_values, RUN_SIZE));
-
 
 
     /// -------------------------------------------------------------------------------
     /// ------------------------------------MERGING------------------------------------
     /// -------------------------------------------------------------------------------
-    /// Min is 3 := 2 for input, 1 for output | Less than 3 not possible for merging phase
-    assert((mem_size / VALUE_SIZE) >= 3);
 
-    /// 3. Not Full Merge := with intermediate passes and terrible I/O number, since memory size too little
-    ///    mem_size can not be devided into (NUM_RUNS + 1) parts ==> FAN_IN can't be NUM_RUNS
-    ///    try to divide mem_size into FAN_IN parts
-    if ((mem_size / (NUM_RUNS + 1)) / VALUE_SIZE == 0) {
+    stats.start_phase();
+
+    /// 3. Plan the merge
+    ///    mem_size can be devided into (NUM_RUNS + 1) parts ==> Full K-way Merge without any intermediate passes
+    ///    otherwise ==> Not Full Merge := intermediate merges with the largest fan-in mem_size allows, smallest runs first
+    ///    Every merge thread merges with its share of mem_size, so the fan-in depends on the share.
+    const MergePlan plan = plan_run_merge(runs, mem_size / NUM_MERGE_THREADS, NUM_HALVES);
+    if (plan.steps.size() > 1) {
         std::cout << "LOGGING OUTPUT: NOT FULL K WAY SORTING." << std::endl;
-        not_full_way_merge(tmp_file.get(), num_values, mem_size, NUM_RUNS, NUM_VALUES_RUN, NUM_VALUES_LAST_RUN, RUN_SIZE, LAST_RUN_SIZE);
     } else {
         std::cout << "LOGGING OUTPUT: FULL K WAY SORTING." << std::endl;
     }
+    std::cout << "LOGGING OUTPUT: MERGE PLAN WITH FAN-IN " << plan.fan_in << ": " << plan.num_passes << " PASSES, "
+              << plan.steps.size() << " MERGES, " << plan.size_to_move << " BYTES TO MOVE." << std::endl;
 
-    /// 4. Full K-way Merge := partitioning mem_size into K input buffers and 1 output buffer without any intermediate passes
-    /**
-      *  mem_size := a set of K input buffers and 1 output buffer
-      *
-      *  IN HEAP ALLOCATED
-      *  (n stands for NUM_RUNS)
-      *
-      *  0           buffer_size       buffer_size*2     buffer_size*3    buffer_size*(n-1)  buffer_size*n            mem_size
-      *  ^                 ^                 ^                 ^                 ^                 ^                  ^
-      *  --------------------------------------------------------------------------------------------------------------
-      *  |   Run 0 Buffer  |   Run 1 Buffer  |   Run 2 Buffer  |   ............  |   Run n Buffer  |   Output Buffer  |
-      *  --------------------------------------------------------------------------------------------------------------
-      *  ^                                                                                         ^
-      *  | <-----------------------------------Input Buffer--------------------------------------->|
-      *
-      */
-
-    /// 4.1 Init Merge phase.
-    const size_t FAN_IN = NUM_RUNS;
-    /// 4.1.1. Get the buffer size and number values in buffer.
-    /// Make sure Input Buffer Size is multiple time of 8.
-    const size_t NUM_VALUE_INPUT_BUFFER = (mem_size / (FAN_IN + 1)) / VALUE_SIZE;
-    const size_t INPUT_BUFFER_SIZE = NUM_VALUE_INPUT_BUFFER * VALUE_SIZE;
-    assert(NUM_VALUE_INPUT_BUFFER > 0);
-    assert(INPUT_BUFFER_SIZE > 0);
-    assert(INPUT_BUFFER_SIZE % 8 == 0);
-    /// Make sure Output Buffer Size is multiple time of 8.
-    const size_t NUM_VALUE_OUTPUT_BUFFER = (mem_size - FAN_IN * INPUT_BUFFER_SIZE) / VALUE_SIZE;
-    const size_t OUT_BUFFER_SIZE = NUM_VALUE_OUTPUT_BUFFER * VALUE_SIZE;
-    assert(OUT_BUFFER_SIZE > 0);
-    assert(OUT_BUFFER_SIZE % 8 == 0);
-    /// 4.1.2. Make sure heap usage not to exceed the mem_size.
-    assert(INPUT_BUFFER_SIZE * FAN_IN + OUT_BUFFER_SIZE <= mem_size);
+    /// 4. Merge := all merges but the last into tmp files, the last is a Full K-way Merge into the output
+    const Run merged = execute_merge_plan(plan, runs, spill, output, mem_size, arena, NUM_HALVES, NUM_MERGE_THREADS, ENCODE_RUNS, SIZE_MAX, AGGREGATE);
+    if (AGGREGATE != Aggregate::NONE) {
+        output.resize(merged.size);
+        std::cout << "LOGGING OUTPUT: " << merged.num_values << " DISTINCT VALUES." << std::endl;
+    }
+    stats.end_phase(StatsRecorder::MERGE);
+    stats.set_runs(runs.size(), plan.num_passes, plan.fan_in);
+    if (ENCODE_RUNS) {
+        std::cout << "LOGGING OUTPUT: ENCODED RUNS: " << NUM_RUN_BYTES_ENCODED << " OF " << NUM_RUN_BYTES_RAW << " BYTES, COMPRESSION RATIO "
+                  << static_cast<double>(NUM_RUN_BYTES_RAW) / static_cast<double>(std::max<size_t>(1, NUM_RUN_BYTES_ENCODED)) << "." << std::endl;
+    }
+    spill.log();
+    std::cout << "LOGGING OUTPUT: PEAK MEMORY " << arena.peak() << " OF " << mem_size << " BYTES." << std::endl;
+    std::cout << "NUM_IO_READS: " << NUM_IO_READS << ", NUM_IO_WRITES: " << NUM_IO_WRITES << ", NUM_IO: " << NUM_IO_READS + NUM_IO_WRITES << std::endl;
+}
 
-    /// 4.1.3. Bookkeeping Values + std::vectors
-    /// for output buffer size, for reading file, for input buffer index, for remaining number in runs.
+void external_top_k(File& input, size_t num_values, size_t k, File& output, size_t mem_size) {
+    /// 0. Init, see external_sort()
+    assert(mem_size % VALUE_SIZE == 0);
+    assert(input.get_mode() == File::Mode::READ);
+    assert(output.get_mode() == File::Mode::WRITE);
+    assert(input.size() >= num_values * VALUE_SIZE);
+    const size_t K = std::min(k, num_values);
+    output.resize(K * VALUE_SIZE);
 
-    /// output_buffer_current_num_values := current size of output buffer, value range is [0, OUT_BUFFER_SIZE).
-    size_t output_buffer_current_num_values = 0;
-    /// next_read_offset_run             := next byte-offset to read of each run, assuming first read loaded into input buffer.
-    /// Improvement after grading: Never use a variable-sized array! Use a std::vector.
-    std::vector<size_t> next_read_offset_run(FAN_IN, 0);
-    /// next_push_index_input_buffer     := next uint64-index to push into priority heap of each input buffer, assuming first read loaded into priority queue.
+    /// 1. Edge cases
+    /// 1.1. Edge Case: no values to write, return directly
+    if (K == 0) {
+        std::cout << "LOGGING OUTPUT: NO VALUE FOR TOP-K." << std::endl;
+        return;
+    }
+    /// 1.2. Edge Case: all values := sort them all
+    if (K == num_values) {
+        return external_sort(input, num_values, output, mem_size);
+    }
 
-    /// Improvement after grading: Never use a variable-sized array! Use a std::vector allocated at Heap.
-    /// value range is [0, NUM_VALUE_INPUT_BUFFER)
-    std::vector<size_t> next_push_index_input_buffer(FAN_IN, 0);
-    /// remaining_num_values_run         := remaining values to be output-ed in each run.
-    /// Improvement after grading: Never use a variable-sized array! Use a std::vector.
-    std::vector<size_t> remaining_num_values_run(FAN_IN, 0);
-    for (size_t i = 0; i < FAN_IN - 1; i++) {
-        next_read_offset_run[i] = INPUT_BUFFER_SIZE;
-        next_push_index_input_buffer[i] = 1;
-        remaining_num_values_run[i] = NUM_VALUES_RUN;
-    }
-    next_read_offset_run[FAN_IN - 1] = INPUT_BUFFER_SIZE;
-    next_push_index_input_buffer[FAN_IN - 1] = 1;
-    remaining_num_values_run[FAN_IN - 1] = NUM_VALUES_LAST_RUN;
-
-    /// 4.1.4. Allocate mem_size memory, and pick out base point array to each input buffer
-    auto memory = std::make_unique<char[]>(mem_size);
-    char *memory_ptr = reinterpret_cast<char*>(memory.get());
-    /// Improvement after grading: Never use a variable-sized array! Use a std::vector allocated at Heap.
-    std::vector<Value*> input_buffer_base_ptrs(FAN_IN, nullptr);
-    auto *output_buffer_base_ptr = reinterpret_cast<Value*>(memory_ptr + INPUT_BUFFER_SIZE * FAN_IN);
-
-    /// 4.1.5. Load NUM_VALUE_INPUT_BUFFER values into read buffers
-    for (size_t i = 0, buffer_offset = 0, tmpfile_offset = 0; i < FAN_IN; i++, buffer_offset += INPUT_BUFFER_SIZE, tmpfile_offset += RUN_SIZE) {
-        input_buffer_base_ptrs[i] = reinterpret_cast<Value*>(memory_ptr + buffer_offset);
-        tmp_file->read_block(tmpfile_offset, INPUT_BUFFER_SIZE, memory_ptr + buffer_offset);
-        NUM_IO_READS++;
-    }
-
-    /// 4.1.6. Figure := After first time reading into input buffers
-    /**
-      *  tmp file := a set of runs
-      *
-      *  offset in file:
-      *  (n stands for NUM_RUNS)
-      *  (--- := loaded into input buffer)
-      *
-      *  0                    mem_size                mem_size*2              mem_size*3             mem_size*(n-1)
-      *  ^                       ^                       ^                       ^                      ^
-      *  -----------------------------------------------------------------------------------------------------------
-      *  |---      Run 0         |---      Run 1         |---      Run 2         |---      ...          |---Run n-1|
-      *  -----------------------------------------------------------------------------------------------------------
-      *                                                                                                 ^
-      *                                                                                                 the last run may be not full
-      */
-
-    /// 4.1.7. Init a priority queue, add the first value of each Input Buffer.
-    std::priority_queue<PQ_Element, std::vector<PQ_Element>, std::greater<PQ_Element>> pq;  // NOLINT
-    for (size_t i = 0; i < FAN_IN; i++) {
-        pq.emplace(*(input_buffer_base_ptrs[i]), i);
-    }
-
-    /// 4.2. Merge using while looping a std::priority_queue.
-    size_t num_full_writes = 0;
-    while (!pq.empty()) {
-        /// 4.2.1. Pop min value
-        const PQ_Element top = pq.top();
-        pq.pop();
-        /// 4.2.1. Write it into output buffer
-        *(output_buffer_base_ptr + output_buffer_current_num_values++) = top.first;
-        /// 4.2.3. Locate which run the min comes from.
-        const Input_Buffer_Index ib_index = top.second;
-        /// 4.2.4. Decrement remaining values in this run.
-        remaining_num_values_run[ib_index]--;
+    /// 2. K values fit into half of mem_size := bounded heap in a single pass, the other half is the input buffer
+    MemoryArena arena(mem_size);
+    if (K <= mem_size / VALUE_SIZE / 2) {
+        heap_top_k(input, num_values, K, output, mem_size, arena);
+        std::cout << "LOGGING OUTPUT: TOP-K WITH A BOUNDED HEAP." << std::endl;
+        std::cout << "NUM_IO_READS: " << NUM_IO_READS << ", NUM_IO_WRITES: " << NUM_IO_WRITES << ", NUM_IO: " << NUM_IO_READS + NUM_IO_WRITES << std::endl;
+        return;
+    }
 
-        /// 4.2.5. If full in output buffer, write out to output file.
-        if (output_buffer_current_num_values == NUM_VALUE_OUTPUT_BUFFER) {
-            assert(std::is_sorted(output_buffer_base_ptr, output_buffer_base_ptr + NUM_VALUE_OUTPUT_BUFFER));
-            output.write_block(reinterpret_cast<char*>(output_buffer_base_ptr), (num_full_writes++) * OUT_BUFFER_SIZE, OUT_BUFFER_SIZE);
-            NUM_IO_WRITES++;
-            output_buffer_current_num_values = 0;
-        }
+    /// 3. Runs of mem_size cut to their K smallest values
+    assert((mem_size / VALUE_SIZE) >= 3);
+    auto tmp_file = File::make_temporary_file();
+    tmp_file->resize(((num_values - 1) / (mem_size / VALUE_SIZE) + 1) * std::min(K, mem_size / VALUE_SIZE) * VALUE_SIZE);
+    NUM_IO_WRITES++;
+    const auto runs = top_k_runs(input, *tmp_file, num_values, K, mem_size, arena);
 
-        /// 4.2.6. This run is done / empty.
-        if (remaining_num_values_run[ib_index] == 0) {
-            continue;
-        }
+    /// 4. Merge, every merge stops after the first K values
+    const MergePlan plan = plan_run_merge(runs, mem_size, 1);
+    std::cout << "LOGGING OUTPUT: TOP-K OF " << runs.size() << " RUNS, MERGE PLAN WITH FAN-IN " << plan.fan_in << ": " << plan.num_passes << " PASSES." << std::endl;
+    SpillSpace spill;
+    execute_merge_plan(plan, runs, spill, output, mem_size, arena, 1, 1, false, K);
+    std::cout << "NUM_IO_READS: " << NUM_IO_READS << ", NUM_IO_WRITES: " << NUM_IO_WRITES << ", NUM_IO: " << NUM_IO_READS + NUM_IO_WRITES << std::endl;
+}
 
-        /// 4.2.7. If done / all-used-up in input buffer, read next part of run into input run.
-        if (next_push_index_input_buffer[ib_index] == NUM_VALUE_INPUT_BUFFER) {
-            const bool if_last_run = ib_index == (FAN_IN - 1);
-            if (if_last_run ? next_read_offset_run[ib_index] + INPUT_BUFFER_SIZE >= LAST_RUN_SIZE : next_read_offset_run[ib_index] + INPUT_BUFFER_SIZE >= RUN_SIZE) {
-                /// last load from this run.
-                const size_t last_load_size = if_last_run ? LAST_RUN_SIZE - next_read_offset_run[ib_index] : RUN_SIZE - next_read_offset_run[ib_index];
-                assert(last_load_size % 8 == 0);
-                tmp_file->read_block(next_read_offset_run[ib_index] + RUN_SIZE * ib_index, last_load_size, reinterpret_cast<char*>(input_buffer_base_ptrs[ib_index]));
-                assert(std::is_sorted(input_buffer_base_ptrs[ib_index], input_buffer_base_ptrs[ib_index] + (last_load_size / VALUE_SIZE)));
-                next_read_offset_run[ib_index] += last_load_size;
-            } else {
-                /// Load from run (not the last load).
-                tmp_file->read_block(next_read_offset_run[ib_index] + RUN_SIZE * ib_index, INPUT_BUFFER_SIZE, reinterpret_cast<char*>(input_buffer_base_ptrs[ib_index]));
-                assert(std::is_sorted(input_buffer_base_ptrs[ib_index], input_buffer_base_ptrs[ib_index] + NUM_VALUE_INPUT_BUFFER));
-                next_read_offset_run[ib_index] += INPUT_BUFFER_SIZE;
-            }
-            NUM_IO_READS++;
-            next_push_index_input_buffer[ib_index] = 0;
-        }
-        /// 4.2.8. Load next one from this input buffer to the std::priority_queue.
-        pq.emplace(*(input_buffer_base_ptrs[ib_index] + next_push_index_input_buffer[ib_index]++), ib_index);
+/// The state of a `SortedStream` := either the sorted values in memory, or the last merge with its files.
+struct SortedStream::Impl {
+    Impl(const ExternalSortOptions &options, size_t mem_size)
+        : spill(options), arena(mem_size), stats(options.stats, &spill, &arena), AGGREGATE(options.aggregate), AGGREGATE_WORDS(aggregate_words(options.aggregate)) {}
+
+    /// The tmp files must not outlive their counters.
+    SpillSpace spill;
+    /// The buffers must not outlive their memory.
+    MemoryArena arena;
+    StatsRecorder stats;
+    const Aggregate AGGREGATE;
+    const size_t AGGREGATE_WORDS;
+    /// The sorted values if they fit into memory, handed out as a single batch.
+    MemoryArena::Buffer inmemory_buffer;
+    Batch inmemory_batch;
+    /// The file natural runs are detected into, which holds the single run of presorted input.
+    std::unique_ptr<File> presorted_file;
+    SortedRuns sorted_runs;
+    /// The tmp files of the intermediate merges.
+    std::vector<std::unique_ptr<File>> merged_files;
+    /// The input buffers of the last merge followed by the batch buffer.
+    MemoryArena::Buffer memory;
+    Value *batch_buffer = nullptr;
+    size_t batch_num_words = 0;
+    /// The I/O queue must not outlive the memory, and the merger must not outlive the I/O queue.
+    std::unique_ptr<IoQueue> io;
+    std::unique_ptr<RunMerger> merger;
+};
+
+SortedStream::SortedStream(File& input, size_t num_values, size_t mem_size, const ExternalSortOptions& options)
+    : impl(std::make_unique<Impl>(options, mem_size)) {
+    /// 0. Init, see external_sort()
+    assert(mem_size % VALUE_SIZE == 0);
+    assert(input.get_mode() == File::Mode::READ);
+    const size_t INPUT_SORT_SIZE = num_values * VALUE_SIZE;
+    assert(input.size() >= INPUT_SORT_SIZE);
+    Impl &state = *impl;
+    const Aggregate AGGREGATE = state.AGGREGATE;
+
+    /// 1. Edge cases
+    /// 1.1. Edge Case: no values to sort, the first batch is empty
+    if (num_values == 0) {
+        return;
+    }
+    /// 1.2. Edges Case: fits actually into main memory := a single batch
+    if (INPUT_SORT_SIZE * state.AGGREGATE_WORDS <= mem_size) {
+        const auto [sorted_values, num_words] = inmemory_sort_values(input, num_values, mem_size, options.run_sort, AGGREGATE, state.arena, state.inmemory_buffer);
+        state.inmemory_batch = {sorted_values, num_words};
+        state.stats.end_phase(StatsRecorder::RUN_GENERATION);
+        state.stats.set_runs(1, 0);
+        return;
     }
-    /// 4.2.9 The std::priority_queue is empty. But output buffer maybe still have to write out from output buffer.
-    const size_t num_full_write = INPUT_SORT_SIZE / OUT_BUFFER_SIZE;
-    if (INPUT_SORT_SIZE > OUT_BUFFER_SIZE * num_full_write) {
-        assert(std::is_sorted(output_buffer_base_ptr, output_buffer_base_ptr + ((INPUT_SORT_SIZE - OUT_BUFFER_SIZE * num_full_write) / VALUE_SIZE)));
-        output.write_block(reinterpret_cast<char*>(output_buffer_base_ptr), num_full_writes * OUT_BUFFER_SIZE, INPUT_SORT_SIZE - OUT_BUFFER_SIZE * num_full_write);
+
+    /// 2. Generate sorted runs, a single natural run ends up in a tmp file instead of the output
+    const MergeSettings settings = merge_settings(mem_size, options);
+    if (options.detect_presorted && AGGREGATE == Aggregate::NONE) {
+        state.presorted_file = state.spill.make_temporary_file();
+        state.presorted_file->resize(INPUT_SORT_SIZE);
         NUM_IO_WRITES++;
     }
-    std::cout << "NUM_IO_READS: " << NUM_IO_READS << ", NUM_IO_WRITES: " << NUM_IO_WRITES << ", NUM_IO: " << NUM_IO_READS + NUM_IO_WRITES << std::endl;
+    state.sorted_runs = generate_runs(input, num_values, state.presorted_file.get(), mem_size, options, settings, state.spill, state.arena);
+    const std::vector<Run> &runs = state.sorted_runs.runs;
+    state.stats.end_phase(StatsRecorder::RUN_GENERATION);
+
+    /// 3. All merges but the last, see external_sort()
+    state.stats.start_phase();
+    std::vector<Run> last_runs = runs;
+    size_t num_passes = 1;
+    size_t fan_in = runs.size();
+    if (runs.size() > 1) {
+        /// the fan-in of the last merge leaves room for a batch of a whole (value, count) pair
+        const size_t PLAN_MEM_SIZE = mem_size - (state.AGGREGATE_WORDS - 1) * VALUE_SIZE;
+        const MergePlan plan = plan_run_merge(runs, PLAN_MEM_SIZE / settings.num_merge_threads, settings.num_halves);
+        last_runs = execute_intermediate_merges(plan, runs, state.spill, state.merged_files, mem_size, state.arena, settings.num_halves, settings.num_merge_threads, settings.encode_runs, SIZE_MAX, AGGREGATE);
+        num_passes = plan.num_passes;
+        fan_in = plan.fan_in;
+    }
+    std::cout << "LOGGING OUTPUT: SORTED STREAM OVER " << last_runs.size() << " OF " << runs.size() << " RUNS." << std::endl;
+
+    /// 4. Start the last merge := an input buffer of every run, the rest of mem_size is the batch buffer
+    const size_t FAN_IN = last_runs.size();
+    const size_t NUM_HALVES = settings.num_halves;
+    const size_t INPUT_BUFFER_SIZE = std::min(mem_size / (FAN_IN + 1), (mem_size - state.AGGREGATE_WORDS * VALUE_SIZE) / FAN_IN) / VALUE_SIZE / NUM_HALVES * VALUE_SIZE;
+    assert(INPUT_BUFFER_SIZE > 0);
+    const size_t INPUT_BUFFERS_SIZE = FAN_IN * NUM_HALVES * INPUT_BUFFER_SIZE;
+    /// a batch holds whole (value, count) pairs
+    state.batch_num_words = (mem_size - INPUT_BUFFERS_SIZE) / VALUE_SIZE / state.AGGREGATE_WORDS * state.AGGREGATE_WORDS;
+    assert(state.batch_num_words >= state.AGGREGATE_WORDS);
+    state.memory = state.arena.allocate(INPUT_BUFFERS_SIZE + state.batch_num_words * VALUE_SIZE);
+    state.batch_buffer = reinterpret_cast<Value *>(state.memory.get() + INPUT_BUFFERS_SIZE);
+    state.io = std::make_unique<IoQueue>(NUM_HALVES > 1);
+    state.merger = std::make_unique<RunMerger>(last_runs, state.memory.get(), INPUT_BUFFER_SIZE, NUM_HALVES, AGGREGATE, *state.io);
+    state.stats.end_phase(StatsRecorder::MERGE);
+    state.stats.set_runs(runs.size(), num_passes, fan_in);
+}
+
+SortedStream::~SortedStream() = default;
+
+SortedStream::Batch SortedStream::next() {
+    Impl &state = *impl;
+    if (!state.inmemory_batch.empty()) {
+        return std::exchange(state.inmemory_batch, Batch{});
+    }
+    if (!state.merger) {
+        return {};
+    }
+    /// 1. Fill the batch buffer with the next values of the last merge
+    state.stats.start_phase();
+    size_t num_words = 0;
+    Value value = 0;
+    size_t count = 0;
+    while (num_words + state.AGGREGATE_WORDS <= state.batch_num_words && state.merger->next(value, count)) {
+        state.batch_buffer[num_words++] = value;
+        if (state.AGGREGATE == Aggregate::COUNT) {
+            state.batch_buffer[num_words++] = count;
+        }
+    }
+    /// 2. The merge is done := free its memory and files right away, not only with the stream
+    if (num_words == 0) {
+        state.merger.reset();
+        state.io.reset();
+        state.memory.reset();
+        state.merged_files.clear();
+        state.sorted_runs = {};
+        state.presorted_file.reset();
+    }
+    state.stats.add_phase(StatsRecorder::MERGE);
+    return {num_words > 0 ? state.batch_buffer : nullptr, num_words};
 }
 
 }  // namespace moderndbs
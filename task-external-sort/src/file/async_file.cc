@@ -0,0 +1,476 @@
+#include "moderndbs/async_file.h"
+#include "moderndbs/file.h"
+#include "moderndbs/worker_thread.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define MODERNDBS_HAS_IO_URING
+#endif
+#endif
+
+
+namespace moderndbs {
+
+namespace {
+
+[[noreturn]] static void throw_errno(int error = errno) {
+    throw std::system_error{error, std::system_category()};
+}
+
+
+/// Rethrows the error of a completed request, if any.
+void rethrow_if_failed(const std::exception_ptr& error) {
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+/// Requests that are executed by worker threads with the blocking calls of the file.
+class ThreadPoolFile
+: public AsyncFile {
+private:
+    File& file;
+    const size_t queue_depth;
+
+    std::mutex mutex;
+    /// Signals the workers that there is a request in the queue or that they should stop.
+    std::condition_variable work_cv;
+    /// Signals the submitter that a request completed.
+    std::condition_variable done_cv;
+    /// The requests that are not picked up by a worker yet.
+    std::deque<std::pair<Handle, Request>> queue;
+    /// The completed requests that are not polled yet, with their error.
+    std::unordered_map<Handle, std::exception_ptr> completed;
+    /// Number of requests that are queued or executed.
+    size_t num_in_flight = 0;
+    Handle next_handle = 0;
+    bool stop = false;
+    std::vector<WorkerThread> workers;
+
+    void work() {
+        std::unique_lock lock{mutex};
+        while (true) {
+            work_cv.wait(lock, [&] { return stop || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            auto [handle, request] = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                if (request.kind == Request::READ) {
+                    file.read_block(request.offset, request.size, request.block);
+                } else {
+                    file.write_block(request.block, request.offset, request.size);
+                }
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            completed.emplace(handle, std::move(error));
+            --num_in_flight;
+            done_cv.notify_all();
+        }
+    }
+
+    /// Waits for the requests in flight and joins the workers.
+    void stop_workers() {
+        {
+            std::unique_lock lock{mutex};
+            done_cv.wait(lock, [&] { return num_in_flight == 0; });
+            stop = true;
+        }
+        work_cv.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    /// Takes the request out of `completed` if it is there. Expects the lock.
+    bool take_completed(Handle handle) {
+        auto it = completed.find(handle);
+        if (it == completed.end()) {
+            return false;
+        }
+        auto error = std::move(it->second);
+        completed.erase(it);
+        rethrow_if_failed(error);
+        return true;
+    }
+
+public:
+    ThreadPoolFile(File& file, size_t queue_depth) : file(file), queue_depth(queue_depth) {
+        const size_t num_workers = std::min<size_t>(queue_depth, std::max(4u, std::thread::hardware_concurrency()));
+        workers.reserve(num_workers);
+        try {
+            for (size_t i = 0; i < num_workers; ++i) {
+                workers.emplace_back([this] { work(); });
+            }
+        } catch (...) {
+            /// Join the workers that did start, so no thread is left behind
+            stop_workers();
+            throw;
+        }
+    }
+
+    ~ThreadPoolFile() override {
+        stop_workers();
+    }
+
+    AsyncBackend get_backend() const override {
+        return AsyncBackend::THREAD_POOL;
+    }
+
+    std::vector<Handle> submit(const std::vector<Request>& requests) override {
+        std::vector<Handle> handles;
+        handles.reserve(requests.size());
+        std::unique_lock lock{mutex};
+        for (auto& request : requests) {
+            done_cv.wait(lock, [&] { return num_in_flight < queue_depth; });
+            handles.push_back(next_handle++);
+            queue.emplace_back(handles.back(), request);
+            ++num_in_flight;
+            work_cv.notify_one();
+        }
+        return handles;
+    }
+
+    bool poll(Handle handle) override {
+        std::unique_lock lock{mutex};
+        return take_completed(handle);
+    }
+
+    void wait(Handle handle) override {
+        std::unique_lock lock{mutex};
+        done_cv.wait(lock, [&] { return completed.count(handle) != 0; });
+        take_completed(handle);
+    }
+
+    void wait_all() override {
+        std::unique_lock lock{mutex};
+        done_cv.wait(lock, [&] { return num_in_flight == 0; });
+        auto finished = std::move(completed);
+        completed.clear();
+        for (auto& [handle, error] : finished) {
+            rethrow_if_failed(error);
+        }
+    }
+};
+
+
+#ifdef MODERNDBS_HAS_IO_URING
+
+/// Requests that are submitted to an io_uring of the kernel.
+///
+/// The submission queue (SQ) and the completion queue (CQ) are rings in
+/// memory that is shared with the kernel. Requests are added at the tail of
+/// the SQ and `io_uring_enter()` hands all of them to the kernel at once,
+/// completions are taken from the head of the CQ without a system call.
+///
+/// ```
+///   SQ  | sqe | sqe | sqe |     |      -- io_uring_enter() -->  kernel
+///          ^head         ^tail
+///   CQ  | cqe | cqe |     |     |      <-- completions -------  kernel
+///          ^head   ^tail
+/// ```
+///
+class IoUringFile
+: public AsyncFile {
+private:
+    /// A request whose bytes `[done, request.size)` are still to be transferred.
+    struct Pending {
+        Request request;
+        size_t done;
+        /// The remaining part of the block, passed to the kernel.
+        ::iovec iov;
+    };
+
+    const int file_fd;
+    /// Blocks of direct files are checked like `File::read_block()` does, as newer kernels accept smaller alignments.
+    const bool check_alignment;
+    int ring_fd = -1;
+    unsigned num_entries = 0;
+
+    void* sq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    void* cq_ring = MAP_FAILED;
+    size_t cq_ring_size = 0;
+    ::io_uring_sqe* sqes = static_cast<::io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    ::io_uring_cqe* cqes = nullptr;
+
+    /// The requests in flight, their nodes and thereby the iovecs stay where they are.
+    std::unordered_map<Handle, Pending> pending;
+    /// The completed requests that are not polled yet, with their error.
+    std::unordered_map<Handle, std::exception_ptr> completed;
+    /// Number of SQEs that are in the SQ and not handed to the kernel yet.
+    unsigned num_unsubmitted = 0;
+    /// Number of SQEs that did not complete yet.
+    unsigned num_in_flight = 0;
+    Handle next_handle = 0;
+
+    void release() {
+        if (sqes != MAP_FAILED) {
+            ::munmap(sqes, sqes_size);
+        }
+        if (cq_ring != MAP_FAILED) {
+            ::munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != MAP_FAILED) {
+            ::munmap(sq_ring, sq_ring_size);
+        }
+        if (ring_fd >= 0) {
+            ::close(ring_fd);
+        }
+    }
+
+    /// Hands the unsubmitted SQEs to the kernel and waits for `min_complete` completions.
+    void enter(unsigned min_complete) {
+        while (num_unsubmitted > 0 || min_complete > 0) {
+            const unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+            const long result = ::syscall(__NR_io_uring_enter, ring_fd, num_unsubmitted, min_complete, flags, nullptr, 0);
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw_errno();
+            }
+            num_unsubmitted -= static_cast<unsigned>(result);
+            min_complete = 0;
+        }
+    }
+
+    /// Adds an SQE for the remaining bytes of the pending request.
+    void push(Handle handle, Pending& request) {
+        while (num_in_flight == num_entries) {
+            enter(1);
+            reap();
+        }
+        request.iov.iov_base = request.request.block + request.done;
+        request.iov.iov_len = request.request.size - request.done;
+
+        const unsigned tail = *sq_tail;
+        const unsigned index = tail & sq_mask;
+        ::io_uring_sqe& sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = request.request.kind == Request::READ ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe.fd = file_fd;
+        sqe.addr = reinterpret_cast<uint64_t>(&request.iov);
+        sqe.len = 1;
+        sqe.off = request.request.offset + request.done;
+        sqe.user_data = handle;
+        sq_array[index] = index;
+        // the kernel must see the SQE before the new tail
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++num_unsubmitted;
+        ++num_in_flight;
+    }
+
+    /// Handles the result of an SQE, i.e. the number of bytes transferred or a negative errno.
+    void complete(Handle handle, int result) {
+        auto it = pending.find(handle);
+        assert(it != pending.end());
+        Pending& request = it->second;
+        if (result == -EINTR || result == -EAGAIN) {
+            push(handle, request);
+            return;
+        }
+        if (result < 0) {
+            completed.emplace(handle, std::make_exception_ptr(std::system_error{-result, std::system_category()}));
+            pending.erase(it);
+            return;
+        }
+        request.done += static_cast<size_t>(result);
+        // 0 bytes is the end of the file, where `read_block()` stops as well
+        if (result > 0 && request.done < request.request.size) {
+            push(handle, request);
+            return;
+        }
+        completed.emplace(handle, nullptr);
+        pending.erase(it);
+    }
+
+    /// Takes all CQEs from the CQ.
+    void reap() {
+        unsigned head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            const ::io_uring_cqe& cqe = cqes[head & cq_mask];
+            const Handle handle = cqe.user_data;
+            const int result = cqe.res;
+            ++head;
+            // frees the CQE for the kernel
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            --num_in_flight;
+            complete(handle, result);
+        }
+    }
+
+    /// Takes the request out of `completed` if it is there.
+    bool take_completed(Handle handle) {
+        auto it = completed.find(handle);
+        if (it == completed.end()) {
+            return false;
+        }
+        auto error = std::move(it->second);
+        completed.erase(it);
+        rethrow_if_failed(error);
+        return true;
+    }
+
+public:
+    IoUringFile(const File& file, size_t queue_depth)
+    : file_fd(file.native_handle()), check_alignment(file.get_caching() == File::Caching::DIRECT) {
+        // IORING_MAX_ENTRIES of the kernel
+        constexpr size_t MAX_ENTRIES = 32768;
+        ::io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, std::min(queue_depth, MAX_ENTRIES), &params));
+        if (ring_fd < 0) {
+            throw_errno();
+        }
+        num_entries = params.sq_entries;
+
+        auto map = [&](size_t size, off_t offset) {
+            void* mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+            if (mapping == MAP_FAILED) {
+                int error = errno;
+                release();
+                throw_errno(error);
+            }
+            return mapping;
+        };
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(::io_uring_cqe);
+        cq_ring = map(cq_ring_size, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(::io_uring_sqe);
+        sqes = static_cast<::io_uring_sqe*>(map(sqes_size, IORING_OFF_SQES));
+
+        auto sq = static_cast<char*>(sq_ring);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        auto cq = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<::io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~IoUringFile() override {
+        // Don't throw here, the errors are lost with the handles anyway.
+        try {
+            wait_all();
+        } catch (...) {
+        }
+        release();
+    }
+
+    AsyncBackend get_backend() const override {
+        return AsyncBackend::IO_URING;
+    }
+
+    std::vector<Handle> submit(const std::vector<Request>& requests) override {
+        std::vector<Handle> handles;
+        handles.reserve(requests.size());
+        for (auto& request : requests) {
+            const Handle handle = next_handle++;
+            handles.push_back(handle);
+            if (request.size == 0) {
+                completed.emplace(handle, nullptr);
+                continue;
+            }
+            if (check_alignment && !File::is_aligned(request.block, request.offset, request.size)) {
+                completed.emplace(handle, std::make_exception_ptr(std::system_error{EINVAL, std::system_category(), "unaligned block for direct I/O"}));
+                continue;
+            }
+            auto& entry = pending.emplace(handle, Pending{request, 0, {}}).first->second;
+            push(handle, entry);
+        }
+        // one system call for the whole batch
+        enter(0);
+        return handles;
+    }
+
+    bool poll(Handle handle) override {
+        enter(0);
+        reap();
+        return take_completed(handle);
+    }
+
+    void wait(Handle handle) override {
+        while (!poll(handle)) {
+            enter(1);
+        }
+    }
+
+    void wait_all() override {
+        while (!pending.empty()) {
+            enter(1);
+            reap();
+        }
+        auto finished = std::move(completed);
+        completed.clear();
+        for (auto& [handle, error] : finished) {
+            rethrow_if_failed(error);
+        }
+    }
+};
+
+#endif
+
+}  // namespace
+
+
+std::unique_ptr<AsyncFile> AsyncFile::open(File& file, AsyncBackend backend, size_t queue_depth) {
+    queue_depth = std::max<size_t>(queue_depth, 1);
+    if (backend != AsyncBackend::THREAD_POOL) {
+#ifdef MODERNDBS_HAS_IO_URING
+        if (file.native_handle() >= 0) {
+            try {
+                return std::make_unique<IoUringFile>(file, queue_depth);
+            } catch (const std::system_error&) {
+                // e.g. ENOSYS on old kernels or EPERM if io_uring is disabled
+                if (backend == AsyncBackend::IO_URING) {
+                    throw;
+                }
+            }
+        } else if (backend == AsyncBackend::IO_URING) {
+            throw_errno(EBADF);
+        }
+#else
+        if (backend == AsyncBackend::IO_URING) {
+            throw_errno(ENOSYS);
+        }
+#endif
+    }
+    return std::make_unique<ThreadPoolFile>(file, queue_depth);
+}
+
+}  // namespace moderndbs
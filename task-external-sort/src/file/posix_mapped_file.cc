@@ -0,0 +1,112 @@
+#include "moderndbs/file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <system_error>
+
+
+namespace moderndbs {
+
+namespace {
+
+[[noreturn]] static void throw_errno(int error = errno) {
+    throw std::system_error{error, std::system_category()};
+}
+
+}  // namespace
+
+
+class PosixMappedFile
+: public File {
+private:
+    int fd;
+    size_t file_size;
+    /// The whole file mapped read-only, nullptr for an empty file.
+    char* data;
+
+public:
+    explicit PosixMappedFile(const char* filename) : data(nullptr) {
+        fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            throw_errno();
+        }
+        struct ::stat file_stat;
+        if (::fstat(fd, &file_stat) < 0) {
+            int error = errno;
+            ::close(fd);
+            throw_errno(error);
+        }
+        file_size = file_stat.st_size;
+        // mmap() fails for an empty range
+        if (file_size > 0) {
+            void* mapping = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                throw_errno(error);
+            }
+            data = static_cast<char*>(mapping);
+        }
+    }
+
+    ~PosixMappedFile() override {
+        // Don't check the return values here, as we don't want a throwing
+        // destructor.
+        if (data) {
+            ::munmap(data, file_size);
+        }
+        ::close(fd);
+    }
+
+    Mode get_mode() const override {
+        return READ;
+    }
+
+    int native_handle() const override {
+        return fd;
+    }
+
+    size_t size() const override {
+        return file_size;
+    }
+
+    void resize(size_t /*new_size*/) override {
+        throw_errno(EBADF);
+    }
+
+    void read_block(size_t offset, size_t size, char* block) override {
+        assert(offset + size <= file_size);
+        if (size > 0) {
+            std::memcpy(block, data + offset, size);
+        }
+    }
+
+    void write_block(const char* /*block*/, size_t /*offset*/, size_t /*size*/) override {
+        throw_errno(EBADF);
+    }
+
+    const char* map_range(size_t offset, size_t size, Advice advice) override {
+        assert(offset + size <= file_size);
+        if (size > 0 && advice != Advice::NORMAL) {
+            // madvise() needs a page-aligned start
+            static const size_t page_size = ::sysconf(_SC_PAGESIZE);
+            const size_t begin = offset / page_size * page_size;
+            // Hints are best effort, a failing one does not break the mapping.
+            ::madvise(data + begin, offset + size - begin, advice == Advice::SEQUENTIAL ? MADV_SEQUENTIAL : MADV_WILLNEED);
+        }
+        return data + offset;
+    }
+};
+
+
+std::unique_ptr<File> File::open_mapped_file(const char* filename) {
+    return std::make_unique<PosixMappedFile>(filename);
+}
+
+}  // namespace moderndbs
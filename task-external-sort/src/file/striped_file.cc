@@ -0,0 +1,266 @@
+#include "moderndbs/striped_file.h"
+#include "moderndbs/worker_thread.h"
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <utility>
+
+
+namespace moderndbs {
+
+namespace {
+
+/// The part of a block that is stored in one stripe.
+struct Part {
+    /// Byte-offset in the file of the device.
+    size_t offset;
+    /// Size of the part.
+    size_t size;
+    /// The memory of the part in the block.
+    char* block;
+};
+
+
+/// Counts the parts of a block that are executed by the I/O threads, and keeps their first failure.
+struct Completion {
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t num_pending = 0;
+    std::exception_ptr error;
+
+    void complete(std::exception_ptr failure) {
+        std::unique_lock lock{mutex};
+        if (failure && !error) {
+            error = std::move(failure);
+        }
+        if (--num_pending == 0) {
+            cv.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock lock{mutex};
+        cv.wait(lock, [&] { return num_pending == 0; });
+    }
+};
+
+
+/// A device := its file, its counters and the I/O thread that executes the parts of blocks of other threads.
+struct Device {
+    struct Task {
+        Part part;
+        bool is_write;
+        Completion* completion;
+    };
+
+    std::unique_ptr<File> file;
+    StripedFile::DeviceCounters* counters;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Task> tasks;
+    bool stop = false;
+    /// The I/O thread, not started for the first device.
+    WorkerThread worker;
+
+    Device(std::unique_ptr<File> file, StripedFile::DeviceCounters* counters)
+        : file(std::move(file)), counters(counters) {}
+
+    /// Reads or writes a part on the calling thread.
+    void execute(const Part& part, bool is_write) {
+        if (is_write) {
+            file->write_block(part.block, part.offset, part.size);
+            if (counters) {
+                counters->bytes_written += part.size;
+            }
+        } else {
+            file->read_block(part.offset, part.size, part.block);
+            if (counters) {
+                counters->bytes_read += part.size;
+            }
+        }
+    }
+
+    void work() {
+        std::unique_lock lock{mutex};
+        while (true) {
+            cv.wait(lock, [&] { return stop || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            const Task task = tasks.front();
+            tasks.pop_front();
+            lock.unlock();
+            std::exception_ptr failure;
+            try {
+                execute(task.part, task.is_write);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            task.completion->complete(std::move(failure));
+            lock.lock();
+        }
+    }
+
+    void start_worker() {
+        worker = WorkerThread([this] { work(); });
+    }
+
+    /// Executes the remaining tasks and joins the I/O thread.
+    void stop_worker() {
+        if (!worker.joinable()) {
+            return;
+        }
+        {
+            std::unique_lock lock{mutex};
+            stop = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    /// Hands a part to the I/O thread.
+    void submit(const Part& part, bool is_write, Completion& completion) {
+        {
+            std::unique_lock lock{mutex};
+            tasks.push_back({part, is_write, &completion});
+        }
+        cv.notify_one();
+    }
+};
+
+}  // namespace
+
+
+struct StripedFile::Impl {
+    const size_t STRIPE_SIZE;
+    std::vector<std::unique_ptr<Device>> devices;
+    size_t size = 0;
+
+    explicit Impl(size_t stripe_size) : STRIPE_SIZE(stripe_size) {}
+
+    ~Impl() {
+        for (auto& device : devices) {
+            device->stop_worker();
+        }
+    }
+
+    /// Returns the bytes of a file of `size` bytes that are stored on the device.
+    size_t device_size(size_t device, size_t size) const {
+        const size_t NUM_DEVICES = devices.size();
+        const size_t num_full_stripes = size / STRIPE_SIZE;
+        const size_t last_stripe = num_full_stripes % NUM_DEVICES;
+        return (num_full_stripes / NUM_DEVICES + (device < last_stripe ? 1 : 0)) * STRIPE_SIZE +
+            (device == last_stripe ? size % STRIPE_SIZE : 0);
+    }
+
+    /// Cuts the block into its stripes, executes the parts on the device of the first stripe on the calling thread,
+    /// and all others on the I/O threads of their devices at the same time.
+    void execute(size_t offset, size_t size, char* block, bool is_write) {
+        const size_t NUM_DEVICES = devices.size();
+        /// 1. Cut the block at the stripe bounds
+        std::vector<std::pair<size_t, Part>> parts;
+        for (size_t done = 0; done < size;) {
+            const size_t stripe = (offset + done) / STRIPE_SIZE;
+            const size_t stripe_offset = (offset + done) % STRIPE_SIZE;
+            const size_t part_size = std::min(STRIPE_SIZE - stripe_offset, size - done);
+            parts.push_back({stripe % NUM_DEVICES, {stripe / NUM_DEVICES * STRIPE_SIZE + stripe_offset, part_size, block + done}});
+            done += part_size;
+        }
+        if (parts.empty()) {
+            return;
+        }
+        /// 2. Hand the parts of the other devices to their I/O threads
+        const size_t own_device = parts.front().first;
+        Completion completion;
+        for (auto& [device, part] : parts) {
+            if (device != own_device) {
+                ++completion.num_pending;
+                devices[device]->submit(part, is_write, completion);
+            }
+        }
+        /// 3. Execute the own parts, and wait for the others, as they use the block
+        std::exception_ptr failure;
+        try {
+            for (auto& [device, part] : parts) {
+                if (device == own_device) {
+                    devices[device]->execute(part, is_write);
+                }
+            }
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        completion.wait();
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+        if (completion.error) {
+            std::rethrow_exception(completion.error);
+        }
+    }
+};
+
+
+StripedFile::StripedFile(std::vector<std::unique_ptr<File>> files, size_t stripe_size, DeviceCounters* counters)
+    : impl(std::make_unique<Impl>(stripe_size)) {
+    assert(!files.empty());
+    assert(stripe_size > 0);
+    for (size_t i = 0; i < files.size(); ++i) {
+        assert(files[i]->get_mode() == WRITE && files[i]->size() == 0);
+        impl->devices.push_back(std::make_unique<Device>(std::move(files[i]), counters ? &counters[i] : nullptr));
+    }
+    /// a single device has no other devices to wait for
+    if (impl->devices.size() > 1) {
+        for (auto& device : impl->devices) {
+            device->start_worker();
+        }
+    }
+}
+
+
+StripedFile::~StripedFile() = default;
+
+
+size_t StripedFile::size() const {
+    return impl->size;
+}
+
+
+void StripedFile::resize(size_t new_size) {
+    for (size_t i = 0; i < impl->devices.size(); ++i) {
+        impl->devices[i]->file->resize(impl->device_size(i, new_size));
+    }
+    impl->size = new_size;
+}
+
+
+void StripedFile::read_block(size_t offset, size_t size, char* block) {
+    assert(offset + size <= impl->size);
+    impl->execute(offset, size, block, false);
+}
+
+
+void StripedFile::write_block(const char* block, size_t offset, size_t size) {
+    assert(offset + size <= impl->size);
+    impl->execute(offset, size, const_cast<char*>(block), true);  // NOLINT
+}
+
+
+size_t StripedFile::num_devices() const {
+    return impl->devices.size();
+}
+
+
+std::unique_ptr<StripedFile> StripedFile::make_temporary_file(const std::vector<std::string>& directories, size_t stripe_size, DeviceCounters* counters) {
+    std::vector<std::unique_ptr<File>> files;
+    files.reserve(directories.size());
+    for (auto& directory : directories) {
+        files.push_back(File::make_temporary_file(directory.c_str()));
+    }
+    return std::make_unique<StripedFile>(std::move(files), stripe_size, counters);
+}
+
+}  // namespace moderndbs
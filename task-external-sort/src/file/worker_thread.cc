@@ -0,0 +1,54 @@
+#include "moderndbs/worker_thread.h"
+#include <algorithm>
+#include <exception>
+#include <system_error>
+#include <utility>
+#include <limits.h>  // NOLINT
+
+
+namespace moderndbs {
+
+WorkerThread::WorkerThread(std::function<void()> function)
+    : function(std::make_unique<std::function<void()>>(std::move(function))) {
+    ::pthread_attr_t attr;
+    ::pthread_attr_init(&attr);
+    ::pthread_attr_setstacksize(&attr, std::max<size_t>(STACK_SIZE, PTHREAD_STACK_MIN));
+    const int error = ::pthread_create(&thread, &attr, [](void* function) -> void* {
+        (*static_cast<std::function<void()>*>(function))();
+        return nullptr;
+    }, this->function.get());
+    ::pthread_attr_destroy(&attr);
+    if (error != 0) {
+        this->function.reset();
+        throw std::system_error{error, std::system_category()};
+    }
+}
+
+
+WorkerThread::~WorkerThread() {
+    if (joinable()) {
+        std::terminate();
+    }
+}
+
+
+WorkerThread::WorkerThread(WorkerThread&& other) noexcept
+    : function(std::move(other.function)), thread(other.thread) {}
+
+
+WorkerThread& WorkerThread::operator=(WorkerThread&& other) noexcept {
+    if (joinable()) {
+        std::terminate();
+    }
+    function = std::move(other.function);
+    thread = other.thread;
+    return *this;
+}
+
+
+void WorkerThread::join() {
+    ::pthread_join(thread, nullptr);
+    function.reset();
+}
+
+}  // namespace moderndbs
@@ -18,9 +18,13 @@ set(
 set(
     SRC_CC
     src/external_sort.cc
+    src/memory_arena.cc
+    src/merge_plan.cc
+    src/radix_sort.cc
+    src/run_codec.cc
 )
 if(UNIX)
-    set(SRC_CC ${SRC_CC} src/file/posix_file.cc)
+    set(SRC_CC ${SRC_CC} src/file/async_file.cc src/file/posix_file.cc src/file/posix_mapped_file.cc src/file/striped_file.cc src/file/worker_thread.cc)
 elseif(WIN32)
     message(SEND_ERROR "Windows is not supported")
 else()
@@ -0,0 +1,78 @@
+#include "moderndbs/memory_arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+
+
+namespace moderndbs {
+
+MemoryArena::MemoryArena(size_t capacity)
+    : CAPACITY(capacity), memory(new char[capacity]) {}
+
+
+MemoryArena::~MemoryArena() {
+    assert(blocks.empty());
+}
+
+
+MemoryArena::Buffer MemoryArena::allocate(size_t size) {
+    /// every block starts at a multiple of ALIGNMENT, the memory itself is aligned by new
+    const size_t block_size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    if (block_size == 0) {
+        return Buffer{nullptr, Release{this}};
+    }
+    std::unique_lock lock{mutex};
+    /// 1. First fit := the first gap in front of a block or at the end that is large enough
+    size_t offset = 0;
+    for (const auto& [block_offset, other_size] : blocks) {
+        if (block_offset - offset >= block_size) {
+            break;
+        }
+        offset = block_offset + other_size;
+    }
+    if (CAPACITY - offset < block_size) {
+        throw BudgetExceeded{"memory budget of " + std::to_string(CAPACITY) + " bytes exceeded: allocating " +
+                             std::to_string(size) + " bytes with " + std::to_string(used_size) + " bytes in use"};
+    }
+    /// 2. Hand out the block
+    blocks.emplace(offset, block_size);
+    used_size += block_size;
+    peak_size = std::max(peak_size, used_size);
+    return Buffer{memory.get() + offset, Release{this}};
+}
+
+
+void MemoryArena::release(char* block) {
+    std::unique_lock lock{mutex};
+    auto it = blocks.find(block - memory.get());
+    assert(it != blocks.end());
+    used_size -= it->second;
+    blocks.erase(it);
+}
+
+
+size_t MemoryArena::available() const {
+    std::unique_lock lock{mutex};
+    size_t largest = 0;
+    size_t offset = 0;
+    for (const auto& [block_offset, block_size] : blocks) {
+        largest = std::max(largest, block_offset - offset);
+        offset = block_offset + block_size;
+    }
+    return std::max(largest, CAPACITY - offset);
+}
+
+
+size_t MemoryArena::used() const {
+    std::unique_lock lock{mutex};
+    return used_size;
+}
+
+
+size_t MemoryArena::peak() const {
+    std::unique_lock lock{mutex};
+    return peak_size;
+}
+
+}  // namespace moderndbs
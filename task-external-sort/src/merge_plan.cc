@@ -0,0 +1,53 @@
+#include "moderndbs/merge_plan.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <queue>
+#include <utility>
+
+namespace moderndbs {
+
+MergePlan plan_merge(const std::vector<size_t> &run_sizes, size_t max_fan_in) {
+    assert(max_fan_in >= 2);
+    const size_t NUM_RUNS = run_sizes.size();
+    MergePlan plan{std::max<size_t>(2, std::min(NUM_RUNS, max_fan_in)), {}, 0, 0};
+    /// (size, run id) of the unmerged runs, smallest on top
+    using Candidate = std::pair<size_t, size_t>;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;  // NOLINT
+    /// depth[id] := number of merges the values of run id passed through
+    std::vector<size_t> depth(NUM_RUNS, 0);
+    for (size_t i = 0; i < NUM_RUNS; i++) {
+        candidates.emplace(run_sizes[i], i);
+    }
+    /// every merge reduces the number of runs by (fan_in - 1), so the first merge takes the remainder
+    size_t group_size = NUM_RUNS;
+    if (NUM_RUNS > plan.fan_in) {
+        group_size = (NUM_RUNS - 1) % (plan.fan_in - 1) + 1;
+        if (group_size == 1) {
+            group_size = plan.fan_in;
+        }
+    }
+    while (!candidates.empty()) {
+        MergeStep step{{}, 0};
+        size_t step_depth = 0;
+        for (size_t i = 0; i < group_size; i++) {
+            const auto [size, id] = candidates.top();
+            candidates.pop();
+            step.inputs.push_back(id);
+            step.size += size;
+            step_depth = std::max(step_depth, depth[id] + 1);
+        }
+        plan.size_to_move += step.size;
+        plan.num_passes = std::max(plan.num_passes, step_depth);
+        depth.push_back(step_depth);
+        if (!candidates.empty()) {
+            candidates.emplace(step.size, NUM_RUNS + plan.steps.size());
+        }
+        plan.steps.push_back(std::move(step));
+        group_size = std::min(plan.fan_in, candidates.size());
+    }
+    return plan;
+}
+
+}  // namespace moderndbs
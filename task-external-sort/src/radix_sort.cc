@@ -0,0 +1,54 @@
+#include "moderndbs/radix_sort.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace moderndbs {
+
+uint64_t* radix_sort(uint64_t* values, uint64_t* scratch, size_t* histograms, size_t num_values, unsigned digit_bits) {
+    assert(digit_bits == 8 || digit_bits == 11);
+    const size_t NUM_BUCKETS = size_t{1} << digit_bits;
+    const uint64_t DIGIT_MASK = NUM_BUCKETS - 1;
+    const unsigned NUM_DIGITS = (64 + digit_bits - 1) / digit_bits;
+    if (num_values == 0) {
+        return values;
+    }
+
+    /// 1. Histograms of all digits with one read of the values
+    std::fill(histograms, histograms + NUM_DIGITS * NUM_BUCKETS, 0);
+    for (size_t i = 0; i < num_values; i++) {
+        const uint64_t value = values[i];
+        for (unsigned digit = 0; digit < NUM_DIGITS; digit++) {
+            histograms[digit * NUM_BUCKETS + ((value >> (digit * digit_bits)) & DIGIT_MASK)]++;
+        }
+    }
+
+    /// 2. One scatter pass per digit, from the least significant one on
+    uint64_t* from = values;
+    uint64_t* to = scratch;
+    for (unsigned digit = 0; digit < NUM_DIGITS; digit++) {
+        size_t* histogram = &histograms[digit * NUM_BUCKETS];
+        const unsigned shift = digit * digit_bits;
+        /// 2.1. All values have the same digit := the pass would not move anything
+        if (histogram[(from[0] >> shift) & DIGIT_MASK] == num_values) {
+            continue;
+        }
+        /// 2.2. Exclusive prefix sum := first output position of every bucket
+        size_t offset = 0;
+        for (size_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+            const size_t count = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += count;
+        }
+        /// 2.3. Stable scatter by the digit
+        for (size_t i = 0; i < num_values; i++) {
+            const uint64_t value = from[i];
+            to[histogram[(value >> shift) & DIGIT_MASK]++] = value;
+        }
+        std::swap(from, to);
+    }
+    return from;
+}
+
+}  // namespace moderndbs
@@ -0,0 +1,54 @@
+#include "moderndbs/run_codec.h"
+
+#include <algorithm>
+
+namespace moderndbs {
+
+namespace run_codec {
+
+size_t encode_block(uint64_t *words, size_t num_values, size_t max_words) {
+    assert(num_values > 0);
+    const uint64_t *values = words + HEADER_WORDS;
+    /// 1. The bit width of the largest difference
+    uint64_t max_delta = 0;
+    for (size_t i = 1; i < num_values; i++) {
+        assert(values[i - 1] <= values[i]);
+        max_delta = std::max(max_delta, values[i] - values[i - 1]);
+    }
+    const unsigned bit_width = max_delta == 0 ? 0 : 64 - __builtin_clzll(max_delta);
+    if (HEADER_WORDS + ((num_values - 1) * bit_width + 63) / 64 > max_words) {
+        return 0;
+    }
+
+    /// 2. Pack the differences. The i-th difference ends in a word before values[i], so no unread value is overwritten.
+    const uint64_t first = values[0];
+    uint64_t previous = first;
+    size_t num_words = HEADER_WORDS;
+    uint64_t bits = 0;
+    unsigned num_bits = 0;
+    for (size_t i = 1; i < num_values && bit_width > 0; i++) {
+        const uint64_t value = values[i];
+        const uint64_t delta = value - previous;
+        previous = value;
+        bits |= delta << num_bits;
+        if (num_bits + bit_width >= 64) {
+            words[num_words++] = bits;
+            bits = num_bits == 0 ? 0 : delta >> (64 - num_bits);
+            num_bits = num_bits + bit_width - 64;
+        } else {
+            num_bits += bit_width;
+        }
+    }
+    if (num_bits > 0) {
+        words[num_words++] = bits;
+    }
+
+    /// 3. The header goes into the headroom
+    words[0] = first;
+    words[1] = (uint64_t{num_values} << 8) | bit_width;
+    return num_words;
+}
+
+}  // namespace run_codec
+
+}  // namespace moderndbs
@@ -0,0 +1,142 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <system_error>
+#include <vector>
+#include <gtest/gtest.h>
+#include "moderndbs/async_file.h"
+#include "moderndbs/file.h"
+#include "test_file.h"
+
+
+namespace {
+
+using moderndbs::AsyncBackend;
+using moderndbs::AsyncFile;
+using moderndbs::File;
+
+constexpr size_t BLOCK_SIZE = 4096;
+
+
+/// Opens the backend, or returns nullptr if io_uring is not available on this kernel.
+std::unique_ptr<AsyncFile> open_async(File& file, AsyncBackend backend, size_t queue_depth = 8) {
+    try {
+        return AsyncFile::open(file, backend, queue_depth);
+    } catch (const std::system_error& e) {
+        if (backend != AsyncBackend::IO_URING) {
+            throw;
+        }
+        return nullptr;
+    }
+}
+
+
+class AsyncFileTest
+: public ::testing::TestWithParam<AsyncBackend> {
+};
+
+
+// NOLINTNEXTLINE
+TEST_P(AsyncFileTest, WriteThenReadBatch) {
+    auto file = File::make_temporary_file();
+    constexpr size_t NUM_BLOCKS = 100;
+    file->resize(NUM_BLOCKS * BLOCK_SIZE);
+    auto async = open_async(*file, GetParam());
+    if (!async) {
+        return;
+    }
+    ASSERT_EQ(GetParam(), async->get_backend());
+
+    /// more requests than the queue depth in one batch
+    std::vector<uint64_t> written(NUM_BLOCKS * BLOCK_SIZE / 8);
+    std::iota(written.begin(), written.end(), 1);
+    std::vector<AsyncFile::Request> writes;
+    for (size_t i = 0; i < NUM_BLOCKS; ++i) {
+        writes.push_back({AsyncFile::Request::WRITE, i * BLOCK_SIZE, BLOCK_SIZE, reinterpret_cast<char*>(written.data()) + i * BLOCK_SIZE});
+    }
+    auto handles = async->submit(writes);
+    ASSERT_EQ(NUM_BLOCKS, handles.size());
+    async->wait_all();
+
+    std::vector<uint64_t> read(written.size());
+    std::vector<AsyncFile::Request> reads;
+    for (size_t i = 0; i < NUM_BLOCKS; ++i) {
+        /// backwards, so the requests do not complete in file order
+        size_t block = NUM_BLOCKS - 1 - i;
+        reads.push_back({AsyncFile::Request::READ, block * BLOCK_SIZE, BLOCK_SIZE, reinterpret_cast<char*>(read.data()) + block * BLOCK_SIZE});
+    }
+    handles = async->submit(reads);
+    for (auto handle : handles) {
+        async->wait(handle);
+    }
+    ASSERT_EQ(written, read);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(AsyncFileTest, SubmitAndPoll) {
+    auto file = File::make_temporary_file();
+    file->resize(2 * BLOCK_SIZE);
+    auto async = open_async(*file, GetParam());
+    if (!async) {
+        return;
+    }
+    std::vector<char> block(BLOCK_SIZE, 'x');
+    async->wait(async->submit_write(block.data(), BLOCK_SIZE, BLOCK_SIZE));
+
+    std::vector<char> read(BLOCK_SIZE);
+    auto handle = async->submit_read(BLOCK_SIZE, BLOCK_SIZE, read.data());
+    while (!async->poll(handle)) {
+    }
+    ASSERT_EQ(block, read);
+
+    /// an empty request completes right away
+    async->wait(async->submit_read(0, 0, read.data()));
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(AsyncFileTest, FailedRequestThrows) {
+    auto file = File::make_temporary_file(File::Caching::DIRECT);
+    file->resize(2 * BLOCK_SIZE);
+    auto async = open_async(*file, GetParam());
+    if (!async) {
+        return;
+    }
+    /// unaligned memory fails with EINVAL on a direct file in the kernel or in the File
+    auto block = File::allocate_aligned(2 * BLOCK_SIZE);
+    auto handle = async->submit_read(0, BLOCK_SIZE, block.get() + 1);
+    try {
+        async->wait(handle);
+        FAIL() << "unaligned direct read did not fail";
+    } catch (const std::system_error& e) {
+        ASSERT_EQ(EINVAL, e.code().value());
+    }
+    /// the file is still usable
+    async->wait(async->submit_read(0, BLOCK_SIZE, block.get()));
+}
+
+
+INSTANTIATE_TEST_CASE_P(
+    AsyncFileTest,
+    AsyncFileTest,
+    ::testing::Values(AsyncBackend::IO_URING, AsyncBackend::THREAD_POOL)
+);
+
+
+// NOLINTNEXTLINE
+TEST(AsyncFileTest, FilesWithoutDescriptorUseThreadPool) {
+    std::vector<char> content(BLOCK_SIZE);
+    std::iota(content.begin(), content.end(), 0);
+    moderndbs::TestFile file{std::vector<char>(content)};
+    auto async = AsyncFile::open(file);
+    ASSERT_EQ(AsyncBackend::THREAD_POOL, async->get_backend());
+    std::vector<char> read(BLOCK_SIZE);
+    async->wait(async->submit_read(0, BLOCK_SIZE, read.data()));
+    ASSERT_EQ(content, read);
+    ASSERT_THROW(AsyncFile::open(file, AsyncBackend::IO_URING), std::system_error);
+}
+
+}  // namespace
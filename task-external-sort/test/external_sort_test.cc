@@ -2,12 +2,14 @@
 #include <cstdint>
 #include <cstring>
 #include <exception>
+#include <map>
 #include <utility>
 #include <random>
 #include <vector>
 #include <gtest/gtest.h>
 #include "moderndbs/external_sort.h"
 #include "moderndbs/file.h"
+#include "test_file.h"
 
 #ifdef __linux__
 
@@ -15,84 +17,6 @@
 
 #endif // __linux__
 
-namespace moderndbs {
-
-class TestFileError
-: public std::exception {
-private:
-    const char* message;
-
-public:
-    explicit TestFileError(const char* message) : message(message) {}
-
-    ~TestFileError() override = default;
-
-    const char* what() const noexcept override {
-        return message;
-    }
-};
-
-
-class TestFile
-: public File {
-private:
-    Mode mode;
-    std::vector<char> file_content;
-
-public:
-    explicit TestFile(Mode mode = WRITE) : mode(mode) {}
-
-    explicit TestFile(std::vector<char>&& file_content, Mode mode = READ)
-    : mode(mode), file_content(std::move(file_content)) {}
-
-    TestFile(const TestFile&) = default;
-    TestFile(TestFile&&) = default;
-
-    ~TestFile() override = default;
-
-    TestFile& operator=(const TestFile&) = default;
-    TestFile& operator=(TestFile&&) = default;
-
-    std::vector<char>& get_content() {
-        return file_content;
-    }
-
-    Mode get_mode() const override {
-        return mode;
-    }
-
-    size_t size() const override {
-        return file_content.size();
-    }
-
-    void resize(size_t new_size) override {
-        if (mode == READ) {
-            throw TestFileError{"trying to resize a read only file"};
-        }
-        file_content.resize(new_size);
-    }
-
-    void read_block(size_t offset, size_t size, char* block) override {
-        if (offset + size > file_content.size()) {
-            throw TestFileError{"trying to read past end of file"};
-        }
-        std::memcpy(block, file_content.data() + offset, size);
-    }
-
-    void write_block(const char* block, size_t offset, size_t size) override {
-        if (mode == READ) {
-            throw TestFileError{"trying to write to a read only file"};
-        }
-        if (offset + size > file_content.size()) {
-            throw TestFileError{"trying to write past end of file"};
-        }
-        std::memcpy(file_content.data() + offset, block, size);
-    }
-};
-
-}  // namespace moderndbs
-
-
 namespace {
 
 static_assert(sizeof(uint64_t) == 8, "sizeof(uint64_t) must be 8");
@@ -275,18 +199,70 @@ TEST(ExternalSortTest, SmallPartialLastRun) {
   ASSERT_EQ(10, output_values[9]);
 }
 
+// NOLINTNEXTLINE
+TEST(ExternalSortTest, Stats) {
+  std::vector<char> file_content(8*10);
+  uint64_t input_values [10] = { 10, 5, 2, 9, 3, 8, 1, 4, 6, 7 };
+  std::memcpy(file_content.data(), &input_values, 8*10);
+  moderndbs::TestFile input{std::move(file_content)};
+  moderndbs::TestFile output;
+  moderndbs::ExternalSortStats stats;
+  moderndbs::ExternalSortOptions options;
+  options.stats = &stats;
+
+  moderndbs::external_sort(input, 10, output, 80, options);
+  ASSERT_EQ(1, stats.num_runs);
+  ASSERT_EQ(0, stats.num_merge_passes);
+  ASSERT_EQ(1, stats.num_reads);
+  ASSERT_EQ(1, stats.num_writes);
+  ASSERT_EQ(80, stats.bytes_read);
+  ASSERT_EQ(80, stats.bytes_written);
+  ASSERT_EQ(80, stats.peak_memory);
+  ASSERT_EQ(0, stats.merge_fan_in);
+  ASSERT_EQ(80, stats.run_generation_io.bytes_read);
+  ASSERT_EQ(0, stats.merge_io.num_reads);
+  /// a single read of 80 bytes := size class [64, 128)
+  ASSERT_EQ((std::vector<size_t>{0, 0, 0, 0, 0, 0, 1}), stats.read_size_histogram);
+
+  output.resize(0);
+  moderndbs::external_sort(input, 10, output, 24, options);
+  /// runs of 3 values, merged with fan-in 2
+  ASSERT_EQ(4, stats.num_runs);
+  ASSERT_EQ(2, stats.num_merge_passes);
+  /// every pass reads and writes all values
+  ASSERT_EQ(3 * 80, stats.bytes_read);
+  ASSERT_EQ(3 * 80, stats.bytes_written);
+  ASSERT_LE(10, stats.num_reads);
+  ASSERT_LE(10, stats.num_writes);
+  /// the buffers of run generation and of every merge take all of mem_size, but never more
+  ASSERT_EQ(24, stats.peak_memory);
+  ASSERT_EQ(2, stats.merge_fan_in);
+  /// run generation reads and writes all values once, the merge passes the rest
+  ASSERT_EQ(80, stats.run_generation_io.bytes_read);
+  ASSERT_EQ(80, stats.run_generation_io.bytes_written);
+  ASSERT_EQ(2 * 80, stats.merge_io.bytes_read);
+  ASSERT_EQ(2 * 80, stats.merge_io.bytes_written);
+  ASSERT_EQ(stats.num_reads, stats.run_generation_io.num_reads + stats.merge_io.num_reads);
+  ASSERT_EQ(stats.num_writes, stats.run_generation_io.num_writes + stats.merge_io.num_writes);
+  ASSERT_LE(0, stats.merge_io.wait_seconds);
+  /// runs of 24 bytes and a last run of 8 bytes, the merge reads single values
+  ASSERT_EQ(5, stats.read_size_histogram.size());
+  ASSERT_EQ(3, stats.read_size_histogram[4]);
+  size_t num_histogram_reads = 0;
+  for (auto count : stats.read_size_histogram) {
+    num_histogram_reads += count;
+  }
+  ASSERT_EQ(stats.num_reads, num_histogram_reads);
+  ASSERT_FALSE(stats.write_size_histogram.empty());
+  ASSERT_LE(0, stats.run_generation_seconds);
+  ASSERT_LE(0, stats.merge_seconds);
+}
+
 
 std::pair<std::vector<uint64_t>, moderndbs::TestFile> make_random_numbers(
     size_t count
 ) {
-    std::mt19937_64 engine{0};
-    std::uniform_int_distribution<uint64_t> distr;
-    std::vector<uint64_t> values;
-    values.reserve(count);
-    for (size_t i = 0; i < count; ++i) {
-        uint64_t value = distr(engine);
-        values.push_back(value);
-    }
+    auto values = moderndbs::make_random_values(count);
     std::vector<char> file_content(count * 8);
     std::memcpy(file_content.data(), values.data(), count * 8);
     return std::make_pair(
@@ -296,14 +272,50 @@ std::pair<std::vector<uint64_t>, moderndbs::TestFile> make_random_numbers(
 }
 
 
-std::vector<uint64_t> get_file_values(moderndbs::TestFile file) {
-    auto& content = file.get_content();
-    std::vector<uint64_t> values(content.size() / 8);
-    std::memcpy(values.data(), content.data(), content.size());
+/// Returns the values count, count - 1, ..., 1.
+std::vector<uint64_t> make_descending_numbers(size_t count) {
+    std::vector<uint64_t> values(count);
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = count - i;
+    }
     return values;
 }
 
 
+/// Sorts values by `external_sort()` with the options, and checks the output against std::sort.
+void check_sort(size_t mem_size, const std::vector<uint64_t>& values, const moderndbs::ExternalSortOptions& options) {
+    std::vector<char> file_content(values.size() * 8);
+    std::memcpy(file_content.data(), values.data(), values.size() * 8);
+    moderndbs::TestFile input{std::move(file_content)};
+    moderndbs::TestFile output;
+    moderndbs::external_sort(input, values.size(), output, mem_size, options);
+    auto expected_values = values;
+    std::sort(expected_values.begin(), expected_values.end());
+    ASSERT_EQ(values.size() * 8, output.size());
+    ASSERT_EQ(expected_values, get_file_values(output));
+}
+
+
+// NOLINTNEXTLINE
+TEST(ExternalSortTest, StatsRadixSort) {
+    /// the histograms of the radix sort come from mem_size as well, with 4 threads they take more than a thread's share
+    const size_t mem_size = 256 * MEM_1KiB;
+    const size_t num_values = 100000;
+    auto [expected_values, input] = make_random_numbers(num_values);
+    std::sort(expected_values.begin(), expected_values.end());
+    moderndbs::TestFile output;
+    moderndbs::ExternalSortStats stats;
+    moderndbs::ExternalSortOptions options;
+    options.run_sort = moderndbs::RunSort::RADIX_SORT_11;
+    options.num_threads = 4;
+    options.stats = &stats;
+    moderndbs::external_sort(input, num_values, output, mem_size, options);
+    ASSERT_EQ(expected_values, get_file_values(output));
+    ASSERT_LT(1, stats.num_runs);
+    ASSERT_LE(stats.peak_memory, mem_size);
+}
+
+
 class ExternalSortParametrizedTest
 : public ::testing::TestWithParam<std::pair<size_t, size_t>> {
 };
@@ -452,6 +464,346 @@ TEST_P(ExternalSortParametrizedTest, SortEqualNumbers) {
 }
 
 
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortRandomNumbersParallelRuns) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.num_threads = 4;
+    check_sort(mem_size, make_random_numbers(num_values).first, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortRandomNumbersReplacementSelection) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.run_generation = moderndbs::RunGeneration::REPLACEMENT_SELECTION;
+    check_sort(mem_size, make_random_numbers(num_values).first, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortDescendingNumbersReplacementSelection) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.run_generation = moderndbs::RunGeneration::REPLACEMENT_SELECTION;
+    check_sort(mem_size, make_descending_numbers(num_values), options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortRandomNumbersPrefetch) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.prefetch = true;
+    check_sort(mem_size, make_random_numbers(num_values).first, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortRandomNumbersRadixSort) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.run_sort = moderndbs::RunSort::RADIX_SORT_11;
+    check_sort(mem_size, make_random_numbers(num_values).first, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortDescendingNumbersRadixSort) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.run_sort = moderndbs::RunSort::RADIX_SORT_8;
+    check_sort(mem_size, make_descending_numbers(num_values), options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortRandomNumbersParallelMerge) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.num_merge_threads = 4;
+    check_sort(mem_size, make_random_numbers(num_values).first, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortFewDistinctNumbersParallelMerge) {
+    auto [mem_size, num_values] = GetParam();
+    std::vector<uint64_t> values(num_values);
+    std::mt19937_64 engine{0};
+    for (auto& value : values) {
+        value = engine() % 3;
+    }
+    moderndbs::ExternalSortOptions options;
+    options.num_merge_threads = 4;
+    check_sort(mem_size, values, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortRandomNumbersEncodedRuns) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.encode_runs = true;
+    check_sort(mem_size, make_random_numbers(num_values).first, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortRandomNumbersEncodedRunsReplacementSelectionPrefetch) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.encode_runs = true;
+    options.run_generation = moderndbs::RunGeneration::REPLACEMENT_SELECTION;
+    options.prefetch = true;
+    check_sort(mem_size, make_random_numbers(num_values).first, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortDescendingNumbersDetectPresorted) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortStats stats;
+    moderndbs::ExternalSortOptions options;
+    options.detect_presorted = true;
+    options.stats = &stats;
+    check_sort(mem_size, make_descending_numbers(num_values), options);
+    /// one read and one write of the input
+    ASSERT_EQ(1, stats.num_runs);
+    ASSERT_EQ(num_values * 8, stats.bytes_read);
+    ASSERT_EQ(num_values * 8, stats.bytes_written);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortNaturalRunsDetectPresorted) {
+    auto [mem_size, num_values] = GetParam();
+    /// equal values, an ascending, a descending and another ascending run that interleave
+    std::vector<uint64_t> values(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        switch (i * 4 / num_values) {
+            case 0: values[i] = 42; break;
+            case 1: values[i] = 3 * i; break;
+            case 2: values[i] = 3 * (num_values - i) + 1; break;
+            default: values[i] = 3 * i + 2; break;
+        }
+    }
+    moderndbs::ExternalSortOptions options;
+    options.detect_presorted = true;
+    check_sort(mem_size, values, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortEqualThenDescendingNumbersDetectPresorted) {
+    auto [mem_size, num_values] = GetParam();
+    std::vector<uint64_t> values(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        values[i] = std::min<uint64_t>(num_values / 2, num_values - i);
+    }
+    moderndbs::ExternalSortOptions options;
+    options.detect_presorted = true;
+    check_sort(mem_size, values, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, SortRandomNumbersDetectPresorted) {
+    auto [mem_size, num_values] = GetParam();
+    moderndbs::ExternalSortOptions options;
+    options.detect_presorted = true;
+    check_sort(mem_size, make_random_numbers(num_values).first, options);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, TopKRandomNumbers) {
+    auto [mem_size, num_values] = GetParam();
+    auto [expected_values, input] = make_random_numbers(num_values);
+    std::sort(expected_values.begin(), expected_values.end());
+    for (size_t k : {size_t{0}, size_t{1}, size_t{100}, num_values / 2, num_values - 1, num_values, num_values + 1}) {
+        moderndbs::TestFile output;
+        moderndbs::external_top_k(input, num_values, k, output, mem_size);
+        const size_t expected_k = std::min(k, num_values);
+        ASSERT_EQ(expected_k * 8, output.size());
+        if (expected_k == 0) {
+            continue;
+        }
+        auto output_values = get_file_values(output);
+        ASSERT_TRUE(std::equal(output_values.begin(), output_values.end(), expected_values.begin())) << "k = " << k;
+    }
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, TopKFewDistinctNumbers) {
+    auto [mem_size, num_values] = GetParam();
+    std::vector<uint64_t> expected_values(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        expected_values[i] = (i * 7919) % 5;
+    }
+    std::vector<char> file_content(num_values * 8);
+    std::memcpy(file_content.data(), expected_values.data(), num_values * 8);
+    std::sort(expected_values.begin(), expected_values.end());
+    moderndbs::TestFile input{std::move(file_content)};
+    moderndbs::TestFile output;
+    const size_t k = num_values * 3 / 4;
+    moderndbs::external_top_k(input, num_values, k, output, mem_size);
+    ASSERT_EQ(k * 8, output.size());
+    auto output_values = get_file_values(output);
+    ASSERT_TRUE(std::equal(output_values.begin(), output_values.end(), expected_values.begin()));
+}
+
+
+/// Sorts values with duplicates by `external_sort()` with the aggregation, and checks the output against std::map.
+void check_aggregate(size_t mem_size, const std::vector<uint64_t>& values, moderndbs::Aggregate aggregate, moderndbs::RunSort run_sort) {
+    std::map<uint64_t, uint64_t> counts;
+    for (auto value : values) {
+        ++counts[value];
+    }
+    std::vector<uint64_t> expected_values;
+    for (auto [value, count] : counts) {
+        expected_values.push_back(value);
+        if (aggregate == moderndbs::Aggregate::COUNT) {
+            expected_values.push_back(count);
+        }
+    }
+    std::vector<char> file_content(values.size() * 8);
+    std::memcpy(file_content.data(), values.data(), values.size() * 8);
+    moderndbs::TestFile input{std::move(file_content)};
+    moderndbs::TestFile output;
+    moderndbs::ExternalSortOptions options;
+    options.aggregate = aggregate;
+    options.run_sort = run_sort;
+    moderndbs::external_sort(input, values.size(), output, mem_size, options);
+    ASSERT_EQ(expected_values.size() * 8, output.size());
+    if (!expected_values.empty()) {
+        ASSERT_EQ(expected_values, get_file_values(output));
+    }
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, DistinctFewDistinctNumbers) {
+    auto [mem_size, num_values] = GetParam();
+    std::vector<uint64_t> values(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        values[i] = (i * 7919) % 37;
+    }
+    check_aggregate(mem_size, values, moderndbs::Aggregate::DISTINCT, moderndbs::RunSort::STD_SORT);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, CountFewDistinctNumbers) {
+    auto [mem_size, num_values] = GetParam();
+    std::vector<uint64_t> values(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        values[i] = (i * 7919) % 37;
+    }
+    check_aggregate(mem_size, values, moderndbs::Aggregate::COUNT, moderndbs::RunSort::STD_SORT);
+    check_aggregate(mem_size, values, moderndbs::Aggregate::COUNT, moderndbs::RunSort::RADIX_SORT_8);
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, CountRandomNumbers) {
+    auto [mem_size, num_values] = GetParam();
+    std::mt19937_64 engine{0};
+    /// about half of the values are duplicates
+    std::uniform_int_distribution<uint64_t> distr(0, num_values);
+    std::vector<uint64_t> values(num_values);
+    for (auto& value : values) {
+        value = distr(engine);
+    }
+    check_aggregate(mem_size, values, moderndbs::Aggregate::COUNT, moderndbs::RunSort::STD_SORT);
+    check_aggregate(mem_size, values, moderndbs::Aggregate::DISTINCT, moderndbs::RunSort::RADIX_SORT_11);
+}
+
+
+/// Pulls all batches of a `SortedStream` into a vector.
+std::vector<uint64_t> drain_stream(moderndbs::SortedStream& stream) {
+    std::vector<uint64_t> values;
+    for (auto batch = stream.next(); !batch.empty(); batch = stream.next()) {
+        values.insert(values.end(), batch.begin(), batch.end());
+    }
+    /// the stream stays exhausted
+    EXPECT_TRUE(stream.next().empty());
+    return values;
+}
+
+
+// NOLINTNEXTLINE
+TEST(ExternalSortTest, StreamEmpty) {
+    moderndbs::TestFile input{std::vector<char>()};
+    moderndbs::SortedStream stream{input, 0, MEM_1KiB};
+    ASSERT_TRUE(stream.next().empty());
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, StreamRandomNumbers) {
+    auto [mem_size, num_values] = GetParam();
+    auto [expected_values, input] = make_random_numbers(num_values);
+    std::sort(expected_values.begin(), expected_values.end());
+    moderndbs::SortedStream stream{input, num_values, mem_size};
+    ASSERT_EQ(expected_values, drain_stream(stream));
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, StreamDescendingNumbersDetectPresorted) {
+    auto [mem_size, num_values] = GetParam();
+    auto values = make_descending_numbers(num_values);
+    std::vector<char> file_content(num_values * 8);
+    std::memcpy(file_content.data(), values.data(), num_values * 8);
+    moderndbs::TestFile input{std::move(file_content)};
+    std::sort(values.begin(), values.end());
+    moderndbs::ExternalSortOptions options;
+    options.detect_presorted = true;
+    moderndbs::SortedStream stream{input, num_values, mem_size, options};
+    ASSERT_EQ(values, drain_stream(stream));
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, StreamRandomNumbersPrefetchParallelMerge) {
+    auto [mem_size, num_values] = GetParam();
+    auto [expected_values, input] = make_random_numbers(num_values);
+    std::sort(expected_values.begin(), expected_values.end());
+    moderndbs::ExternalSortOptions options;
+    options.prefetch = true;
+    options.num_merge_threads = 4;
+    moderndbs::SortedStream stream{input, num_values, mem_size, options};
+    ASSERT_EQ(expected_values, drain_stream(stream));
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(ExternalSortParametrizedTest, StreamCountFewDistinctNumbers) {
+    auto [mem_size, num_values] = GetParam();
+    std::vector<uint64_t> values(num_values);
+    std::map<uint64_t, uint64_t> counts;
+    for (size_t i = 0; i < num_values; ++i) {
+        values[i] = (i * 7919) % 37;
+        ++counts[values[i]];
+    }
+    std::vector<uint64_t> expected_values;
+    for (auto [value, count] : counts) {
+        expected_values.push_back(value);
+        expected_values.push_back(count);
+    }
+    std::vector<char> file_content(num_values * 8);
+    std::memcpy(file_content.data(), values.data(), num_values * 8);
+    moderndbs::TestFile input{std::move(file_content)};
+    moderndbs::ExternalSortOptions options;
+    options.aggregate = moderndbs::Aggregate::COUNT;
+    moderndbs::SortedStream stream{input, num_values, mem_size, options};
+    ASSERT_EQ(expected_values, drain_stream(stream));
+}
+
+
 INSTANTIATE_TEST_CASE_P(
     ExternalSortTest,
     ExternalSortParametrizedTest,
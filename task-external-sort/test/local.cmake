@@ -7,7 +7,15 @@
 # ---------------------------------------------------------------------------
 
 set(TEST_CC
+    test/async_file_test.cc
     test/external_sort_test.cc
+    test/loser_tree_test.cc
+    test/mapped_file_test.cc
+    test/memory_arena_test.cc
+    test/posix_file_test.cc
+    test/record_sort_test.cc
+    test/run_codec_test.cc
+    test/striped_file_test.cc
 )
 
 # ---------------------------------------------------------------------------
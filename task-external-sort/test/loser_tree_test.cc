@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+#include "moderndbs/loser_tree.h"
+
+
+namespace {
+
+/// Merges the runs with a loser tree.
+std::vector<uint64_t> merge(const std::vector<std::vector<uint64_t>>& runs) {
+    moderndbs::LoserTree<uint64_t> tree(runs.size());
+    std::vector<size_t> positions(runs.size(), 1);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        if (!runs[i].empty()) {
+            tree.set(i, runs[i][0]);
+        }
+    }
+    tree.build();
+    std::vector<uint64_t> output;
+    while (!tree.empty()) {
+        output.push_back(tree.top());
+        const size_t run = tree.top_source();
+        if (positions[run] < runs[run].size()) {
+            tree.replace_top(runs[run][positions[run]++]);
+        } else {
+            tree.pop_top();
+        }
+    }
+    return output;
+}
+
+
+// NOLINTNEXTLINE
+TEST(LoserTreeTest, SingleRun) {
+    std::vector<std::vector<uint64_t>> runs{{1, 2, 3}};
+    EXPECT_EQ((std::vector<uint64_t>{1, 2, 3}), merge(runs));
+}
+
+
+// NOLINTNEXTLINE
+TEST(LoserTreeTest, EmptyAndDuplicateRuns) {
+    std::vector<std::vector<uint64_t>> runs{{}, {2, 2, 5}, {}, {1, 2}, {7}};
+    EXPECT_EQ((std::vector<uint64_t>{1, 2, 2, 2, 5, 7}), merge(runs));
+}
+
+
+// NOLINTNEXTLINE
+TEST(LoserTreeTest, RandomRuns) {
+    std::mt19937_64 engine{0};
+    std::uniform_int_distribution<uint64_t> distr;
+    for (size_t num_runs : {2, 3, 16, 100, 1024}) {
+        std::vector<std::vector<uint64_t>> runs(num_runs);
+        std::vector<uint64_t> expected_values;
+        for (size_t i = 0; i < num_runs; ++i) {
+            runs[i].resize(distr(engine) % 50);
+            for (auto& value : runs[i]) {
+                value = distr(engine) % 1000;
+                expected_values.push_back(value);
+            }
+            std::sort(runs[i].begin(), runs[i].end());
+        }
+        std::sort(expected_values.begin(), expected_values.end());
+        EXPECT_EQ(expected_values, merge(runs));
+    }
+}
+
+}  // namespace
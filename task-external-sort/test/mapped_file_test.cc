@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include "moderndbs/external_sort.h"
+#include "moderndbs/file.h"
+#include "test_file.h"
+
+
+namespace {
+
+using moderndbs::File;
+using moderndbs::make_random_values;
+
+/// A file on disk with the given values that is removed again at the end of the test.
+class MappedInput {
+private:
+    std::string path;
+
+public:
+    explicit MappedInput(const std::vector<uint64_t>& values)
+    : path("mapped_file_test_" + std::to_string(::getpid())) {
+        std::remove(path.c_str());
+        auto file = File::open_file(path.c_str(), File::WRITE);
+        file->resize(values.size() * 8);
+        file->write_block(reinterpret_cast<const char*>(values.data()), 0, values.size() * 8);
+    }
+
+    ~MappedInput() {
+        std::remove(path.c_str());
+    }
+
+    std::unique_ptr<File> open() const {
+        return File::open_mapped_file(path.c_str());
+    }
+};
+
+
+// NOLINTNEXTLINE
+TEST(MappedFileTest, ReadBlockAndMapRange) {
+    auto values = make_random_values(10000);
+    MappedInput input{values};
+    auto file = input.open();
+    ASSERT_EQ(File::READ, file->get_mode());
+    ASSERT_EQ(values.size() * 8, file->size());
+
+    std::vector<uint64_t> block(100);
+    file->read_block(4321 * 8, 100 * 8, reinterpret_cast<char*>(block.data()));
+    ASSERT_TRUE(std::equal(block.begin(), block.end(), values.begin() + 4321));
+
+    for (auto advice : {File::Advice::NORMAL, File::Advice::SEQUENTIAL, File::Advice::WILLNEED}) {
+        auto mapped = reinterpret_cast<const uint64_t*>(file->map_range(777 * 8, 5000 * 8, advice));
+        ASSERT_NE(nullptr, mapped);
+        ASSERT_TRUE(std::equal(mapped, mapped + 5000, values.begin() + 777));
+    }
+}
+
+
+// NOLINTNEXTLINE
+TEST(MappedFileTest, EmptyFile) {
+    MappedInput input{{}};
+    auto file = input.open();
+    ASSERT_EQ(0, file->size());
+    moderndbs::TestFile output;
+    moderndbs::external_sort(*file, 0, output, 1024);
+    ASSERT_EQ(0, output.size());
+}
+
+
+// NOLINTNEXTLINE
+TEST(MappedFileTest, WriteFails) {
+    MappedInput input{{1, 2, 3}};
+    auto file = input.open();
+    uint64_t value = 4;
+    ASSERT_THROW(file->write_block(reinterpret_cast<const char*>(&value), 0, 8), std::system_error);
+    ASSERT_THROW(file->resize(0), std::system_error);
+}
+
+
+// NOLINTNEXTLINE
+TEST(MappedFileTest, TestFileIsNotMapped) {
+    moderndbs::TestFile file{std::vector<char>(64)};
+    ASSERT_EQ(nullptr, file.map_range(0, 64));
+}
+
+
+class MappedFileSortTest
+: public ::testing::TestWithParam<moderndbs::ExternalSortOptions> {
+};
+
+
+// NOLINTNEXTLINE
+TEST_P(MappedFileSortTest, SortRandomNumbers) {
+    constexpr size_t NUM_VALUES = 100000;
+    constexpr size_t MEM_SIZE = 64 * 1024;
+    auto values = make_random_values(NUM_VALUES);
+    MappedInput input{values};
+    auto file = input.open();
+    moderndbs::TestFile output;
+    moderndbs::external_sort(*file, NUM_VALUES, output, MEM_SIZE, GetParam());
+    std::sort(values.begin(), values.end());
+    ASSERT_EQ(values, get_file_values(output));
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(MappedFileSortTest, SortDescendingNumbers) {
+    constexpr size_t NUM_VALUES = 100000;
+    constexpr size_t MEM_SIZE = 64 * 1024;
+    std::vector<uint64_t> values(NUM_VALUES);
+    for (size_t i = 0; i < NUM_VALUES; ++i) {
+        values[i] = NUM_VALUES - i;
+    }
+    MappedInput input{values};
+    auto file = input.open();
+    moderndbs::TestFile output;
+    moderndbs::external_sort(*file, NUM_VALUES, output, MEM_SIZE, GetParam());
+    std::sort(values.begin(), values.end());
+    ASSERT_EQ(values, get_file_values(output));
+}
+
+
+moderndbs::ExternalSortOptions replacement_selection() {
+    moderndbs::ExternalSortOptions options;
+    options.run_generation = moderndbs::RunGeneration::REPLACEMENT_SELECTION;
+    return options;
+}
+
+
+moderndbs::ExternalSortOptions detect_presorted() {
+    moderndbs::ExternalSortOptions options;
+    options.detect_presorted = true;
+    return options;
+}
+
+
+INSTANTIATE_TEST_CASE_P(
+    MappedFileTest,
+    MappedFileSortTest,
+    ::testing::Values(moderndbs::ExternalSortOptions{}, replacement_selection(), detect_presorted())
+);
+
+
+// NOLINTNEXTLINE
+TEST(MappedFileTest, TopK) {
+    constexpr size_t NUM_VALUES = 100000;
+    auto values = make_random_values(NUM_VALUES);
+    MappedInput input{values};
+    auto file = input.open();
+    std::sort(values.begin(), values.end());
+    /// a heap of 100 values and runs cut to 50000 values
+    for (size_t k : {size_t{100}, size_t{50000}}) {
+        moderndbs::TestFile output;
+        moderndbs::external_top_k(*file, NUM_VALUES, k, output, 64 * 1024);
+        auto output_values = get_file_values(output);
+        ASSERT_EQ(k, output_values.size());
+        ASSERT_TRUE(std::equal(output_values.begin(), output_values.end(), values.begin()));
+    }
+}
+
+}  // namespace
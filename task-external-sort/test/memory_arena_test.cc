@@ -0,0 +1,102 @@
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "moderndbs/memory_arena.h"
+
+
+namespace {
+
+using moderndbs::MemoryArena;
+
+
+// NOLINTNEXTLINE
+TEST(MemoryArenaTest, AllocateWithinBudget) {
+    MemoryArena arena{64};
+    auto first = arena.allocate(24);
+    auto second = arena.allocate(40);
+    ASSERT_NE(nullptr, first.get());
+    ASSERT_EQ(first.get() + 24, second.get());
+    EXPECT_EQ(64, arena.used());
+    EXPECT_EQ(0, arena.available());
+    std::memset(first.get(), 1, 24);
+    std::memset(second.get(), 2, 40);
+
+    first.reset();
+    EXPECT_EQ(40, arena.used());
+    EXPECT_EQ(24, arena.available());
+    EXPECT_EQ(64, arena.peak());
+}
+
+
+// NOLINTNEXTLINE
+TEST(MemoryArenaTest, RoundsUpToAlignment) {
+    MemoryArena arena{32};
+    auto first = arena.allocate(1);
+    auto second = arena.allocate(9);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(second.get()) % MemoryArena::ALIGNMENT);
+    EXPECT_EQ(24, arena.used());
+    EXPECT_EQ(8, arena.available());
+    auto empty = arena.allocate(0);
+    EXPECT_EQ(nullptr, empty.get());
+    EXPECT_EQ(24, arena.used());
+}
+
+
+// NOLINTNEXTLINE
+TEST(MemoryArenaTest, ThrowsOnOverrun) {
+    MemoryArena arena{64};
+    EXPECT_THROW(arena.allocate(72), MemoryArena::BudgetExceeded);
+    auto first = arena.allocate(32);
+    EXPECT_THROW(arena.allocate(40), MemoryArena::BudgetExceeded);
+    /// a failed allocation takes nothing
+    EXPECT_EQ(32, arena.used());
+    EXPECT_EQ(32, arena.peak());
+    auto second = arena.allocate(32);
+    EXPECT_EQ(64, arena.used());
+}
+
+
+// NOLINTNEXTLINE
+TEST(MemoryArenaTest, ReusesGapsOfReleasedBlocks) {
+    MemoryArena arena{96};
+    auto first = arena.allocate(32);
+    auto second = arena.allocate(32);
+    auto third = arena.allocate(32);
+    char* second_block = second.get();
+    second.reset();
+    /// a gap of 32 bytes := 40 bytes do not fit, 32 bytes go into the gap
+    EXPECT_EQ(32, arena.available());
+    EXPECT_THROW(arena.allocate(40), MemoryArena::BudgetExceeded);
+    auto fourth = arena.allocate(16);
+    EXPECT_EQ(second_block, fourth.get());
+    auto fifth = arena.allocate(16);
+    EXPECT_EQ(second_block + 16, fifth.get());
+    EXPECT_EQ(96, arena.peak());
+}
+
+
+// NOLINTNEXTLINE
+TEST(MemoryArenaTest, ConcurrentAllocations) {
+    constexpr size_t NUM_THREADS = 4;
+    constexpr size_t BLOCK_SIZE = 1024;
+    MemoryArena arena{NUM_THREADS * BLOCK_SIZE};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NUM_THREADS; ++t) {
+        threads.emplace_back([&arena, t] {
+            for (size_t i = 0; i < 1000; ++i) {
+                auto block = arena.allocate(BLOCK_SIZE);
+                std::memset(block.get(), static_cast<int>(t), BLOCK_SIZE);
+                ASSERT_EQ(static_cast<char>(t), block[BLOCK_SIZE - 1]);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(0, arena.used());
+    EXPECT_LE(arena.peak(), NUM_THREADS * BLOCK_SIZE);
+}
+
+}  // namespace
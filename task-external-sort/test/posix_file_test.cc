@@ -0,0 +1,108 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <system_error>
+#include <gtest/gtest.h>
+#include "moderndbs/file.h"
+
+
+namespace {
+
+using moderndbs::File;
+
+/// Opens a temporary file with `O_DIRECT`, or returns nullptr if the file system does not support it (e.g. older
+/// tmpfs).
+std::unique_ptr<File> make_direct_file() {
+    try {
+        return File::make_temporary_file(File::Caching::DIRECT);
+    } catch (const std::system_error& e) {
+        if (e.code().value() != EINVAL) {
+            throw;
+        }
+        return nullptr;
+    }
+}
+
+
+// NOLINTNEXTLINE
+TEST(PosixFileTest, AllocateAligned) {
+    for (size_t size : {size_t{0}, size_t{1}, File::DIRECT_ALIGNMENT, 3 * File::DIRECT_ALIGNMENT + 5}) {
+        auto block = File::allocate_aligned(size);
+        ASSERT_NE(nullptr, block.get());
+        ASSERT_TRUE(File::is_aligned(block.get(), 0, 0));
+        /// the size is rounded up, so the whole last alignment unit can be written
+        std::memset(block.get(), 0, (size + File::DIRECT_ALIGNMENT - 1) / File::DIRECT_ALIGNMENT * File::DIRECT_ALIGNMENT);
+    }
+}
+
+
+// NOLINTNEXTLINE
+TEST(PosixFileTest, IsAligned) {
+    auto block = File::allocate_aligned(2 * File::DIRECT_ALIGNMENT);
+    ASSERT_TRUE(File::is_aligned(block.get(), File::DIRECT_ALIGNMENT, File::DIRECT_ALIGNMENT));
+    ASSERT_FALSE(File::is_aligned(block.get() + 8, 0, File::DIRECT_ALIGNMENT));
+    ASSERT_FALSE(File::is_aligned(block.get(), 512, File::DIRECT_ALIGNMENT));
+    ASSERT_FALSE(File::is_aligned(block.get(), 0, 100));
+}
+
+
+// NOLINTNEXTLINE
+TEST(PosixFileTest, BufferedIsDefault) {
+    auto file = File::make_temporary_file();
+    ASSERT_EQ(File::Caching::BUFFERED, file->get_caching());
+    /// buffered files take any block
+    uint64_t value = 42;
+    file->resize(16);
+    file->write_block(reinterpret_cast<const char*>(&value), 3, 8);
+    uint64_t read_value = 0;
+    file->read_block(3, 8, reinterpret_cast<char*>(&read_value));
+    ASSERT_EQ(value, read_value);
+}
+
+
+// NOLINTNEXTLINE
+TEST(PosixFileTest, DirectReadWrite) {
+    auto file = make_direct_file();
+    if (!file) {
+        return;
+    }
+    ASSERT_EQ(File::Caching::DIRECT, file->get_caching());
+    constexpr size_t SIZE = 4 * File::DIRECT_ALIGNMENT;
+    auto block = File::allocate_aligned(SIZE);
+    for (size_t i = 0; i < SIZE; ++i) {
+        block[i] = static_cast<char>(i * 7);
+    }
+    file->resize(2 * SIZE);
+    file->write_block(block.get(), SIZE, SIZE);
+
+    auto read = File::allocate_aligned(SIZE);
+    file->read_block(SIZE, SIZE, read.get());
+    ASSERT_EQ(0, std::memcmp(block.get(), read.get(), SIZE));
+}
+
+
+// NOLINTNEXTLINE
+TEST(PosixFileTest, DirectUnalignedBlocksFail) {
+    auto file = make_direct_file();
+    if (!file) {
+        return;
+    }
+    auto block = File::allocate_aligned(2 * File::DIRECT_ALIGNMENT);
+    file->resize(4 * File::DIRECT_ALIGNMENT);
+    auto check_einval = [](auto&& io) {
+        try {
+            io();
+            FAIL() << "unaligned direct I/O did not throw";
+        } catch (const std::system_error& e) {
+            ASSERT_EQ(EINVAL, e.code().value());
+        }
+    };
+    /// unaligned memory, offset and size
+    check_einval([&] { file->write_block(block.get() + 1, 0, File::DIRECT_ALIGNMENT); });
+    check_einval([&] { file->write_block(block.get(), 100, File::DIRECT_ALIGNMENT); });
+    check_einval([&] { file->read_block(0, 100, block.get()); });
+    check_einval([&] { file->read_block(0, File::DIRECT_ALIGNMENT, block.get() + 8); });
+}
+
+}  // namespace
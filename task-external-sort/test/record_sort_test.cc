@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <gtest/gtest.h>
+#include "moderndbs/record_sort.h"
+#include "test_file.h"
+
+
+namespace {
+
+constexpr size_t MEM_1KiB = 1ul << 10;
+
+/// A fixed-width tuple: key + payload.
+struct Row {
+    uint64_t key;
+    uint32_t payload[6];
+};
+
+/// Random rows, the payload holds the position of the row in the input.
+std::vector<Row> make_random_rows(size_t num_rows) {
+    std::mt19937_64 engine{0};
+    std::vector<Row> rows(num_rows);
+    for (size_t i = 0; i < num_rows; ++i) {
+        rows[i].key = engine() % 1000;
+        std::fill(std::begin(rows[i].payload), std::end(rows[i].payload), static_cast<uint32_t>(i));
+    }
+    return rows;
+}
+
+/// Random records of 0 to `max_size` lowercase letters.
+std::vector<std::string> make_random_records(size_t num_records, size_t max_size) {
+    std::mt19937_64 engine{0};
+    std::vector<std::string> records(num_records);
+    for (auto& record : records) {
+        record.resize(engine() % (max_size + 1));
+        for (auto& c : record) {
+            c = static_cast<char>('a' + engine() % 26);
+        }
+    }
+    return records;
+}
+
+/// Writes the records into a data file and an offset file, the first record starts at `first_offset`.
+std::pair<moderndbs::TestFile, moderndbs::TestFile> make_variable_files(const std::vector<std::string>& records, size_t first_offset) {
+    std::vector<char> data(first_offset, 'x');
+    std::vector<uint64_t> offsets;
+    for (const auto& record : records) {
+        offsets.push_back(data.size());
+        data.insert(data.end(), record.begin(), record.end());
+    }
+    offsets.push_back(data.size());
+    std::vector<char> offset_content(offsets.size() * sizeof(uint64_t));
+    std::memcpy(offset_content.data(), offsets.data(), offset_content.size());
+    return {moderndbs::TestFile{std::move(data)}, moderndbs::TestFile{std::move(offset_content)}};
+}
+
+/// Reads the records back from a data file and an offset file.
+std::vector<std::string> get_records(moderndbs::TestFile& data, moderndbs::TestFile& offset_file) {
+    std::vector<uint64_t> offsets(offset_file.size() / sizeof(uint64_t));
+    std::memcpy(offsets.data(), offset_file.get_content().data(), offset_file.size());
+    std::vector<std::string> records;
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+        records.emplace_back(data.get_content().data() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+    return records;
+}
+
+
+class RecordSortParametrizedTest
+: public ::testing::TestWithParam<size_t> {};
+
+
+// NOLINTNEXTLINE
+TEST_P(RecordSortParametrizedTest, SortFixedSizeRows) {
+    const size_t num_rows = GetParam();
+    auto rows = make_random_rows(num_rows);
+    std::vector<char> file_content(num_rows * sizeof(Row));
+    std::memcpy(file_content.data(), rows.data(), file_content.size());
+    moderndbs::TestFile input{std::move(file_content)};
+    moderndbs::TestFile output;
+
+    moderndbs::external_sort<Row>(input, num_rows, output, MEM_1KiB, [](const Row& row) { return row.key; });
+
+    ASSERT_EQ(num_rows * sizeof(Row), output.size());
+    std::vector<Row> output_rows(num_rows);
+    std::memcpy(output_rows.data(), output.get_content().data(), output.size());
+    std::vector<bool> seen(num_rows, false);
+    for (size_t i = 0; i < num_rows; ++i) {
+        const auto& row = output_rows[i];
+        if (i > 0) {
+            ASSERT_LE(output_rows[i - 1].key, row.key);
+        }
+        ASSERT_LT(row.payload[0], num_rows);
+        ASSERT_FALSE(seen[row.payload[0]]);
+        seen[row.payload[0]] = true;
+        ASSERT_EQ(rows[row.payload[0]].key, row.key);
+        ASSERT_EQ(row.payload[0], row.payload[5]);
+    }
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(RecordSortParametrizedTest, SortVariableLengthRecords) {
+    const size_t num_records = GetParam();
+    auto records = make_random_records(num_records, 40);
+    auto [input, input_offsets] = make_variable_files(records, 3);
+    moderndbs::TestFile output;
+    moderndbs::TestFile output_offsets;
+
+    moderndbs::external_sort_variable(input, input_offsets, num_records, output, output_offsets, MEM_1KiB,
+                                      [](std::string_view record) { return record; });
+
+    std::sort(records.begin(), records.end());
+    ASSERT_EQ((num_records + 1) * sizeof(uint64_t), output_offsets.size());
+    ASSERT_EQ(input.size() - 3, output.size());
+    ASSERT_EQ(records, get_records(output, output_offsets));
+}
+
+
+// NOLINTNEXTLINE
+TEST_P(RecordSortParametrizedTest, SortVariableLengthRecordsByKeyPrefix) {
+    const size_t num_records = GetParam();
+    auto records = make_random_records(num_records, 40);
+    auto [input, input_offsets] = make_variable_files(records, 0);
+    moderndbs::TestFile output;
+    moderndbs::TestFile output_offsets;
+
+    /// descending by the first two characters
+    auto key = [](std::string_view record) { return record.substr(0, 2); };
+    moderndbs::external_sort_variable(input, input_offsets, num_records, output, output_offsets, MEM_1KiB, key, std::greater<>());
+
+    auto output_records = get_records(output, output_offsets);
+    ASSERT_EQ(num_records, output_records.size());
+    ASSERT_TRUE(std::is_sorted(output_records.begin(), output_records.end(), [&](const auto& a, const auto& b) {
+        return key(a) > key(b);
+    }));
+    std::sort(records.begin(), records.end());
+    std::sort(output_records.begin(), output_records.end());
+    ASSERT_EQ(records, output_records);
+}
+
+
+INSTANTIATE_TEST_CASE_P(
+    RecordSortTest,
+    RecordSortParametrizedTest,
+    ::testing::Values(0, 1, 20, 1000, 20000)
+);
+
+
+// NOLINTNEXTLINE
+TEST(RecordSortTest, VariableLengthRecordTooLarge) {
+    std::vector<std::string> records{"a", std::string(MEM_1KiB, 'b'), "c"};
+    auto [input, input_offsets] = make_variable_files(records, 0);
+    moderndbs::TestFile output;
+    moderndbs::TestFile output_offsets;
+    EXPECT_THROW(moderndbs::external_sort_variable(input, input_offsets, records.size(), output, output_offsets,
+                                                   MEM_1KiB, [](std::string_view record) { return record; }),
+                 std::length_error);
+}
+
+}  // namespace
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+#include "moderndbs/run_codec.h"
+
+
+namespace {
+
+namespace run_codec = moderndbs::run_codec;
+
+/// Encodes the values as one block, returns the words of the block.
+std::vector<uint64_t> encode(const std::vector<uint64_t>& values) {
+    std::vector<uint64_t> words(run_codec::HEADER_WORDS);
+    words.insert(words.end(), values.begin(), values.end());
+    words.resize(run_codec::encode_block(words.data(), values.size()));
+    EXPECT_LE(words.size(), values.size() + 1);
+    return words;
+}
+
+/// Decodes `num_values` values from the words.
+std::vector<uint64_t> decode(const std::vector<uint64_t>& words, size_t num_values) {
+    run_codec::Decoder decoder;
+    size_t next_word = 0;
+    std::vector<uint64_t> values;
+    for (size_t i = 0; i < num_values; ++i) {
+        values.push_back(decoder.next([&] { return words.at(next_word++); }));
+    }
+    EXPECT_EQ(words.size(), next_word);
+    return values;
+}
+
+
+// NOLINTNEXTLINE
+TEST(RunCodecTest, SingleValue) {
+    std::vector<uint64_t> values{42};
+    auto words = encode(values);
+    EXPECT_EQ(run_codec::HEADER_WORDS, words.size());
+    EXPECT_EQ(values, decode(words, 1));
+}
+
+
+// NOLINTNEXTLINE
+TEST(RunCodecTest, EqualValues) {
+    std::vector<uint64_t> values(1000, 7);
+    auto words = encode(values);
+    EXPECT_EQ(run_codec::HEADER_WORDS, words.size());
+    EXPECT_EQ(values, decode(words, values.size()));
+}
+
+
+// NOLINTNEXTLINE
+TEST(RunCodecTest, FullWidthDifferences) {
+    std::vector<uint64_t> values{0, 1, std::numeric_limits<uint64_t>::max() - 1, std::numeric_limits<uint64_t>::max()};
+    auto words = encode(values);
+    EXPECT_EQ(values, decode(words, values.size()));
+}
+
+
+// NOLINTNEXTLINE
+TEST(RunCodecTest, BlockLargerThanMaxWordsIsNotEncoded) {
+    std::vector<uint64_t> values{0, std::numeric_limits<uint64_t>::max()};
+    std::vector<uint64_t> words(run_codec::HEADER_WORDS);
+    words.insert(words.end(), values.begin(), values.end());
+    auto expected = words;
+    EXPECT_EQ(0, run_codec::encode_block(words.data(), values.size(), values.size()));
+    EXPECT_EQ(expected, words);
+    EXPECT_EQ(3, run_codec::encode_block(words.data(), values.size(), values.size() + 1));
+}
+
+
+// NOLINTNEXTLINE
+TEST(RunCodecTest, RandomBlocks) {
+    std::mt19937_64 engine{0};
+    for (uint64_t range : {uint64_t{1} << 10, uint64_t{1} << 33, std::numeric_limits<uint64_t>::max()}) {
+        std::vector<uint64_t> all_values;
+        std::vector<uint64_t> all_words;
+        /// several blocks of different sizes back to back
+        for (size_t num_values : {1, 5, 64, 1000, 3}) {
+            std::vector<uint64_t> values(num_values);
+            for (auto& value : values) {
+                value = engine() % range;
+            }
+            std::sort(values.begin(), values.end());
+            auto words = encode(values);
+            all_values.insert(all_values.end(), values.begin(), values.end());
+            all_words.insert(all_words.end(), words.begin(), words.end());
+        }
+        EXPECT_EQ(all_values, decode(all_words, all_values.size()));
+    }
+}
+
+
+// NOLINTNEXTLINE
+TEST(RunCodecTest, DenseValuesCompress) {
+    std::vector<uint64_t> values(4096);
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = (uint64_t{1} << 40) + 3 * i;
+    }
+    auto words = encode(values);
+    /// differences of 3 take 2 bits
+    EXPECT_EQ(run_codec::HEADER_WORDS + (values.size() - 1) * 2 / 64 + 1, words.size());
+    EXPECT_EQ(values, decode(words, values.size()));
+}
+
+}  // namespace
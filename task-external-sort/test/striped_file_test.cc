@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include "moderndbs/external_sort.h"
+#include "moderndbs/striped_file.h"
+#include "test_file.h"
+
+
+namespace {
+
+using moderndbs::File;
+using moderndbs::StripedFile;
+
+/// Directories that are removed again at the end of the test.
+class SpillDirectories {
+public:
+    std::vector<std::string> paths;
+
+    explicit SpillDirectories(size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            std::string path = "striped_file_test_XXXXXX";
+            if (::mkdtemp(path.data()) == nullptr) {
+                throw std::system_error{errno, std::system_category()};
+            }
+            paths.push_back(path);
+        }
+    }
+
+    ~SpillDirectories() {
+        for (auto& path : paths) {
+            ::rmdir(path.c_str());
+        }
+    }
+};
+
+
+/// A file of the content that counts its bytes, as the devices of a `StripedFile`.
+std::vector<std::unique_ptr<File>> make_devices(size_t count) {
+    std::vector<std::unique_ptr<File>> files;
+    for (size_t i = 0; i < count; ++i) {
+        files.push_back(std::make_unique<moderndbs::TestFile>());
+    }
+    return files;
+}
+
+
+// NOLINTNEXTLINE
+TEST(StripedFileTest, StripesRoundRobin) {
+    constexpr size_t STRIPE_SIZE = 64;
+    auto devices = make_devices(3);
+    std::vector<moderndbs::TestFile*> device_files;
+    for (auto& device : devices) {
+        device_files.push_back(static_cast<moderndbs::TestFile*>(device.get()));
+    }
+    std::vector<StripedFile::DeviceCounters> counters(3);
+    StripedFile file{std::move(devices), STRIPE_SIZE, counters.data()};
+    ASSERT_EQ(3, file.num_devices());
+
+    /// 7 full stripes and half a stripe := 3 stripes on device 0, 2.5 on device 1, 2 on device 2
+    constexpr size_t SIZE = 7 * STRIPE_SIZE + STRIPE_SIZE / 2;
+    file.resize(SIZE);
+    ASSERT_EQ(SIZE, file.size());
+    ASSERT_EQ(3 * STRIPE_SIZE, device_files[0]->size());
+    ASSERT_EQ(2 * STRIPE_SIZE + STRIPE_SIZE / 2, device_files[1]->size());
+    ASSERT_EQ(2 * STRIPE_SIZE, device_files[2]->size());
+
+    std::vector<char> written(SIZE);
+    std::iota(written.begin(), written.end(), 0);
+    file.write_block(written.data(), 0, SIZE);
+    /// stripe 4 is the second stripe of device 1
+    ASSERT_EQ(written[4 * STRIPE_SIZE + 5], device_files[1]->get_content()[STRIPE_SIZE + 5]);
+    ASSERT_EQ(3 * STRIPE_SIZE, counters[0].bytes_written);
+    ASSERT_EQ(2 * STRIPE_SIZE + STRIPE_SIZE / 2, counters[1].bytes_written);
+
+    /// a block across the bounds of several stripes
+    std::vector<char> read(3 * STRIPE_SIZE);
+    file.read_block(STRIPE_SIZE / 2, read.size(), read.data());
+    ASSERT_TRUE(std::equal(read.begin(), read.end(), written.begin() + STRIPE_SIZE / 2));
+    ASSERT_EQ(STRIPE_SIZE, counters[1].bytes_read);
+    ASSERT_EQ(STRIPE_SIZE, counters[0].bytes_read);
+    ASSERT_EQ(STRIPE_SIZE, counters[2].bytes_read);
+}
+
+
+// NOLINTNEXTLINE
+TEST(StripedFileTest, ManyConcurrentBlocks) {
+    SpillDirectories directories{4};
+    auto file = StripedFile::make_temporary_file(directories.paths, 4096);
+    constexpr size_t NUM_VALUES = 100000;
+    file->resize(NUM_VALUES * 8);
+    std::vector<uint64_t> values(NUM_VALUES);
+    std::iota(values.begin(), values.end(), 0);
+    file->write_block(reinterpret_cast<const char*>(values.data()), 0, NUM_VALUES * 8);
+
+    /// blocks of odd sizes from several threads at once
+    std::vector<std::thread> threads;
+    std::vector<bool> correct(4);
+    for (size_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            bool ok = true;
+            for (size_t offset = t * 8; offset + 1003 * 8 <= NUM_VALUES * 8; offset += 4 * 997 * 8) {
+                std::vector<uint64_t> block(1003);
+                file->read_block(offset, block.size() * 8, reinterpret_cast<char*>(block.data()));
+                ok &= std::equal(block.begin(), block.end(), values.begin() + offset / 8);
+            }
+            correct[t] = ok;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(std::vector<bool>(4, true), correct);
+}
+
+
+// NOLINTNEXTLINE
+TEST(StripedFileTest, ExternalSortReportsBytesPerDirectory) {
+    constexpr size_t NUM_VALUES = 100000;
+    std::vector<uint64_t> values(NUM_VALUES);
+    for (size_t i = 0; i < NUM_VALUES; ++i) {
+        values[i] = (i * 7919) % NUM_VALUES;
+    }
+    std::vector<char> file_content(NUM_VALUES * 8);
+    std::memcpy(file_content.data(), values.data(), NUM_VALUES * 8);
+    moderndbs::TestFile input{std::move(file_content)};
+    moderndbs::TestFile output;
+
+    SpillDirectories directories{3};
+    moderndbs::ExternalSortStats stats;
+    moderndbs::ExternalSortOptions options;
+    options.spill_directories = directories.paths;
+    options.spill_stripe_size = 4096;
+    options.stats = &stats;
+    moderndbs::external_sort(input, NUM_VALUES, output, 64 * 1024, options);
+
+    std::sort(values.begin(), values.end());
+    std::vector<uint64_t> output_values(NUM_VALUES);
+    std::memcpy(output_values.data(), output.get_content().data(), NUM_VALUES * 8);
+    ASSERT_EQ(values, output_values);
+    /// every run is written to all directories once, and read at least once (debug builds check the runs)
+    ASSERT_EQ(3, stats.spill_bytes_written.size());
+    ASSERT_EQ(3, stats.spill_bytes_read.size());
+    ASSERT_EQ(NUM_VALUES * 8, std::accumulate(stats.spill_bytes_written.begin(), stats.spill_bytes_written.end(), size_t{0}));
+    ASSERT_LE(NUM_VALUES * 8, std::accumulate(stats.spill_bytes_read.begin(), stats.spill_bytes_read.end(), size_t{0}));
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_GT(stats.spill_bytes_written[i], NUM_VALUES * 8 / 4);
+        ASSERT_GT(stats.spill_bytes_read[i], NUM_VALUES * 8 / 4);
+    }
+}
+
+
+
+// NOLINTNEXTLINE
+TEST(StripedFileTest, ExternalSortMultiPassMerge) {
+    constexpr size_t NUM_VALUES = 50000;
+    std::vector<uint64_t> values(NUM_VALUES);
+    for (size_t i = 0; i < NUM_VALUES; ++i) {
+        values[i] = NUM_VALUES - i + (i * 7919) % 13;
+    }
+    std::vector<char> file_content(NUM_VALUES * 8);
+    std::memcpy(file_content.data(), values.data(), NUM_VALUES * 8);
+    moderndbs::TestFile input{std::move(file_content)};
+    std::sort(values.begin(), values.end());
+
+    SpillDirectories directories{2};
+    for (size_t variant = 0; variant < 3; ++variant) {
+        moderndbs::ExternalSortOptions options;
+        options.spill_directories = directories.paths;
+        options.spill_stripe_size = 1000;
+        options.prefetch = variant == 1;
+        options.num_merge_threads = variant == 1 ? 4 : 1;
+        options.encode_runs = variant == 2;
+        options.run_generation = variant == 2 ? moderndbs::RunGeneration::REPLACEMENT_SELECTION : moderndbs::RunGeneration::SORT;
+
+        /// 1 KiB := several merge passes over tmp files
+        moderndbs::TestFile output;
+        moderndbs::external_sort(input, NUM_VALUES, output, 1024, options);
+        std::vector<uint64_t> output_values(NUM_VALUES);
+        std::memcpy(output_values.data(), output.get_content().data(), NUM_VALUES * 8);
+        ASSERT_EQ(values, output_values) << "variant " << variant;
+
+        moderndbs::SortedStream stream{input, NUM_VALUES, 1024, options};
+        std::vector<uint64_t> stream_values;
+        for (auto batch = stream.next(); !batch.empty(); batch = stream.next()) {
+            stream_values.insert(stream_values.end(), batch.begin(), batch.end());
+        }
+        ASSERT_EQ(values, stream_values) << "variant " << variant;
+    }
+}
+
+}  // namespace
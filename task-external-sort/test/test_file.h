@@ -0,0 +1,113 @@
+#ifndef TEST_TEST_FILE_H
+#define TEST_TEST_FILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <utility>
+#include <vector>
+#include "moderndbs/file.h"
+
+
+namespace moderndbs {
+
+class TestFileError
+: public std::exception {
+private:
+    const char* message;
+
+public:
+    explicit TestFileError(const char* message) : message(message) {}
+
+    ~TestFileError() override = default;
+
+    const char* what() const noexcept override {
+        return message;
+    }
+};
+
+
+class TestFile
+: public File {
+private:
+    Mode mode;
+    std::vector<char> file_content;
+
+public:
+    explicit TestFile(Mode mode = WRITE) : mode(mode) {}
+
+    explicit TestFile(std::vector<char>&& file_content, Mode mode = READ)
+    : mode(mode), file_content(std::move(file_content)) {}
+
+    TestFile(const TestFile&) = default;
+    TestFile(TestFile&&) = default;
+
+    ~TestFile() override = default;
+
+    TestFile& operator=(const TestFile&) = default;
+    TestFile& operator=(TestFile&&) = default;
+
+    std::vector<char>& get_content() {
+        return file_content;
+    }
+
+    Mode get_mode() const override {
+        return mode;
+    }
+
+    size_t size() const override {
+        return file_content.size();
+    }
+
+    void resize(size_t new_size) override {
+        if (mode == READ) {
+            throw TestFileError{"trying to resize a read only file"};
+        }
+        file_content.resize(new_size);
+    }
+
+    void read_block(size_t offset, size_t size, char* block) override {
+        if (offset + size > file_content.size()) {
+            throw TestFileError{"trying to read past end of file"};
+        }
+        std::memcpy(block, file_content.data() + offset, size);
+    }
+
+    void write_block(const char* block, size_t offset, size_t size) override {
+        if (mode == READ) {
+            throw TestFileError{"trying to write to a read only file"};
+        }
+        if (offset + size > file_content.size()) {
+            throw TestFileError{"trying to write past end of file"};
+        }
+        std::memcpy(file_content.data() + offset, block, size);
+    }
+};
+
+
+/// Returns `count` uniformly random values, the same ones for every call.
+inline std::vector<uint64_t> make_random_values(size_t count) {
+    std::mt19937_64 engine{0};
+    std::uniform_int_distribution<uint64_t> distr;
+    std::vector<uint64_t> values(count);
+    for (auto& value : values) {
+        value = distr(engine);
+    }
+    return values;
+}
+
+
+/// Returns the content of a file as 64 bit values.
+inline std::vector<uint64_t> get_file_values(TestFile& file) {
+    auto& content = file.get_content();
+    std::vector<uint64_t> values(content.size() / 8);
+    if (!values.empty()) {
+        std::memcpy(values.data(), content.data(), content.size());
+    }
+    return values;
+}
+
+}  // namespace moderndbs
+
+#endif
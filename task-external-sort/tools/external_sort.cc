@@ -5,6 +5,7 @@
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 #include "moderndbs/external_sort.h"
 #include "moderndbs/file.h"
 
@@ -24,13 +25,37 @@ Options for generate:
 Options for print:
     print <input_file>
 
-    "print" prints all integers contained in <input_file>.
+    "print" prints all integers contained in <input_file>, which is read
+    through a memory mapping.
 
 Options for sort
-    sort <input_file> <output_file> <mem_size>
+    sort [--threads <num_threads>] [--replacement-selection] [--prefetch]
+         [--radix <digit_bits>] [--merge-threads <num_threads>] [--encode-runs]
+         [--detect-presorted] [--top-k <k>] [--distinct|--count]
+         [--spill-dir <directory>]... [--stripe-size <bytes>]
+         [--stats[=json]] <input_file> <output_file> <mem_size>
 
     "sort" sorts the integers contained in <input_file> and writes them into
-    <output_file> by using moderndbs::external_sort().
+    <output_file> by using moderndbs::external_sort(). <input_file> is
+    memory-mapped, so scans over it read the page cache in place. With
+    --threads, runs are generated by <num_threads> threads that share
+    <mem_size>. With
+    --replacement-selection, runs are generated by replacement selection.
+    With --prefetch, the merge reads and writes on a background I/O thread.
+    With --radix, runs are sorted by an LSD radix sort with 8 or 11 bit
+    digits instead of std::sort(). With --merge-threads, every merge is cut
+    into <num_threads> key ranges that are merged concurrently. With
+    --encode-runs, the runs in tmp files are compressed. With
+    --detect-presorted, sorted, reverse sorted and nearly sorted input skips
+    run generation. With --top-k, only the <k> smallest integers are written
+    by using moderndbs::external_top_k(). With --distinct, every integer is
+    written once. With --count, every integer is written once followed by the
+    number of its occurrences. With --spill-dir, the tmp files are striped
+    across all given directories in stripes of --stripe-size bytes, which
+    should be on different devices. With --stats, the metrics of the sort
+    are printed to stderr once it is done: the wall time and the I/O of run
+    generation and merge, the shape of the merge and histograms of the I/O
+    sizes, as JSON with --stats=json. --top-k does not support --stats.
 )";
 }
 
@@ -120,20 +145,12 @@ int mode_print(int argc, const char* argv[]) {
         usage(argv[0]);
         return 2;
     }
-    auto file = File::open_file(argv[2], File::READ);
-    size_t file_size = file->size();
-    std::vector<uint64_t> values(512);
-    size_t offset = 0;
-    while (offset + 512 * sizeof(uint64_t) <= file_size) {
-        file->read_block(offset, 512 * sizeof(uint64_t), reinterpret_cast<char*>(values.data()));
-        for (uint64_t value : values) {
-            std::cout << value << '\n';
-        }
-        offset += 512 * sizeof(uint64_t);
-    }
-    size_t remaining = (file_size - offset) / sizeof(uint64_t);
-    file->read_block(offset, remaining * sizeof(uint64_t), reinterpret_cast<char*>(values.data()));
-    for (size_t i = 0; i < remaining; ++i) {
+    auto file = File::open_mapped_file(argv[2]);
+    size_t num_values = file->size() / sizeof(uint64_t);
+    auto values = reinterpret_cast<const uint64_t*>(
+        file->map_range(0, num_values * sizeof(uint64_t), File::Advice::SEQUENTIAL)
+    );
+    for (size_t i = 0; i < num_values; ++i) {
         std::cout << values[i] << '\n';
     }
     std::cout.flush();
@@ -141,27 +158,182 @@ int mode_print(int argc, const char* argv[]) {
 }
 
 
+/// Prints the I/O of a phase, `what` is the name of the phase.
+static void print_phase(std::ostream& out, const char* what, double seconds, const moderndbs::ExternalSortPhaseIo& io) {
+    out << what << ": " << seconds << " s (" << io.wait_seconds << " s waiting for I/O), "
+        << io.num_reads << " reads of " << io.bytes_read << " bytes, "
+        << io.num_writes << " writes of " << io.bytes_written << " bytes" << std::endl;
+}
+
+
+/// Prints the non-empty size classes of an I/O size histogram.
+static void print_histogram(std::ostream& out, const char* what, const std::vector<size_t>& histogram) {
+    out << what << " sizes:";
+    for (size_t i = 0; i < histogram.size(); ++i) {
+        if (histogram[i] > 0) {
+            out << " [" << (size_t{1} << i) << ", " << (size_t{1} << i) * 2 << "): " << histogram[i];
+        }
+    }
+    out << std::endl;
+}
+
+
+/// Prints the I/O of a phase as a JSON object.
+static void print_phase_json(std::ostream& out, double seconds, const moderndbs::ExternalSortPhaseIo& io) {
+    out << "{\"seconds\": " << seconds << ", \"wait_seconds\": " << io.wait_seconds
+        << ", \"num_reads\": " << io.num_reads << ", \"bytes_read\": " << io.bytes_read
+        << ", \"num_writes\": " << io.num_writes << ", \"bytes_written\": " << io.bytes_written << "}";
+}
+
+
+/// Prints the values as a JSON array.
+static void print_array_json(std::ostream& out, const std::vector<size_t>& values) {
+    out << "[";
+    for (size_t i = 0; i < values.size(); ++i) {
+        out << (i > 0 ? ", " : "") << values[i];
+    }
+    out << "]";
+}
+
+
+/// Prints the metrics of a sort, as a single JSON object with `json`.
+static void print_stats(std::ostream& out, const moderndbs::ExternalSortStats& stats, bool json) {
+    if (!json) {
+        print_phase(out, "run generation", stats.run_generation_seconds, stats.run_generation_io);
+        print_phase(out, "merge", stats.merge_seconds, stats.merge_io);
+        out << "runs: " << stats.num_runs << ", merge passes: " << stats.num_merge_passes
+            << ", merge fan-in: " << stats.merge_fan_in << ", peak memory: " << stats.peak_memory << " bytes" << std::endl;
+        print_histogram(out, "read", stats.read_size_histogram);
+        print_histogram(out, "write", stats.write_size_histogram);
+        for (size_t i = 0; i < stats.spill_bytes_read.size(); ++i) {
+            out << "spill directory " << i << ": " << stats.spill_bytes_read[i] << " bytes read, "
+                << stats.spill_bytes_written[i] << " bytes written" << std::endl;
+        }
+        return;
+    }
+    out << "{\"run_generation\": ";
+    print_phase_json(out, stats.run_generation_seconds, stats.run_generation_io);
+    out << ", \"merge\": ";
+    print_phase_json(out, stats.merge_seconds, stats.merge_io);
+    out << ", \"num_runs\": " << stats.num_runs << ", \"num_merge_passes\": " << stats.num_merge_passes
+        << ", \"merge_fan_in\": " << stats.merge_fan_in << ", \"peak_memory\": " << stats.peak_memory
+        << ", \"num_reads\": " << stats.num_reads << ", \"bytes_read\": " << stats.bytes_read
+        << ", \"num_writes\": " << stats.num_writes << ", \"bytes_written\": " << stats.bytes_written
+        << ", \"read_size_histogram\": ";
+    print_array_json(out, stats.read_size_histogram);
+    out << ", \"write_size_histogram\": ";
+    print_array_json(out, stats.write_size_histogram);
+    out << ", \"spill_bytes_read\": ";
+    print_array_json(out, stats.spill_bytes_read);
+    out << ", \"spill_bytes_written\": ";
+    print_array_json(out, stats.spill_bytes_written);
+    out << "}" << std::endl;
+}
+
+
+static bool parse_size(const char* str, size_t& result) {
+    std::string s(str);
+    size_t pos = 0;
+    result = std::stoull(s, &pos);
+    return pos == s.size();
+}
+
+
 int mode_sort(int argc, const char* argv[]) {
     using File = moderndbs::File;
-    if (argc != 5) {
+    moderndbs::ExternalSortOptions options;
+    moderndbs::ExternalSortStats stats;
+    bool print_json = false;
+    bool top_k = false;
+    size_t k = 0;
+    int arg = 2;
+    while (arg < argc && std::string_view{argv[arg]}.substr(0, 2) == "--"sv) {
+        if (argv[arg] == "--threads"sv && arg + 1 < argc) {
+            if (!parse_size(argv[arg + 1], options.num_threads) || options.num_threads == 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            arg += 2;
+        } else if (argv[arg] == "--merge-threads"sv && arg + 1 < argc) {
+            if (!parse_size(argv[arg + 1], options.num_merge_threads) || options.num_merge_threads == 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            arg += 2;
+        } else if (argv[arg] == "--top-k"sv && arg + 1 < argc) {
+            if (!parse_size(argv[arg + 1], k)) {
+                usage(argv[0]);
+                return 2;
+            }
+            top_k = true;
+            arg += 2;
+        } else if (argv[arg] == "--replacement-selection"sv) {
+            options.run_generation = moderndbs::RunGeneration::REPLACEMENT_SELECTION;
+            ++arg;
+        } else if (argv[arg] == "--radix"sv && arg + 1 < argc) {
+            if (argv[arg + 1] == "8"sv) {
+                options.run_sort = moderndbs::RunSort::RADIX_SORT_8;
+            } else if (argv[arg + 1] == "11"sv) {
+                options.run_sort = moderndbs::RunSort::RADIX_SORT_11;
+            } else {
+                usage(argv[0]);
+                return 2;
+            }
+            arg += 2;
+        } else if (argv[arg] == "--encode-runs"sv) {
+            options.encode_runs = true;
+            ++arg;
+        } else if (argv[arg] == "--distinct"sv) {
+            options.aggregate = moderndbs::Aggregate::DISTINCT;
+            ++arg;
+        } else if (argv[arg] == "--count"sv) {
+            options.aggregate = moderndbs::Aggregate::COUNT;
+            ++arg;
+        } else if (argv[arg] == "--detect-presorted"sv) {
+            options.detect_presorted = true;
+            ++arg;
+        } else if (argv[arg] == "--spill-dir"sv && arg + 1 < argc) {
+            options.spill_directories.emplace_back(argv[arg + 1]);
+            arg += 2;
+        } else if (argv[arg] == "--stripe-size"sv && arg + 1 < argc) {
+            if (!parse_size(argv[arg + 1], options.spill_stripe_size) || options.spill_stripe_size == 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            arg += 2;
+        } else if (argv[arg] == "--stats"sv || argv[arg] == "--stats=json"sv) {
+            options.stats = &stats;
+            print_json = argv[arg] == "--stats=json"sv;
+            ++arg;
+        } else if (argv[arg] == "--prefetch"sv) {
+            options.prefetch = true;
+            ++arg;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - arg != 3 || (top_k && options.stats)) {
         usage(argv[0]);
         return 2;
     }
     size_t mem_size;
-    {
-        std::string mem_size_s(argv[4]);
-        size_t pos = 0;
-        mem_size = std::stoull(mem_size_s, &pos);
-        if (pos != mem_size_s.size()) {
-            usage(argv[0]);
-            return 2;
-        }
+    if (!parse_size(argv[arg + 2], mem_size)) {
+        usage(argv[0]);
+        return 2;
+    }
+    auto input_file = File::open_mapped_file(argv[arg]);
+    auto output_file = File::open_file(argv[arg + 1], File::WRITE);
+    if (top_k) {
+        moderndbs::external_top_k(*input_file, input_file->size() / sizeof(uint64_t), k, *output_file, mem_size);
+        return 0;
     }
-    auto input_file = File::open_file(argv[2], File::READ);
-    auto output_file = File::open_file(argv[3], File::WRITE);
     moderndbs::external_sort(
-        *input_file, input_file->size() / sizeof(uint64_t), *output_file, mem_size
+        *input_file, input_file->size() / sizeof(uint64_t), *output_file, mem_size, options
     );
+    if (options.stats) {
+        print_stats(std::cerr, stats, print_json);
+    }
     return 0;
 }
 
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdlib>
 #include <memory>
 
 
@@ -17,11 +18,40 @@ public:
     /// File mode (read or write)
     enum Mode { READ, WRITE };
 
+    /// How blocks get from and to the disk.
+    enum class Caching {
+        /// Through the page cache of the OS.
+        BUFFERED,
+        /// Past the page cache (`O_DIRECT`). The memory, the offset and the
+        /// size of every block must be multiples of `DIRECT_ALIGNMENT`, see
+        /// `allocate_aligned()`.
+        DIRECT
+    };
+
+    /// Alignment of the blocks of `Caching::DIRECT` files. A multiple of the
+    /// logical block size of all common devices.
+    static constexpr size_t DIRECT_ALIGNMENT = 4096;
+
+    /// Frees the memory of `allocate_aligned()`.
+    struct AlignedDelete {
+        void operator()(char* block) const {
+            std::free(block);  // NOLINT
+        }
+    };
+
+    /// Memory of `allocate_aligned()`.
+    using AlignedBlock = std::unique_ptr<char[], AlignedDelete>;
+
     virtual ~File() = default;
 
     /// Returns the `Mode` this file was opened with.
     virtual Mode get_mode() const = 0;
 
+    /// Returns the `Caching` this file was opened with.
+    virtual Caching get_caching() const {
+        return Caching::BUFFERED;
+    }
+
     /// Returns the current size of the file in bytes.
     /// Is not thread-safe w.r.t concurrent calls to `resize()`.
     virtual size_t size() const = 0;
@@ -33,7 +63,8 @@ public:
     virtual void resize(size_t new_size) = 0;
 
     /// Reads a block of the file. `offset + size` must not be larger than
-    /// `size()`.
+    /// `size()`. Throws `std::system_error` with `EINVAL` if the file uses
+    /// `Caching::DIRECT` and the block is not aligned, see `is_aligned()`.
     /// Is thread-safe w.r.t concurrent calls to `read_block()` and
     /// `write_block()`.
     /// @param[in]  offset The offset in the file from which the block should
@@ -43,7 +74,8 @@ public:
     ///                    Must be able to hold at least `size` bytes.
     virtual void read_block(size_t offset, size_t size, char* block) = 0;
 
-    /// Reads a block of the file and returns it.
+    /// Reads a block of the file and returns it. Use `allocate_aligned()`
+    /// and the other overload for `Caching::DIRECT` files.
     std::unique_ptr<char[]> read_block(size_t offset, size_t size) {
         auto block = std::make_unique<char[]>(size);
         read_block(offset, size, block.get());
@@ -52,7 +84,8 @@ public:
 
     /// Writes a block to the file. `offset + size` must not be larger than
     /// `size()`. If you want to write past the end of the file, use
-    /// `resize()` first.
+    /// `resize()` first. Throws `std::system_error` with `EINVAL` if the file
+    /// uses `Caching::DIRECT` and the block is not aligned.
     /// This function must not be used when the file was opened in `READ` mode.
     /// Is thread-safe w.r.t concurrent calls to `read_block()` and
     /// `write_block()`.
@@ -66,11 +99,23 @@ public:
     /// Opens a file with the given mode. Existing files are never overwritten.
     /// @param[in] filename Path to the file.
     /// @param[in] mode     `Mode` that should be used to open the file.
-    static std::unique_ptr<File> open_file(const char* filename, Mode mode);
+    /// @param[in] caching  `Caching` that should be used for the file.
+    static std::unique_ptr<File> open_file(const char* filename, Mode mode, Caching caching = Caching::BUFFERED);
 
     /// Opens a temporary file in `WRITE` mode. The file will be deleted
     /// automatically after use.
-    static std::unique_ptr<File> make_temporary_file();
+    /// @param[in] caching `Caching` that should be used for the file.
+    static std::unique_ptr<File> make_temporary_file(Caching caching = Caching::BUFFERED);
+
+    /// Allocates `size` bytes aligned to `DIRECT_ALIGNMENT`, with `size`
+    /// rounded up to a multiple of it. Throws `std::bad_alloc` on failure.
+    static AlignedBlock allocate_aligned(size_t size);
+
+    /// Returns whether a block can be read or written with `Caching::DIRECT`.
+    static bool is_aligned(const void* block, size_t offset, size_t size) {
+        return reinterpret_cast<uintptr_t>(block) % DIRECT_ALIGNMENT == 0 &&
+            offset % DIRECT_ALIGNMENT == 0 && size % DIRECT_ALIGNMENT == 0;
+    }
 };
 
 }  // namespace moderndbs